@@ -547,56 +547,11 @@ void DemoApplicationApp::UpdateVoiceChat() {
 	// Update FMOD voice compoent
 	if (_Client) { _Client->UpdateFMOD(); }
 
-	// Push to talk
-	if (input->isKeyDown(aie::INPUT_KEY_T) && !_AChatWindowIsActive) {
-
-		// Client isnt currently talking
-		if (!_Client->isTalking()) {
-
-			_Client->setTryingToBroadcastVoice(true);
-
-			// Request talking channel with teammates only
-			for (auto iter : _Client->getClientList()) {
-
-				// Skip ourself
-				if (iter->GUID != _Client->getInfo().GUID) {
-
-					// iterator is a team mate
-					if (iter->Channel == _Client->getInfo().Channel) { _Client->RequestVoiceChannel(iter->GUID); }
-				}
-			}
-		}
-	}
-
-	// Only broadcast voice if client is talking
-	if (_Client->isTalking()) {
-
-		// Only send voice to clients on the same channel (team mates)
-		for (auto iter : _Client->getClientList()) {
-
-			// Skip ourself
-			if (iter->ID != _Client->getInfo().ID) {
-
-				// Send voice
-				if (iter->Channel == _Client->getInfo().Channel) { _Client->SendVoiceBuffer(iter->GUID, _Client->getVoiceBuffer()); }
-			}
-		}
-	}
-
-	// We are no longer trying to talk so close all open voice channels
-	else {
-
-		// Only send voice to clients on the same channel (team mates)
-		for (auto iter : _Client->getClientList()) {
-
-			// Skip ourself
-			if (iter->ID != _Client->getInfo().ID) {
-
-				// Close channel
-				if (iter->Channel == _Client->getInfo().Channel) { _Client->CloseVoiceChannel(iter->GUID); }
-			}
-		}
-	}
+	// Push to talk. The voice channel stays open while we are connected & the recorded frames are
+	// streamed by the voice adapter, so holding the key only flags whether they are sent
+	bool pushToTalk = input->isKeyDown(aie::INPUT_KEY_T) && !_AChatWindowIsActive;
+	_Client->setTryingToBroadcastVoice(pushToTalk);
+	_Client->setPushToTalk(pushToTalk);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
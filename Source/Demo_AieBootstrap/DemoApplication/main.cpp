@@ -64,6 +64,22 @@ void EnterAddress(std::string& address) {
 	return;
 }
 
+int EnterVoiceSampleRate() {
+
+	// Speex supports narrowband, wideband & ultra wideband
+	std::cout << "\n - Voice quality? < 8 > / < 16 > / < 32 > kHz: ";
+	while (true) {
+
+		int kHz = 0;
+		std::cin >> kHz;
+		if (kHz == 8 || kHz == 16 || kHz == 32) { return kHz * 1000; }
+
+		std::cin.clear();
+		std::cin.ignore(INT_MAX, '\n');
+		std::cout << "\n Invalid input - Please try again: ";
+	}
+}
+
 int main() {
 
 	// Debugs memory leaks
@@ -100,7 +116,8 @@ int main() {
 				std::string address;
 				///address = "127.0.0.1";
 				EnterAddress(address);
-				_Client = new Client(address, PORT);
+				int sampleRate = EnterVoiceSampleRate();
+				_Client = new Client(address, PORT, RakNet::VOICE_PROFILE_LOW_LATENCY, sampleRate);
 				break;
 			}
 
@@ -0,0 +1,93 @@
+#pragma once
+
+// Standard libraries
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+// Raknet libraries
+#include <PluginInterface2.h>
+
+#define EVENT_LOOP_RECHECK_US (250)							// How long to wait before looking again, when woken for a packet that wasnt queued yet.
+#define EVENT_LOOP_MAX_RECHECKS (8)							// Looks again at most this many times per wake, as some messages never reach Receive().
+
+struct TickStats {
+
+	unsigned long long Ticks = 0;							// Amount of fixed rate ticks that have completed.
+	unsigned long long Wakeups = 0;							// Amount of times the loop was woken early by the network or a shutdown.
+	unsigned long long Rechecks = 0;						// Amount of times the loop looked again for a packet it was woken for.
+	unsigned long long IdleMicroseconds = 0;				// Total time spent sleeping in the event wait.
+	unsigned long long BusyMicroseconds = 0;				// Total time spent handling packets & periodic work.
+	unsigned long long LastTickIdleMicroseconds = 0;		// Time spent sleeping during the most recent tick.
+	unsigned long long LastTickBusyMicroseconds = 0;		// Time spent working during the most recent tick.
+};
+
+class ServerEventLoop : public RakNet::PluginInterface2 {
+
+public:
+
+	// Constructors
+	ServerEventLoop(unsigned int tickRate);
+	~ServerEventLoop() {}
+
+	// Scheduling
+	void AddPeriodicTask(unsigned int intervalTicks, std::function<void()> task);
+	void WaitForEvent();
+	void OnPacketsDrained();
+	void RunDueTicks();
+	void Wake();
+
+	// Work from other threads
+	void Post(std::function<void()> task);
+	void Call(std::function<void()> task);
+	void RunPostedTasks();
+
+	// Properties
+	TickStats getTickStats();
+	unsigned int getTickIntervalMs()						{ return _TickIntervalMs; }
+
+	// Raknet plugin callbacks (called on the RakPeer update thread)
+	virtual bool UsesReliabilityLayer(void) const			{ return true; }
+	virtual void OnDirectSocketReceive(const char* data, const RakNet::BitSize_t bitsUsed, RakNet::SystemAddress remoteSystemAddress);
+	virtual void OnInternalPacket(RakNet::InternalPacket* internalPacket, unsigned frameNumber, RakNet::SystemAddress remoteSystemAddress, RakNet::TimeMS time, int isSend);
+
+	// Raknet plugin callbacks (called from Receive)
+	virtual RakNet::PluginReceiveResult OnReceive(RakNet::Packet* packet);
+
+protected:
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct PeriodicTask {
+
+		unsigned int IntervalTicks;
+		unsigned int TicksRemaining;
+		std::function<void()> Task;
+	};
+
+	unsigned long long ElapsedMicroseconds(Clock::time_point from, Clock::time_point to);
+
+	std::mutex _Mutex;										// Guards the wake flag, the posted tasks & the tick statistics.
+	std::condition_variable _WakeCondition;					// Signalled when packets arrive or a shutdown is requested.
+	bool _WakeRequested = false;							// Returns TRUE when the loop should stop waiting before the next tick.
+	bool _Woken = false;									// Returns TRUE if the last wait was ended by a wake rather than the tick.
+	unsigned int _PacketsReceived = 0;						// Packets Receive() has handled since the last wait, including those consumed by plugins.
+	unsigned int _Rechecks = 0;								// Times the loop has looked again since it last found a packet.
+	Clock::time_point _RecheckAt;							// When to look again, if _Rechecks is set.
+	bool _RanPosted = false;								// Returns TRUE if the last wake was for work posted by another thread.
+
+	std::vector<std::function<void()>> _Posted;				// Work posted by other threads, waiting to be run on the loop thread.
+
+	unsigned int _TickIntervalMs;							// Time between fixed rate ticks.
+	Clock::time_point _NextTick;							// When the next fixed rate tick is due.
+	Clock::time_point _BusySince;							// When the loop last woke up & started working.
+	std::vector<PeriodicTask> _Tasks;						// Work run on the fixed rate ticks.
+
+	unsigned long long _TickIdleMicroseconds = 0;			// Idle time accumulated in the tick currently in progress.
+	unsigned long long _TickBusyMicroseconds = 0;			// Busy time accumulated in the tick currently in progress.
+	TickStats _Stats;										// Counters for all completed ticks.
+
+};
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+// Standard libraries
+#include <atomic>
+#include <vector>
+
+// Raknet libraries
+#include <PluginInterface2.h>
+#include <RakNetTypes.h>
+#include <BitStream.h>
+
+// NPC libraries
+#include "ClientRegistry.h"
+#include "VoiceMixer.h"
+#include "RakVoice.h"
+
+#define VOICE_RELAY_DEFAULT_SPEAKERS (4)					// Loudest talkers forwarded in each channel, when limited.
+#define VOICE_RELAY_SPEAKER_TIMEOUT_MS (500)				// A talker who sends nothing for this long gives up their place among the loudest.
+
+enum VoiceRelayMode {
+
+	VOICE_RELAY_FORWARD,									// Forward every talker's stream untouched (SFU).
+	VOICE_RELAY_MIX											// Decode & mix each channel into one stream per listener (MCU).
+};
+
+struct RelayStats {
+
+	unsigned long long PacketsIn = 0;						// Voice packets uploaded by talkers.
+	unsigned long long PacketsOut = 0;						// Voice packets forwarded to listeners.
+	unsigned long long BytesIn = 0;							// Voice bytes uploaded by talkers.
+	unsigned long long BytesOut = 0;						// Voice bytes forwarded to listeners.
+	unsigned long long PacketsSkipped = 0;					// Voice packets not forwarded, as their talker wasnt among the loudest.
+	unsigned long long SpeakersReplaced = 0;				// Times a louder talker took the place of one being forwarded.
+};
+
+// Forwards the encoded voice of each talker to the other members of their channel, without decoding it.
+// Every client only ever uploads one stream (to the server), no matter how many clients are listening.
+// In mix mode, clients using the mixer's sample rate are mixed instead, so they only decode one stream.
+class VoiceRelay : public RakNet::PluginInterface2 {
+
+public:
+
+	// Constructors
+	VoiceRelay(ClientRegistry& clients, int mixSampleRate);
+	~VoiceRelay() {}
+
+	// Mixing
+	void Update();
+	void setMode(VoiceRelayMode mode)						{ _Mode = mode; }
+	void setPacketProfile(const RakNet::VoicePacketProfile& profile) { _Profile = profile; }
+	void setMaxSpeakers(unsigned int speakers)				{ _MaxSpeakers = speakers; }
+	void setWorkerPool(VoiceWorkerPool* pool)				{ _Mixer.setWorkerPool(pool); }
+
+	// Channels
+	void OnChannelJoined(ClientHandle handle);
+	void OnChannelLeaving(ClientHandle handle);
+
+	// Properties
+	VoiceRelayMode getMode() const							{ return _Mode; }
+	RakNet::VoicePacketProfile getPacketProfile() const		{ return _Profile; }
+	unsigned int getMaxSpeakers() const						{ return _MaxSpeakers; }
+	const RelayStats& getStats() const						{ return _Stats; }
+	const MixStats& getMixStats() const						{ return _Mixer.getStats(); }
+	bool isVoiceOpen(RakNet::RakNetGUID guid);
+	bool getTalkerLatency(RakNet::RakNetGUID guid, RakNet::VoiceLatencyStatistics& stats);
+
+	// Raknet plugin callbacks
+	virtual RakNet::PluginReceiveResult OnReceive(RakNet::Packet* packet);
+	virtual void OnClosedConnection(const RakNet::SystemAddress& systemAddress, RakNet::RakNetGUID rakNetGUID, RakNet::PI2_LostConnectionReason lostConnectionReason);
+
+protected:
+
+	void OnOpenChannelRequest(RakNet::Packet* packet);
+	void OnCloseChannel(RakNet::RakNetGUID guid);
+	void OnVoiceData(RakNet::Packet* packet);
+	void RecordUplinkLatency(unsigned int slot, RakNet::RakNetGUID guid, RakNet::VoiceLatencyStamp& stamp);
+	bool PickSpeaker(unsigned int slot, int channel, const RakNet::VoicePayload& payload);
+	void EndStreams(unsigned int slot);
+	void ResetStreams(unsigned int slot);
+	bool isOpen(unsigned int slot);
+
+	struct Stream {
+
+		unsigned int Listener = 0;							// The listener's registry slot.
+		unsigned short Sequence = 0;						// Message number of the last packet forwarded to the listener.
+		unsigned short LastTalkerSequence = 0;				// Talker's own message number for that packet.
+		bool Started = false;								// Returns FALSE until the talker's current channel has been forwarded.
+	};
+
+	Stream* findStream(unsigned int talker, unsigned int listener);
+
+	struct Talker {
+
+		ClientHandle Handle;								// The client that opened the voice channel.
+		int SampleRate = 0;									// The sample rate their encoder runs at.
+		bool Open = false;
+		RakNet::VoiceLatencyStatistics Latency = {};			// How long their stamped packets took to reach the server, per hop.
+
+		float Level = 0.0f;									// Loudness of their packets, followed by RakNet::UpdateSpeakerLevel.
+		bool Picked = false;								// Returns TRUE while they are among the loudest of their channel.
+		RakNet::TimeMS PickedTime = 0;						// When they were picked.
+		RakNet::TimeMS LastVoiceTime = 0;					// When their last packet arrived.
+		unsigned int LastFrameCount = 0;					// Frames in the last packet forwarded, so their end can be marked.
+
+		std::vector<Stream> Streams;						// One for each other member of their channel.
+	};
+
+	ClientRegistry& _Clients;								// The clients connected to the server.
+	std::vector<Talker> _Talkers;							// Voice channel state for each registry slot.
+	RakNet::BitStream _RelayPacket;							// Reused for every forwarded packet.
+	RelayStats _Stats;										// Traffic counters.
+
+	VoiceMixer _Mixer;										// Mixes the channels in mix mode.
+	std::atomic<VoiceRelayMode> _Mode;						// How voice is passed on (set from the server commands thread).
+	VoiceRelayMode _UpdatedMode = VOICE_RELAY_FORWARD;		// The mode as of the last update.
+	std::atomic<RakNet::VoicePacketProfile> _Profile;		// Packet profile offered to clients as they open their channel (set from the server commands thread).
+	std::atomic<unsigned int> _MaxSpeakers;					// Loudest talkers forwarded in each channel, or 0 for all of them (set from the server commands thread).
+
+};
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+// Standard libraries
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define VOICE_WORKER_POOL_AUTO (0)							// Thread count that sizes the pool to the CPU (one less than its hardware threads).
+#define VOICE_WORKER_POOL_MAX_THREADS (16)					// Most threads a pool starts, however it is sized.
+
+struct WorkerPoolStats {
+
+	unsigned long long JobsRun = 0;							// Jobs finished by the pool's threads.
+	unsigned long long JobsStolen = 0;						// Jobs a thread took from another thread's queue.
+	unsigned long long JobsHelped = 0;						// Jobs run by a thread waiting on a group, instead of sleeping.
+};
+
+// A small pool of threads that run voice encode, decode & mix jobs. Each thread has its own queue & takes
+// work from the others when it runs out, so a batch of uneven jobs still keeps every thread busy.
+// Jobs are waited on in groups, & the waiting thread runs queued jobs itself until its group is done,
+// sleeping while the last of them run on other threads.
+// Jobs submitted through the same strand run one at a time, in the order they were submitted.
+class VoiceWorkerPool {
+
+public:
+
+	typedef std::function<void()> Job;
+
+	// Jobs that are waited on together
+	class Group {
+
+	public:
+
+		bool isDone() const									{ return _Pending.load() == 0; }
+
+	protected:
+
+		friend class VoiceWorkerPool;
+		std::atomic<unsigned int> _Pending{ 0 };			// Jobs submitted that havent finished yet.
+	};
+
+	// Jobs that have to run in order, such as the frames of one voice stream
+	class Strand {
+
+	protected:
+
+		friend class VoiceWorkerPool;
+		struct Entry {
+
+			Job Run;
+			Group* Owner;
+		};
+
+		std::mutex _Mutex;									// Guards the queue & the scheduled flag.
+		std::deque<Entry> _Jobs;							// Jobs waiting for the strand's turn.
+		bool _Scheduled = false;							// Returns TRUE while a thread is queued to (or is) running the strand.
+	};
+
+	// Constructors
+	VoiceWorkerPool(unsigned int threads = VOICE_WORKER_POOL_AUTO);
+	~VoiceWorkerPool();
+
+	// Jobs
+	void Submit(Group& group, Job job);
+	void Submit(Strand& strand, Group& group, Job job);
+	void Wait(Group& group);
+
+	// Properties
+	unsigned int getThreadCount() const						{ return (unsigned int)_Workers.size(); }
+	WorkerPoolStats getStats() const;
+
+protected:
+
+	struct Task {
+
+		Job Run;											// The job, or empty to run a strand.
+		Group* Owner = nullptr;
+		Strand* Serial = nullptr;
+	};
+
+	struct Worker {
+
+		std::mutex Mutex;									// Guards the queue, as other threads steal from its front.
+		std::deque<Task> Jobs;								// The thread takes its own jobs from the back.
+		std::thread Thread;
+	};
+
+	void Push(Task&& task);
+	bool Pop(unsigned int worker, Task& task);
+	bool Steal(unsigned int thief, Task& task);
+	void Execute(Task& task);
+	void Finish(Group& group);
+	void RunStrand(Strand& strand);
+	void WorkerLoop(unsigned int worker);
+
+	std::vector<std::unique_ptr<Worker>> _Workers;
+	std::atomic<unsigned int> _NextWorker{ 0 };				// Queue the next job from outside the pool goes to.
+	std::atomic<unsigned int> _Queued{ 0 };					// Jobs sitting in the queues.
+	std::atomic<unsigned int> _Sleeping{ 0 };				// Threads waiting on the wake condition.
+	std::atomic<unsigned int> _Waiting{ 0 };				// Threads in Wait() sleeping on the done condition.
+	std::mutex _SleepMutex;									// Guards sleeping, waiting & the stop flag.
+	std::condition_variable _WakeCondition;					// Signalled when a job is queued to an idle pool.
+	std::condition_variable _DoneCondition;					// Signalled when a group finishes, or a job is queued while a thread is in Wait().
+	bool _Stopping = false;									// Returns TRUE once the threads should finish up & exit.
+
+	std::atomic<unsigned long long> _JobsRun{ 0 };
+	std::atomic<unsigned long long> _JobsStolen{ 0 };
+	std::atomic<unsigned long long> _JobsHelped{ 0 };
+
+};
\ No newline at end of file
@@ -12,8 +12,13 @@
 	
 	@param:		IP						- The ip address of the server to connect to.
 	@param:		PORT					- The internal pc port that the network will flow through.
+	@param:		voiceProfile			- How many voice frames to bundle into each packet. The server may ask for more.
+	@param:		voiceSampleRate			- 8000, 16000 or 32000. Higher rates sound clearer for more bandwidth & CPU.
 */
-Client::Client(std::string IP, const unsigned short PORT) {
+Client::Client(std::string IP, const unsigned short PORT, const RakNet::VoicePacketProfile& voiceProfile, int voiceSampleRate) {
+
+	_VoiceProfile = voiceProfile;
+	if (voiceSampleRate == 8000 || voiceSampleRate == 16000 || voiceSampleRate == 32000) { _VoiceSampleRate = voiceSampleRate; }
 
 	// Get reference to Rak peer interface
 	_pPeerInterface = RakNet::RakPeerInterface::GetInstance();
@@ -59,15 +64,8 @@ void Client::Shutdown() {
 
 	// Start to shutdown
 	_ShuttingDown = true;
-		
-	// Wait until the thread has been connected back to the main thread
-	while (_VoiceChatMutexIsLocked) {} // This becomes false ONLY once the _VoiceChatThread has been closed
-	if (_VoiceChatThread.joinable()) { _VoiceChatThread.join(); }
 	
 	// Release any FMOD resources used & shutdown FMOD itself
-	if (_ChannelOutput) { _ChannelOutput->stop(); }
-	_SoundInput->release();
-	_SoundOutput->release();
 	RakNet::FMODVoiceAdapter::Instance()->Release();
 	_FMODsystem->close();
 	_FMODsystem->release();	
@@ -103,17 +101,30 @@ void Client::InitializeVoiceChat() {
 	RakAssert(result >= 0);
 
 	// Initialize rakVoice & attach to peer
+	// One buffer holds one packet's frames
+	unsigned int samplesPerBuffer = _VoiceProfile.framesPerPacket * (_VoiceSampleRate / SPEEX_FRAMES_PER_SECOND);
 	_pPeerInterface->AttachPlugin(&_RakVoice);
-	_RakVoice.Init(SAMPLE_RATE, FRAMES_PER_BUFFER * sizeof(SAMPLE));
+	_RakVoice.SetPacketProfile(_VoiceProfile);
+	_RakVoice.SetWorkerPool(&_VoiceWorkers);
+	_RakVoice.SetTalking(false);
+	_RakVoice.Init((unsigned short)_VoiceSampleRate, samplesPerBuffer * sizeof(SAMPLE));
+
+	// Connect to FMOD, which converts between the device's rate & ours
+	unsigned int framesInSound = (_VoiceSampleRate * VOICE_SOUND_MS / 1000) / samplesPerBuffer;
+	if (framesInSound < FMOD_VOICE_FRAMES_IN_SOUND) { framesInSound = FMOD_VOICE_FRAMES_IN_SOUND; }
+
+	// Each block waits in the adapter's playback ring, then is heard a whole sound after it is written, so cancel its echo from the microphone from then on
+	_RakVoice.SetEchoPath(((framesInSound + FMOD_VOICE_PLAYBACK_RING_BLOCKS) * samplesPerBuffer * 1000) / _VoiceSampleRate);
+	_RakVoice.SetEchoCancellation(true);
 
-	// Connect to FMOD
-	RakNet::FMODVoiceAdapter::Instance()->SetupAdapter(_FMODsystem, &_RakVoice);
+	// Let the encoder follow the link to the server & the CPU, rather than tuning it by hand
+	_RakVoice.SetAdaptiveQuality(true);
 
-	/*
-		Spawn a new dedicated thread for voice chat that will
-		use a lambda which loops endlessly (until _Shutdown == true) to record voice
-	*/
-	_VoiceChatThread = std::thread([=] { RecordVoice(); });
+	// Stamp our packets so the server & listeners can see where the mouth to ear latency goes
+	_RakVoice.SetLatencyStamps(true);
+
+	// The adapter records & plays back from UpdateFMOD(), so there is no voice thread to start
+	RakNet::FMODVoiceAdapter::Instance()->SetupAdapter(_FMODsystem, &_RakVoice, framesInSound);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -152,6 +163,9 @@ void Client::onSetClientIDPacket(RakNet::Packet* packet) {
 	bitstream.Read(_Info.ID);
 
 	std::cout << "\t- My client ID is: " << _Info.ID << std::endl;
+
+	// The server knows us now, so open the voice channel for as long as we are connected. Push to talk only flags the stream.
+	RequestVoiceChannel();
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -168,6 +182,7 @@ void Client::onSetClientChannelPacket(RakNet::Packet* packet) {
 	bitstream.Read(_Info.Channel);
 
 	std::cout << "\t- My team channel is: " << _Info.Channel << std::endl;
+	UpdateVoiceTeam();
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -244,6 +259,13 @@ void Client::onReceivedChatMessage(RakNet::Packet* packet) {
 	RakNet::BitStream bitstream(packet->data, packet->length, false);
 	bitstream.IgnoreBytes(sizeof(RakNet::MessageID));
 
+	// Whispers carry the recipient's GUID for the server to route by
+	if (packet->data[0] == ID_CLIENT_CHAT_MESSAGE_WHISPER) {
+
+		RakNet::RakNetGUID recipient;
+		bitstream.Read(recipient);
+	}
+
 	// Read in sender's ID
 	int clientID;
 	bitstream.Read(clientID);
@@ -269,79 +291,189 @@ void Client::onReceivedChatMessage(RakNet::Packet* packet) {
 	bitstream.Read(channel);
 	_MsgInChannel = channel;
 
-	// If this message is for us to read
-	if (_MsgInChannel == 0 || _MsgInChannel == _Info.Channel) {
-
-		// Read in message string
-		RakNet::RakString msgString;
-		bitstream.Read(msgString);
+	// The server only sends us messages that are meant for us, so there is nothing to filter
+	RakNet::RakString msgString;
+	bitstream.Read(msgString);
 
-		// Notify client of newely read in message
-		_RakMsgIn = msgString;
-		_HasReceivedMessage = true;
+	// Notify client of newely read in message
+	_RakMsgIn = msgString;
+	_HasReceivedMessage = true;
 
-		// Debug
-		std::cout << " Client ' " << _MsgInSenderID << "': " << msgString << std::endl;
-	}
+	// Debug
+	std::cout << " Client ' " << _MsgInSenderID << "': " << msgString << std::endl;
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Reads in updated client list size
+	@Summary:	Reads in the full client list. Existing client infos are reused in place.
 	
 	@param:		packet			- Reference to the packet received.
 	
 	@return:	VOID
 */
-void Client::onReceivedPreUpdateClientList(RakNet::Packet * packet) {
+void Client::onReceivedLobbySnapshot(RakNet::Packet* packet) {
 
 	RakNet::BitStream bitstream(packet->data, packet->length, false);
 	bitstream.IgnoreBytes(sizeof(RakNet::MessageID));
 
-	// Update local vector array size
-	int size;
-	bitstream.Read(size);
+	unsigned int version;
+	unsigned int size;
+	bitstream.Read(version);
+	bitstream.ReadCompressed(size);
 
-	// Empty the array
-	for (auto iter : _ClientList) { delete iter; iter = nullptr; }
-	_ClientList.clear();
-	
-	// Add empty pointers
-	for (int i = 0; i < size; ++i) { _ClientList.push_back(new ClientInfo()); }
+	// Remember who we knew, so anyone missing from the snapshot has their voice closed
+	std::vector<RakNet::RakNetGUID> previous;
+	previous.reserve(_ClientList.size());
+	for (ClientInfo* info : _ClientList) { previous.push_back(info->GUID); }
+
+	// Match the local array size, keeping the existing allocations
+	while (_ClientList.size() > size) { delete _ClientList.back(); _ClientList.pop_back(); }
+	while (_ClientList.size() < size) { _ClientList.push_back(new ClientInfo()); }
+
+	std::unordered_set<uint64_t> present;
+	for (unsigned int i = 0; i < size; ++i) {
+
+		RakNet::RakString rakString;
+		ClientInfo* info = _ClientList.at(i);
+		bitstream.Read(info->GUID);
+		bitstream.ReadCompressed(info->ID);
+		bitstream.ReadCompressed(info->Channel);
+		bitstream.Read(rakString);
+		info->ProfileName = rakString.C_String();
+		present.insert(info->GUID.g);
+	}
+
+	// Stop decoding the voice of clients who left while the list couldnt be trusted
+	for (const RakNet::RakNetGUID& guid : previous) {
+
+		if (present.count(guid.g) == 0) { _RakVoice.CloseRelayedChannel(guid); }
+	}
+
+	_LobbyVersion = version;
+	_HasLobbySnapshot = true;
+	_LobbyResyncRequested = false;
+	UpdateVoiceTeam();
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Reads in updated client info
+	@Summary:	Reads in a single change to the client list & applies it in place.
+				If a delta has been missed, the full client list is requested instead.
 	
 	@param:		packet			- Reference to the packet received.
 	
 	@return:	VOID
 */
-void Client::onReceivedUpdatedClientList(RakNet::Packet * packet) {
-	
+void Client::onReceivedLobbyDelta(RakNet::Packet* packet) {
+
 	RakNet::BitStream bitstream(packet->data, packet->length, false);
 	bitstream.IgnoreBytes(sizeof(RakNet::MessageID));
 
-	// The array should have already a size greater that 0 specified by the server
-	if (_ClientList.size() > 0) {
+	unsigned int version;
+	bitstream.Read(version);
 
-		int i;
-		RakNet::RakNetGUID guid;
-		int id;
-		int channel;
-		RakNet::RakString rakString;
+	// The snapshot already contains this change, or we are waiting for one that will
+	if (!_HasLobbySnapshot || _LobbyResyncRequested) { return; }
+	if (int(version - _LobbyVersion) <= 0) { return; }
+
+	// Missed a delta, the list can no longer be trusted
+	if (version != _LobbyVersion + 1) {
+
+		RequestLobbyResync();
+		return;
+	}
+
+	unsigned char type;
+	unsigned char fields = 0;
+	RakNet::RakNetGUID guid;
+	bitstream.Read(type);
+	bitstream.Read(guid);
+
+	ClientInfo* info = findClientInfo(guid);
+	switch (type) {
+
+		case LOBBY_DELTA_ADD: {
+
+			if (info == nullptr) { info = new ClientInfo(); _ClientList.push_back(info); }
+			info->GUID = guid;
+			bitstream.ReadCompressed(info->ID);
+			fields = LOBBY_FIELD_CHANNEL | LOBBY_FIELD_NAME;
+			break;
+		}
+
+		case LOBBY_DELTA_REMOVE: {
+
+			// Stop decoding their voice
+			_RakVoice.CloseRelayedChannel(guid);
+
+			for (unsigned int i = 0; i < _ClientList.size(); ++i) {
+
+				if (_ClientList.at(i) == info) {
+
+					// Order doesnt matter, so swap the last client into its place
+					delete info; info = nullptr;
+					_ClientList.at(i) = _ClientList.back();
+					_ClientList.pop_back();
+					break;
+				}
+			}
+			break;
+		}
+
+		case LOBBY_DELTA_MODIFY: {
+
+			bitstream.Read(fields);
+			break;
+		}
+
+		default: break;
+	}
+
+	// Read the changed fields, even if we dont know the client so the version stays in step
+	ClientInfo discarded;
+	if (info == nullptr) { info = &discarded; }
+	if (fields & LOBBY_FIELD_CHANNEL) { bitstream.ReadCompressed(info->Channel); }
+	if (fields & LOBBY_FIELD_NAME) {
 
-		bitstream.Read(i);
-		bitstream.Read(guid);
-		bitstream.Read(id);
-		bitstream.Read(channel);
+		RakNet::RakString rakString;
 		bitstream.Read(rakString);
+		info->ProfileName = rakString.C_String();
+	}
+
+	_LobbyVersion = version;
+	if (fields & LOBBY_FIELD_CHANNEL) { UpdateVoiceTeam(); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Asks the server for the full client list after a missed delta.
+	
+	@return:	VOID
+*/
+void Client::RequestLobbyResync() {
 
-		// Update client list with new info
-		_ClientList.at(i)->GUID = guid;
-		_ClientList.at(i)->ID = id;
-		_ClientList.at(i)->Channel = channel;
-		_ClientList.at(i)->ProfileName = rakString.C_String();
+	_LobbyResyncRequested = true;
+
+	// Create packet
+	RakNet::BitStream bitstream;
+	bitstream.Write((RakNet::MessageID)GameMessages::ID_CLIENT_REQUEST_LOBBY_RESYNC);
+	bitstream.Write(_LobbyVersion);
+
+	// Send packet
+	_pPeerInterface->Send(&bitstream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, RakNet::UNASSIGNED_RAKNET_GUID, true);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Finds a client in the local client list.
+	
+	@param:		guid			- The GUID of the client.
+	
+	@return:	ClientInfo*		- NULL if the client isnt in the list.
+*/
+ClientInfo* Client::findClientInfo(RakNet::RakNetGUID guid) {
+
+	for (auto iter : _ClientList) {
+
+		if (iter->GUID == guid) { return iter; }
 	}
+	return nullptr;
 }
 
 /** ---------------------------------------------------------------------------------------------------------------
@@ -400,6 +532,7 @@ void Client::sendChatMessageToGUID(RakNet::RakNetGUID guid, std::string message,
 	// Create packet
 	RakNet::BitStream bitstream;
 	bitstream.Write((RakNet::MessageID)GameMessages::ID_CLIENT_CHAT_MESSAGE_WHISPER);
+	bitstream.Write(guid);									// Recipient's GUID (routed by the server)
 	bitstream.Write(_Info.ID);								// Sender's client ID
 	bitstream.Write(_Info.Channel);							// Sender's channel ID
 	bitstream.Write((unsigned short)strlen(profileName));	// Sender's current profile name
@@ -410,8 +543,8 @@ void Client::sendChatMessageToGUID(RakNet::RakNetGUID guid, std::string message,
 	bitstream.Write((unsigned short)strlen(_RakMsgOut));
 	bitstream.Write(_RakMsgOut, strlen(_RakMsgOut));		// Message text string
 
-	// Send packet
-	_pPeerInterface->Send(&bitstream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, guid, false);
+	// Send packet (clients are not connected to each other, so it goes through the server)
+	_pPeerInterface->Send(&bitstream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, RakNet::UNASSIGNED_RAKNET_GUID, true);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -497,7 +630,13 @@ void Client::HandleNetworkMessages() {
 			// Client accepted connection
 			case ID_CONNECTION_REQUEST_ACCEPTED: {
 
-				_Info.GUID = packet->guid;
+				// The packet comes from the server, so its GUID is the server's not ours
+				_Info.GUID = _pPeerInterface->GetMyGUID();
+				_ServerGUID = packet->guid;
+				_VoiceChannelOpen = false;
+
+				// All voice goes through the server
+				RakNet::FMODVoiceAdapter::Instance()->SetRelay(_ServerGUID);
 				break;
 			}
 
@@ -540,19 +679,19 @@ void Client::HandleNetworkMessages() {
 				break;
 			}
 
-			// Set client list size
-			case ID_SERVER_SET_CLIENTLIST_SIZE: {
+			// Full client list
+			case ID_SERVER_LOBBY_SNAPSHOT: {
 
 				// Read in packet
-				onReceivedPreUpdateClientList(packet);
+				onReceivedLobbySnapshot(packet);
 				break;
 			}
 
-			// Client iterator in client list
-			case ID_SERVER_UPDATE_CLIENTLIST: {
+			// Single change to the client list
+			case ID_SERVER_LOBBY_DELTA: {
 
 				// Read in client list packet
-				onReceivedUpdatedClientList(packet);
+				onReceivedLobbyDelta(packet);
 				break;
 			}
 
@@ -580,7 +719,9 @@ void Client::HandleNetworkMessages() {
 			case ID_RAKVOICE_OPEN_CHANNEL_REPLY: {
 
 				std::cout << "new channel from %s\n" << packet->systemAddress.ToString() << std::endl;
-				DecodeIncomingVoice();
+
+				// Nothing to create here. Every talker on the channel is heard through the adapter's one playback sound,
+				// & RakVoice gives each a voice from its fixed pool as they start talking
 				break;
 			}
 
@@ -590,6 +731,13 @@ void Client::HandleNetworkMessages() {
 				break;
 			}
 
+			// Another client's voice, forwarded by the server
+			case ID_SERVER_VOICE_RELAY: {
+
+				_RakVoice.OnRelayedVoiceData(packet);
+				break;
+			}
+
 			default: break;			
 		}
 	}
@@ -638,169 +786,47 @@ void Client::DecreaseVoiceEncoderComplexity(int amount) {
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Records to sound, from an input device if detected.
+	@Summary:	Opens a voice channel to the server, if one isnt open already.
 	
 	@return:	VOID
 */
-void Client::RecordVoice() {
-
-	while (!_ShuttingDown) {
-		
-		// Lock the voice chat mutex if it isnt already
-		if (!_VoiceChatMutexIsLocked) {
-
-			_VoiceChatMutex.lock();
-			_VoiceChatMutexIsLocked = true;
-		}
-
-		// Get input device
-		FMOD_RESULT result;
-		result = _FMODsystem->getRecordNumDrivers(NULL, &_DriverCount);
-
-		/*
-			Determine latency in sampels
-		*/
-		int nativeChannels = 0;
-		result = _FMODsystem->getRecordDriverInfo(DEVICE_INDEX, NULL, 0, NULL, &_NativeRate, NULL, &nativeChannels, NULL);
-
-		_DriftThreshold = (_NativeRate * DRIFT_MS) / 1000;		// The point where we start compensating for drift
-		_DesiredLatency = (_NativeRate * LATENCY_MS) / 1000;	// User specified latency
-		_AdjustedLatency = _DesiredLatency;						// User specified latency adjusted for driver update granularity
-		_ActualLatency = _DesiredLatency;						// Latency measured once playback begins (smoothened for jitter)
-
-		/*
-			Create user sound to record into, then start playing
-		*/
-		FMOD_CREATESOUNDEXINFO exinfo = { 0 };
-		exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
-		exinfo.numchannels = nativeChannels;
-		exinfo.format = FMOD_SOUND_FORMAT_PCM16;
-		exinfo.defaultfrequency = _NativeRate;
-		exinfo.length = _NativeRate * sizeof(short) * nativeChannels; // 1 second buffer, size here doesnt change latency
-
-		result = _FMODsystem->createSound(0, FMOD_LOOP_NORMAL | FMOD_OPENUSER, &exinfo, &_SoundInput);
-		result = _FMODsystem->recordStart(DEVICE_INDEX, _SoundInput, true);
-		result = _SoundInput->getLength(&_SoundLength, FMOD_TIMEUNIT_PCM);
-
-		do {
-
-			/*
-				Determine how much has been recorded since we last checked
-			*/
-			unsigned int recordPos = 0;
-			result = _FMODsystem->getRecordPosition(DEVICE_INDEX, &recordPos);
-
-			static unsigned int lastRecordPos = 0;
-			unsigned int recordDelta = (recordPos >= lastRecordPos) ? (recordPos - lastRecordPos) : (recordPos + _SoundLength - lastRecordPos);
-			lastRecordPos = recordPos;
-			_SamplesRecorded += recordDelta;
-
-			static unsigned int minRecordDelta = (unsigned int)-1;
-			if (recordDelta && (recordDelta < minRecordDelta)) {
-
-				// Smallest driver granularity seen so far
-				minRecordDelta = recordDelta;
-
-				// Adjust our latency if driver granularity is high
-				_AdjustedLatency = (recordDelta <= _DesiredLatency) ? _DesiredLatency : recordDelta;
-			}
-
-			/*
-				Delay playback until our desired latency is reached
-			*/
-			if (!_ChannelOutput && _SamplesRecorded >= _AdjustedLatency) {
+void Client::RequestVoiceChannel() {
 
-				result = _FMODsystem->playSound(_SoundInput, 0, false, &_ChannelOutput);
-				_IsTalking = true;
-			}
+	if (_VoiceChannelOpen) { return; }
 
-			if (_ChannelOutput) {
-
-				/*
-					Stop playback if recording stops
-				*/
-				bool isRecording = false;
-				result = _FMODsystem->isRecording(DEVICE_INDEX, &isRecording);
-				if (!isRecording) {
-				
-					result = _ChannelOutput->setPaused(true);
-					_IsTalking = false;
-				} 
-				else { _IsTalking = true; }
-
-				/*
-					Determine how much has been played since we last checked
-				*/
-				unsigned int playPos = 0;
-				result = _ChannelOutput->getPosition(&playPos, FMOD_TIMEUNIT_PCM);
-
-				static unsigned int lastPlayPos = 0;
-				unsigned int playDelta = (playPos >= lastPlayPos) ? (playPos - lastPlayPos) : (playPos + _SoundLength - lastPlayPos);
-				lastPlayPos = playPos;
-				_SamplesPlayed += playDelta;
-
-				/*
-					Compensate for any recording / playback drift
-				*/
-				int latency = _SamplesRecorded - _SamplesPlayed;
-				_ActualLatency = int((0.97f * _ActualLatency) + (0.03f * latency));
-
-				int playbackRate = _NativeRate;
-				if (_ActualLatency < (int)(_AdjustedLatency - _DriftThreshold)) {
-
-					// Play position is catching up to the record position, slow playback down by 2%
-					playbackRate = _NativeRate - (_NativeRate / 50);
-				} 
-				else if (_ActualLatency > (int)(_AdjustedLatency + _DriftThreshold)) {
-
-					// Play position is falling behind the record position, speed playback up by 2%
-					playbackRate = _NativeRate + (_NativeRate / 50);
-				}
-				_ChannelOutput->setFrequency((float)playbackRate);
-			}
-		} while (_DriverCount > 0 && !_ShuttingDown);
-	}
-	_VoiceChatMutex.unlock();
-	_VoiceChatMutexIsLocked = false;
+	_RakVoice.RequestVoiceChannel(_ServerGUID);
+	_VoiceChannelOpen = true;
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Decodes & plays back an incoming sound from the network.
+	@Summary:	Closes the voice channel to the server, if one is open.
 	
 	@return:	VOID
 */
-void Client::DecodeIncomingVoice() {
-	
-	FMOD_RESULT result;
+void Client::CloseVoiceChannel() {
+
+	if (!_VoiceChannelOpen) { return; }
 
-	// Create sound output
-	int nativeRate = 0;
-	int nativeChannels = 0;
-	result = _FMODsystem->getRecordDriverInfo(DEVICE_INDEX, NULL, 0, NULL, &nativeRate, NULL, &nativeChannels, NULL);
-
-	FMOD_CREATESOUNDEXINFO exinfo	= { 0 };
-	exinfo.cbsize					= sizeof(FMOD_CREATESOUNDEXINFO);
-	exinfo.numchannels				= nativeChannels;
-	exinfo.format					= FMOD_SOUND_FORMAT_PCM16;
-	exinfo.defaultfrequency			= nativeRate;
-	exinfo.length					= nativeRate * sizeof(short) * nativeChannels; // 1 second buffer, size here doesnt change latency
-
-	// Decode the sound to output
-	result = _FMODsystem->createSound(0, FMOD_LOOP_NORMAL | FMOD_OPENUSER, &exinfo, &_SoundOutput);
-	_RakVoice.ReceiveFrame(_SoundOutput);
-
-	// Play output
-	result = _FMODsystem->playSound(_SoundOutput, 0, false, &_ChannelOutput);
-	_SoundOutput->release();
+	_RakVoice.CloseVoiceChannel(_ServerGUID);
+	_VoiceChannelOpen = false;
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Encodes an sound and sents it to a recipient.
+	@Summary:	Opens a decoder for every team mate before they talk & frees those of clients that have
+				left the team, so the first packet of their push to talk is heard straight away.
 	
 	@return:	VOID
 */
-void Client::SendVoiceBuffer(RakNet::RakNetGUID targetGUID, FMOD::Sound* voiceSound) {
-	
-	// Encode the data & send it to the target recipient
-	_RakVoice.SendFrame(targetGUID, voiceSound);
+void Client::UpdateVoiceTeam() {
+
+	if (_ServerGUID == RakNet::UNASSIGNED_RAKNET_GUID) { return; }
+
+	for (ClientInfo* info : _ClientList) {
+
+		if (info->GUID == _Info.GUID) { continue; }
+
+		// The server only forwards the voice of our own team
+		if (info->Channel == _Info.Channel) { _RakVoice.PrepareRelayedChannel(info->GUID, _ServerGUID); }
+		else { _RakVoice.CloseRelayedChannel(info->GUID); }
+	}
 }
\ No newline at end of file
@@ -4,8 +4,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <thread>
-#include <mutex>
+#include <unordered_set>
 
 // Raknet libraries
 #include <RakPeerInterface.h>
@@ -20,31 +19,33 @@
 
 // NPC libraries
 #include "Enumeration.h"
+#include "VoiceWorkerPool.h"
 
 // define sample type. Only short(16 bits sound) is supported at the moment.
 typedef short SAMPLE;
 
-// Reads and writes per second of the sound data
-// Speex only supports these 3 values
+// Default reads and writes per second of the voice data, the device runs at its own rate & is resampled to this
+// Speex only supports 8000 (narrowband), 16000 (wideband) & 32000 (ultra wideband)
 #define SAMPLE_RATE  (8000)
-///#define SAMPLE_RATE  (16000)
-///#define SAMPLE_RATE  (32000)
 
-// I think one buffer has to be full (of samples) before you hear the sound.
-// So higher frames per buffer means that there will be a larger latency before you hear the sound
-// However, it would lock and unlock the buffer more often, hindering performance.
-#define FRAMES_PER_BUFFER  (2048 / (32000 / SAMPLE_RATE))
+// Speex encodes 20ms frames. Each buffer holds the frames of one voice packet, so a whole buffer has
+// to be recorded before it is sent. Bundling more frames per packet adds that much latency, but the
+// buffer is locked & unlocked less often.
+#define SPEEX_FRAMES_PER_SECOND  (50)
 
-#define LATENCY_MS      (50) /* Some devices will require higher latency to avoid glitches */
-#define DRIFT_MS        (1)
-#define DEVICE_INDEX    (0)
+// Length of the FMOD record & playback sounds, whatever the buffer size
+#define VOICE_SOUND_MS  (256)
+
+// Threads that encode & decode voice alongside the one running RakVoice, so frame rendering doesnt stall under voice load.
+// A client only has a few speex jobs every 20ms frame & the RakVoice thread runs them too while it waits, so one is plenty.
+#define VOICE_WORKER_THREADS  (1)
 
 class Client {
 
 public:
 
 	// Constructors
-	Client(std::string IP, const unsigned short PORT);
+	Client(std::string IP, const unsigned short PORT, const RakNet::VoicePacketProfile& voiceProfile = RakNet::VOICE_PROFILE_LOW_LATENCY, int voiceSampleRate = SAMPLE_RATE);
 	~Client();
 	
 	// Networking packets
@@ -57,8 +58,9 @@ public:
 	void onSetClientConnected(RakNet::Packet* packet);
 	void onReceivedServerMessage(RakNet::Packet* packet);
 	void onReceivedChatMessage(RakNet::Packet* packet);
-	void onReceivedPreUpdateClientList(RakNet::Packet* packet);
-	void onReceivedUpdatedClientList(RakNet::Packet* packet);
+	void onReceivedLobbySnapshot(RakNet::Packet* packet);
+	void onReceivedLobbyDelta(RakNet::Packet* packet);
+	void RequestLobbyResync();
 	void sendChatMessageToAll(int channel, std::string message, MessageChannelType messageChannelType);
 	void sendChatMessageToGUID(RakNet::RakNetGUID guid, std::string message, MessageChannelType messageChannelType);
 	void RequestProfileNameToServer(std::string name);
@@ -66,6 +68,7 @@ public:
 	void HandleNetworkMessages();
 	
 	// Client properties
+	ClientInfo* findClientInfo(RakNet::RakNetGUID guid);
 	ClientInfo getInfo()									{ return _Info; }
 	std::string getConnectedIP()							{ return _ConnectedIP; }
 	std::vector<ClientInfo*> getClientList()				{ return _ClientList; }
@@ -91,17 +94,32 @@ public:
 	void UpdateFMOD();
 	void IncreaseVoiceEncoderComplexity(int amount = 1);	
 	void DecreaseVoiceEncoderComplexity(int amount = 1);
-	void RecordVoice(); 
-	void DecodeIncomingVoice();
-	void SendVoiceBuffer(RakNet::RakNetGUID targetGUID, FMOD::Sound* voiceSound);
 	void setNoiseFilterActive(bool value)					{ _RakVoice.SetNoiseFilter(value); }
 	void setVAD(bool value)									{ _RakVoice.SetVAD(value); }
 	void setVBR(bool value)									{ _RakVoice.SetVBR(value); }
+	void setVoiceRedundancy(unsigned int frames)			{ _RakVoice.SetRedundancy(frames); }
+	void setEchoCancellation(bool value)					{ _RakVoice.SetEchoCancellation(value); }
+	void setFixedPointMix(bool value)						{ _RakVoice.SetFixedPointMix(value); }
+	void getVoiceMemoryStats(RakNet::VoiceArenaStatistics& stats) const { _RakVoice.GetMemoryStatistics(&stats); }
+	WorkerPoolStats getVoiceWorkerStats() const				{ return _VoiceWorkers.getStats(); }
+	void getPlaybackVoiceStats(RakNet::VoicePlaybackStatistics& stats) const { _RakVoice.GetPlaybackStatistics(&stats); }
+	unsigned int getPlaybackStreams(RakNet::VoicePlaybackStream* streams, unsigned int maxStreams) const { return _RakVoice.GetPlaybackStreams(streams, maxStreams); }
+	void getVoiceDeviceStats(RakNet::FMODVoiceStatistics& stats) const { RakNet::FMODVoiceAdapter::Instance()->GetStatistics(&stats); }
+	void getEchoStats(RakNet::VoiceEchoStatistics& stats) const { _RakVoice.GetEchoStatistics(&stats); }
+	void getVoiceAdaptiveStats(RakNet::VoiceAdaptiveStatistics& stats) const { _RakVoice.GetAdaptiveStatistics(&stats); }
+	void setVoicePacketProfile(const RakNet::VoicePacketProfile& profile) { _RakVoice.SetPacketProfile(profile); }
+	void setMaxSpeakers(unsigned int speakers)				{ _RakVoice.SetMaxSpeakers(speakers); }
+	void getSpeakerStats(RakNet::VoiceSpeakerStatistics& stats) const { _RakVoice.GetSpeakerStatistics(&stats); }
+	RakNet::VoicePacketProfile getVoicePacketProfile() const { RakNet::VoicePacketProfile profile = _RakVoice.GetPacketProfile(); _RakVoice.GetChannelPacketProfile(_ServerGUID, &profile); return profile; }
+	bool getVoiceJitterStats(RakNet::RakNetGUID talker, RakNet::VoiceJitterStatistics& stats) const { return _RakVoice.GetJitterStatistics(talker, &stats); }
+	bool getVoiceLatencyStats(RakNet::RakNetGUID talker, RakNet::VoiceLatencyStatistics& stats) const { return _RakVoice.GetLatencyStatistics(talker, &stats); }
 	void setTryingToBroadcastVoice(bool value)				{ _TryingToBroadCastingVoice = value; }
-	void RequestVoiceChannel(RakNet::RakNetGUID targetGUID) { _RakVoice.RequestVoiceChannel(targetGUID); }
-	void CloseVoiceChannel(RakNet::RakNetGUID targetGUID)	{ _RakVoice.CloseVoiceChannel(targetGUID); }
-	FMOD::Sound* getVoiceBuffer()							{ return _SoundInput; }
-	bool isTalking()										{ return _IsTalking; }
+	void setPushToTalk(bool value)							{ _RakVoice.SetTalking(value); }
+	void RequestVoiceChannel();
+	void CloseVoiceChannel();
+	void UpdateVoiceTeam();
+	bool isTalking() const									{ return _RakVoice.IsTalking(); }
+	int getVoiceSampleRate() const							{ return _VoiceSampleRate; }
 		
 protected:
 
@@ -111,7 +129,11 @@ protected:
 	
 	// Server info
 	std::string _ConnectedIP;								// IP address of the server we are connected to
+	RakNet::RakNetGUID _ServerGUID;							// GUID of the server we are connected to, which relays all voice.
 	std::vector<ClientInfo*> _ClientList;					// Array of all client infos connected to the server.
+	unsigned int _LobbyVersion = 0;							// Version of the server's client list that _ClientList matches.
+	bool _HasLobbySnapshot = false;							// Returns TRUE once the full client list has been received.
+	bool _LobbyResyncRequested = false;						// Returns TRUE while waiting on a snapshot after a missed delta.
 	
 	// Client info
 	ClientInfo _Info;										// Profile info related to this client.
@@ -132,23 +154,12 @@ protected:
 	MessageChannelType _MsgInType;							// Enum identifier on whether the message is for ALL_CLIENTS, TEAM_ONLY or WHISPER
 
 	// Voice communication system
-	std::thread _VoiceChatThread;							// The thread related to the voice chat recording process.
-	std::mutex _VoiceChatMutex;								// Mutux related to the _VoiceChatThread.
-	bool _VoiceChatMutexIsLocked = false;					// Returns TRUE if the voice chat mutex is currently locked.
 	bool _TryingToBroadCastingVoice = false;				// Returns TRUE if the client is trying to broadcast. 
-	bool _IsTalking = false;								// Returns TRUE if FMOD detects sound being recorded.
+	VoiceWorkerPool _VoiceWorkers{ VOICE_WORKER_THREADS };	// Runs the speex jobs of each RakVoice update (outlives _RakVoice).
 	RakNet::RakVoice _RakVoice;								// Reference to the RakVoice component.
-	FMOD::Channel* _ChannelOutput = NULL;					// Reference to the channel that the sound output is being emitted from.
-	FMOD::Sound* _SoundInput = NULL;						// Reference to sound from the client's input device.
-	FMOD::Sound* _SoundOutput = NULL;						// Reference to sound being sent from the network.
-	unsigned int _SamplesRecorded = 0;						// Counter for how many samples have been recorded.
-	unsigned int _SamplesPlayed = 0;						// Counter for how many samples have been played.
-	unsigned int _DriftThreshold;							// The point where we start compensating for drift.
-	unsigned int _DesiredLatency;							// User specified latency.
-	unsigned int _AdjustedLatency;							// User specified latency adjusted for driver update granularity.
-	unsigned int _SoundLength;								// Length of the sound being recorded.
-	int _ActualLatency;										// Latency measured once playback begins (smoothened for jitter).
-	int _NativeRate = 0;									// 
+	bool _VoiceChannelOpen = false;							// Returns TRUE if a voice channel to the server has been requested.
+	RakNet::VoicePacketProfile _VoiceProfile;				// Packet profile the voice buffers were sized for.
+	int _VoiceSampleRate = SAMPLE_RATE;						// Rate speex encodes & decodes at (8000, 16000 or 32000).
 	int _DriverCount = 0;									// Number of input devices detected.
 
 };
\ No newline at end of file
@@ -0,0 +1,347 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "ClientRegistry.h"
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the index of the lowest set bit in a non zero word.
+
+	@param:		word					- The word to scan (must not be 0).
+
+	@return:	unsigned int
+*/
+static unsigned int LowestSetBit(uint64_t word) {
+
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (unsigned int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)word)) { return (unsigned int)index; }
+	_BitScanForward(&index, (unsigned long)(word >> 32));
+	return (unsigned int)index + 32;
+#else
+	return (unsigned int)__builtin_ctzll(word);
+#endif
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Marks IDs 1 to maxID as free. ID 0 is never handed out.
+
+	@param:		maxID					- The highest ID that can be handed out.
+*/
+ClientIDAllocator::ClientIDAllocator(unsigned int maxID) {
+
+	_MaxID = maxID;
+	_FreeBits.assign((maxID / 64) + 1, ~0ull);
+
+	// Mask off ID 0 & everything past the max ID
+	_FreeBits[0] &= ~1ull;
+	unsigned int tail = (maxID + 1) % 64;
+	if (tail != 0) { _FreeBits.back() &= (1ull << tail) - 1; }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Takes the lowest free ID.
+
+	@return:	int						- The ID, or -1 if every ID is in use.
+*/
+int ClientIDAllocator::Allocate() {
+
+	for (unsigned int i = _FirstFreeWord; i < _FreeBits.size(); ++i) {
+
+		if (_FreeBits[i] != 0) {
+
+			unsigned int bit = LowestSetBit(_FreeBits[i]);
+			_FreeBits[i] &= ~(1ull << bit);
+			_FirstFreeWord = i;
+			return (int)(i * 64 + bit);
+		}
+	}
+
+	// Full
+	_FirstFreeWord = (unsigned int)_FreeBits.size();
+	return -1;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Makes an ID available again for use.
+
+	@param:		id						- The ID to free.
+
+	@return:	VOID
+*/
+void ClientIDAllocator::Release(int id) {
+
+	if (id <= 0 || (unsigned int)id > _MaxID) { return; }
+
+	unsigned int word = (unsigned int)id / 64;
+	_FreeBits[word] |= 1ull << (id % 64);
+	if (word < _FirstFreeWord) { _FirstFreeWord = word; }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns TRUE if the ID has been handed out.
+
+	@param:		id						- The ID to check.
+
+	@return:	bool
+*/
+bool ClientIDAllocator::isInUse(int id) const {
+
+	if (id <= 0 || (unsigned int)id > _MaxID) { return false; }
+	return (_FreeBits[id / 64] & (1ull << (id % 64))) == 0;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Allocates every slot up front.
+
+	@param:		maxClients				- The maximum amount of clients that can be registered at once.
+*/
+ClientRegistry::ClientRegistry(unsigned int maxClients) : _IDs(maxClients) {
+
+	_Slots.resize(maxClients);
+	_Occupied.reserve(maxClients);
+	_SlotByID.assign(maxClients + 1, ClientHandle::INVALID_SLOT);
+	_SlotByGUID.reserve(maxClients);
+
+	// Hand out the lowest slots first
+	_FreeSlots.reserve(maxClients);
+	for (unsigned int i = maxClients; i > 0; --i) { _FreeSlots.push_back(i - 1); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Registers a client & gives it the lowest free ID.
+
+	@param:		guid					- The GUID of the client.
+
+	@return:	ClientHandle			- Invalid if the registry is full.
+*/
+ClientHandle ClientRegistry::Add(RakNet::RakNetGUID guid) {
+
+	// Already registered
+	ClientHandle handle = Find(guid);
+	if (handle.isValid()) { return handle; }
+	if (_FreeSlots.empty()) { return handle; }
+
+	int id = _IDs.Allocate();
+	if (id < 0) { return handle; }
+
+	// Take a free slot
+	unsigned int slotIndex = _FreeSlots.back();
+	_FreeSlots.pop_back();
+
+	Slot& slot = _Slots[slotIndex];
+	slot.Info = ClientInfo();
+	slot.Info.GUID = guid;
+	slot.Info.ID = id;
+	slot.InUse = true;
+	slot.OccupiedIndex = (unsigned int)_Occupied.size();
+	_Occupied.push_back(slotIndex);
+
+	// Index it
+	_SlotByGUID[guid.g] = slotIndex;
+	_SlotByID[id] = slotIndex;
+	JoinChannel(slotIndex, slot.Info.Channel);
+
+	handle.Slot = slotIndex;
+	handle.Generation = slot.Generation;
+	return handle;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes a client & frees their ID.
+
+	@param:		handle					- The client to remove.
+
+	@return:	bool					- FALSE if the handle is stale.
+*/
+bool ClientRegistry::Remove(ClientHandle handle) {
+
+	if (Get(handle) == nullptr) { return false; }
+
+	Slot& slot = _Slots[handle.Slot];
+
+	// Remove from the indices
+	LeaveChannel(handle.Slot);
+	_SlotByGUID.erase(slot.Info.GUID.g);
+	_SlotByID[slot.Info.ID] = ClientHandle::INVALID_SLOT;
+	_IDs.Release(slot.Info.ID);
+
+	// Swap the last occupied slot into this one's place
+	unsigned int last = _Occupied.back();
+	_Occupied[slot.OccupiedIndex] = last;
+	_Slots[last].OccupiedIndex = slot.OccupiedIndex;
+	_Occupied.pop_back();
+
+	// Invalidate any handles still pointing at this slot
+	slot.InUse = false;
+	slot.Generation++;
+	_FreeSlots.push_back(handle.Slot);
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes a client & frees their ID.
+
+	@param:		guid					- The GUID of the client to remove.
+
+	@return:	bool					- FALSE if the client isnt registered.
+*/
+bool ClientRegistry::Remove(RakNet::RakNetGUID guid) {
+
+	return Remove(Find(guid));
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes every client.
+
+	@return:	VOID
+*/
+void ClientRegistry::Clear() {
+
+	while (!_Occupied.empty()) { Remove(getHandleAt(0)); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Moves a client into a different channel.
+
+	@param:		handle					- The client to move.
+	@param:		channel					- The channel to subscribe them to.
+
+	@return:	bool					- FALSE if the handle is stale.
+*/
+bool ClientRegistry::SetChannel(ClientHandle handle, int channel) {
+
+	ClientInfo* info = Get(handle);
+	if (info == nullptr) { return false; }
+	if (info->Channel == channel) { return true; }
+
+	LeaveChannel(handle.Slot);
+	info->Channel = channel;
+	JoinChannel(handle.Slot, channel);
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the slots of every client subscribed to a channel.
+
+	@param:		channel					- The channel.
+
+	@return:	const std::vector<unsigned int>&
+*/
+const std::vector<unsigned int>& ClientRegistry::getChannelMembers(int channel) const {
+
+	static const std::vector<unsigned int> noMembers;
+
+	auto iter = _ChannelMembers.find(channel);
+	return iter != _ChannelMembers.end() ? iter->second : noMembers;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Adds a slot to the member list of its channel.
+
+	@return:	VOID
+*/
+void ClientRegistry::JoinChannel(unsigned int slot, int channel) {
+
+	std::vector<unsigned int>& members = _ChannelMembers[channel];
+	_Slots[slot].ChannelIndex = (unsigned int)members.size();
+	members.push_back(slot);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes a slot from the member list of its current channel.
+
+	@return:	VOID
+*/
+void ClientRegistry::LeaveChannel(unsigned int slot) {
+
+	std::vector<unsigned int>& members = _ChannelMembers[_Slots[slot].Info.Channel];
+	unsigned int index = _Slots[slot].ChannelIndex;
+
+	// Swap the last member into this one's place
+	unsigned int last = members.back();
+	members[index] = last;
+	_Slots[last].ChannelIndex = index;
+	members.pop_back();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Finds a client by their GUID.
+
+	@param:		guid					- The GUID of the client.
+
+	@return:	ClientHandle			- Invalid if the client isnt registered.
+*/
+ClientHandle ClientRegistry::Find(RakNet::RakNetGUID guid) const {
+
+	ClientHandle handle;
+
+	auto iter = _SlotByGUID.find(guid.g);
+	if (iter != _SlotByGUID.end()) {
+
+		handle.Slot = iter->second;
+		handle.Generation = _Slots[iter->second].Generation;
+	}
+	return handle;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Finds a client by their client ID.
+
+	@param:		id						- The client ID.
+
+	@return:	ClientHandle			- Invalid if no client has the ID.
+*/
+ClientHandle ClientRegistry::FindByID(int id) const {
+
+	ClientHandle handle;
+
+	if (id > 0 && (unsigned int)id < _SlotByID.size() && _SlotByID[id] != ClientHandle::INVALID_SLOT) {
+
+		handle.Slot = _SlotByID[id];
+		handle.Generation = _Slots[handle.Slot].Generation;
+	}
+	return handle;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Resolves a handle to the client's info.
+
+	@param:		handle					- The client handle.
+
+	@return:	ClientInfo*				- NULL if the handle is invalid or stale.
+*/
+ClientInfo* ClientRegistry::Get(ClientHandle handle) {
+
+	if (handle.Slot >= _Slots.size()) { return nullptr; }
+
+	Slot& slot = _Slots[handle.Slot];
+	if (!slot.InUse || slot.Generation != handle.Generation) { return nullptr; }
+	return &slot.Info;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the handle for the Nth registered client.
+
+	@param:		index					- 0 to getSize() - 1.
+
+	@return:	ClientHandle
+*/
+ClientHandle ClientRegistry::getHandleAt(unsigned int index) const {
+
+	ClientHandle handle;
+	handle.Slot = _Occupied[index];
+	handle.Generation = _Slots[handle.Slot].Generation;
+	return handle;
+}
\ No newline at end of file
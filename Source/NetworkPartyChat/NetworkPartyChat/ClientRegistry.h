@@ -0,0 +1,100 @@
+#pragma once
+
+// Standard libraries
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Raknet libraries
+#include <RakNetTypes.h>
+
+// NPC libraries
+#include "Enumeration.h"
+
+// Identifies a slot in the client registry. The generation changes every time the slot is
+// reused, so a handle kept past a client leaving will never resolve to the next client.
+struct ClientHandle {
+
+	static const unsigned int INVALID_SLOT = 0xFFFFFFFF;
+
+	unsigned int Slot = INVALID_SLOT;
+	unsigned int Generation = 0;
+
+	bool isValid() const									{ return Slot != INVALID_SLOT; }
+};
+
+// Hands out the lowest free client ID, using one bit per ID.
+class ClientIDAllocator {
+
+public:
+
+	// Constructors
+	ClientIDAllocator(unsigned int maxID);
+
+	int Allocate();
+	void Release(int id);
+	bool isInUse(int id) const;
+
+protected:
+
+	std::vector<uint64_t> _FreeBits;						// 1 bit per ID, set when the ID is free to use.
+	unsigned int _FirstFreeWord = 0;						// No word before this one has a free bit.
+	unsigned int _MaxID;									// The highest ID that can be handed out.
+
+};
+
+// Preallocated table of the clients connected to the server.
+class ClientRegistry {
+
+public:
+
+	// Constructors
+	ClientRegistry(unsigned int maxClients);
+
+	// Membership
+	ClientHandle Add(RakNet::RakNetGUID guid);
+	bool Remove(ClientHandle handle);
+	bool Remove(RakNet::RakNetGUID guid);
+	void Clear();
+
+	// Channels
+	bool SetChannel(ClientHandle handle, int channel);
+	const std::vector<unsigned int>& getChannelMembers(int channel) const;
+	ClientInfo& getInfoBySlot(unsigned int slot)			{ return _Slots[slot].Info; }
+
+	// Lookup
+	ClientHandle Find(RakNet::RakNetGUID guid) const;
+	ClientHandle FindByID(int id) const;
+	ClientInfo* Get(ClientHandle handle);
+	ClientInfo* Get(RakNet::RakNetGUID guid)				{ return Get(Find(guid)); }
+
+	// Iteration (in no particular order)
+	unsigned int getSize() const							{ return (unsigned int)_Occupied.size(); }
+	unsigned int getCapacity() const						{ return (unsigned int)_Slots.size(); }
+	ClientHandle getHandleAt(unsigned int index) const;
+	ClientInfo& getInfoAt(unsigned int index)				{ return _Slots[_Occupied[index]].Info; }
+
+protected:
+
+	void JoinChannel(unsigned int slot, int channel);
+	void LeaveChannel(unsigned int slot);
+
+	struct Slot {
+
+		ClientInfo Info;
+		unsigned int Generation = 0;
+		unsigned int OccupiedIndex = 0;						// Where this slot is listed in _Occupied.
+		unsigned int ChannelIndex = 0;						// Where this slot is listed in its channel's member list.
+		bool InUse = false;
+	};
+
+	std::vector<Slot> _Slots;								// Every client slot, allocated once on startup.
+	std::vector<unsigned int> _FreeSlots;					// Stack of slots not in use.
+	std::vector<unsigned int> _Occupied;					// Dense list of the slots in use, for iteration.
+	std::vector<unsigned int> _SlotByID;					// Client ID to slot.
+	std::unordered_map<int, std::vector<unsigned int>> _ChannelMembers;	// Channel to the slots subscribed to it.
+	std::unordered_map<uint64_t, unsigned int> _SlotByGUID;	// Client GUID to slot.
+	ClientIDAllocator _IDs;									// Hands out the client IDs.
+
+};
\ No newline at end of file
@@ -10,14 +10,16 @@ enum GameMessages {
 	ID_SERVER_SET_CLIENT_ID,
 	ID_SERVER_SET_CLIENT_CHANNEL,
 	ID_SERVER_SET_CLIENT_NAME,
-	ID_SERVER_SET_CLIENTLIST_SIZE,
-	ID_SERVER_UPDATE_CLIENTLIST,
+	ID_SERVER_LOBBY_SNAPSHOT,
+	ID_SERVER_LOBBY_DELTA,
 	ID_CLIENT_CHAT_MESSAGE_BROADCAST,
 	ID_CLIENT_CHAT_MESSAGE_WHISPER,
 	ID_CLIENT_VOICE_MESSAGE,
 	ID_CLIENT_REQUEST_CHANNEL_CHANGE,
 	ID_CLIENT_REQUEST_DISCONNECTION,
-	ID_CLIENT_REQUEST_NAME_CHANGE
+	ID_CLIENT_REQUEST_NAME_CHANGE,
+	ID_CLIENT_REQUEST_LOBBY_RESYNC,
+	ID_SERVER_VOICE_RELAY
 };
 
 enum MessageChannelType {
@@ -27,6 +29,20 @@ enum MessageChannelType {
 	WHISPER
 };
 
+enum LobbyDeltaType {
+
+	LOBBY_DELTA_ADD,
+	LOBBY_DELTA_REMOVE,
+	LOBBY_DELTA_MODIFY
+};
+
+// Which fields a LOBBY_DELTA_MODIFY carries
+enum LobbyDeltaField {
+
+	LOBBY_FIELD_CHANNEL = 1 << 0,
+	LOBBY_FIELD_NAME = 1 << 1
+};
+
 struct ClientInfo {
 
 	RakNet::RakNetGUID GUID;
@@ -16,15 +16,12 @@
 
 #include "FMODVoiceAdapter.h"
 #include "fmod_errors.h"
+#include "RakSleep.h"
 
 
 /// To test sending to myself
 //#define _TEST_LOOPBACK
 
-
-// Number of RakVoice frames in the fmod sound
-#define FRAMES_IN_SOUND 4
-
 using namespace RakNet;
 
 FMODVoiceAdapter FMODVoiceAdapter::instance;
@@ -36,26 +33,86 @@ FMODVoiceAdapter::FMODVoiceAdapter(){
 	sound=0;
 	channel=0;
 	mute=false;
+	relay=UNASSIGNED_RAKNET_GUID.g;
+	audioThreadStop=false;
+	playbackTarget=0;
+	playSoundSamples=0;
+	playSampleRate=0;
+	captureOverruns=0;
+	captureOverrunSamples=0;
+	playbackUnderruns=0;
+	playbackUnderrunSamples=0;
+	recordBlock=0;
+	recordConverted=0;
+	recordConvertedSize=0;
+	playBlock=0;
+	playConverted=0;
+	playConvertedSize=0;
 }
 
 FMODVoiceAdapter* FMODVoiceAdapter::Instance(){
 	return &instance;
 }
 
-bool FMODVoiceAdapter::SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice)
+bool FMODVoiceAdapter::SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice, unsigned framesInSound)
 {
 	FMOD_RESULT fmodErr;
 
 	RakAssert(fmodSystem);
 	RakAssert(rakVoice);
+	RakAssert(framesInSound>=2);
 	// Make sure rakVoice was initialized
 	RakAssert((rakVoice->IsInitialized())&&(rakVoice->GetRakPeerInterface()!=NULL));
 
+	StopAudioThread();
 	this->fmodSystem = fmodSystem;
 	this->rakVoice = rakVoice;
 	lastPlayPos = 0;
 	lastRecordingPos = 0;
 
+	// Run the sounds at the device rates, so the only resampling is ours
+	int voiceRate = rakVoice->GetSampleRate();
+	int recordRate = 0;
+	int playRate = 0;
+	if (fmodSystem->getRecordDriverInfo(0, 0, 0, 0, &recordRate, 0, 0, 0)!=FMOD_OK || recordRate<=0)
+		recordRate = voiceRate;
+	if (fmodSystem->getSoftwareFormat(&playRate, 0, 0)!=FMOD_OK || playRate<=0)
+		playRate = voiceRate;
+	if (recordResampler.Init(recordRate, voiceRate)==false)
+	{
+		recordRate = voiceRate;
+		recordResampler.Init(voiceRate, voiceRate);
+	}
+	if (playResampler.Init(voiceRate, playRate)==false)
+	{
+		playRate = voiceRate;
+		playResampler.Init(voiceRate, voiceRate);
+	}
+
+	// Same length in time as framesInSound blocks at the RakVoice rate
+	unsigned blockSamples = rakVoice->GetBufferSizeBytes()/sizeof(short);
+	unsigned recordSamples = (unsigned) (((unsigned long long) blockSamples * framesInSound * recordRate) / voiceRate);
+	unsigned playSamples = (unsigned) (((unsigned long long) blockSamples * framesInSound * playRate) / voiceRate);
+
+	FreeBuffers();
+	recordBlock = (short*) rakMalloc_Ex(blockSamples*sizeof(short), _FILE_AND_LINE_);
+	recordConvertedSize = recordResampler.getMaxOutput(recordSamples);
+	recordConverted = (short*) rakMalloc_Ex(recordConvertedSize*sizeof(short), _FILE_AND_LINE_);
+	playBlock = (short*) rakMalloc_Ex(blockSamples*sizeof(short), _FILE_AND_LINE_);
+	playConvertedSize = playResampler.getMaxOutput(blockSamples);
+	playConverted = (short*) rakMalloc_Ex(playConvertedSize*sizeof(short), _FILE_AND_LINE_);
+
+	// The capture ring holds twice the record sound, so Update can fall that far behind before anything recorded is lost
+	captureRing.Init(blockSamples*framesInSound*2);
+	playbackRing.Init(playConvertedSize*(FMOD_VOICE_PLAYBACK_RING_BLOCKS+1));
+	playbackTarget = (unsigned) (((unsigned long long) blockSamples * FMOD_VOICE_PLAYBACK_RING_BLOCKS * playRate) / voiceRate);
+	playSoundSamples = playSamples;
+	playSampleRate = playRate;
+	captureOverruns=0;
+	captureOverrunSamples=0;
+	playbackUnderruns=0;
+	playbackUnderrunSamples=0;
+
 	//
 	// Create the FMOD sound used to record
 	//
@@ -64,14 +121,16 @@ bool FMODVoiceAdapter::SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice
 	exinfo.cbsize           = sizeof(FMOD_CREATESOUNDEXINFO);
 	exinfo.numchannels      = 1;
 	exinfo.format           = FMOD_SOUND_FORMAT_PCM16;
-	exinfo.defaultfrequency = rakVoice->GetSampleRate();
-	exinfo.length			= rakVoice->GetBufferSizeBytes()*FRAMES_IN_SOUND;
+	exinfo.defaultfrequency = recordRate;
+	exinfo.length			= recordSamples*sizeof(short);
 	
 	fmodErr = fmodSystem->createSound(0, FMOD_2D | FMOD_DEFAULT | FMOD_OPENUSER, &exinfo, &recSound);
 	if (fmodErr!=FMOD_OK)
 		return false;
 
 	// Create the FMOD sound used to play incoming sound data
+	exinfo.defaultfrequency = playRate;
+	exinfo.length			= playSamples*sizeof(short);
 	fmodErr = fmodSystem->createSound(0, FMOD_2D | FMOD_DEFAULT | FMOD_OPENUSER, &exinfo, &sound);
 	if (fmodErr!=FMOD_OK)
 		return false;
@@ -87,15 +146,44 @@ bool FMODVoiceAdapter::SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice
 	if (fmodErr!=FMOD_OK)
 		return false;
 
+	// From here on only the audio thread touches the sounds
+	audioThreadStop=false;
+	audioThread=std::thread(&FMODVoiceAdapter::AudioThread, this);
 	return true;
 }
 
 
 void FMODVoiceAdapter::Update(void)
 {
+	unsigned blockSamples, converted;
+
 	RakAssert(fmodSystem);
-	UpdateSound(true);
-	UpdateSound(false);
+	blockSamples = rakVoice->GetBufferSizeBytes()/sizeof(short);
+
+	// Send every whole block the audio thread has recorded
+	while (captureRing.GetReadAvailable() >= blockSamples)
+	{
+		captureRing.Read(recordBlock, blockSamples);
+
+		// The block's first sample was recorded before everything still behind it in the ring
+		rakVoice->SetCaptureAge((RakNet::TimeUS) (captureRing.GetReadAvailable()+blockSamples) * 1000000 / rakVoice->GetSampleRate());
+		BroadcastFrame(recordBlock);
+	}
+
+	// Keep enough queued for the audio thread to ride out this thread stalling, a whole block from RakVoice at a time.
+	// ReceiveFrame only hands over what the last RakVoice::Update mixed, so each block is mixed here first.  A block Update
+	// already mixed and nobody has received yet is left as it is.
+	while (playbackRing.GetReadAvailable() < playbackTarget && playbackRing.GetWriteAvailable() >= playConvertedSize)
+	{
+		// The block waits behind everything already queued, then is written just behind the play cursor, so goes once around the sound
+		rakVoice->SetPlayoutDelay((RakNet::TimeUS) (playbackRing.GetReadAvailable()+playSoundSamples) * 1000000 / playSampleRate);
+		rakVoice->Update();
+		rakVoice->ReceiveFrame(playBlock);
+		converted = playResampler.Process(playBlock, blockSamples, playConverted, playConvertedSize);
+		if (converted==0)
+			break;
+		playbackRing.Write(playConverted, converted);
+	}
 }
 
 void FMODVoiceAdapter::Release(void)
@@ -104,6 +192,8 @@ void FMODVoiceAdapter::Release(void)
 
 	if (fmodSystem==NULL) return;
 
+	StopAudioThread();
+
 	// Stop recording
 	bool recording=false;
 	err = fmodSystem->isRecording(0,&recording);
@@ -131,7 +221,8 @@ void FMODVoiceAdapter::Release(void)
 		sound->release();
 		sound = NULL;
 	}
-	
+
+	FreeBuffers();
 }
 
 
@@ -140,6 +231,43 @@ void FMODVoiceAdapter::SetMute(bool mute)
 	this->mute = mute;
 }
 
+void FMODVoiceAdapter::SetRelay(RakNetGUID relay)
+{
+	this->relay = relay.g;
+}
+
+void FMODVoiceAdapter::GetStatistics(FMODVoiceStatistics *statistics) const
+{
+	statistics->captureRingSamples=captureRing.GetReadAvailable();
+	statistics->captureRingCapacity=captureRing.GetCapacity();
+	statistics->playbackRingSamples=playbackRing.GetReadAvailable();
+	statistics->playbackRingCapacity=playbackRing.GetCapacity();
+	statistics->captureOverruns=captureOverruns;
+	statistics->captureOverrunSamples=captureOverrunSamples;
+	statistics->playbackUnderruns=playbackUnderruns;
+	statistics->playbackUnderrunSamples=playbackUnderrunSamples;
+}
+
+void FMODVoiceAdapter::AudioThread(void)
+{
+	while (audioThreadStop==false)
+	{
+		UpdateSound(true);
+		UpdateSound(false);
+		RakSleep(FMOD_VOICE_IO_INTERVAL_MS);
+	}
+}
+
+void FMODVoiceAdapter::StopAudioThread(void)
+{
+	if (audioThread.joinable())
+	{
+		audioThreadStop=true;
+		audioThread.join();
+	}
+	audioThreadStop=false;
+}
+
 
 void FMODVoiceAdapter::UpdateSound(bool isRec)
 {
@@ -164,12 +292,6 @@ void FMODVoiceAdapter::UpdateSound(bool isRec)
 	fmodErr=snd->getLength(&soundLength, FMOD_TIMEUNIT_PCM);
 	RakAssert(fmodErr==FMOD_OK);
 
-	// calculate some variables we'll need ahead
-	int bufferSizeBytes = rakVoice->GetBufferSizeBytes();
-
-	// Round down the current position to a multiple of buffer size in samples
-	currPos -= currPos % (bufferSizeBytes/sampleSize);
-
 	if ( ((!isRec)||(isRec && !mute)) && (currPos != lastPos) ) 	
 	{
 		void *ptr1, *ptr2;
@@ -186,25 +308,16 @@ void FMODVoiceAdapter::UpdateSound(bool isRec)
 		// Lock to get access to the raw data
 		snd->lock(lastPos * sampleSize, blockLength * sampleSize, &ptr1, &ptr2, &len1, &len2);
 
-		//  Since the length and current position are both a multiple of bufferSizeBytes
-		// just treat treat one full buffer at a time
-		int numFrames = len1 / bufferSizeBytes;
-		while(numFrames--){
-			if (isRec) {
-				BroadcastFrame(ptr1);
-			} else {
-				rakVoice->ReceiveFrame(ptr1);
-			}
-			ptr1 = (char*)ptr1 + bufferSizeBytes;
-		}
-		numFrames = len2 / bufferSizeBytes;
-		while(numFrames--) {
-			if (isRec){
-				BroadcastFrame(ptr2);
-			} else {
-				rakVoice->ReceiveFrame(ptr2);
-			}
-			ptr2 = (char*)ptr2 + bufferSizeBytes;
+		// The samples recorded since the last pass are converted and queued for Update to send.
+		// The samples just played are refilled, to be heard the next time around the sound.
+		if (isRec) {
+			RecordSamples((short*)ptr1, len1 / sampleSize);
+			if (ptr2)
+				RecordSamples((short*)ptr2, len2 / sampleSize);
+		} else {
+			PlaySamples((short*)ptr1, len1 / sampleSize);
+			if (ptr2)
+				PlaySamples((short*)ptr2, len2 / sampleSize);
 		}
 
 		snd->unlock(ptr1, ptr2, len1, len2);
@@ -213,20 +326,67 @@ void FMODVoiceAdapter::UpdateSound(bool isRec)
 	lastPos = currPos;
 }
 
+void FMODVoiceAdapter::RecordSamples(const short *samples, unsigned count)
+{
+	unsigned converted, written;
 
+	// Never more than the length of the sound, which the buffer was sized for
+	RakAssert(recordResampler.getMaxOutput(count)<=recordConvertedSize);
+	converted = recordResampler.Process(samples, count, recordConverted, recordConvertedSize);
+
+	// Update sends them a block at a time
+	written = captureRing.Write(recordConverted, converted);
+	if (written < converted)
+	{
+		captureOverruns++;
+		captureOverrunSamples+=converted-written;
+	}
+}
+
+void FMODVoiceAdapter::PlaySamples(short *samples, unsigned count)
+{
+	unsigned read;
+
+	// Whatever Update hasn't queued in time is played as silence
+	read = playbackRing.Read(samples, count);
+	if (read < count)
+	{
+		memset(samples+read, 0, (count-read)*sizeof(short));
+		playbackUnderruns++;
+		playbackUnderrunSamples+=count-read;
+	}
+}
 
 void FMODVoiceAdapter::BroadcastFrame(void *ptr)
 {
 #ifndef _TEST_LOOPBACK
-	unsigned i;
-
-	unsigned int numPeers = rakVoice->GetRakPeerInterface()->GetMaximumNumberOfPeers();
-	for (i=0; i < numPeers; i++)
+	// The relay forwards our one stream to everyone listening
+	RakNetGUID relayGuid(relay);
+	if (relayGuid!=UNASSIGNED_RAKNET_GUID)
 	{
-		rakVoice->SendFrame(rakVoice->GetRakPeerInterface()->GetGUIDFromIndex(i), ptr);
+		rakVoice->SendFrame(relayGuid, ptr);
+		return;
 	}
-#else
-	rakVoice->SendFrame(RakNet::UNASSIGNED_SYSTEM_ADDRESS, ptr);
 #endif
 
-}
\ No newline at end of file
+	// RakVoice encodes the frame once and sends it on every open channel
+	rakVoice->SendFrame(ptr);
+}
+
+void FMODVoiceAdapter::FreeBuffers(void)
+{
+	if (recordBlock)
+		rakFree_Ex(recordBlock, _FILE_AND_LINE_);
+	if (recordConverted)
+		rakFree_Ex(recordConverted, _FILE_AND_LINE_);
+	if (playBlock)
+		rakFree_Ex(playBlock, _FILE_AND_LINE_);
+	if (playConverted)
+		rakFree_Ex(playConverted, _FILE_AND_LINE_);
+	captureRing.Free();
+	playbackRing.Free();
+	recordBlock=0;
+	recordConverted=0;
+	playBlock=0;
+	playConverted=0;
+}
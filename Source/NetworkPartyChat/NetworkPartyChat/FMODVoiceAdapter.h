@@ -16,15 +16,46 @@
 #define __FMODVOICEBRIDGE_H
 
 #include "RakVoice.h"
+#include "VoiceResampler.h"
+#include "VoiceSampleRing.h"
+#include <atomic>
+#include <thread>
 
 // If you get:
 // Error	1	fatal error C1083: Cannot open include file: 'fmod.hpp': No such file or directory	c:\raknet\samples\rakvoicefmod\fmodvoiceadapter.h	9
 // It is because this project depends on Fmod.  If you don't have FMOD you can't use it.
 #include "fmod.hpp"
 
+// Default number of RakVoice blocks in each fmod sound
+#define FMOD_VOICE_FRAMES_IN_SOUND 4
+// How often the audio thread moves samples between the fmod sounds and the rings
+#define FMOD_VOICE_IO_INTERVAL_MS 5
+// RakVoice blocks Update keeps queued for the audio thread to play.  Update can stall this long without a gap in what is heard.
+#define FMOD_VOICE_PLAYBACK_RING_BLOCKS 3
+
 namespace RakNet {
 
+/// Health of the rings between the audio thread and RakVoice, as returned by FMODVoiceAdapter::GetStatistics
+struct FMODVoiceStatistics
+{
+	/// Recorded samples at the RakVoice rate, waiting for Update to send them
+	unsigned captureRingSamples;
+	unsigned captureRingCapacity;
+	/// Samples at the device rate, waiting for the audio thread to play them
+	unsigned playbackRingSamples;
+	unsigned playbackRingCapacity;
+	/// Times recorded samples were dropped because Update hadn't emptied the capture ring, and how many samples
+	unsigned captureOverruns;
+	unsigned captureOverrunSamples;
+	/// Times silence was played because Update hadn't refilled the playback ring, and how many samples
+	unsigned playbackUnderruns;
+	unsigned playbackUnderrunSamples;
+};
+
 /// \brief Connects FMOD with RakVoice.
+/// The sounds run at the device's own rate, and are converted to and from the RakVoice sample rate here rather than by FMOD.
+/// A thread of the adapter's own reads and writes the sounds every FMOD_VOICE_IO_INTERVAL_MS, through wait-free rings,
+/// so how often Update is called (such as once a rendered frame) no longer decides when the sound buffers are serviced.
 class RAK_DLL_EXPORT FMODVoiceAdapter {
 
 public:
@@ -40,25 +71,42 @@ public:
 	/// You must call this method to create the connection between FMOD and RakVoice.
 	/// \param[in] fmodSystem FMOD system object to use.
 	/// \param[in] rakVoice RakVoice object to use, fully Initialized AND attached to a RakPeerInterface.
+	/// \param[in] framesInSound How many RakVoice blocks the record and playback sounds hold.  Smaller blocks need more of them to keep the same headroom.
+	/// The sounds are created at the record driver's and the mixer's own rates, so hold the same time at those rates.
 	/// \pre IMPORTANT : Don't forget to initialized and attach rakVoice, before calling this method.
 	/// \sa \link FMODVoiceAdapter::Update \endlink
 	/// \return true on success, false if an error occurred.
-	bool SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice);
+	bool SetupAdapter(FMOD::System *fmodSystem, RakVoice *rakVoice, unsigned framesInSound=FMOD_VOICE_FRAMES_IN_SOUND);
 
 	/// Release any resources used.
 	void Release();
 
-	/// You need to call this once in a while, depending on the parameters used. Ex: call once every 20-30 milliseconds
+	/// Sends what was recorded since the last call and queues more for the audio thread to play.
+	/// Call this on the thread running RakVoice, about once a block.  Stalls up to FMOD_VOICE_PLAYBACK_RING_BLOCKS blocks long are not heard.
+	/// RakVoice::Update is run for each block queued, so every block is freshly mixed and the echo canceller hears each one once.
 	void Update();
 
 	/// Turns on/off outgoing traffic
 	/// \param[in] true to mute, false to allow outgoing traffic.
 	void SetMute(bool mute);
 
+	/// \brief Sends every recorded frame to a single relay (such as a server), instead of to each connected system
+	/// \param[in] relay The system to send to, or UNASSIGNED_RAKNET_GUID to send to every connected system.
+	void SetRelay(RakNetGUID relay);
+
+	/// \brief Returns how full the rings are and how often they ran over or dry
+	/// \param[out] statistics Filled in with the statistics, which are reset by SetupAdapter
+	void GetStatistics(FMODVoiceStatistics *statistics) const;
+
 private:
 
+	void AudioThread(void);
+	void StopAudioThread(void);
 	void UpdateSound(bool isRec);
+	void RecordSamples(const short *samples, unsigned count);
+	void PlaySamples(short *samples, unsigned count);
 	void BroadcastFrame(void *ptr);
+	void FreeBuffers(void);
 
 	static FMODVoiceAdapter instance;
 
@@ -67,18 +115,49 @@ private:
 	FMODVoiceAdapter();
 	FMODVoiceAdapter(const FMODVoiceAdapter &obj) {};
 
-	//  FMOD releases all his resources at shutdown, so we don't need to do anything, which 
+	//  FMOD releases all his resources at shutdown, so we only need to stop the audio thread, which
     // cames in handy, as we don't need to worry about when to destroy the singleton.
-	~FMODVoiceAdapter() {};
+	~FMODVoiceAdapter() {StopAudioThread();};
 
 	RakVoice *rakVoice;
 	FMOD::System *fmodSystem;
 	FMOD::Sound *recSound; // sound used for recording
 	FMOD::Sound *sound; // sound used to play what we hear
 	FMOD::Channel *channel;
-	bool mute;
+	// Set from the user's thread, read by the audio thread and Update
+	std::atomic<bool> mute;
+	// The GUID of the relay, or UNASSIGNED_RAKNET_GUID
+	std::atomic<uint64_t> relay;
 	unsigned int lastPlayPos;
 	unsigned int lastRecordingPos;
+
+	// Services the sounds.  Only the audio thread touches the sounds' positions, recordResampler and recordConverted.
+	std::thread audioThread;
+	std::atomic<bool> audioThreadStop;
+	// Recorded samples at the RakVoice rate, written by the audio thread and read by Update
+	VoiceSampleRing captureRing;
+	// Samples to play at the device rate, written by Update and read by the audio thread
+	VoiceSampleRing playbackRing;
+	// Update keeps at least this many samples in playbackRing
+	unsigned playbackTarget;
+	// Length of the sound we hear, and the device rate it plays at, to time how long a queued block waits
+	unsigned playSoundSamples;
+	int playSampleRate;
+	std::atomic<unsigned> captureOverruns, captureOverrunSamples;
+	std::atomic<unsigned> playbackUnderruns, playbackUnderrunSamples;
+
+	// Device rate to RakVoice rate for what we record, and back for what we hear
+	VoiceResampler recordResampler;
+	VoiceResampler playResampler;
+	// A block at the RakVoice rate, read out of captureRing to send
+	short *recordBlock;
+	// Recorded samples converted in one go, at the RakVoice rate
+	short *recordConverted;
+	unsigned recordConvertedSize;
+	// The last block received from RakVoice, and the same block at the device rate
+	short *playBlock;
+	short *playConverted;
+	unsigned playConvertedSize;
 };
 
 } // namespace RakNet
@@ -11,13 +11,19 @@
 #include "RakVoice.h"
 #include "speex/speex.h"
 #include "speex/speex_preprocess.h"
+#include "speex/speex_echo.h"
 #include "BitStream.h"
 #include "PacketPriority.h"
 #include "MessageIdentifiers.h"
 #include "BitStream.h"
 #include "RakPeerInterface.h"
+#include "RakNetStatistics.h"
 #include <stdlib.h>
+#include <math.h>
+#include <new>
 #include "GetTime.h"
+#include "VoiceMixing.h"
+#include "VoiceWorkerPool.h"
 
 #ifdef _DEBUG
 	#include <stdio.h>
@@ -33,23 +39,422 @@ using namespace RakNet;
 #include <stdio.h>
 #endif
 
-int RakNet::VoiceChannelComp( const RakNetGUID &key, VoiceChannel * const &data )
+// Speex quality and least frames per packet at each step of the adaptive quality ladder.  About 28, 21, 17, 13 and 8 kbps in wideband.
+static const struct {int quality; unsigned framesPerPacket;} adaptLevels[VOICE_ADAPT_LEVELS] = { {8,1}, {6,2}, {5,3}, {4,4}, {2,4} };
+
+VoicePacketProfile RakNet::NegotiatePacketProfile(const VoicePacketProfile &a, const VoicePacketProfile &b)
+{
+	VoicePacketProfile profile;
+	profile.framesPerPacket = (a.framesPerPacket > b.framesPerPacket) ? a.framesPerPacket : b.framesPerPacket;
+	profile.sendIntervalMS = (a.sendIntervalMS > b.sendIntervalMS) ? a.sendIntervalMS : b.sendIntervalMS;
+	if (profile.framesPerPacket < 1)
+		profile.framesPerPacket=1;
+	if (profile.framesPerPacket > VOICE_MAX_FRAMES_PER_PACKET)
+		profile.framesPerPacket=VOICE_MAX_FRAMES_PER_PACKET;
+	return profile;
+}
+
+// Upper limit of each bucket of VoiceLatencyHistogram, in microseconds.  Finer where the stages usually fall.
+static const unsigned latencyBucketLimits[VOICE_LATENCY_BUCKETS] = {
+	500, 1000, 2000, 3000, 5000, 7500, 10000, 15000, 20000, 30000, 40000, 50000,
+	60000, 80000, 100000, 125000, 150000, 200000, 250000, 300000, 400000, 500000, 1000000, 0xFFFFFFFF };
+
+void RakNet::WriteVoiceLatencyStamp(unsigned char *data, const VoiceLatencyStamp &stamp)
+{
+	memcpy(data, &stamp.captureTime, sizeof(uint32_t));
+	memcpy(data+4, &stamp.captureUnits, sizeof(unsigned short));
+	memcpy(data+6, &stamp.encodeUnits, sizeof(unsigned short));
+	memcpy(data+8, &stamp.sendQueueUnits, sizeof(unsigned short));
+}
+
+unsigned char RakNet::GetVoiceEnergy(const short *samples, unsigned count)
+{
+	unsigned i;
+	double sum, level;
+
+	if (count==0)
+		return VOICE_ENERGY_SILENT;
+	sum=0.0;
+	for (i=0; i < count; i++)
+		sum+=(double) samples[i] * (double) samples[i];
+
+	// dB below full scale, offset so silence is 0
+	if (sum==0.0)
+		return VOICE_ENERGY_SILENT;
+	level=10.0 * log10(sum / ((double) count * 32768.0 * 32768.0)) + VOICE_ENERGY_FULL_SCALE;
+	if (level <= VOICE_ENERGY_SILENT)
+		return VOICE_ENERGY_SILENT;
+	if (level >= VOICE_ENERGY_FULL_SCALE)
+		return VOICE_ENERGY_FULL_SCALE;
+	return (unsigned char) level;
+}
+
+float RakNet::UpdateSpeakerLevel(float level, unsigned char energy)
+{
+	if ((float) energy > level)
+		return level + ((float) energy - level) * VOICE_SPEAKER_ATTACK;
+	return level + ((float) energy - level) * VOICE_SPEAKER_RELEASE;
+}
+
+void RakNet::RecordVoiceLatency(VoiceLatencyHistogram *histogram, int64_t microseconds)
+{
+	unsigned bucket, time;
+
+	if (microseconds < 0)
+		microseconds=0;
+	time = (microseconds > 0xFFFFFFFF) ? 0xFFFFFFFF : (unsigned) microseconds;
+	for (bucket=0; time > latencyBucketLimits[bucket]; bucket++)
+		;
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->totalMicroseconds+=time;
+	if (time > histogram->maxMicroseconds)
+		histogram->maxMicroseconds=time;
+}
+
+unsigned RakNet::GetVoiceLatencyBucketLimit(unsigned bucket)
+{
+	RakAssert(bucket < VOICE_LATENCY_BUCKETS);
+	return latencyBucketLimits[bucket];
+}
+
+unsigned RakNet::GetVoiceLatencyPercentile(const VoiceLatencyHistogram &histogram, float fraction)
+{
+	unsigned bucket, wanted, seen;
+
+	if (histogram.count==0)
+		return 0;
+	wanted = (unsigned) (fraction * (float) histogram.count + 0.5f);
+	if (wanted < 1)
+		wanted=1;
+	seen=0;
+	for (bucket=0; bucket < VOICE_LATENCY_BUCKETS-1; bucket++)
+	{
+		seen+=histogram.buckets[bucket];
+		if (seen >= wanted)
+			break;
+	}
+	// The last bucket has no limit of its own
+	if (latencyBucketLimits[bucket] > histogram.maxMicroseconds)
+		return histogram.maxMicroseconds;
+	return latencyBucketLimits[bucket];
+}
+
+bool RakNet::ParseVoicePayload(const unsigned char *data, unsigned length, VoicePayload *payload)
+{
+	unsigned offset, lengths, t;
+
+	if (length < 1)
+		return false;
+	payload->endOfTalk=(data[0] & VOICE_PAYLOAD_END_OF_TALK)!=0;
+	payload->hasLatencyStamp=false;
+	payload->latencyStampOffset=0;
+	payload->hasEnergy=false;
+	payload->energy=VOICE_ENERGY_SILENT;
+
+	// An end of talk marker on its own carries no frames
+	if (length==1 && payload->endOfTalk)
+	{
+		payload->frameCount=0;
+		payload->redundantCount=0;
+		return true;
+	}
+
+	payload->frameCount=(data[0] & 7) + 1;
+	payload->redundantCount=(data[0] >> 3) & 3;
+	if (payload->frameCount > VOICE_MAX_FRAMES_PER_PACKET || payload->redundantCount > VOICE_FEC_MAX_FRAMES)
+		return false;
+
+	// The loudness and the stamp come before the length table
+	lengths=1;
+	if (data[0] & VOICE_PAYLOAD_ENERGY)
+	{
+		if (length < lengths + 1)
+			return false;
+		payload->energy=data[lengths];
+		payload->hasEnergy=true;
+		lengths++;
+	}
+	if (data[0] & VOICE_PAYLOAD_LATENCY_STAMP)
+	{
+		if (length < lengths + VOICE_LATENCY_STAMP_SIZE)
+			return false;
+		memcpy(&payload->latencyStamp.captureTime, data+lengths, sizeof(uint32_t));
+		memcpy(&payload->latencyStamp.captureUnits, data+lengths+4, sizeof(unsigned short));
+		memcpy(&payload->latencyStamp.encodeUnits, data+lengths+6, sizeof(unsigned short));
+		memcpy(&payload->latencyStamp.sendQueueUnits, data+lengths+8, sizeof(unsigned short));
+		payload->hasLatencyStamp=true;
+		payload->latencyStampOffset=lengths;
+		lengths+=VOICE_LATENCY_STAMP_SIZE;
+	}
+
+	// Skip the length table
+	offset=lengths + payload->redundantCount + payload->frameCount - 1;
+	if (offset > length)
+		return false;
+
+	for (t=0; t < payload->redundantCount; t++)
+	{
+		payload->redundantFrames[t]=data+offset;
+		payload->redundantLengths[t]=data[lengths+t];
+		offset+=data[lengths+t];
+	}
+	for (t=0; t < payload->frameCount; t++)
+	{
+		if (offset >= length)
+			return false;
+		payload->frames[t]=data+offset;
+		// The last frame takes up the rest of the packet
+		if (t+1 < payload->frameCount)
+			payload->frameLengths[t]=data[lengths+payload->redundantCount+t];
+		else
+			payload->frameLengths[t]=length-offset;
+		offset+=payload->frameLengths[t];
+	}
+	return offset <= length;
+}
+
+/// \internal
+/// Returns the time from \a from to \a to in VOICE_LATENCY_STAMP_UNIT_US, clamped to fit in a VoiceLatencyStamp
+static unsigned short GetLatencyUnits(RakNet::TimeUS from, RakNet::TimeUS to)
 {
-	if (key < data->guid)
-		return -1;
-	if (key == data->guid)
+	RakNet::TimeUS units;
+	if (to <= from)
 		return 0;
-	return 1;
+	units=(to-from) / VOICE_LATENCY_STAMP_UNIT_US;
+	return (unsigned short) (units > 0xFFFF ? 0xFFFF : units);
+}
+
+// Marks a bucket of VoiceChannelTable with no channel in it
+#define VOICE_CHANNEL_TABLE_EMPTY ((unsigned)-1)
+
+VoiceChannelTable::VoiceChannelTable()
+{
+	buckets=0;
+	bucketCount=0;
+	bucketShift=0;
+	channels=0;
+	channelCount=0;
+	channelCapacity=0;
+	active=0;
+	activeCount=0;
+}
+VoiceChannelTable::~VoiceChannelTable()
+{
+	Clear();
+}
+unsigned VoiceChannelTable::GetIndexFromKey(const RakNetGUID &key, bool *objectExists) const
+{
+	unsigned bucket=FindBucket(key);
+	*objectExists=(bucket!=bucketCount);
+	return (*objectExists) ? buckets[bucket] : 0;
+}
+bool VoiceChannelTable::HasData(const RakNetGUID &key) const
+{
+	return FindBucket(key)!=bucketCount;
+}
+VoiceChannel* VoiceChannelTable::Insert(const RakNetGUID &key)
+{
+	RakAssert(HasData(key)==false);
+	if (channelCount==channelCapacity)
+		Grow();
+
+	// Value initialized, so every field starts at zero and the GUIDs are constructed
+	VoiceChannel *channel=new (channels+channelCount) VoiceChannel();
+	channel->guid=key;
+	channel->activeIndex=VOICE_CHANNEL_TABLE_EMPTY;
+
+	unsigned mask=bucketCount-1;
+	unsigned bucket=GetBucket(key);
+	while (buckets[bucket]!=VOICE_CHANNEL_TABLE_EMPTY)
+		bucket=(bucket+1)&mask;
+	buckets[bucket]=channelCount++;
+	return channel;
+}
+void VoiceChannelTable::RemoveAtIndex(unsigned index)
+{
+	RakAssert(index<channelCount);
+	unsigned mask=bucketCount-1;
+	unsigned hole=FindBucket(channels[index].guid);
+	unsigned next, home, last;
+	RakAssert(hole!=bucketCount);
+
+	Deactivate(channels+index);
+
+	// Shift the rest of the probe run back over the hole, so lookups never have to step over deleted buckets.
+	// An entry can fill the hole if the hole is between its home bucket and where it is now.
+	for (next=(hole+1)&mask; buckets[next]!=VOICE_CHANNEL_TABLE_EMPTY; next=(next+1)&mask)
+	{
+		home=GetBucket(channels[buckets[next]].guid);
+		if (((next-home)&mask) >= ((next-hole)&mask))
+		{
+			buckets[hole]=buckets[next];
+			hole=next;
+		}
+	}
+	buckets[hole]=VOICE_CHANNEL_TABLE_EMPTY;
+
+	// Keep the channels packed
+	last=channelCount-1;
+	if (index!=last)
+	{
+		buckets[FindBucket(channels[last].guid)]=index;
+		channels[index]=channels[last];
+		if (channels[index].activeIndex!=VOICE_CHANNEL_TABLE_EMPTY)
+			active[channels[index].activeIndex]=index;
+	}
+	channelCount--;
+}
+bool VoiceChannelTable::Activate(VoiceChannel *channel)
+{
+	RakAssert(channel >= channels && channel < channels+channelCount);
+	if (channel->activeIndex!=VOICE_CHANNEL_TABLE_EMPTY)
+		return false;
+	channel->activeIndex=activeCount;
+	active[activeCount++]=(unsigned) (channel-channels);
+	return true;
+}
+void VoiceChannelTable::Deactivate(VoiceChannel *channel)
+{
+	unsigned index=channel->activeIndex;
+	if (index==VOICE_CHANNEL_TABLE_EMPTY)
+		return;
+
+	// Swapped with the last, so a loop over the active list that runs backwards can deactivate as it goes
+	activeCount--;
+	if (index!=activeCount)
+	{
+		active[index]=active[activeCount];
+		channels[active[index]].activeIndex=index;
+	}
+	channel->activeIndex=VOICE_CHANNEL_TABLE_EMPTY;
+}
+void VoiceChannelTable::Clear(void)
+{
+	if (buckets)
+		rakFree_Ex(buckets, _FILE_AND_LINE_ );
+	if (channels)
+		rakFree_Ex(channels, _FILE_AND_LINE_ );
+	if (active)
+		rakFree_Ex(active, _FILE_AND_LINE_ );
+	buckets=0;
+	bucketCount=0;
+	bucketShift=0;
+	channels=0;
+	channelCount=0;
+	channelCapacity=0;
+	active=0;
+	activeCount=0;
+}
+unsigned VoiceChannelTable::GetBucket(const RakNetGUID &key) const
+{
+	// Fibonacci hashing, so GUIDs that only differ in a few bits still spread over the whole table
+	return (unsigned) ((key.g * 0x9E3779B97F4A7C15ULL) >> bucketShift);
+}
+unsigned VoiceChannelTable::FindBucket(const RakNetGUID &key) const
+{
+	if (channelCount==0)
+		return bucketCount;
+
+	unsigned mask=bucketCount-1;
+	unsigned bucket=GetBucket(key);
+	while (buckets[bucket]!=VOICE_CHANNEL_TABLE_EMPTY)
+	{
+		if (channels[buckets[bucket]].guid==key)
+			return bucket;
+		bucket=(bucket+1)&mask;
+	}
+	return bucketCount;
+}
+void VoiceChannelTable::Grow(void)
+{
+	unsigned i, bucket, mask;
+
+	channelCapacity=(channelCapacity==0) ? VOICE_CHANNEL_TABLE_MIN_CAPACITY : channelCapacity*2;
+	channels=(VoiceChannel*) rakRealloc_Ex(channels, sizeof(VoiceChannel)*channelCapacity, _FILE_AND_LINE_);
+	active=(unsigned*) rakRealloc_Ex(active, sizeof(unsigned)*channelCapacity, _FILE_AND_LINE_);
+
+	// Twice as many buckets as channels keeps the probe runs short
+	if (buckets)
+		rakFree_Ex(buckets, _FILE_AND_LINE_ );
+	bucketCount=channelCapacity*2;
+	bucketShift=64;
+	for (i=bucketCount; i > 1; i>>=1)
+		bucketShift--;
+	buckets=(unsigned*) rakMalloc_Ex(sizeof(unsigned)*bucketCount, _FILE_AND_LINE_);
+	memset(buckets, 0xFF, sizeof(unsigned)*bucketCount);
+
+	mask=bucketCount-1;
+	for (i=0; i < channelCount; i++)
+	{
+		bucket=GetBucket(channels[i].guid);
+		while (buckets[bucket]!=VOICE_CHANNEL_TABLE_EMPTY)
+			bucket=(bucket+1)&mask;
+		buckets[bucket]=i;
+	}
 }
 
 RakVoice::RakVoice()
 {
 	bufferedOutput=0;
+	bufferedOutputFixed=0;
+	bufferedOutputMixed=false;
+	fixedPointMix=false;
+	fixedPointMixRequested=false;
 	defaultEncoderComplexity=2;
 	defaultVADState=true;
 	defaultDENOISEState=false;
 	defaultVBRState=false;
+	defaultEchoState=false;
+	echoPlaybackDelayMS=0;
+	echoTailMS=VOICE_ECHO_DEFAULT_TAIL_MS;
+	redundantFrames=0;
+	requestedRedundantFrames=0;
+	adaptiveQuality=false;
+	adaptSampleTime=0;
+	adaptStepDownTime=0;
+	adaptCleanSince=0;
+	adaptLossCleanSince=0;
+	adaptEncodeCleanSince=0;
+	previousSendBufferBytes=0;
+	encodeMicroseconds=0;
+	encodeFrames=0;
+	memset(&adaptiveStatistics, 0, sizeof(adaptiveStatistics));
+	memset(&stageStatistics, 0, sizeof(stageStatistics));
+	adaptiveStatistics.complexity=defaultEncoderComplexity;
+	adaptiveStatistics.rttMS=-1;
+	adaptiveStatistics.lowestRttMS=-1;
+	packetProfile=VOICE_PROFILE_LOW_LATENCY;
 	loopbackMode=false;
+	workerPool=0;
+	talkingRequested=true;
+	talking=true;
+	talkStarting=false;
+	talkEnding=false;
+	talkStoppedTime=0;
+	latencyStamps=false;
+	captureAge=0;
+	playoutDelaySet=false;
+	playoutDelay=0;
+	memset(outgoingCaptureTimes, 0, sizeof(outgoingCaptureTimes));
+	maxSpeakers=0;
+	memset(&speakerStatistics, 0, sizeof(speakerStatistics));
+	enc_state=0;
+	enc_bits=0;
+	pre_state=0;
+	fec_enc_state=0;
+	fec_enc_bits=0;
+	echo_state=0;
+	echoResidual=0;
+	echoReference=0;
+	memset(&echoStatistics, 0, sizeof(echoStatistics));
+	encodedFrameIndex=0;
+	contiguousFrames=0;
+	outgoingBuffer=0;
+	playbackVoices=0;
+	freePlaybackVoices=0;
+	freePlaybackVoiceCount=0;
+	memset(&playbackStatistics, 0, sizeof(playbackStatistics));
 }
 RakVoice::~RakVoice()
 {
@@ -63,11 +468,75 @@ void RakVoice::Init(unsigned short sampleRate, unsigned bufferSizeBytes)
 	this->bufferSizeBytes=bufferSizeBytes;
 	bufferedOutputCount=bufferSizeBytes/SAMPLESIZE;
 	bufferedOutput = (float*) rakMalloc_Ex(sizeof(float)*bufferedOutputCount, _FILE_AND_LINE_);
-	unsigned i;
-	for (i=0; i < bufferedOutputCount; i++)
-		bufferedOutput[i]=0.0f;
+	bufferedOutputFixed = (int32_t*) rakMalloc_Ex(sizeof(int32_t)*bufferedOutputCount, _FILE_AND_LINE_);
+	VoiceMixing::ZeroFloat(bufferedOutput, bufferedOutputCount);
+	VoiceMixing::ZeroInt32(bufferedOutputFixed, bufferedOutputCount);
+	fixedPointMix=fixedPointMixRequested;
 	zeroBufferedOutput=false;
+	bufferedOutputMixed=false;
+	memset(&stageStatistics, 0, sizeof(stageStatistics));
+
+	// Every voice is allocated up front, so a talker starting is never a heap allocation.  Voice 0 is given out first.
+	unsigned voiceIndex;
+	playbackVoices = (VoicePlaybackVoice*) arena.Allocate(sizeof(VoicePlaybackVoice)*VOICE_PLAYBACK_VOICES);
+	freePlaybackVoices = (unsigned*) arena.Allocate(sizeof(unsigned)*VOICE_PLAYBACK_VOICES);
+	for (voiceIndex=0; voiceIndex < VOICE_PLAYBACK_VOICES; voiceIndex++)
+		freePlaybackVoices[voiceIndex]=VOICE_PLAYBACK_VOICES-1-voiceIndex;
+	freePlaybackVoiceCount=VOICE_PLAYBACK_VOICES;
+	memset(&playbackStatistics, 0, sizeof(playbackStatistics));
+	playbackStatistics.voices=VOICE_PLAYBACK_VOICES;
+
+	// Speex allocates from the arena until the end of Init
+	VoiceArena::Scope arenaScope(&arena);
+
+	// One encoder and preprocessor for the outgoing stream, whoever it is sent to
+	if (sampleRate==8000)
+		enc_state=speex_encoder_init(&speex_nb_mode);
+	else if (sampleRate==16000)
+		enc_state=speex_encoder_init(&speex_wb_mode);
+	else // 32000
+		enc_state=speex_encoder_init(&speex_uwb_mode);
+	RakAssert(enc_state);
+
+	int ret;
+	ret=speex_encoder_ctl(enc_state, SPEEX_GET_FRAME_SIZE, &speexOutgoingFrameSampleCount);
+	RakAssert(ret==0);
+	(void)ret;
+	enc_bits=arena.Allocate(sizeof(SpeexBits));
+	speex_bits_init((SpeexBits*)enc_bits);
+	outgoingBuffer = (char*) rakMalloc_Ex(bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT, _FILE_AND_LINE_);
+	outgoingReadIndex=0;
+	outgoingWriteIndex=0;
+	encodedFrameIndex=0;
+	contiguousFrames=0;
+
+	pre_state = speex_preprocess_state_init(speexOutgoingFrameSampleCount, sampleRate);
+	RakAssert(pre_state);
+
+	// Second encoder for the redundant copies.  Speex signals the bitrate in every frame, so the receiver's decoder reads them as well.
+	if (sampleRate==8000)
+		fec_enc_state=speex_encoder_init(&speex_nb_mode);
+	else if (sampleRate==16000)
+		fec_enc_state=speex_encoder_init(&speex_wb_mode);
+	else // 32000
+		fec_enc_state=speex_encoder_init(&speex_uwb_mode);
+	RakAssert(fec_enc_state);
+	fec_enc_bits=arena.Allocate(sizeof(SpeexBits));
+	speex_bits_init((SpeexBits*)fec_enc_bits);
+	int fecParameter=VOICE_FEC_QUALITY;
+	speex_encoder_ctl(fec_enc_state, SPEEX_SET_QUALITY, &fecParameter);
+	fecParameter=1;
+	speex_encoder_ctl(fec_enc_state, SPEEX_SET_COMPLEXITY, &fecParameter);
 
+	// Set encoder default parameters
+	SetEncoderParameter(SPEEX_SET_VBR, (defaultVBRState) ? 1 : 0 );
+	SetEncoderParameter(SPEEX_SET_COMPLEXITY, defaultEncoderComplexity);
+	// Set preprocessor default parameters
+	SetPreprocessorParameter(SPEEX_PREPROCESS_SET_DENOISE, (defaultDENOISEState) ? 1 : 2);
+	SetPreprocessorParameter(SPEEX_PREPROCESS_SET_VAD, (defaultVADState) ? 1 : 2);
+
+	if (defaultEchoState)
+		CreateEchoCanceller();
 }
 void RakVoice::Deinit(void)
 {
@@ -75,8 +544,34 @@ void RakVoice::Deinit(void)
 	if (bufferedOutput)
 	{
 		rakFree_Ex(bufferedOutput, _FILE_AND_LINE_ );
+		rakFree_Ex(bufferedOutputFixed, _FILE_AND_LINE_ );
 		bufferedOutput = 0;
+		bufferedOutputFixed = 0;
 		CloseAllChannels();
+		VoiceArena::Free(playbackVoices);
+		VoiceArena::Free(freePlaybackVoices);
+		playbackVoices=0;
+		freePlaybackVoices=0;
+		freePlaybackVoiceCount=0;
+
+		speex_encoder_destroy(enc_state);
+		speex_encoder_destroy(fec_enc_state);
+		speex_bits_destroy((SpeexBits*)enc_bits);
+		speex_bits_destroy((SpeexBits*)fec_enc_bits);
+		VoiceArena::Free(enc_bits);
+		VoiceArena::Free(fec_enc_bits);
+		speex_preprocess_state_destroy((SpeexPreprocessState*)pre_state);
+		FreeEchoCanceller();
+		rakFree_Ex(outgoingBuffer, _FILE_AND_LINE_ );
+		enc_state=0;
+		enc_bits=0;
+		fec_enc_state=0;
+		fec_enc_bits=0;
+		pre_state=0;
+		outgoingBuffer=0;
+
+		// Everything from the arena has been freed, so give its memory back
+		arena.Release();
 	}
 }
 void RakVoice::SetLoopbackMode(bool enabled)
@@ -87,6 +582,8 @@ void RakVoice::SetLoopbackMode(bool enabled)
 		RakNet::BitStream out;
 		out.Write((unsigned char)ID_RAKVOICE_OPEN_CHANNEL_REQUEST);
 		out.Write((int32_t)sampleRate);
+		out.Write(packetProfile.framesPerPacket);
+		out.Write(packetProfile.sendIntervalMS);
 		p.data=out.GetData();
 		p.systemAddress=RakNet::UNASSIGNED_SYSTEM_ADDRESS;
 		p.guid=UNASSIGNED_RAKNET_GUID;
@@ -109,6 +606,8 @@ void RakVoice::RequestVoiceChannel(RakNetGUID recipient)
 	RakNet::BitStream out;
 	out.Write((unsigned char)ID_RAKVOICE_OPEN_CHANNEL_REQUEST);
 	out.Write((int32_t)sampleRate);
+	out.Write(packetProfile.framesPerPacket);
+	out.Write(packetProfile.sendIntervalMS);
 	SendUnified(&out, HIGH_PRIORITY, RELIABLE_ORDERED,0,recipient,false);	
 }
 void RakVoice::CloseVoiceChannel(RakNetGUID recipient)
@@ -129,70 +628,87 @@ void RakVoice::CloseAllChannels(void)
 	unsigned index;
 	for (index=0; index < voiceChannels.Size(); index++)
 	{
-		SendUnified(&out, HIGH_PRIORITY, RELIABLE_ORDERED,0,voiceChannels[index]->guid,false);	
+		// Relayed channels were never opened with the talker, so there is no one to tell
+		if (voiceChannels[index]->relayedBy==UNASSIGNED_RAKNET_GUID)
+			SendUnified(&out, HIGH_PRIORITY, RELIABLE_ORDERED,0,voiceChannels[index]->guid,false);	
 		FreeChannelMemory(index,false);
 	}
 
-	voiceChannels.Clear(false, _FILE_AND_LINE_);
+	voiceChannels.Clear();
 }
-bool RakVoice::SendFrame(RakNetGUID recipient, void *inputBuffer)
+bool RakVoice::SendFrame(void *inputBuffer)
 {
-	bool objectExists;
-	unsigned index;
-	VoiceChannel *channel;
-
-	index = voiceChannels.GetIndexFromKey(recipient, &objectExists);
-	if (objectExists)
-	{
-		unsigned totalBufferSize;
-		unsigned remainingBufferSize;
+	unsigned totalBufferSize;
+	unsigned remainingBufferSize;
 
-		channel=voiceChannels[index];
+	// Don't fill the buffer if there is no one to send it to
+	if (outgoingBuffer==0 || talkingRequested==false || HasOutgoingChannel()==false)
+		return false;
 
-		totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
-		if (channel->outgoingWriteIndex >= channel->outgoingReadIndex)
-			remainingBufferSize=totalBufferSize-(channel->outgoingWriteIndex-channel->outgoingReadIndex);
-		else
-			remainingBufferSize=channel->outgoingReadIndex-channel->outgoingWriteIndex;
+	totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
+	if (outgoingWriteIndex >= outgoingReadIndex)
+		remainingBufferSize=totalBufferSize-(outgoingWriteIndex-outgoingReadIndex);
+	else
+		remainingBufferSize=outgoingReadIndex-outgoingWriteIndex;
 
 #ifdef _DEBUG
-		RakAssert(remainingBufferSize>0 && remainingBufferSize <= totalBufferSize);
-	//	printf("SendFrame: buff=%i writeIndex=%i readIndex=%i\n",remainingBufferSize, channel->outgoingWriteIndex, channel->outgoingReadIndex);
-
-		//printf("Writing %i bytes to write offset %i. %i %i.\n", bufferSizeBytes, channel->outgoingWriteIndex, *((char*)inputBuffer+channel->outgoingWriteIndex), *((char*)inputBuffer+channel->outgoingWriteIndex+bufferSizeBytes-1));
+	RakAssert(remainingBufferSize>0 && remainingBufferSize <= totalBufferSize);
 #endif
 
-		// Copy encoded sound to the outgoing buffer for that channel.  This has to be fast, since this function is likely to be called from a locked buffer
-		// I allocated the buffer to be a size multiple of bufferSizeBytes so don't have to watch for overflow on this line
-		memcpy(channel->outgoingBuffer + channel->outgoingWriteIndex, inputBuffer, bufferSizeBytes );
+	// Copy encoded sound to the outgoing buffer.  This has to be fast, since this function is likely to be called from a locked buffer
+	// I allocated the buffer to be a size multiple of bufferSizeBytes so don't have to watch for overflow on this line
+	memcpy(outgoingBuffer + outgoingWriteIndex, inputBuffer, bufferSizeBytes );
+
+	// When the block started being recorded, for the latency stamps
+	RakNet::TimeUS now=RakNet::GetTimeUS();
+	outgoingCaptureTimes[outgoingWriteIndex / bufferSizeBytes] = (now > captureAge) ? now-captureAge : 0;
+	captureAge=0;
 
 #ifdef _DEBUG
-		RakAssert(channel->outgoingWriteIndex+bufferSizeBytes <= totalBufferSize);
+	RakAssert(outgoingWriteIndex+bufferSizeBytes <= totalBufferSize);
 #endif
 
-
-		// Increment the write index, wrapping if needed.
-		channel->outgoingWriteIndex+=bufferSizeBytes;
+	// Increment the write index, wrapping if needed.
+	outgoingWriteIndex+=bufferSizeBytes;
 #ifdef _DEBUG
-		// Verify that the write is aligned to the size of outgoingBuffer
-		RakAssert(channel->outgoingWriteIndex <= totalBufferSize);
+	// Verify that the write is aligned to the size of outgoingBuffer
+	RakAssert(outgoingWriteIndex <= totalBufferSize);
 #endif
-		if (channel->outgoingWriteIndex==totalBufferSize)
-			channel->outgoingWriteIndex=0;
+	if (outgoingWriteIndex==totalBufferSize)
+		outgoingWriteIndex=0;
 
-		if (bufferSizeBytes >= remainingBufferSize) // Would go past the current read position
-		{
+	if (bufferSizeBytes >= remainingBufferSize) // Would go past the current read position
+	{
 #ifdef _DEBUG
-			// This is actually a warning - it means that FRAME_OUTGOING_BUFFER_COUNT wasn't big enough and old data is being overwritten
-			RakAssert(0);
+		// This is actually a warning - it means that FRAME_OUTGOING_BUFFER_COUNT wasn't big enough and old data is being overwritten
+		RakAssert(0);
 #endif
-			// Force the read index up one block
-			channel->outgoingReadIndex=(channel->outgoingReadIndex+channel->speexOutgoingFrameSampleCount * SAMPLESIZE)%totalBufferSize;			
-		}
+		// Force the read index up one block
+		outgoingReadIndex=(outgoingReadIndex+speexOutgoingFrameSampleCount * SAMPLESIZE)%totalBufferSize;
+	}
+
+	return true;
+}
+bool RakVoice::SendFrame(RakNetGUID recipient, void *inputBuffer)
+{
+	bool objectExists;
+	unsigned index;
 
-    	return true;
+	// Every channel is sent the same stream, so the recipient only needs to have a channel open
+	index = voiceChannels.GetIndexFromKey(recipient, &objectExists);
+	if (objectExists==false || voiceChannels[index]->relayedBy!=UNASSIGNED_RAKNET_GUID)
+		return false;
+
+	return SendFrame(inputBuffer);
+}
+bool RakVoice::HasOutgoingChannel(void) const
+{
+	// Relayed channels only ever receive
+	for (unsigned i=0; i < voiceChannels.Size(); i++)
+	{
+		if (voiceChannels[i]->relayedBy==UNASSIGNED_RAKNET_GUID)
+			return true;
 	}
-	
 	return false;
 }
 bool RakVoice::IsSendingVoiceDataTo(RakNetGUID recipient)
@@ -209,17 +725,20 @@ bool RakVoice::IsSendingVoiceDataTo(RakNetGUID recipient)
 void RakVoice::ReceiveFrame(void *outputBuffer)
 {
 	short *out = (short*)outputBuffer;
-	unsigned i;
-	// Convert the floats to final 16-bits output
-	for (i=0; i < bufferSizeBytes / SAMPLESIZE; i++)
+	// Clamp the mix to final 16-bits output.  Nobody talking is just silence.
+	if (bufferedOutputMixed==false)
 	{
-		if (bufferedOutput[i]>32767.0f)
-			out[i]=32767;
-		else if (bufferedOutput[i]<-32768.0f)
-			out[i]=-32768;
-		else
-			out[i]=(short)bufferedOutput[i];
+		memset(out, 0, bufferSizeBytes);
+		stageStatistics.silentBlocks++;
 	}
+	else if (fixedPointMix)
+		VoiceMixing::ClampToInt16(out, bufferedOutputFixed, bufferSizeBytes / SAMPLESIZE);
+	else
+		VoiceMixing::ClampToInt16(out, bufferedOutput, bufferSizeBytes / SAMPLESIZE);
+
+	// This is what the microphone will hear back from the speakers
+	if (echo_state)
+		StoreEchoReference(out, bufferSizeBytes / SAMPLESIZE);
 
 	// Done with this block.  Zero all the values in Update
 	zeroBufferedOutput=true;
@@ -248,68 +767,70 @@ RakPeerInterface* RakVoice::GetRakPeerInterface(void) const
 }
 unsigned RakVoice::GetBufferedBytesToSend(RakNetGUID guid) const
 {
-	bool objectExists;
-	VoiceChannel *channel;
 	unsigned totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
-	if (guid!=UNASSIGNED_RAKNET_GUID)
-	{
-		unsigned index = voiceChannels.GetIndexFromKey(guid, &objectExists);
-		channel = voiceChannels[index];
-		if (objectExists)
-		{
-			if (channel->outgoingWriteIndex>=channel->outgoingReadIndex)
-				return channel->outgoingWriteIndex-channel->outgoingReadIndex;
-			else
-				return channel->outgoingWriteIndex + (totalBufferSize-channel->outgoingReadIndex);
-		}
-	}
+
+	// Every channel shares the one write buffer
+	if (outgoingBuffer==0)
+		return 0;
+	if (guid!=UNASSIGNED_RAKNET_GUID && voiceChannels.HasData(guid)==false)
+		return 0;
+
+	if (outgoingWriteIndex>=outgoingReadIndex)
+		return outgoingWriteIndex-outgoingReadIndex;
 	else
-	{
-		unsigned total=0;
-		for (unsigned i=0; i < voiceChannels.Size(); i++)
-		{
-			channel=voiceChannels[i];
-			if (channel->outgoingWriteIndex>=channel->outgoingReadIndex)
-				total+=channel->outgoingWriteIndex-channel->outgoingReadIndex;
-			else
-				total+=channel->outgoingWriteIndex + (totalBufferSize-channel->outgoingReadIndex);
-		}
-		return total;
-	}
-	
-	return 0;
+		return outgoingWriteIndex + (totalBufferSize-outgoingReadIndex);
 }
 unsigned RakVoice::GetBufferedBytesToReturn(RakNetGUID guid) const
 {
-	bool objectExists;
 	VoiceChannel *channel;
-	unsigned totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
-	if (guid!=UNASSIGNED_RAKNET_GUID)
-	{
-		unsigned index = voiceChannels.GetIndexFromKey(guid, &objectExists);
-		channel = voiceChannels[index];
-		if (objectExists)
-		{
-			if (channel->incomingReadIndex <= channel->incomingWriteIndex)
-				return channel->incomingWriteIndex-channel->incomingReadIndex;
-			else
-				return totalBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
-		}
-	}
-	else
+	unsigned totalBufferSize=bufferSizeBytes * FRAME_INCOMING_BUFFER_COUNT;
+	unsigned total=0;
+	for (unsigned i=0; i < voiceChannels.Size(); i++)
 	{
-		unsigned total=0;
-		for (unsigned i=0; i < voiceChannels.Size(); i++)
-		{
-			channel=voiceChannels[i];
-			if (channel->incomingReadIndex <= channel->incomingWriteIndex)
-				total+=channel->incomingWriteIndex-channel->incomingReadIndex;
-			else
-				total+=totalBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
-		}
-		return total;
+		channel=voiceChannels[i];
+		if (guid!=UNASSIGNED_RAKNET_GUID && channel->guid!=guid)
+			continue;
+
+		if (channel->incomingReadIndex <= channel->incomingWriteIndex)
+			total+=channel->incomingWriteIndex-channel->incomingReadIndex;
+		else
+			total+=totalBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
+
+		// Frames still waiting in the jitter buffer, once decoded
+		total+=GetJitterDepth(channel) * channel->speexIncomingFrameSampleCount * SAMPLESIZE;
 	}
-	return 0;
+	return total;
+}
+bool RakVoice::GetJitterStatistics(RakNetGUID guid, VoiceJitterStatistics *statistics) const
+{
+	bool objectExists;
+	unsigned index;
+	VoiceChannel *channel;
+	RakAssert(statistics);
+
+	index = voiceChannels.GetIndexFromKey(guid, &objectExists);
+	if (objectExists==false)
+		return false;
+
+	channel=voiceChannels[index];
+	*statistics=channel->jitterStatistics;
+	statistics->depthFrames=GetJitterDepth(channel);
+	statistics->targetDelayFrames=channel->targetDelayFrames;
+	statistics->jitterMS=channel->jitterMS;
+	return true;
+}
+bool RakVoice::GetLatencyStatistics(RakNetGUID guid, VoiceLatencyStatistics *statistics) const
+{
+	bool objectExists;
+	unsigned index;
+	RakAssert(statistics);
+
+	index = voiceChannels.GetIndexFromKey(guid, &objectExists);
+	if (objectExists==false || voiceChannels[index]->latency==0)
+		return false;
+
+	*statistics=*voiceChannels[index]->latency;
+	return true;
 }
 void RakVoice::OnShutdown(void)
 {
@@ -318,243 +839,680 @@ void RakVoice::OnShutdown(void)
 
 void RakVoice::Update(void)
 {
-	unsigned i,j, bytesAvailable, speexFramesAvailable, speexBlockSize;
-	unsigned bytesWaitingToReturn;
-	int bytesWritten;
+	unsigned i;
 	VoiceChannel *channel;
-	char *inputBuffer;
-	char tempOutput[2048];
-	// 1 byte for ID, and 2 bytes(short) for Message number
-	static const int headerSize=sizeof(unsigned char) + sizeof(unsigned short);
-	// First byte is ID for RakNet
-	tempOutput[0]=ID_RAKVOICE_DATA;
+	RakNet::TimeUS decodeStart, mixStart;
 	
 	RakNet::TimeMS currentTime = RakNet::GetTimeMS();
 
-	// Size of VoiceChannel::incomingBuffer and VoiceChannel::outgoingBuffer arrays
-	unsigned totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
-	
-	// Allow all channels to write, and set the output to zero in preparation
+	if (talkingRequested!=talking && outgoingBuffer)
+		ApplyTalking(currentTime);
+	// Done between encodes, so the encoder is never changed while a job is using it
+	if (adaptiveQuality && outgoingBuffer && currentTime - adaptSampleTime >= VOICE_ADAPT_INTERVAL_MS)
+		UpdateAdaptiveQuality(currentTime);
+
+	// Allow the active channels to write, and set the output to zero in preparation.  Only channels with something to play
+	// are visited, so a channel full of silent members costs nothing until one of them talks.
 	if (zeroBufferedOutput)
 	{
-		for (i=0; i < bufferedOutputCount; i++)
-			bufferedOutput[i]=0.0f;
-		for (i=0; i < voiceChannels.Size(); i++)
-			voiceChannels[i]->copiedOutgoingBufferToBufferedOutput=false;
+		// Switch mixes between blocks, so a block is never part mixed in each.  The other mix's buffer is stale.
+		if (fixedPointMix!=fixedPointMixRequested)
+		{
+			fixedPointMix=fixedPointMixRequested;
+			bufferedOutputMixed=true;
+		}
+		// A block nothing was mixed into is still zero
+		if (bufferedOutputMixed)
+		{
+			if (fixedPointMix)
+				VoiceMixing::ZeroInt32(bufferedOutputFixed, bufferedOutputCount);
+			else
+				VoiceMixing::ZeroFloat(bufferedOutput, bufferedOutputCount);
+			bufferedOutputMixed=false;
+		}
+		for (i=0; i < voiceChannels.ActiveSize(); i++)
+			voiceChannels.GetActive(i)->copiedOutgoingBufferToBufferedOutput=false;
 		zeroBufferedOutput=false;
 	}
 
-	// For each channel
-	for (i=0; i < voiceChannels.Size(); i++)
+	if (workerPool==0)
 	{
-		channel=voiceChannels[i];
-
-		if (currentTime - channel->lastSend > 50) // Throttle to 20 sends a second
+		EncodeOutgoingStream(currentTime);
+		decodeStart=RakNet::GetTimeUS();
+		for (i=0; i < voiceChannels.ActiveSize(); i++)
+			DecodeChannel(voiceChannels.GetActive(i));
+	}
+	else
+	{
+		// Each channel's decoder and jitter buffer is only touched by its own job, and the encoder only by its job.
+		// In loopback mode the encoder writes into a channel's jitter buffer, so it has to finish before that channel decodes.
+		VoiceWorkerPool::Group jobs;
+		if (loopbackMode)
+			EncodeOutgoingStream(currentTime);
+		decodeStart=RakNet::GetTimeUS();
+		if (loopbackMode==false && outgoingBuffer)
+			workerPool->Submit(jobs, [this, currentTime] { EncodeOutgoingStream(currentTime); });
+		for (i=0; i < voiceChannels.ActiveSize(); i++)
 		{
-			channel->isSendingVoiceData=false;
-
-			// Circular buffer so I have to do this to count how many bytes are available
-			if (channel->outgoingWriteIndex>=channel->outgoingReadIndex)
-				bytesAvailable=channel->outgoingWriteIndex-channel->outgoingReadIndex;
-			else
-				bytesAvailable=channel->outgoingWriteIndex + (totalBufferSize-channel->outgoingReadIndex);
-
-			// Speex returns how many frames it encodes per block.  Each frame is of byte length sampleSize.
-			speexBlockSize = channel->speexOutgoingFrameSampleCount * SAMPLESIZE;
-
-#ifdef PRINT_DEBUG_INFO
-			static int lastPrint=0;
-			if (i==0 && currentTime-lastPrint > 2000)
-			{
-				lastPrint=currentTime;
-				unsigned bytesWaitingToReturn;
-				if (channel->incomingReadIndex <= channel->incomingWriteIndex)
-					bytesWaitingToReturn=channel->incomingWriteIndex-channel->incomingReadIndex;
-				else
-					bytesWaitingToReturn=totalBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
-
-				printf("%i bytes to send. incomingMessageNumber=%i. bytesWaitingToReturn=%i.\n", bytesAvailable, channel->incomingMessageNumber, bytesWaitingToReturn );
-			}
-#endif
+			channel=voiceChannels.GetActive(i);
+			if (channel->copiedOutgoingBufferToBufferedOutput==false)
+				workerPool->Submit(jobs, [this, channel] { DecodeChannel(channel); });
+		}
+		workerPool->Wait(jobs);
+	}
 
-#ifdef _TEST_LOOPBACK
-			/*
-			if (bufferSizeBytes<bytesAvailable)
-			{
-				printf("Update: bytesAvailable=%i writeIndex=%i readIndex=%i\n",bytesAvailable, channel->outgoingWriteIndex, channel->outgoingReadIndex);
-				memcpy(channel->incomingBuffer + channel->incomingWriteIndex, channel->outgoingBuffer+channel->outgoingReadIndex, bufferSizeBytes);
-				channel->incomingWriteIndex=(channel->incomingWriteIndex+bufferSizeBytes) % totalBufferSize;
-				channel->outgoingReadIndex=(channel->outgoingReadIndex+bufferSizeBytes) % totalBufferSize;
-			}
-			return;
-			*/
-#endif
+	mixStart=RakNet::GetTimeUS();
+	stageStatistics.decodeMicroseconds+=mixStart-decodeStart;
 
-			// Find out how many frames we can read out of the buffer for speex to encode and send these out.
-			speexFramesAvailable = bytesAvailable / speexBlockSize;
+	// Mixed in the order of the active list, so the float mix adds up the same however the jobs ran.
+	// Backwards, as a channel that has played out leaves the list while it is mixed.
+	stageStatistics.channelsVisited+=voiceChannels.ActiveSize();
+	i=voiceChannels.ActiveSize();
+	while (i-- > 0)
+		MixChannel(voiceChannels.GetActive(i), currentTime);
+	stageStatistics.mixMicroseconds+=RakNet::GetTimeUS()-mixStart;
 
-			// Encode all available frames and send them unreliable sequenced
-			if (speexFramesAvailable > 0)
-			{
-				SpeexBits speexBits;
-				speex_bits_init(&speexBits);
-				while (speexFramesAvailable-- > 0)
-				{
-					speex_bits_reset(&speexBits);
+	// Only the block just mixed waits that long
+	playoutDelaySet=false;
+	stageStatistics.updates++;
+}
+void RakVoice::EncodeOutgoingStream(RakNet::TimeMS currentTime)
+{
+	unsigned i, bytesAvailable, speexFramesAvailable, speexBlockSize;
+	int bytesWritten;
+	VoiceChannel *channel;
+	VoiceEncodedFrame *frame;
+	char *inputBuffer;
+	char tempOutput[2048];
+	char echoOutput[2048];
+	short echoFrame[2048/SAMPLESIZE];
+	RakNet::TimeUS echoStart, echoTime, encodeStart, preprocessEnd, frameStart, frameCapture;
+	unsigned char energy;
 
-					// If the input data would wrap around the buffer, copy it to another buffer first
-					if (channel->outgoingReadIndex + speexBlockSize >= totalBufferSize)
-					{
-#ifdef _DEBUG
-						RakAssert(speexBlockSize < 2048-1);
-#endif
-						unsigned t;
-						for (t=0; t < speexBlockSize; t++)
-							tempOutput[t+headerSize]=channel->outgoingBuffer[t%totalBufferSize];
-						inputBuffer=tempOutput+headerSize;
-					}
-					else
-						inputBuffer=channel->outgoingBuffer+channel->outgoingReadIndex;
+	// Encode the outgoing stream once, and bundle the same frames into every channel's packets
+	if (outgoingBuffer==0)
+		return;
 
-#ifdef _DEBUG
-					/*
-					printf("In: ");
-					if (shortSampleType)
-					{
-						short *blah = (short*) inputBuffer;
-						for (int p=0; p < 5; p++)
-						{
-							printf("%.i ", blah[p]);
-						}
-					}
-					else
-					{
-						float *blah = (float*) inputBuffer;
-						for (int p=0; p < 5; p++)
-						{
-							printf("%.3f ", blah[p]);
-						}
-					}
-
-					printf("\n");
-*/
-#endif
-					int is_speech=1;
+	// Size of RakVoice::outgoingBuffer
+	unsigned totalBufferSize=bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT;
 
-					// Run preprocessor if required
-					if (defaultDENOISEState||defaultVADState){
-						is_speech=speex_preprocess((SpeexPreprocessState*)channel->pre_state,(spx_int16_t*) inputBuffer, NULL );
-					}
+	// Circular buffer so I have to do this to count how many bytes are available
+	if (outgoingWriteIndex>=outgoingReadIndex)
+		bytesAvailable=outgoingWriteIndex-outgoingReadIndex;
+	else
+		bytesAvailable=outgoingWriteIndex + (totalBufferSize-outgoingReadIndex);
 
-					if ((is_speech)||(!defaultVADState)){
-						is_speech = speex_encode_int(channel->enc_state, (spx_int16_t*) inputBuffer, &speexBits);
-					}
+	// Speex returns how many frames it encodes per block.  Each frame is of byte length sampleSize.
+	speexBlockSize = speexOutgoingFrameSampleCount * SAMPLESIZE;
 
-					channel->outgoingReadIndex=(channel->outgoingReadIndex+speexBlockSize)%totalBufferSize;
+	// Find out how many frames we can read out of the buffer for speex to encode and send these out.
+	speexFramesAvailable = bytesAvailable / speexBlockSize;
 
-					// If no speech detected, don't send this frame
-					if ((!is_speech)&&(defaultVADState)){
-						continue;
-					}
+	// Encode all available frames, sending each channel's packet as it fills
+	if (speexFramesAvailable > 0)
+	{
+		for (i=0; i < voiceChannels.Size(); i++)
+			voiceChannels[i]->isSendingVoiceData=false;
 
-					channel->isSendingVoiceData=true;
+		SpeexBits *speexBits=(SpeexBits*)enc_bits;
+		SpeexBits *fecBits=(SpeexBits*)fec_enc_bits;
+		while (speexFramesAvailable-- > 0)
+		{
+			speex_bits_reset(speexBits);
 
-#ifdef _DEBUG
-//					printf("Update: bytesAvailable=%i writeIndex=%i readIndex=%i\n",bytesAvailable, channel->outgoingWriteIndex, channel->outgoingReadIndex);
-#endif
+			// The frame's first sample was recorded its offset into the block after the start of the block
+			frameStart=RakNet::GetTimeUS();
+			frameCapture=outgoingCaptureTimes[outgoingReadIndex / bufferSizeBytes] +
+				(RakNet::TimeUS) ((outgoingReadIndex % bufferSizeBytes) / SAMPLESIZE) * 1000000 / sampleRate;
 
-					bytesWritten = speex_bits_write(&speexBits, tempOutput+headerSize, 2048-headerSize);
+			// If the input data would wrap around the buffer, copy it to another buffer first
+			if (outgoingReadIndex + speexBlockSize >= totalBufferSize)
+			{
 #ifdef _DEBUG
-					// If this assert hits then you need to increase the size of the temp buffer, but this is really a bug because
-					// voice packets should never be bigger than a few hundred bytes.
-					RakAssert(bytesWritten!=2048-headerSize);
+				RakAssert(speexBlockSize < 2048-1);
 #endif
+				unsigned t;
+				for (t=0; t < speexBlockSize; t++)
+					tempOutput[t]=outgoingBuffer[(outgoingReadIndex+t)%totalBufferSize];
+				inputBuffer=tempOutput;
+			}
+			else
+				inputBuffer=outgoingBuffer+outgoingReadIndex;
+
+			int is_speech=1;
+
+			// Take what was played out of what was recorded, before the preprocessor sees it
+			if (echo_state){
+				ReadEchoReference(echoFrame, speexOutgoingFrameSampleCount);
+				echoStart=RakNet::GetTimeUS();
+				speex_echo_cancel((SpeexEchoState*)echo_state, (short*) inputBuffer, echoFrame, (short*) echoOutput, (spx_int32_t*) echoResidual);
+				echoTime=RakNet::GetTimeUS()-echoStart;
+				inputBuffer=echoOutput;
+
+				echoStatistics.framesCancelled++;
+				echoStatistics.totalMicroseconds+=echoTime;
+				echoStatistics.lastFrameMicroseconds=echoTime;
+				if (echoTime > echoStatistics.maxFrameMicroseconds)
+					echoStatistics.maxFrameMicroseconds=echoTime;
+			}
 
-//					static int bytesSent=0;
-//					bytesSent+= bytesWritten+headerSize;
-//					printf("bytesSent=%i\n", bytesSent);
+			// Run preprocessor if required.  It also suppresses the echo the canceller left behind.
+			encodeStart=RakNet::GetTimeUS();
+			if (defaultDENOISEState||defaultVADState||echo_state){
+				is_speech=speex_preprocess((SpeexPreprocessState*)pre_state,(spx_int16_t*) inputBuffer, (spx_int32_t*) echoResidual );
+			}
+			// Loudness of what is sent, so receivers can pick the loudest talkers without decoding
+			energy=GetVoiceEnergy((const short*) inputBuffer, speexOutgoingFrameSampleCount);
+			preprocessEnd=RakNet::GetTimeUS();
+			stageStatistics.preprocessMicroseconds+=preprocessEnd-encodeStart;
+
+			if ((is_speech)||(!defaultVADState)){
+				is_speech = speex_encode_int(enc_state, (spx_int16_t*) inputBuffer, speexBits);
+				stageStatistics.encodeMicroseconds+=RakNet::GetTimeUS()-preprocessEnd;
+				stageStatistics.framesEncoded++;
+			}
+			encodeMicroseconds+=RakNet::GetTimeUS()-encodeStart;
+			encodeFrames++;
 
-#ifdef PRINT_DEBUG_INFO
-static int voicePacketsSent=0;
-printf("%i ", voicePacketsSent++);
-#endif
+			outgoingReadIndex=(outgoingReadIndex+speexBlockSize)%totalBufferSize;
 
-					// at +1, because the first byte in the buffer has the ID for RakNet.
-					memcpy(tempOutput+1, &channel->outgoingMessageNumber, sizeof(unsigned short));
-					channel->outgoingMessageNumber++;
-					RakNet::BitStream tempOutputBs((unsigned char*) tempOutput,bytesWritten+headerSize,false);
-					SendUnified(&tempOutputBs, HIGH_PRIORITY, UNRELIABLE,0,channel->guid,false);
-
-					if (loopbackMode)
-					{
-						Packet p;
-						p.length=bytesWritten+1;
-						p.data=(unsigned char*)tempOutput;
-						p.guid=channel->guid;
-						p.systemAddress=rakPeerInterface->GetSystemAddressFromGuid(p.guid);
-						OnVoiceData(&p);
-					}
+			// If no speech detected, don't send this frame
+			if ((!is_speech)&&(defaultVADState)){
+				for (i=0; i < voiceChannels.Size(); i++)
+				{
+					// Send what was bundled before the pause straight away
+					if (voiceChannels[i]->pendingFrames>0)
+						SendPendingFrames(voiceChannels[i], false);
+					// The message number still counts the frame, so the receiver can tell a pause from lost packets
+					voiceChannels[i]->outgoingMessageNumber++;
 				}
-
-				speex_bits_destroy(&speexBits);
-				channel->lastSend=currentTime;
+				// The frames before the next packet weren't sent, so there is nothing to repeat
+				contiguousFrames=0;
+				continue;
 			}
-		}
 
-		// As sound buffer blocks fill up, I add their values to RakVoice::bufferedOutput .  Then when the user calls ReceiveFrame they get that value, already
-		// processed.  This is necessary because that function needs to run as fast as possible so I remove all processing there that I can.  Otherwise the sound
-		// plays back distorted and popping
-		if (channel->copiedOutgoingBufferToBufferedOutput==false)
-		{
-			if (channel->incomingReadIndex <= channel->incomingWriteIndex)
-				bytesWaitingToReturn=channel->incomingWriteIndex-channel->incomingReadIndex;
-			else
-				bytesWaitingToReturn=totalBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
+			frame=encodedFrames+encodedFrameIndex;
+			bytesWritten = speex_bits_write(speexBits, frame->data, VOICE_JITTER_MAX_FRAME_BYTES);
+#ifdef _DEBUG
+			// Voice frames should never be bigger than a hundred or so bytes
+			RakAssert(bytesWritten < VOICE_JITTER_MAX_FRAME_BYTES);
+#endif
+			frame->length=bytesWritten;
+			frame->energy=energy;
 
-			if (bytesWaitingToReturn==0)
+			// The low bitrate copy goes in the packets after this one
+			frame->redundantLength=0;
+			if (redundantFrames>0)
 			{
-				channel->bufferOutput=true;
+				speex_bits_reset(fecBits);
+				speex_encode_int(fec_enc_state, (spx_int16_t*) inputBuffer, fecBits);
+				frame->redundantLength = speex_bits_write(fecBits, frame->redundantData, VOICE_JITTER_MAX_FRAME_BYTES);
 			}
-			else if (channel->bufferOutput==false || bytesWaitingToReturn > bufferSizeBytes*2)
+			frame->captureTime=frameCapture;
+			frame->encodeStartTime=frameStart;
+			frame->encodeEndTime=RakNet::GetTimeUS();
+
+			encodedFrameIndex=(encodedFrameIndex+1)%VOICE_ENCODED_FRAME_COUNT;
+			if (contiguousFrames < VOICE_ENCODED_FRAME_COUNT)
+				contiguousFrames++;
+
+			for (i=0; i < voiceChannels.Size(); i++)
 			{
-				// Block running this again until the user calls ReceiveFrame since every call to ReceiveFrame only gets zero or one output blocks from
-				// each channel
-				channel->copiedOutgoingBufferToBufferedOutput=true;
+				channel=voiceChannels[i];
+
+				// Relayed channels only ever receive
+				if (channel->relayedBy!=UNASSIGNED_RAKNET_GUID)
+					continue;
+
+				channel->isSendingVoiceData=true;
+				channel->outgoingMessageNumber++;
+				if (channel->pendingFrames==0)
+					channel->pendingSince=currentTime;
+				channel->pendingFrames++;
+				// The first frame of a talk spurt isn't held back for the rest of its packet
+				if (channel->pendingFrames >= GetFramesPerPacket(channel) || talkStarting)
+					SendPendingFrames(channel, false);
+			}
+			talkStarting=false;
+		}
+	}
 
-				// Stop buffering output.  We won't start buffering again until there isn't enough data to read.
-				channel->bufferOutput=false;
+	// Talking stopped, so send what is left flagged as the end.  Part of a frame left over is dropped, not sent with the next talk spurt.
+	if (talkEnding)
+	{
+		for (i=0; i < voiceChannels.Size(); i++)
+		{
+			if (voiceChannels[i]->relayedBy==UNASSIGNED_RAKNET_GUID)
+				SendPendingFrames(voiceChannels[i], true);
+		}
+		outgoingReadIndex=outgoingWriteIndex;
+		talkEnding=false;
+	}
 
-				// Cap to the size of the output buffer.  But we do write less if less is available, with the rest silence
-				if (bytesWaitingToReturn > bufferSizeBytes)
-				{
-					bytesWaitingToReturn=bufferSizeBytes;
-				}
-				else
-				{
-					// Align the write index so when we increment the partial block read (which is always aligned) it computes out to 0 bytes waiting
-					channel->incomingWriteIndex=channel->incomingReadIndex+bufferSizeBytes;
-					if (channel->incomingWriteIndex==totalBufferSize)
-						channel->incomingWriteIndex=0;
-				}
+	// Don't hold a partly filled packet past the channel's send interval
+	for (i=0; i < voiceChannels.Size(); i++)
+	{
+		channel=voiceChannels[i];
+		if (channel->pendingFrames>0 && currentTime - channel->pendingSince >= GetSendIntervalMS(channel))
+			SendPendingFrames(channel, false);
+	}
+}
+unsigned RakVoice::GetFramesPerPacket(const VoiceChannel *channel) const
+{
+	// The adaptive controller only ever bundles more than the channel negotiated
+	if (adaptiveQuality && adaptiveStatistics.framesPerPacket > channel->packetProfile.framesPerPacket)
+		return adaptiveStatistics.framesPerPacket;
+	return channel->packetProfile.framesPerPacket;
+}
+unsigned RakVoice::GetSendIntervalMS(const VoiceChannel *channel) const
+{
+	// Long enough to fill the packet, or the extra frames per packet would never be bundled
+	unsigned fillMS=GetFramesPerPacket(channel) * speexOutgoingFrameSampleCount * 1000 / sampleRate;
+	return (fillMS > channel->packetProfile.sendIntervalMS) ? fillMS : channel->packetProfile.sendIntervalMS;
+}
+void RakVoice::UpdateAdaptiveQuality(RakNet::TimeMS currentTime)
+{
+	unsigned i, sendBufferBytes, priority, copies, level;
+	int rtt, ping;
+	float loss, encodeLoad, frameMicroseconds;
+	bool limited, congested, changed;
+	SystemAddress address;
+	RakNetStatistics rns;
+	VoiceChannel *channel;
 
-				short *in = (short *) (channel->incomingBuffer+channel->incomingReadIndex);
-				for (j=0; j < bytesWaitingToReturn / SAMPLESIZE; j++)
-				{
-					// Write short to float so if the range goes over the range of a float we can still add and subtract the correct final value.
-					// It will be clamped at the end
-					bufferedOutput[j]+=in[j%(totalBufferSize/SAMPLESIZE)];
-				}
+	adaptSampleTime=currentTime;
 
-				// Update the read index.  Always update by bufferSizeBytes, not bytesWaitingToReturn.
-				// if bytesWaitingToReturn < bufferSizeBytes then the rest is silence since this means the buffer ran out or we stopped sending.
-				channel->incomingReadIndex+=bufferSizeBytes;
-				if (channel->incomingReadIndex==totalBufferSize)
-					channel->incomingReadIndex=0;
+	// Sample the worst of the outgoing channels, since they all share the one encoder
+	loss=0.0f;
+	rtt=-1;
+	sendBufferBytes=0;
+	limited=false;
+	for (i=0; i < voiceChannels.Size(); i++)
+	{
+		channel=voiceChannels[i];
+		if (channel->relayedBy!=UNASSIGNED_RAKNET_GUID || channel->guid==UNASSIGNED_RAKNET_GUID || rakPeerInterface==0)
+			continue;
+		address=rakPeerInterface->GetSystemAddressFromGuid(channel->guid);
+		if (address==UNASSIGNED_SYSTEM_ADDRESS || rakPeerInterface->GetStatistics(address, &rns)==0)
+			continue;
+
+		if (rns.packetlossLastSecond > loss)
+			loss=rns.packetlossLastSecond;
+		for (priority=0; priority < NUMBER_OF_PRIORITIES; priority++)
+			sendBufferBytes+=(unsigned) rns.bytesInSendBuffer[priority];
+		limited|=rns.isLimitedByCongestionControl;
+		ping=rakPeerInterface->GetLastPing(channel->guid);
+		if (ping > rtt)
+			rtt=ping;
+	}
+	if (rtt>=0 && (adaptiveStatistics.lowestRttMS<0 || rtt < adaptiveStatistics.lowestRttMS))
+		adaptiveStatistics.lowestRttMS=rtt;
+
+	frameMicroseconds=(float) speexOutgoingFrameSampleCount * 1000000.0f / (float) sampleRate;
+	encodeLoad=(encodeFrames>0) ? (float) encodeMicroseconds / ((float) encodeFrames * frameMicroseconds) : 0.0f;
+	encodeMicroseconds=0;
+	encodeFrames=0;
+
+	adaptiveStatistics.packetLoss=loss;
+	adaptiveStatistics.rttMS=rtt;
+	adaptiveStatistics.sendBufferBytes=sendBufferBytes;
+	adaptiveStatistics.unencodedBytes=GetBufferedBytesToSend(UNASSIGNED_RAKNET_GUID);
+	adaptiveStatistics.encodeLoad=encodeLoad;
+
+	// The link is falling behind if what we send backs up, or if packets sit in a queue on the way
+	congested = (sendBufferBytes > VOICE_ADAPT_SEND_BUFFER_BYTES && (sendBufferBytes > previousSendBufferBytes || limited)) ||
+		(rtt>=0 && adaptiveStatistics.lowestRttMS>=0 && rtt > adaptiveStatistics.lowestRttMS + VOICE_ADAPT_RTT_RISE_MS);
+	previousSendBufferBytes=sendBufferBytes;
+
+	changed=false;
+	level=adaptiveStatistics.level;
+	if (congested)
+	{
+		adaptCleanSince=currentTime;
+		if (level+1 < VOICE_ADAPT_LEVELS && currentTime - adaptStepDownTime >= VOICE_ADAPT_HOLD_MS)
+		{
+			level++;
+			adaptStepDownTime=currentTime;
+			adaptiveStatistics.stepsDown++;
+		}
+	}
+	else if (level>0 && currentTime - adaptCleanSince >= VOICE_ADAPT_RECOVER_MS)
+	{
+		level--;
+		adaptCleanSince=currentTime;
+		adaptiveStatistics.stepsUp++;
+	}
+	if (level!=adaptiveStatistics.level)
+	{
+		adaptiveStatistics.level=level;
+		changed=true;
+	}
 
-			//	printf("%f %f\n", channel->incomingReadIndex/(float)bufferSizeBytes, channel->incomingWriteIndex/(float)bufferSizeBytes);
-			}
+	// Loss on its own is covered by repeating frames, rather than by sending less
+	copies=(loss >= VOICE_ADAPT_LOSS_TWO_COPIES) ? 2 : (loss >= VOICE_ADAPT_LOSS_ONE_COPY) ? 1 : 0;
+	if (copies < requestedRedundantFrames)
+		copies=requestedRedundantFrames;
+	if (copies > VOICE_FEC_MAX_FRAMES)
+		copies=VOICE_FEC_MAX_FRAMES;
+	if (copies >= redundantFrames)
+	{
+		redundantFrames=copies;
+		adaptLossCleanSince=currentTime;
+	}
+	else if (currentTime - adaptLossCleanSince >= VOICE_ADAPT_RECOVER_MS)
+	{
+		redundantFrames--;
+		adaptLossCleanSince=currentTime;
+	}
+	adaptiveStatistics.redundantFrames=redundantFrames;
+
+	// Encoding falling behind the recording costs latency, so trade complexity for time
+	if (encodeLoad > VOICE_ADAPT_ENCODE_HIGH || adaptiveStatistics.unencodedBytes > 2 * (unsigned) speexOutgoingFrameSampleCount * SAMPLESIZE)
+	{
+		adaptEncodeCleanSince=currentTime;
+		if (adaptiveStatistics.complexity > 1)
+		{
+			adaptiveStatistics.complexity--;
+			changed=true;
+		}
+	}
+	else if (encodeLoad < VOICE_ADAPT_ENCODE_LOW && adaptiveStatistics.complexity < defaultEncoderComplexity &&
+		currentTime - adaptEncodeCleanSince >= VOICE_ADAPT_RECOVER_MS)
+	{
+		adaptEncodeCleanSince=currentTime;
+		adaptiveStatistics.complexity++;
+		changed=true;
+	}
+
+	if (changed)
+		ApplyAdaptiveQuality();
+}
+void RakVoice::ApplyAdaptiveQuality(void)
+{
+	float vbrQuality;
+
+	adaptiveStatistics.quality=adaptLevels[adaptiveStatistics.level].quality;
+	adaptiveStatistics.framesPerPacket=adaptLevels[adaptiveStatistics.level].framesPerPacket;
+	SetEncoderParameter(SPEEX_SET_QUALITY, adaptiveStatistics.quality);
+	SetEncoderParameter(SPEEX_SET_COMPLEXITY, adaptiveStatistics.complexity);
+
+	// VBR picks its bitrate from its own quality setting
+	if (enc_state && defaultVBRState)
+	{
+		vbrQuality=(float) adaptiveStatistics.quality;
+		speex_encoder_ctl(enc_state, SPEEX_SET_VBR_QUALITY, &vbrQuality);
+	}
+}
+void RakVoice::ApplyTalking(RakNet::TimeMS currentTime)
+{
+	unsigned i, frameTimeMS, pausedFrames;
+
+	talking=talkingRequested;
+	if (talking==false)
+	{
+		// Flagged on the packets sent once the frames already recorded are encoded
+		talkEnding=true;
+		talkStoppedTime=currentTime;
+		return;
+	}
+
+	// Count the frames that weren't recorded during the pause, as VAD does, so receivers can tell it from lost packets
+	frameTimeMS=speexOutgoingFrameSampleCount * 1000 / sampleRate;
+	pausedFrames=(frameTimeMS > 0) ? (currentTime - talkStoppedTime) / frameTimeMS : 0;
+	if (pausedFrames > VOICE_TALK_MAX_PAUSE_FRAMES)
+		pausedFrames=VOICE_TALK_MAX_PAUSE_FRAMES;
+	for (i=0; i < voiceChannels.Size(); i++)
+	{
+		if (voiceChannels[i]->relayedBy==UNASSIGNED_RAKNET_GUID)
+			voiceChannels[i]->outgoingMessageNumber+=(unsigned short) pausedFrames;
+	}
+
+	// Nothing from before the pause is repeated
+	contiguousFrames=0;
+	talkStarting=true;
+}
+void RakVoice::DecodeChannel(VoiceChannel *channel)
+{
+	unsigned bytesWaitingToReturn, speexBlockSize;
+
+	// Size of VoiceChannel::incomingBuffer
+	unsigned incomingBufferSize=bufferSizeBytes * FRAME_INCOMING_BUFFER_COUNT;
+
+	// As sound buffer blocks fill up, I add their values to RakVoice::bufferedOutput .  Then when the user calls ReceiveFrame they get that value, already
+	// processed.  This is necessary because that function needs to run as fast as possible so I remove all processing there that I can.  Otherwise the sound
+	// plays back distorted and popping
+	if (channel->copiedOutgoingBufferToBufferedOutput)
+		return;
+
+	// Block running this again until the user calls ReceiveFrame since every call to ReceiveFrame only gets zero or one output blocks from
+	// each channel.  This is also what clocks frames out of the jitter buffer.
+	channel->copiedOutgoingBufferToBufferedOutput=true;
+
+	if (channel->incomingReadIndex <= channel->incomingWriteIndex)
+		bytesWaitingToReturn=channel->incomingWriteIndex-channel->incomingReadIndex;
+	else
+		bytesWaitingToReturn=incomingBufferSize-channel->incomingReadIndex+channel->incomingWriteIndex;
+
+	// Decode frames out of the jitter buffer until there is a whole block to return
+	speexBlockSize = channel->speexIncomingFrameSampleCount * SAMPLESIZE;
+	if (bytesWaitingToReturn < bufferSizeBytes)
+		StartPlayoutWhenBuffered(channel);
+	while (bytesWaitingToReturn < bufferSizeBytes && PlayoutFrame(channel))
+		bytesWaitingToReturn+=speexBlockSize;
+
+	if (bytesWaitingToReturn==0)
+		return;
+
+	// Cap to the size of the output buffer.  But we do write less if less is available, with the rest silence
+	if (bytesWaitingToReturn > bufferSizeBytes)
+	{
+		bytesWaitingToReturn=bufferSizeBytes;
+	}
+	else
+	{
+		// Align the write index so when we increment the partial block read (which is always aligned) it computes out to 0 bytes waiting
+		channel->incomingWriteIndex=channel->incomingReadIndex+bufferSizeBytes;
+		if (channel->incomingWriteIndex==incomingBufferSize)
+			channel->incomingWriteIndex=0;
+	}
+	channel->bytesToMix=bytesWaitingToReturn;
+}
+void RakVoice::MixChannel(VoiceChannel *channel, RakNet::TimeMS currentTime)
+{
+	VoicePlaybackVoice *voice;
+
+	// Voices are given out and taken back here rather than in DecodeChannel, which may run on the worker pool
+	if (channel->playoutState==VOICE_PLAYOUT_PLAYING && channel->playbackVoice==0)
+		AssignPlaybackVoice(channel, currentTime);
+
+	voice=channel->playbackVoice;
+	if (channel->bytesToMix>0)
+	{
+		// A channel without a voice is still decoded and read, so it stays in step, but isn't heard
+		if (voice)
+		{
+			// Sum in a wider type so going over the range of a short still adds and subtracts to the correct final value.
+			// It will be clamped at the end
+			short *in = (short *) (channel->incomingBuffer+channel->incomingReadIndex);
+			if (fixedPointMix)
+				VoiceMixing::AccumulateInt16(bufferedOutputFixed, in, channel->bytesToMix / SAMPLESIZE);
+			else
+				VoiceMixing::AccumulateInt16(bufferedOutput, in, channel->bytesToMix / SAMPLESIZE);
+			bufferedOutputMixed=true;
+
+			// A stamped frame is only timed to the ear if it was heard
+			if (channel->latencyPending)
+				RecordDownstreamLatency(channel);
+		}
+		channel->latencyPending=false;
+		channel->bytesToMix=0;
+
+		// Update the read index.  Always update by bufferSizeBytes, not bytesWaitingToReturn.
+		// if bytesWaitingToReturn < bufferSizeBytes then the rest is silence since this means the talker stopped.
+		channel->incomingReadIndex+=bufferSizeBytes;
+		if (channel->incomingReadIndex==bufferSizeBytes * FRAME_INCOMING_BUFFER_COUNT)
+			channel->incomingReadIndex=0;
+	}
+
+	if (voice)
+	{
+		voice->stream.framesPlayed=channel->jitterStatistics.framesPlayed-voice->framesPlayedAtStart;
+		voice->stream.concealedFrames=channel->jitterStatistics.concealedFrames-voice->concealedFramesAtStart;
+	}
+
+	// Once the talker goes quiet its last block has been mixed, and the voice goes back to the pool.
+	// Nothing is left to decode until they talk again, so the channel stops being visited.
+	if (channel->playoutState==VOICE_PLAYOUT_IDLE)
+	{
+		ReleasePlaybackVoice(channel, currentTime);
+		channel->waitingForVoice=false;
+		DropSpeaker(channel);
+		voiceChannels.Deactivate(channel);
+	}
+}
+void RakVoice::AssignPlaybackVoice(VoiceChannel *channel, RakNet::TimeMS currentTime)
+{
+	VoicePlaybackVoice *voice;
+
+	if (freePlaybackVoiceCount==0)
+	{
+		// Counted once per stream, however long it waits
+		if (channel->waitingForVoice==false)
+		{
+			channel->waitingForVoice=true;
+			playbackStatistics.streamsRefused++;
 		}
+		return;
 	}
+
+	voice=playbackVoices+freePlaybackVoices[--freePlaybackVoiceCount];
+	voice->stream.talker=channel->guid;
+	voice->stream.startTime=currentTime;
+	voice->stream.framesPlayed=0;
+	voice->stream.concealedFrames=0;
+	voice->framesPlayedAtStart=channel->jitterStatistics.framesPlayed;
+	voice->concealedFramesAtStart=channel->jitterStatistics.concealedFrames;
+	channel->playbackVoice=voice;
+	channel->waitingForVoice=false;
+	playbackStatistics.voicesInUse++;
+	playbackStatistics.streamsStarted++;
+}
+void RakVoice::ReleasePlaybackVoice(VoiceChannel *channel, RakNet::TimeMS currentTime)
+{
+	VoicePlaybackVoice *voice=channel->playbackVoice;
+	if (voice==0)
+		return;
+
+	RakNet::TimeMS length=currentTime-voice->stream.startTime;
+	playbackStatistics.totalStreamMS+=length;
+	if (length > playbackStatistics.longestStreamMS)
+		playbackStatistics.longestStreamMS=length;
+	playbackStatistics.streamsFinished++;
+	playbackStatistics.voicesInUse--;
+
+	RakAssert(freePlaybackVoiceCount < VOICE_PLAYBACK_VOICES);
+	freePlaybackVoices[freePlaybackVoiceCount++]=(unsigned) (voice-playbackVoices);
+	channel->playbackVoice=0;
+}
+void RakVoice::SendPendingFrames(VoiceChannel *channel, bool endOfTalk)
+{
+	char tempOutput[2048];
+	unsigned frameCount, redundantCount, offset, t;
+	unsigned short firstMessageNumber;
+	unsigned char energy;
+	VoiceEncodedFrame *frame;
+	VoiceLatencyStamp stamp;
+	RakNet::TimeUS packetizeStart;
+	// 1 byte for ID, and 2 bytes(short) for Message number
+	static const int headerSize=sizeof(unsigned char) + sizeof(unsigned short);
+
+	frameCount=channel->pendingFrames;
+	channel->pendingFrames=0;
+	if (frameCount==0 && endOfTalk==false)
+		return;
+	packetizeStart=RakNet::GetTimeUS();
+
+	// Repeat the frames just before this packet, as far back as they were encoded without a pause.  An end of talk marker on its own has none.
+	redundantCount=0;
+	while (frameCount>0 && redundantCount < redundantFrames && frameCount+redundantCount < contiguousFrames && GetEncodedFrame(frameCount+redundantCount)->redundantLength>0)
+		redundantCount++;
+
+	// Header, then the lengths of the copies and of every frame but the last
+	tempOutput[0]=ID_RAKVOICE_DATA;
+	firstMessageNumber=(unsigned short) (channel->outgoingMessageNumber-frameCount);
+	memcpy(tempOutput+1, &firstMessageNumber, sizeof(unsigned short));
+	offset=headerSize;
+	if (frameCount>0)
+		tempOutput[offset]=(char) ((frameCount-1) | (redundantCount<<3));
+	else
+		tempOutput[offset]=0;
+	if (endOfTalk)
+		tempOutput[offset]|=VOICE_PAYLOAD_END_OF_TALK;
+	offset++;
+
+	// The loudest frame, so receivers and relays can pick the loudest talkers
+	if (frameCount>0)
+	{
+		energy=VOICE_ENERGY_SILENT;
+		for (t=0; t < frameCount; t++)
+		{
+			if (GetEncodedFrame(t)->energy > energy)
+				energy=GetEncodedFrame(t)->energy;
+		}
+		tempOutput[headerSize]|=(char) VOICE_PAYLOAD_ENERGY;
+		tempOutput[offset++]=(char) energy;
+	}
+
+	// When the first frame was recorded, and how long it took to get this far
+	if (latencyStamps && frameCount>0)
+	{
+		frame=GetEncodedFrame(frameCount-1);
+		stamp.captureTime=(uint32_t) (frame->captureTime / 1000);
+		stamp.captureUnits=GetLatencyUnits(frame->captureTime, frame->encodeStartTime);
+		stamp.encodeUnits=GetLatencyUnits(frame->encodeStartTime, frame->encodeEndTime);
+		stamp.sendQueueUnits=GetLatencyUnits(frame->encodeEndTime, packetizeStart);
+		tempOutput[headerSize]|=VOICE_PAYLOAD_LATENCY_STAMP;
+		WriteVoiceLatencyStamp((unsigned char*) tempOutput+offset, stamp);
+		offset+=VOICE_LATENCY_STAMP_SIZE;
+	}
+	for (t=0; t < redundantCount; t++)
+		tempOutput[offset++]=(char) GetEncodedFrame(frameCount+t)->redundantLength;
+	for (t=0; t+1 < frameCount; t++)
+		tempOutput[offset++]=(char) GetEncodedFrame(frameCount-1-t)->length;
+
+	// The copies newest first, then the frames oldest first
+	for (t=0; t < redundantCount; t++)
+	{
+		frame=GetEncodedFrame(frameCount+t);
+		memcpy(tempOutput+offset, frame->redundantData, frame->redundantLength);
+		offset+=frame->redundantLength;
+	}
+	for (t=0; t < frameCount; t++)
+	{
+		frame=GetEncodedFrame(frameCount-1-t);
+		memcpy(tempOutput+offset, frame->data, frame->length);
+		offset+=frame->length;
+	}
+	stageStatistics.packetizeMicroseconds+=RakNet::GetTimeUS()-packetizeStart;
+	stageStatistics.packetsBuilt++;
+
+	if (loopbackMode && channel->guid==UNASSIGNED_RAKNET_GUID)
+	{
+		Packet p;
+		p.length=offset;
+		p.data=(unsigned char*)tempOutput;
+		p.guid=channel->guid;
+		p.systemAddress=RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+		OnVoiceData(&p);
+	}
+	else
+		SendUnified(tempOutput, offset, HIGH_PRIORITY, UNRELIABLE,0,channel->guid,false);
+}
+VoiceEncodedFrame* RakVoice::GetEncodedFrame(unsigned age)
+{
+	// Age 0 is the frame encoded last
+	RakAssert(age < VOICE_ENCODED_FRAME_COUNT);
+	return encodedFrames + (encodedFrameIndex + VOICE_ENCODED_FRAME_COUNT - 1 - age) % VOICE_ENCODED_FRAME_COUNT;
 }
 PluginReceiveResult RakVoice::OnReceive(Packet *packet)
 {
@@ -570,6 +1528,7 @@ PluginReceiveResult RakVoice::OnReceive(Packet *packet)
 		break;
 	case ID_RAKVOICE_CLOSE_CHANNEL:
 		FreeChannelMemory(packet->guid);
+		FreeRelayedChannels(packet->guid);
 	break;
 	case ID_RAKVOICE_DATA:
 		OnVoiceData(packet);
@@ -586,6 +1545,8 @@ void RakVoice::OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID
 		CloseVoiceChannel(rakNetGUID);
 	else
 		FreeChannelMemory(rakNetGUID);
+
+	FreeRelayedChannels(rakNetGUID);
 }
 
 void RakVoice::OnOpenChannelRequest(Packet *packet)
@@ -602,6 +1563,8 @@ void RakVoice::OnOpenChannelRequest(Packet *packet)
 	RakNet::BitStream out;
 	out.Write((unsigned char)ID_RAKVOICE_OPEN_CHANNEL_REPLY);
 	out.Write((int32_t)sampleRate);
+	out.Write(packetProfile.framesPerPacket);
+	out.Write(packetProfile.sendIntervalMS);
 	SendUnified(&out, HIGH_PRIORITY, RELIABLE_ORDERED,0,packet->systemAddress,false);	
 }
 void RakVoice::OnOpenChannelReply(Packet *packet)
@@ -617,28 +1580,31 @@ void RakVoice::OpenChannel(Packet *packet)
 
 	FreeChannelMemory(packet->guid);
 
-	VoiceChannel *channel=RakNet::OP_NEW<VoiceChannel>( _FILE_AND_LINE_ );
-	channel->guid=packet->guid;
-	channel->isSendingVoiceData=false;
 	int sampleRate;
 	in.Read(sampleRate);
-	channel->remoteSampleRate=sampleRate;
-
-	if (channel->remoteSampleRate!=8000 && channel->remoteSampleRate!=16000 && channel->remoteSampleRate!=32000)
+	if (sampleRate!=8000 && sampleRate!=16000 && sampleRate!=32000)
 	{
 #ifdef _DEBUG
 		RakAssert(0);
 #endif
-		RakNet::OP_DELETE(channel, _FILE_AND_LINE_);
 		return;
 	}
 
-	if (sampleRate==8000)
-		channel->enc_state=speex_encoder_init(&speex_nb_mode);
-	else if (sampleRate==16000)
-		channel->enc_state=speex_encoder_init(&speex_wb_mode);
-	else // 32000
-		channel->enc_state=speex_encoder_init(&speex_uwb_mode);
+	// Systems that don't send a profile send one frame per packet
+	VoicePacketProfile remoteProfile=VOICE_PROFILE_LOW_LATENCY;
+	if (in.Read(remoteProfile.framesPerPacket)==false || in.Read(remoteProfile.sendIntervalMS)==false)
+		remoteProfile=VOICE_PROFILE_LOW_LATENCY;
+
+	// Speex allocates from the arena until the end of OpenChannel
+	VoiceArena::Scope arenaScope(&arena);
+
+	VoiceChannel *channel=voiceChannels.Insert(packet->guid);
+	channel->relayedBy=UNASSIGNED_RAKNET_GUID;
+	channel->isSendingVoiceData=false;
+	channel->remoteSampleRate=sampleRate;
+	channel->packetProfile=NegotiatePacketProfile(packetProfile, remoteProfile);
+	channel->pendingFrames=0;
+	channel->pendingSince=0;
 
 	if (channel->remoteSampleRate==8000)
 		channel->dec_state=speex_decoder_init(&speex_nb_mode);
@@ -647,96 +1613,180 @@ void RakVoice::OpenChannel(Packet *packet)
 	else // 32000
 		channel->dec_state=speex_decoder_init(&speex_uwb_mode);
 
-	// make sure encoder and decoder are created
-	RakAssert((channel->enc_state)&&(channel->dec_state));
+	// make sure decoder is created
+	RakAssert(channel->dec_state);
+	channel->dec_bits=arena.Allocate(sizeof(SpeexBits));
+	speex_bits_init((SpeexBits*)channel->dec_bits);
 
 	int ret;
-	ret=speex_encoder_ctl(channel->enc_state, SPEEX_GET_FRAME_SIZE, &channel->speexOutgoingFrameSampleCount);
-	RakAssert(ret==0);
-	channel->outgoingBuffer = (char*) rakMalloc_Ex(bufferSizeBytes * FRAME_OUTGOING_BUFFER_COUNT, _FILE_AND_LINE_);
-	channel->outgoingReadIndex=0;
-	channel->outgoingWriteIndex=0;
-	channel->bufferOutput=true;
 	channel->outgoingMessageNumber=0;
 	channel->copiedOutgoingBufferToBufferedOutput=false;
 
 	ret=speex_decoder_ctl(channel->dec_state, SPEEX_GET_FRAME_SIZE, &channel->speexIncomingFrameSampleCount);
 	RakAssert(ret==0);
-	channel->incomingBuffer = (char*) rakMalloc_Ex(bufferSizeBytes * FRAME_INCOMING_BUFFER_COUNT, _FILE_AND_LINE_);
+	(void)ret;
+	channel->incomingBuffer = (char*) arena.Allocate(bufferSizeBytes * FRAME_INCOMING_BUFFER_COUNT);
 	channel->incomingReadIndex=0;
 	channel->incomingWriteIndex=0;
-	channel->lastSend=0;
-	channel->incomingMessageNumber=0;
 
-	// Initialize preprocessor
-	channel->pre_state = speex_preprocess_state_init(channel->speexOutgoingFrameSampleCount, sampleRate);
-	RakAssert(channel->pre_state);
-
-	// Set encoder default parameters
-	SetEncoderParameter(channel->enc_state, SPEEX_SET_VBR, (defaultVBRState) ? 1 : 0 );
-	SetEncoderParameter(channel->enc_state, SPEEX_SET_COMPLEXITY, defaultEncoderComplexity);
-	// Set preprocessor default parameters
-	SetPreprocessorParameter(channel->pre_state, SPEEX_PREPROCESS_SET_DENOISE, (defaultDENOISEState) ? 1 : 2);
-	SetPreprocessorParameter(channel->pre_state, SPEEX_PREPROCESS_SET_VAD, (defaultVADState) ? 1 : 2);
-
-	voiceChannels.Insert(packet->guid, channel, true, _FILE_AND_LINE_);
+	channel->jitterSlots = (VoiceJitterSlot*) arena.Allocate(sizeof(VoiceJitterSlot) * VOICE_JITTER_BUFFER_COUNT);
+	memset(&channel->jitterStatistics, 0, sizeof(channel->jitterStatistics));
+	channel->targetDelayFrames=VOICE_JITTER_MIN_DELAY;
+	channel->jitterMS=0.0f;
+	channel->jitterStarted=false;
+	channel->redundantFramesSeen=0;
+	channel->framesPerPacketSeen=1;
+	ResetJitterBuffer(channel, 0);
+	channel->playoutState=VOICE_PLAYOUT_IDLE;
 }
 
 
-void RakVoice::SetEncoderParameter(void* enc_state, int vartype, int val)
+void RakVoice::SetEncoderParameter(int vartype, int val)
 {
+	// Before Init the value is only stored as the default
 	if (enc_state){ 
-		// Set parameter for just one encoder
 		int ret = speex_encoder_ctl(enc_state, vartype, &val);
-		RakAssert(ret==0);		
-	} else {
-		// Set parameter for all encoders
-		for (unsigned int index=0; index < voiceChannels.Size(); index++)
-		{
-			int ret = speex_encoder_ctl(voiceChannels[index]->enc_state, vartype, &val);
-			RakAssert(ret==0);
-		}
+		RakAssert(ret==0);
+		(void)ret;
 	}
 }
 
-void RakVoice::SetPreprocessorParameter(void* pre_state, int vartype, int val)
+void RakVoice::SetPreprocessorParameter(int vartype, int val)
 {
 	if (pre_state){
-		// Set parameter for just one preprocessor
 		int ret = speex_preprocess_ctl((SpeexPreprocessState*)pre_state, vartype, &val);
 		RakAssert(ret==0);
-	} else {
-		// Set parameter for all decoders
-		for (unsigned int index=0; index < voiceChannels.Size(); index++)
-		{
-			int ret = speex_preprocess_ctl((SpeexPreprocessState*)voiceChannels[index]->pre_state, vartype, &val);
-			RakAssert(ret==0);
-		}
+		(void)ret;
 	}
 }
 
 void RakVoice::SetEncoderComplexity(int complexity)
 {
 	RakAssert((complexity>=0)&&(complexity<=10));
-	SetEncoderParameter(NULL, SPEEX_SET_COMPLEXITY, complexity);
+	SetEncoderParameter(SPEEX_SET_COMPLEXITY, complexity);
 	defaultEncoderComplexity = complexity;
+	// Also the most the adaptive controller raises it to
+	adaptiveStatistics.complexity = complexity;
 }
 void RakVoice::SetVAD(bool enable)
 {
-	SetPreprocessorParameter(NULL, SPEEX_PREPROCESS_SET_VAD, (enable)? 1 : 2);
+	SetPreprocessorParameter(SPEEX_PREPROCESS_SET_VAD, (enable)? 1 : 2);
 	defaultVADState = enable;
 }
 void RakVoice::SetNoiseFilter(bool enable)
 {
-	SetPreprocessorParameter(NULL, SPEEX_PREPROCESS_SET_DENOISE, (enable) ? 1 : 2);
+	SetPreprocessorParameter(SPEEX_PREPROCESS_SET_DENOISE, (enable) ? 1 : 2);
 	defaultDENOISEState = enable;
 }
 void RakVoice::SetVBR(bool enable)
 {
-	SetEncoderParameter(NULL, SPEEX_SET_VBR, (enable) ? 1 : 0);
+	SetEncoderParameter(SPEEX_SET_VBR, (enable) ? 1 : 0);
 	defaultVBRState = enable;
 }
 
+void RakVoice::SetRedundancy(unsigned frames)
+{
+	RakAssert(frames<=VOICE_FEC_MAX_FRAMES);
+	if (frames>VOICE_FEC_MAX_FRAMES)
+		frames=VOICE_FEC_MAX_FRAMES;
+	requestedRedundantFrames=frames;
+	// The adaptive controller may send more, never fewer
+	if (adaptiveQuality==false || frames > redundantFrames)
+		redundantFrames=frames;
+}
+void RakVoice::SetAdaptiveQuality(bool enable)
+{
+	RakNet::TimeMS currentTime=RakNet::GetTimeMS();
+
+	adaptiveQuality=enable;
+
+	// Start from the top of the ladder either way.  Turned off, that is speex's default quality and the fixed settings.
+	adaptiveStatistics.level=0;
+	adaptiveStatistics.complexity=defaultEncoderComplexity;
+	adaptiveStatistics.redundantFrames=requestedRedundantFrames;
+	adaptiveStatistics.lowestRttMS=-1;
+	adaptiveStatistics.rttMS=-1;
+	redundantFrames=requestedRedundantFrames;
+	adaptSampleTime=currentTime;
+	adaptStepDownTime=currentTime;
+	adaptCleanSince=currentTime;
+	adaptLossCleanSince=currentTime;
+	adaptEncodeCleanSince=currentTime;
+	previousSendBufferBytes=0;
+	encodeMicroseconds=0;
+	encodeFrames=0;
+	ApplyAdaptiveQuality();
+}
+bool RakVoice::IsAdaptiveQualityActive(void) const
+{
+	return adaptiveQuality;
+}
+void RakVoice::GetAdaptiveStatistics(VoiceAdaptiveStatistics *statistics) const
+{
+	*statistics=adaptiveStatistics;
+}
+void RakVoice::SetEchoCancellation(bool enable)
+{
+	FreeEchoCanceller();
+	defaultEchoState = enable;
+	// Before Init the value is only stored as the default
+	if (enable && enc_state)
+		CreateEchoCanceller();
+}
+void RakVoice::SetEchoPath(unsigned playbackDelayMS, unsigned tailMS)
+{
+	RakAssert(tailMS>0);
+	echoPlaybackDelayMS=playbackDelayMS;
+	echoTailMS=tailMS;
+	// Start again with the new path
+	SetEchoCancellation(defaultEchoState);
+}
+void RakVoice::SetFixedPointMix(bool enable)
+{
+	// Picked up when Update next clears the mix
+	fixedPointMixRequested=enable;
+}
+void RakVoice::SetWorkerPool(VoiceWorkerPool *pool)
+{
+	workerPool=pool;
+}
+void RakVoice::SetTalking(bool talking)
+{
+	talkingRequested=talking;
+}
+bool RakVoice::IsTalking(void) const
+{
+	return talkingRequested;
+}
+void RakVoice::SetLatencyStamps(bool enable)
+{
+	latencyStamps=enable;
+}
+void RakVoice::SetCaptureAge(RakNet::TimeUS microseconds)
+{
+	captureAge=microseconds;
+}
+void RakVoice::SetPlayoutDelay(RakNet::TimeUS microseconds)
+{
+	playoutDelay=microseconds;
+	playoutDelaySet=true;
+}
+void RakVoice::SetMaxSpeakers(unsigned maxSpeakers)
+{
+	unsigned i;
+
+	// Everyone talking is picked again from their next packet
+	this->maxSpeakers=maxSpeakers;
+	speakerStatistics.maxSpeakers=maxSpeakers;
+	for (i=0; i < voiceChannels.ActiveSize(); i++)
+		DropSpeaker(voiceChannels.GetActive(i));
+}
+void RakVoice::SetPacketProfile(const VoicePacketProfile &profile)
+{
+	RakAssert(profile.framesPerPacket>=1 && profile.framesPerPacket<=VOICE_MAX_FRAMES_PER_PACKET);
+	packetProfile=NegotiatePacketProfile(profile, profile);
+}
+
 int RakVoice::GetEncoderComplexity(void)
 {
 	return defaultEncoderComplexity;
@@ -753,8 +1803,145 @@ bool RakVoice::IsVBRActive()
 {
 	return defaultVBRState;
 }
+unsigned RakVoice::GetRedundancy(void) const
+{
+	return redundantFrames;
+}
+bool RakVoice::IsEchoCancellationActive(void) const
+{
+	return defaultEchoState;
+}
+VoiceWorkerPool* RakVoice::GetWorkerPool(void) const
+{
+	return workerPool;
+}
+bool RakVoice::IsFixedPointMix(void) const
+{
+	return fixedPointMixRequested;
+}
+void RakVoice::GetEchoStatistics(VoiceEchoStatistics *statistics) const
+{
+	*statistics=echoStatistics;
+}
+const VoicePacketProfile& RakVoice::GetPacketProfile(void) const
+{
+	return packetProfile;
+}
+void RakVoice::GetMemoryStatistics(VoiceArenaStatistics *statistics) const
+{
+	*statistics=arena.GetStatistics();
+}
+void RakVoice::GetSpeakerStatistics(VoiceSpeakerStatistics *statistics) const
+{
+	RakAssert(statistics);
+	*statistics=speakerStatistics;
+}
+unsigned RakVoice::GetActiveChannelCount(void) const
+{
+	return voiceChannels.ActiveSize();
+}
+void RakVoice::GetStageStatistics(VoiceStageStatistics *statistics) const
+{
+	*statistics=stageStatistics;
+}
+void RakVoice::GetPlaybackStatistics(VoicePlaybackStatistics *statistics) const
+{
+	*statistics=playbackStatistics;
+}
+unsigned RakVoice::GetPlaybackStreams(VoicePlaybackStream *streams, unsigned maxStreams) const
+{
+	unsigned i, count=0;
+	for (i=0; i < voiceChannels.Size() && count < maxStreams; i++)
+	{
+		if (voiceChannels[i]->playbackVoice)
+			streams[count++]=voiceChannels[i]->playbackVoice->stream;
+	}
+	return count;
+}
+bool RakVoice::GetChannelPacketProfile(RakNetGUID guid, VoicePacketProfile *profile) const
+{
+	bool objectExists;
+	unsigned index;
+	index = voiceChannels.GetIndexFromKey(guid, &objectExists);
+	if (objectExists==false)
+		return false;
+	*profile=voiceChannels[index]->packetProfile;
+	return true;
+}
+
 
+void RakVoice::CreateEchoCanceller(void)
+{
+	int echoSampleRate=sampleRate;
+	unsigned delaySamples=sampleRate * echoPlaybackDelayMS / 1000;
+	VoiceArena::Scope arenaScope(&arena);
+
+	echo_state=speex_echo_state_init(speexOutgoingFrameSampleCount, sampleRate * echoTailMS / 1000);
+	RakAssert(echo_state);
+	speex_echo_ctl((SpeexEchoState*)echo_state, SPEEX_ECHO_SET_SAMPLING_RATE, &echoSampleRate);
+	echoResidual = (int32_t*) arena.Allocate(sizeof(int32_t) * (speexOutgoingFrameSampleCount+1));
+
+	// Room for the playback delay, a block from ReceiveFrame, and the two clocks drifting apart
+	echoReferenceSize=delaySamples + bufferSizeBytes / SAMPLESIZE + VOICE_ECHO_MAX_DRIFT_FRAMES * speexOutgoingFrameSampleCount;
+	echoReference = (short*) arena.Allocate(sizeof(short) * echoReferenceSize);
+	echoReferenceReadIndex=0;
+	// Nothing played yet can be heard for the length of the delay
+	echoReferenceCount=delaySamples;
+
+	memset(&echoStatistics, 0, sizeof(echoStatistics));
+	echoStatistics.frameSamples=speexOutgoingFrameSampleCount;
+}
+void RakVoice::FreeEchoCanceller(void)
+{
+	if (echo_state==0)
+		return;
+	speex_echo_state_destroy((SpeexEchoState*)echo_state);
+	VoiceArena::Free(echoResidual);
+	VoiceArena::Free(echoReference);
+	echo_state=0;
+	echoResidual=0;
+	echoReference=0;
+}
+void RakVoice::StoreEchoReference(const short *samples, unsigned count)
+{
+	unsigned i;
 
+	// Recording has fallen behind, so the oldest played samples will never be needed
+	if (echoReferenceCount + count > echoReferenceSize)
+	{
+		unsigned drop = echoReferenceCount + count - echoReferenceSize;
+		if (drop > echoReferenceCount)
+			drop = echoReferenceCount;
+		echoReferenceReadIndex=(echoReferenceReadIndex+drop)%echoReferenceSize;
+		echoReferenceCount-=drop;
+		echoStatistics.referenceOverrunSamples+=drop;
+	}
+
+	for (i=0; i < count && echoReferenceCount < echoReferenceSize; i++)
+	{
+		echoReference[(echoReferenceReadIndex+echoReferenceCount)%echoReferenceSize]=samples[i];
+		echoReferenceCount++;
+	}
+}
+void RakVoice::ReadEchoReference(short *samples, unsigned count)
+{
+	unsigned i;
+
+	if (echoReferenceCount < count)
+		echoStatistics.referenceUnderruns++;
+
+	for (i=0; i < count; i++)
+	{
+		if (echoReferenceCount > 0)
+		{
+			samples[i]=echoReference[echoReferenceReadIndex];
+			echoReferenceReadIndex=(echoReferenceReadIndex+1)%echoReferenceSize;
+			echoReferenceCount--;
+		}
+		else
+			samples[i]=0;
+	}
+}
 void RakVoice::FreeChannelMemory(RakNetGUID recipient)
 {
 	bool objectExists;
@@ -771,12 +1958,14 @@ void RakVoice::FreeChannelMemory(unsigned index, bool removeIndex)
 {
 	VoiceChannel *channel;
 	channel=voiceChannels[index];
-	speex_encoder_destroy(channel->enc_state);
+	ReleasePlaybackVoice(channel, RakNet::GetTimeMS());
+	DropSpeaker(channel);
 	speex_decoder_destroy(channel->dec_state);
-	speex_preprocess_state_destroy((SpeexPreprocessState*)channel->pre_state);
-	rakFree_Ex(channel->incomingBuffer, _FILE_AND_LINE_ );
-	rakFree_Ex(channel->outgoingBuffer, _FILE_AND_LINE_ );
-	RakNet::OP_DELETE(channel, _FILE_AND_LINE_);
+	speex_bits_destroy((SpeexBits*)channel->dec_bits);
+	VoiceArena::Free(channel->dec_bits);
+	VoiceArena::Free(channel->incomingBuffer);
+	VoiceArena::Free(channel->jitterSlots);
+	VoiceArena::Free(channel->latency);
 	if (removeIndex)
 		voiceChannels.RemoveAtIndex(index);
 }
@@ -784,82 +1973,507 @@ void RakVoice::OnVoiceData(Packet *packet)
 {
 	bool objectExists;
 	unsigned index;
-	unsigned short packetMessageNumber, messagesSkipped;
-	VoiceChannel *channel;
-	char tempOutput[2048];
-	unsigned int i;
+	unsigned short packetMessageNumber;
 	// 1 byte for ID, 2 bytes(short) for message number
 	static const int headerSize=sizeof(unsigned char) + sizeof(unsigned short);
 
+	if (packet->length <= headerSize)
+		return;
+
 	index = voiceChannels.GetIndexFromKey(packet->guid, &objectExists);
 	if (objectExists)
 	{
-		SpeexBits speexBits;
-		speex_bits_init(&speexBits);
-		channel=voiceChannels[index];
 		memcpy(&packetMessageNumber, packet->data+1, sizeof(unsigned short));
+		BufferVoiceData(voiceChannels[index], packetMessageNumber, packet->data+headerSize, packet->length-headerSize);
+	}
+}
+void RakVoice::OnRelayedVoiceData(Packet *packet)
+{
+	unsigned short packetMessageNumber;
+	RakNetGUID talker;
+	VoiceChannel *channel;
+	// 1 byte for ID, 2 bytes(short) for message number, 8 bytes for the talker's GUID
+	static const int headerSize=sizeof(unsigned char) + sizeof(unsigned short) + sizeof(uint64_t);
 
-		// Intentional overflow
-		messagesSkipped=packetMessageNumber-channel->incomingMessageNumber;
-		if (messagesSkipped > ((unsigned short)-1)/2)
+	if (packet->length <= headerSize)
+		return;
+
+	RakNet::BitStream in(packet->data, packet->length, false);
+	in.IgnoreBytes(sizeof(unsigned char) + sizeof(unsigned short));
+	in.Read(talker);
+
+	// Every talker gets their own decoder, since each speex stream carries state between frames
+	channel = OpenRelayedChannel(talker, packet->guid);
+	if (channel==0)
+		return;
+
+	memcpy(&packetMessageNumber, packet->data+1, sizeof(unsigned short));
+	BufferVoiceData(channel, packetMessageNumber, packet->data+headerSize, packet->length-headerSize);
+}
+bool RakVoice::PrepareRelayedChannel(RakNetGUID talker, RakNetGUID relay)
+{
+	return OpenRelayedChannel(talker, relay)!=0;
+}
+void RakVoice::CloseRelayedChannel(RakNetGUID talker)
+{
+	bool objectExists;
+	unsigned index;
+	index = voiceChannels.GetIndexFromKey(talker, &objectExists);
+	if (objectExists && voiceChannels[index]->relayedBy!=UNASSIGNED_RAKNET_GUID)
+		FreeChannelMemory(index, true);
+}
+VoiceChannel* RakVoice::OpenRelayedChannel(RakNetGUID talker, RakNetGUID relay)
+{
+	bool objectExists;
+	unsigned index;
+	index = voiceChannels.GetIndexFromKey(talker, &objectExists);
+	if (objectExists)
+		return voiceChannels[index];
+
+	// If the system is not initialized, just return
+	if (bufferedOutput==0)
+		return 0;
+
+	// The relay only forwards talkers using the same sample rate as us
+	Packet p;
+	RakNet::BitStream out;
+	out.Write((unsigned char)ID_RAKVOICE_OPEN_CHANNEL_REPLY);
+	out.Write((int32_t)sampleRate);
+	out.Write(packetProfile.framesPerPacket);
+	out.Write(packetProfile.sendIntervalMS);
+	p.data=out.GetData();
+	p.systemAddress=RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+	p.guid=talker;
+	p.length=out.GetNumberOfBytesUsed();
+	OpenChannel(&p);
+
+	index = voiceChannels.GetIndexFromKey(talker, &objectExists);
+	if (!objectExists)
+		return 0;
+	voiceChannels[index]->relayedBy=relay;
+	return voiceChannels[index];
+}
+void RakVoice::FreeRelayedChannels(RakNetGUID relay)
+{
+	unsigned index=voiceChannels.Size();
+	while (index-- > 0)
+	{
+		if (voiceChannels[index]->relayedBy==relay)
+			FreeChannelMemory(index, true);
+	}
+}
+void RakVoice::BufferVoiceData(VoiceChannel *channel, unsigned short packetMessageNumber, const unsigned char *data, unsigned length)
+{
+	VoicePayload payload;
+	int firstFrameNumber, lastFrameNumber;
+	int transit;
+	int frameTimeMS = channel->speexIncomingFrameSampleCount * 1000 / channel->remoteSampleRate;
+	unsigned t;
+	bool late;
+	int64_t upstreamMicroseconds;
+	VoiceJitterSlot *slot;
+
+	if (ParseVoicePayload(data, length, &payload)==false)
+		return;
+	for (t=0; t < payload.frameCount; t++)
+	{
+		if (payload.frameLengths[t] > VOICE_JITTER_MAX_FRAME_BYTES)
 		{
-#ifdef PRINT_DEBUG_INFO
-			printf("--- UNDERFLOW ---\n");
+#ifdef _DEBUG
+			// Voice packets should never be this big
+			RakAssert(0);
 #endif
-			// Underflow, just ignore it
 			return;
 		}
-#ifdef PRINT_DEBUG_INFO
-		if (messagesSkipped>0)
-			printf("%i messages skipped\n", messagesSkipped);
-#endif
-		// Don't do more than 100 ms of messages skipped.  Discard the rest.
-		int maxSkip = (int)(100.0f / (float) sampleRate);
-		for (i=0; i < (unsigned) messagesSkipped && i < (unsigned) maxSkip; i++)
+	}
+
+	// The message number counts the sender's frames, so extend it to 32 bits and use it as their timestamp.  Intentional overflow.
+	if (channel->jitterStarted)
+		firstFrameNumber=channel->newestFrameNumber + (short)(packetMessageNumber - (unsigned short)channel->newestFrameNumber);
+	else
+		firstFrameNumber=packetMessageNumber;
+	lastFrameNumber=firstFrameNumber + (int) payload.frameCount - 1;
+
+	// A marker on its own only says where the talk spurt ended
+	if (payload.frameCount==0)
+	{
+		if (channel->jitterStarted)
 		{
-			speex_decode_int(channel->dec_state, 0, (spx_int16_t*)tempOutput);
+			channel->talkEnded=true;
+			channel->endOfTalkFrame=lastFrameNumber;
+		}
+		return;
+	}
 
-			// Write to buffer a 'message skipped' interpolation
-			WriteOutputToChannel(channel, tempOutput);
+	// Only the loudest talkers are decoded.  The others' message numbers are still followed while they are quiet, so they
+	// start cleanly when picked, and a talker who lost their place plays out what was buffered and stops.
+	if (PickSpeaker(channel, payload, RakNet::GetTimeMS())==false)
+	{
+		if (channel->playoutState==VOICE_PLAYOUT_IDLE)
+		{
+			if (channel->jitterStarted && lastFrameNumber > channel->newestFrameNumber)
+				channel->newestFrameNumber=lastFrameNumber;
 		}
-	
-		channel->incomingMessageNumber=packetMessageNumber+1;
+		else if (channel->talkEnded==false)
+		{
+			channel->talkEnded=true;
+			channel->endOfTalkFrame=channel->newestFrameNumber;
+		}
+		speakerStatistics.packetsSkipped++;
+		speakerStatistics.framesSkipped+=payload.frameCount;
+		return;
+	}
 
-		// Write to incomingBuffer the decoded data
-		speex_bits_read_from(&speexBits, (char*)(packet->data+headerSize), packet->length-headerSize);
-		speex_decode_int(channel->dec_state, &speexBits, (spx_int16_t*)tempOutput);
+	upstreamMicroseconds=0;
+	if (payload.hasLatencyStamp)
+		upstreamMicroseconds=RecordUpstreamLatency(channel, payload.latencyStamp);
 
-#ifdef _DEBUG
+	// Anything after the end of the last talk spurt starts a new one
+	if (channel->talkEnded && lastFrameNumber > channel->endOfTalkFrame)
+		channel->talkEnded=false;
+
+	if (channel->jitterStarted==false || lastFrameNumber - channel->playoutFrameNumber >= VOICE_JITTER_BUFFER_COUNT)
+	{
+		// First packet, or too far ahead to hold because the sender's stream jumped.  Start over from this packet.
+		channel->jitterStarted=true;
+		channel->newestFrameNumber=firstFrameNumber;
+		ResetJitterBuffer(channel, firstFrameNumber);
+	}
+
+	// Measure how much the transit time varies, against the sender's clock.  The packet was sent once its last frame was encoded.
+	transit = (int) RakNet::GetTimeMS() - lastFrameNumber * frameTimeMS;
+	if (channel->hasTransit)
+	{
+		int difference = transit - channel->lastTransitMS;
+		if (difference < 0)
+			difference=-difference;
+		channel->jitterMS+=((float) difference - channel->jitterMS) / 16.0f;
+	}
+	channel->lastTransitMS=transit;
+	channel->hasTransit=true;
+
+	late=false;
+	if (channel->playoutState==VOICE_PLAYOUT_IDLE && firstFrameNumber > channel->newestFrameNumber)
+	{
+		// The talker started again after a pause.  Don't conceal the pause, start playing from here.
+		channel->playoutFrameNumber=firstFrameNumber;
+		channel->playoutState=VOICE_PLAYOUT_BUFFERING;
+		channel->bufferingFrames=0;
+	}
+	else if (firstFrameNumber < channel->playoutFrameNumber)
+	{
+		// Before playout started, an earlier frame just means the packets were reordered
+		if (channel->playoutState==VOICE_PLAYOUT_BUFFERING && channel->playoutFrameNumber - firstFrameNumber < VOICE_JITTER_BUFFER_COUNT - (int) GetJitterDepth(channel))
 		{
-			/*
-			printf("Out: ");
-			if (channel->remoteIsShortSampleType)
+			channel->playoutFrameNumber=firstFrameNumber;
+		}
+		else
+		{
+#ifdef PRINT_DEBUG_INFO
+			printf("--- LATE %i ---\n", channel->playoutFrameNumber - firstFrameNumber);
+#endif
+			// Some or all of its frames have already been played or concealed
+			late=true;
+			for (t=0; t < payload.frameCount; t++)
 			{
-				short *blah = (short*) tempOutput;
-				for (int p=0; p < 5; p++)
-				{
-					printf("%.i ", blah[p]);
-				}
+				if (firstFrameNumber + (int) t < channel->playoutFrameNumber)
+					channel->jitterStatistics.lateDrops++;
 			}
-			else
+			if (lastFrameNumber < channel->playoutFrameNumber)
 			{
-				float *blah = (float*) tempOutput;
-				for (int p=0; p < 5; p++)
-				{
-					printf("%.3f ", blah[p]);
-				}
+				UpdateTargetDelay(channel, true);
+				return;
 			}
-			
-			printf("\n");
-			*/
 		}
-#endif
+	}
 
-		// Write to buffer
-		WriteOutputToChannel(channel, tempOutput);
+	for (t=0; t < payload.frameCount; t++)
+	{
+		if (firstFrameNumber + (int) t >= channel->playoutFrameNumber)
+			StoreJitterFrame(channel, firstFrameNumber + (int) t, payload.frames[t], payload.frameLengths[t], false);
+	}
+	if (lastFrameNumber > channel->newestFrameNumber)
+		channel->newestFrameNumber=lastFrameNumber;
 
-		speex_bits_destroy(&speexBits);
+	// The stamped frame is timed again when it is decoded, and when it is mixed
+	if (payload.hasLatencyStamp && firstFrameNumber >= channel->playoutFrameNumber)
+	{
+		slot = channel->jitterSlots + ((unsigned) firstFrameNumber % VOICE_JITTER_BUFFER_COUNT);
+		if (slot->filled && slot->frameNumber==firstFrameNumber && slot->redundant==false)
+		{
+			slot->latencyStamped=true;
+			slot->arrivalTime=RakNet::GetTimeUS();
+			slot->upstreamMicroseconds=upstreamMicroseconds;
+		}
 	}
+
+	// Fill in any previous frames that never arrived from their copies
+	for (t=0; t < payload.redundantCount; t++)
+	{
+		if (firstFrameNumber-1-(int)t >= channel->playoutFrameNumber)
+			StoreJitterFrame(channel, firstFrameNumber-1-(int)t, payload.redundantFrames[t], payload.redundantLengths[t], true);
+	}
+	channel->redundantFramesSeen=payload.redundantCount;
+	channel->framesPerPacketSeen=payload.frameCount;
+	if (payload.endOfTalk)
+	{
+		channel->talkEnded=true;
+		channel->endOfTalkFrame=lastFrameNumber;
+	}
+
+	// Start visiting the channel in Update.  It waits for the next block, as it may already have been decoded for this one.
+	if (channel->playoutState!=VOICE_PLAYOUT_IDLE && voiceChannels.Activate(channel))
+		channel->copiedOutgoingBufferToBufferedOutput=true;
+
+	UpdateTargetDelay(channel, late);
+}
+void RakVoice::StoreJitterFrame(VoiceChannel *channel, int frameNumber, const unsigned char *data, unsigned length, bool redundant)
+{
+	VoiceJitterSlot *slot = channel->jitterSlots + ((unsigned) frameNumber % VOICE_JITTER_BUFFER_COUNT);
+
+	// Already have it.  A copy is only replaced by the frame itself.
+	if (slot->filled && slot->frameNumber==frameNumber && (redundant || slot->redundant==false))
+		return;
+	if (length==0 || length > VOICE_JITTER_MAX_FRAME_BYTES)
+		return;
+
+	memcpy(slot->data, data, length);
+	slot->length=(unsigned short) length;
+	slot->frameNumber=frameNumber;
+	slot->redundant=redundant;
+	slot->latencyStamped=false;
+	slot->filled=true;
+}
+int64_t RakVoice::RecordUpstreamLatency(VoiceChannel *channel, const VoiceLatencyStamp &stamp)
+{
+	RakNetGUID from;
+	uint32_t captureTime;
+	int64_t senderMicroseconds, networkMicroseconds;
+
+	// Arena memory isn't thread safe, but packets are only buffered from OnReceive, and in loopback mode from the serial part of Update
+	if (channel->latency==0)
+	{
+		channel->latency=(VoiceLatencyStatistics*) arena.Allocate(sizeof(VoiceLatencyStatistics));
+		if (channel->latency==0)
+			return 0;
+	}
+
+	// The stamp is in the clock of the system the packet came from, the relay if there is one.  Loopback is in our own clock.
+	captureTime=stamp.captureTime;
+	from = (channel->relayedBy!=UNASSIGNED_RAKNET_GUID) ? channel->relayedBy : channel->guid;
+	if (rakPeerInterface && from!=UNASSIGNED_RAKNET_GUID)
+		captureTime-=(uint32_t) rakPeerInterface->GetClockDifferential(from);
+
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_CAPTURE, (int64_t) stamp.captureUnits * VOICE_LATENCY_STAMP_UNIT_US);
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_ENCODE, (int64_t) stamp.encodeUnits * VOICE_LATENCY_STAMP_UNIT_US);
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_SEND_QUEUE, (int64_t) stamp.sendQueueUnits * VOICE_LATENCY_STAMP_UNIT_US);
+
+	// Whatever the sender didn't account for was spent getting here.  Intentional overflow.
+	senderMicroseconds=((int64_t) stamp.captureUnits + stamp.encodeUnits + stamp.sendQueueUnits) * VOICE_LATENCY_STAMP_UNIT_US;
+	networkMicroseconds=(int64_t) (int32_t) (RakNet::GetTimeMS() - captureTime) * 1000 - senderMicroseconds;
+	if (networkMicroseconds < 0)
+		networkMicroseconds=0;
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_NETWORK, networkMicroseconds);
+	return senderMicroseconds + networkMicroseconds;
+}
+bool RakVoice::PickSpeaker(VoiceChannel *channel, const VoicePayload &payload, RakNet::TimeMS currentTime)
+{
+	VoiceChannel *quietest, *other;
+	unsigned i;
+
+	if (payload.hasEnergy)
+		channel->speakerLevel=UpdateSpeakerLevel(channel->speakerLevel, payload.energy);
+	if (maxSpeakers==0 || channel->speakerPicked)
+		return true;
+
+	if (speakerStatistics.speakers >= maxSpeakers)
+	{
+		// Picked channels are always active, so only the talkers are searched
+		quietest=0;
+		for (i=0; i < voiceChannels.ActiveSize(); i++)
+		{
+			other=voiceChannels.GetActive(i);
+			if (other->speakerPicked && (quietest==0 || other->speakerLevel < quietest->speakerLevel))
+				quietest=other;
+		}
+
+		// Only take the place of a talker who has had it a while, and is clearly quieter
+		if (quietest==0 || channel->speakerLevel < quietest->speakerLevel + VOICE_SPEAKER_HYSTERESIS_DB ||
+			currentTime - quietest->speakerPickedTime < VOICE_SPEAKER_HOLD_MS)
+			return false;
+
+		// They play out what they already sent, then stop
+		if (quietest->playoutState!=VOICE_PLAYOUT_IDLE && quietest->talkEnded==false)
+		{
+			quietest->talkEnded=true;
+			quietest->endOfTalkFrame=quietest->newestFrameNumber;
+		}
+		DropSpeaker(quietest);
+		speakerStatistics.speakersReplaced++;
+	}
+	else
+		speakerStatistics.speakersPicked++;
+
+	channel->speakerPicked=true;
+	channel->speakerPickedTime=currentTime;
+	speakerStatistics.speakers++;
+
+	// Picked channels stay active until they go quiet, so there is always someone to take the place of
+	if (voiceChannels.Activate(channel))
+		channel->copiedOutgoingBufferToBufferedOutput=true;
+	return true;
+}
+void RakVoice::DropSpeaker(VoiceChannel *channel)
+{
+	if (channel->speakerPicked==false)
+		return;
+	channel->speakerPicked=false;
+	RakAssert(speakerStatistics.speakers>0);
+	speakerStatistics.speakers--;
+}
+void RakVoice::RecordDownstreamLatency(VoiceChannel *channel)
+{
+	int64_t mixMicroseconds, playoutMicroseconds;
+
+	channel->latencyPending=false;
+	mixMicroseconds=(int64_t) (RakNet::GetTimeUS() - channel->latencyDecodeTime);
+	// Fall back on the echo path when nothing measured how much is queued ahead of the block
+	if (playoutDelaySet)
+		playoutMicroseconds=(int64_t) playoutDelay;
+	else
+		playoutMicroseconds=(int64_t) echoPlaybackDelayMS * 1000;
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_MIX, mixMicroseconds);
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_PLAYOUT, playoutMicroseconds);
+	RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_MOUTH_TO_EAR, channel->latencyMicroseconds + mixMicroseconds + playoutMicroseconds);
+}
+void RakVoice::UpdateTargetDelay(VoiceChannel *channel, bool late)
+{
+	unsigned wanted;
+	float frameTimeMS = (float) channel->speexIncomingFrameSampleCount * 1000.0f / (float) channel->remoteSampleRate;
+
+	// Hold enough to cover three times the average jitter, on top of the frame being played
+	// Wait long enough for the redundant copies of a lost frame to arrive, if the sender repeats frames
+	// Frames arrive a packet at a time, so hold the rest of a packet as well
+	wanted = VOICE_JITTER_MIN_DELAY + channel->redundantFramesSeen + (channel->framesPerPacketSeen - 1) + (unsigned) (channel->jitterMS * 3.0f / frameTimeMS);
+	if (late && wanted <= channel->targetDelayFrames)
+		wanted = channel->targetDelayFrames + 1;
+	if (wanted > VOICE_JITTER_MAX_DELAY)
+		wanted = VOICE_JITTER_MAX_DELAY;
+
+	// Grow straight away, but only shrink one frame at a time once the network has been clean for a while
+	if (wanted > channel->targetDelayFrames)
+	{
+		channel->targetDelayFrames=wanted;
+		channel->cleanFrames=0;
+	}
+	else if (wanted < channel->targetDelayFrames && channel->cleanFrames >= VOICE_JITTER_SHRINK_FRAMES)
+	{
+		channel->targetDelayFrames--;
+		channel->cleanFrames=0;
+	}
+}
+void RakVoice::StartPlayoutWhenBuffered(VoiceChannel *channel)
+{
+	unsigned framesPerBlock;
+
+	if (channel->playoutState!=VOICE_PLAYOUT_BUFFERING)
+		return;
+
+	// Start once the target delay is buffered.  Short bursts of speech may never fill it, so don't wait longer than the delay either.
+	// Once the end of talk is flagged there is nothing more to wait for.
+	if (GetJitterDepth(channel) >= channel->targetDelayFrames || channel->bufferingFrames >= channel->targetDelayFrames || channel->talkEnded)
+	{
+		channel->playoutState=VOICE_PLAYOUT_PLAYING;
+		channel->concealedInARow=0;
+		return;
+	}
+
+	// A block of silence is played instead
+	framesPerBlock = bufferSizeBytes / (channel->speexIncomingFrameSampleCount * SAMPLESIZE);
+	channel->bufferingFrames+=(framesPerBlock > 0) ? framesPerBlock : 1;
+}
+bool RakVoice::PlayoutFrame(VoiceChannel *channel)
+{
+	char tempOutput[2048];
+	VoiceJitterSlot *slot;
+	SpeexBits *speexBits=(SpeexBits*)channel->dec_bits;
+
+	if (channel->playoutState!=VOICE_PLAYOUT_PLAYING)
+		return false;
+
+	// Running behind the target delay, so skip a frame to catch up.  It is still decoded to keep the decoder in step.
+	if (GetJitterDepth(channel) > channel->targetDelayFrames + 1)
+	{
+		slot = channel->jitterSlots + ((unsigned) channel->playoutFrameNumber % VOICE_JITTER_BUFFER_COUNT);
+		if (slot->filled && slot->frameNumber==channel->playoutFrameNumber)
+		{
+			speex_bits_read_from(speexBits, slot->data, slot->length);
+			speex_decode_int(channel->dec_state, speexBits, (spx_int16_t*)tempOutput);
+			slot->filled=false;
+			channel->playoutFrameNumber++;
+			channel->jitterStatistics.discardedFrames++;
+		}
+	}
+
+	slot = channel->jitterSlots + ((unsigned) channel->playoutFrameNumber % VOICE_JITTER_BUFFER_COUNT);
+	if (slot->filled && slot->frameNumber==channel->playoutFrameNumber)
+	{
+		// Each channel is only decoded by one job at a time, so its histograms can be written from here
+		if (slot->latencyStamped && channel->latency)
+		{
+			channel->latencyDecodeTime=RakNet::GetTimeUS();
+			RecordVoiceLatency(channel->latency->hops+VOICE_LATENCY_JITTER_BUFFER, (int64_t) (channel->latencyDecodeTime - slot->arrivalTime));
+			channel->latencyMicroseconds=slot->upstreamMicroseconds + (int64_t) (channel->latencyDecodeTime - slot->arrivalTime);
+			channel->latencyPending=true;
+		}
+		speex_bits_read_from(speexBits, slot->data, slot->length);
+		speex_decode_int(channel->dec_state, speexBits, (spx_int16_t*)tempOutput);
+		slot->filled=false;
+		if (slot->redundant)
+			channel->jitterStatistics.recoveredFrames++;
+		channel->concealedInARow=0;
+		channel->cleanFrames++;
+	}
+	else
+	{
+		// Nothing left to play, so the talker has most likely stopped.  Wait for them to start again.
+		// If they flagged where they stopped, nothing past it is concealed.
+		if ((channel->talkEnded && channel->playoutFrameNumber > channel->endOfTalkFrame) ||
+			(channel->concealedInARow >= VOICE_JITTER_MAX_CONCEAL && GetJitterDepth(channel)==0))
+		{
+			channel->playoutState=VOICE_PLAYOUT_IDLE;
+			return false;
+		}
+
+		// Lost or late, write a 'message skipped' interpolation
+		speex_decode_int(channel->dec_state, 0, (spx_int16_t*)tempOutput);
+		channel->concealedInARow++;
+		channel->jitterStatistics.concealedFrames++;
+	}
+
+	channel->playoutFrameNumber++;
+	channel->jitterStatistics.framesPlayed++;
+	WriteOutputToChannel(channel, tempOutput);
+	return true;
+}
+void RakVoice::ResetJitterBuffer(VoiceChannel *channel, int frameNumber)
+{
+	for (unsigned i=0; i < VOICE_JITTER_BUFFER_COUNT; i++)
+		channel->jitterSlots[i].filled=false;
+	channel->playoutFrameNumber=frameNumber;
+	channel->playoutState=VOICE_PLAYOUT_BUFFERING;
+	channel->bufferingFrames=0;
+	channel->concealedInARow=0;
+	channel->cleanFrames=0;
+	channel->hasTransit=false;
+	channel->talkEnded=false;
+}
+unsigned RakVoice::GetJitterDepth(const VoiceChannel *channel) const
+{
+	// Frames from the one about to play up to the newest received, lost ones included
+	if (channel->jitterStarted==false || channel->newestFrameNumber < channel->playoutFrameNumber)
+		return 0;
+	return (unsigned) (channel->newestFrameNumber - channel->playoutFrameNumber + 1);
 }
 void RakVoice::WriteOutputToChannel(VoiceChannel *channel, char *dataToWrite)
 {
@@ -16,8 +16,10 @@
 
 #include "RakNetTypes.h"
 #include "PluginInterface2.h"
-#include "DS_OrderedList.h"
 #include "NativeTypes.h"
+#include "VoiceArena.h"
+
+class VoiceWorkerPool;
 
 namespace RakNet {
 
@@ -25,38 +27,521 @@ class RakPeerInterface;
 
 // How many frames large to make the circular buffers in the VoiceChannel structure
 #define FRAME_OUTGOING_BUFFER_COUNT 100
-#define FRAME_INCOMING_BUFFER_COUNT 100
+// Incoming frames wait in the jitter buffer, so the decoded buffer only ever holds about one output block
+#define FRAME_INCOMING_BUFFER_COUNT 4
+
+// Size of the per channel jitter buffer, in speex frames (20 ms each).  Must be a power of two.
+#define VOICE_JITTER_BUFFER_COUNT 32
+// Largest encoded speex frame the jitter buffer will hold.  Frame lengths are sent in one byte.
+#define VOICE_JITTER_MAX_FRAME_BYTES 255
+// Range of the playout delay, in speex frames
+#define VOICE_JITTER_MIN_DELAY 1
+#define VOICE_JITTER_MAX_DELAY 16
+// Lost frames concealed in a row before the talker is treated as having stopped talking
+#define VOICE_JITTER_MAX_CONCEAL 3
+// Frames that have to play without a late packet before the playout delay is allowed to shrink by one frame
+#define VOICE_JITTER_SHRINK_FRAMES 50
+
+// Most previous frames that can be repeated in each voice packet, as redundancy against packet loss
+#define VOICE_FEC_MAX_FRAMES 2
+// Speex quality the repeated frames are encoded at.  2 is about 6 kbps in narrowband.
+#define VOICE_FEC_QUALITY 2
+
+// How often the adaptive quality controller samples the outgoing channels, in milliseconds
+#define VOICE_ADAPT_INTERVAL_MS 250
+// Least time between steps down the quality ladder, so one burst of queueing doesn't drop straight to the bottom
+#define VOICE_ADAPT_HOLD_MS 1000
+// Time without congestion before a step back up, in milliseconds.  Redundancy and complexity recover at the same pace.
+#define VOICE_ADAPT_RECOVER_MS 5000
+// Steps of the quality ladder.  Each step down sends fewer bits in fewer, larger packets.
+#define VOICE_ADAPT_LEVELS 5
+// Packet loss over the last second, as a fraction, above which one and then two redundant copies are sent
+#define VOICE_ADAPT_LOSS_ONE_COPY 0.03f
+#define VOICE_ADAPT_LOSS_TWO_COPIES 0.10f
+// Rise of the round trip time over the lowest seen, in milliseconds, that means the link is queueing
+#define VOICE_ADAPT_RTT_RISE_MS 100
+// Bytes in RakNet's send buffer that, if still growing, mean the link is falling behind
+#define VOICE_ADAPT_SEND_BUFFER_BYTES 2048
+// Time spent encoding a frame, as a fraction of its length, above which complexity is lowered and below which it may rise again
+#define VOICE_ADAPT_ENCODE_HIGH 0.25f
+#define VOICE_ADAPT_ENCODE_LOW 0.08f
+
+// Longest echo the echo canceller removes, after the playback delay
+#define VOICE_ECHO_DEFAULT_TAIL_MS 200
+// Speex frames the played sound may get ahead of the recorded sound by, as the two clocks drift, before the oldest is dropped
+#define VOICE_ECHO_MAX_DRIFT_FRAMES 4
+
+// Channels the channel table is first allocated for.  It doubles whenever it fills up.
+#define VOICE_CHANNEL_TABLE_MIN_CAPACITY 8
+
+// Talkers that can be heard at once.  Each is given a playback voice from a fixed pool when it starts talking.
+#define VOICE_PLAYBACK_VOICES 16
+
+// Most speex frames bundled into one voice packet
+#define VOICE_MAX_FRAMES_PER_PACKET 4
+// Encoded frames kept by the sender, enough for a full packet and the copies of the frames before it
+#define VOICE_ENCODED_FRAME_COUNT (VOICE_MAX_FRAMES_PER_PACKET+VOICE_FEC_MAX_FRAMES)
+
+// Flag in the frame count byte of ID_RAKVOICE_DATA, set on the last packet of a talk spurt
+#define VOICE_PAYLOAD_END_OF_TALK 0x20
+// Flag in the frame count byte of ID_RAKVOICE_DATA, set when a VoiceLatencyStamp follows it
+#define VOICE_PAYLOAD_LATENCY_STAMP 0x40
+// Flag in the frame count byte of ID_RAKVOICE_DATA, set when the loudness of the packet's frames follows it
+#define VOICE_PAYLOAD_ENERGY 0x80
+// Loudness of a silent frame, in dB above -VOICE_ENERGY_FULL_SCALE dB full scale.  Full scale is VOICE_ENERGY_FULL_SCALE.
+#define VOICE_ENERGY_SILENT 0
+#define VOICE_ENERGY_FULL_SCALE 127
+// dB a talker outside the loudest has to be above the quietest of them to take their place
+#define VOICE_SPEAKER_HYSTERESIS_DB 6
+// Shortest time a talker keeps a place among the loudest before a louder one can take it
+#define VOICE_SPEAKER_HOLD_MS 1000
+// How quickly a talker's level follows louder and quieter packets, as the fraction of the difference taken each packet
+#define VOICE_SPEAKER_ATTACK 0.5f
+#define VOICE_SPEAKER_RELEASE 0.1f
+// Bytes a VoiceLatencyStamp takes up in a packet
+#define VOICE_LATENCY_STAMP_SIZE 10
+// Microseconds in each unit of the times in a VoiceLatencyStamp, so each fits in an unsigned short
+#define VOICE_LATENCY_STAMP_UNIT_US 100
+// Buckets in a VoiceLatencyHistogram.  The limit of each is given by GetVoiceLatencyBucketLimit.
+#define VOICE_LATENCY_BUCKETS 24
+// Most frames counted for a push to talk pause, so the message numbers never jump by half their range
+#define VOICE_TALK_MAX_PAUSE_FRAMES 16384
+
+// ID_RAKVOICE_DATA is laid out as [MessageID][unsigned short message number of the first frame]
+// [unsigned char frame count - 1 in bits 0-2, redundant frame count in bits 3-4, VOICE_PAYLOAD_END_OF_TALK, VOICE_PAYLOAD_LATENCY_STAMP, VOICE_PAYLOAD_ENERGY]
+// [unsigned char loudness of the loudest frame, if flagged][VoiceLatencyStamp of the first frame, if flagged]
+// [unsigned char length of each redundant frame][unsigned char length of each frame but the last]
+// [redundant frames, newest first][frames, oldest first]
+// where the redundant frames are low bitrate copies of the frames before the first one.
+// A packet of just the frame count byte with only VOICE_PAYLOAD_END_OF_TALK set carries no frames, and marks
+// the end of talk after the frames sent before its message number.
+
+/// \brief How a channel's outgoing voice is split into packets
+/// Both systems offer a profile when a channel is opened, and the channel uses the larger frame count and send interval of the two.
+/// That way a loaded server can hold every client to fewer packets a second.
+struct VoicePacketProfile
+{
+	/// Speex frames (20 ms each) bundled into one packet, 1 to VOICE_MAX_FRAMES_PER_PACKET
+	unsigned char framesPerPacket;
+	/// Longest the first frame of a packet waits for the rest to be encoded, in milliseconds
+	unsigned short sendIntervalMS;
+};
+
+/// One frame per packet, sent as soon as it is encoded
+static const VoicePacketProfile VOICE_PROFILE_LOW_LATENCY = { 1, 20 };
+/// Three frames per packet.  A third of the packets and shared header bytes, for 40 ms more latency.
+static const VoicePacketProfile VOICE_PROFILE_BANDWIDTH = { 3, 60 };
+
+/// Returns the profile a channel uses, when one system offers \a a and the other \a b
+VoicePacketProfile NegotiatePacketProfile(const VoicePacketProfile &a, const VoicePacketProfile &b);
+
+/// When the first frame of a packet was recorded, and how long it took to leave the sender.  Carried in ID_RAKVOICE_DATA
+/// when the sender has latency stamps on, and used by listeners to measure mouth to ear latency.
+struct VoiceLatencyStamp
+{
+	/// RakNet::GetTimeMS() the frame's first sample was recorded at, in the clock of the system the packet came from.
+	/// A relay converts it to its own clock, so listeners only need the clock differential of the system they are connected to.
+	uint32_t captureTime;
+	/// Time from being recorded to being encoded, in VOICE_LATENCY_STAMP_UNIT_US, spent in the capture ring and the outgoing buffer
+	unsigned short captureUnits;
+	/// Time spent in the echo canceller, the preprocessor and the encoders
+	unsigned short encodeUnits;
+	/// Time from being encoded until its packet was built, waiting for the rest of the packet
+	unsigned short sendQueueUnits;
+};
+
+/// \internal
+/// Writes \a stamp to the VOICE_LATENCY_STAMP_SIZE bytes at \a data
+void WriteVoiceLatencyStamp(unsigned char *data, const VoiceLatencyStamp &stamp);
+
+/// Returns the loudness of \a count samples, VOICE_ENERGY_SILENT to VOICE_ENERGY_FULL_SCALE, as carried in ID_RAKVOICE_DATA
+unsigned char GetVoiceEnergy(const short *samples, unsigned count);
+
+/// Follows a talker's loudness packet by packet, quickly when it gets louder and slowly when it gets quieter,
+/// so a pause between words doesn't lose the talker their place among the loudest
+float UpdateSpeakerLevel(float level, unsigned char energy);
+
+/// \internal
+/// The frames found in the payload of ID_RAKVOICE_DATA, after the message number
+struct VoicePayload
+{
+	unsigned frameCount;
+	const unsigned char *frames[VOICE_MAX_FRAMES_PER_PACKET];
+	unsigned frameLengths[VOICE_MAX_FRAMES_PER_PACKET];
+	unsigned redundantCount;
+	const unsigned char *redundantFrames[VOICE_FEC_MAX_FRAMES];
+	unsigned redundantLengths[VOICE_FEC_MAX_FRAMES];
+	// The talker stopped after the last of these frames
+	bool endOfTalk;
+	// When the first frame was recorded, if the sender stamps its packets, and where the stamp is for a relay rewriting it
+	bool hasLatencyStamp;
+	VoiceLatencyStamp latencyStamp;
+	unsigned latencyStampOffset;
+	// Loudness of the loudest frame, VOICE_ENERGY_SILENT to VOICE_ENERGY_FULL_SCALE, if the sender sent it
+	bool hasEnergy;
+	unsigned char energy;
+};
+
+/// \internal
+/// Finds the frames in a voice payload
+/// \return false if the payload is malformed
+bool ParseVoicePayload(const unsigned char *data, unsigned length, VoicePayload *payload);
+
+/// \internal
+/// A frame of the outgoing stream, kept until every channel has sent it and its redundant copy
+struct VoiceEncodedFrame
+{
+	unsigned length;
+	unsigned redundantLength;
+	// Loudness of the frame after the preprocessor
+	unsigned char energy;
+	// When its first sample was recorded, and when encoding it started and finished
+	RakNet::TimeUS captureTime, encodeStartTime, encodeEndTime;
+	char data[VOICE_JITTER_MAX_FRAME_BYTES];
+	char redundantData[VOICE_JITTER_MAX_FRAME_BYTES];
+};
+
+/// Playout state of a channel's jitter buffer
+enum VoicePlayoutState
+{
+	/// Nothing to play, waiting for the talker to start
+	VOICE_PLAYOUT_IDLE,
+	/// The talker started, waiting for the buffer to fill up to the playout delay
+	VOICE_PLAYOUT_BUFFERING,
+	/// Playing one frame per frame of output
+	VOICE_PLAYOUT_PLAYING,
+};
+
+/// Cost and health of the echo canceller, as returned by RakVoice::GetEchoStatistics
+struct VoiceEchoStatistics
+{
+	/// Samples in each frame cancelled.  The cost of a frame grows with this and the tail length.
+	unsigned frameSamples;
+	/// Frames the echo canceller has run on
+	unsigned framesCancelled;
+	/// Time spent cancelling echo, in microseconds
+	RakNet::TimeUS totalMicroseconds;
+	/// Time spent on the last frame, in microseconds
+	RakNet::TimeUS lastFrameMicroseconds;
+	/// Time spent on the slowest frame, in microseconds
+	RakNet::TimeUS maxFrameMicroseconds;
+	/// Recorded frames cancelled against silence, because nothing had been played for them yet
+	unsigned referenceUnderruns;
+	/// Played samples dropped, because recording fell behind playback
+	unsigned referenceOverrunSamples;
+};
+
+/// What the adaptive quality controller last measured and chose, as returned by RakVoice::GetAdaptiveStatistics
+struct VoiceAdaptiveStatistics
+{
+	/// Step of the quality ladder, 0 being the best
+	unsigned level;
+	/// Speex quality and complexity of the outgoing stream
+	int quality;
+	int complexity;
+	/// Least frames bundled into each packet, on top of what each channel negotiated
+	unsigned framesPerPacket;
+	/// Redundant copies sent in each packet
+	unsigned redundantFrames;
+	/// Worst packet loss over the last second of the outgoing channels, as a fraction
+	float packetLoss;
+	/// Worst round trip time of the outgoing channels, and the lowest seen, in milliseconds
+	int rttMS;
+	int lowestRttMS;
+	/// Bytes waiting in RakNet's send buffers for the outgoing channels
+	unsigned sendBufferBytes;
+	/// Recorded bytes waiting to be encoded
+	unsigned unencodedBytes;
+	/// Time spent encoding each frame, as a fraction of the frame's length
+	float encodeLoad;
+	/// Times the controller stepped down and back up the quality ladder
+	unsigned stepsDown;
+	unsigned stepsUp;
+};
+
+/// Time spent in each stage of the voice pipeline since Init, as returned by RakVoice::GetStageStatistics
+struct VoiceStageStatistics
+{
+	/// Times Update ran
+	uint64_t updates;
+	/// Speex frames encoded, and packets built from them
+	uint64_t framesEncoded;
+	uint64_t packetsBuilt;
+	/// Microseconds in the preprocessor, the speex encoder, and building packets.  The echo canceller is in VoiceEchoStatistics.
+	uint64_t preprocessMicroseconds;
+	uint64_t encodeMicroseconds;
+	uint64_t packetizeMicroseconds;
+	/// Microseconds Update spent decoding the channels, and mixing them.  With a worker pool, decoding is the time spent waiting on the jobs.
+	uint64_t decodeMicroseconds;
+	uint64_t mixMicroseconds;
+	/// Channels Update decoded and mixed, added up over every update.  Only channels with something to play are visited.
+	uint64_t channelsVisited;
+	/// Blocks returned by ReceiveFrame with nothing mixed into them
+	uint64_t silentBlocks;
+};
+
+/// Statistics of a channel's jitter buffer, as returned by RakVoice::GetJitterStatistics
+struct VoiceJitterStatistics
+{
+	/// Frames received and waiting to be played
+	unsigned depthFrames;
+	/// How many frames the buffer is currently trying to hold
+	unsigned targetDelayFrames;
+	/// Smoothed variation in packet transit time, in milliseconds
+	float jitterMS;
+	/// Frames played out, including concealed ones
+	unsigned framesPlayed;
+	/// Frames that arrived after they were due to play, and were dropped
+	unsigned lateDrops;
+	/// Frames interpolated by speex for packets that were lost or late
+	unsigned concealedFrames;
+	/// Frames skipped to bring the delay back down to the target
+	unsigned discardedFrames;
+	/// Frames decoded from a redundant copy, because their own packet was lost or late
+	unsigned recoveredFrames;
+};
+
+/// Stages a frame goes through from the talker's microphone to the listener's speaker
+enum VoiceLatencyHop
+{
+	/// Recorded, and waiting in the capture ring and outgoing buffer to be encoded
+	VOICE_LATENCY_CAPTURE,
+	/// The echo canceller, the preprocessor and the encoders
+	VOICE_LATENCY_ENCODE,
+	/// Encoded, and waiting for the rest of its packet
+	VOICE_LATENCY_SEND_QUEUE,
+	/// RakNet's send buffer, the network, and the relay if there is one.  Measured against the clock differential, so only as good as it is.
+	VOICE_LATENCY_NETWORK,
+	/// Waiting in the listener's jitter buffer to be decoded
+	VOICE_LATENCY_JITTER_BUFFER,
+	/// Decoded, and waiting to be mixed into the output
+	VOICE_LATENCY_MIX,
+	/// From the mix to the speaker.  Measured by the sound adapter through SetPlayoutDelay, otherwise the playback delay given to SetEchoPath.
+	VOICE_LATENCY_PLAYOUT,
+	/// Every stage above, from the microphone to the speaker
+	VOICE_LATENCY_MOUTH_TO_EAR,
+	VOICE_LATENCY_HOP_COUNT
+};
+
+/// How long one stage took for the frames measured, bucketed so percentiles can be read off
+struct VoiceLatencyHistogram
+{
+	/// Frames in each bucket.  Bucket i holds times up to GetVoiceLatencyBucketLimit(i) microseconds.
+	unsigned buckets[VOICE_LATENCY_BUCKETS];
+	unsigned count;
+	uint64_t totalMicroseconds;
+	unsigned maxMicroseconds;
+};
+
+/// Latency of a talker's stream, stage by stage, as returned by RakVoice::GetLatencyStatistics
+/// Only the first frame of each stamped packet is measured.
+struct VoiceLatencyStatistics
+{
+	VoiceLatencyHistogram hops[VOICE_LATENCY_HOP_COUNT];
+};
+
+/// Adds a time, in microseconds, to a histogram.  Negative times, from the clock differential being off, count as 0.
+void RecordVoiceLatency(VoiceLatencyHistogram *histogram, int64_t microseconds);
+
+/// Returns the upper limit of a bucket of VoiceLatencyHistogram, in microseconds
+unsigned GetVoiceLatencyBucketLimit(unsigned bucket);
+
+/// Returns the limit of the bucket that \a fraction of the times in a histogram are within, such as 0.95f for the 95th percentile, or 0 if it is empty
+unsigned GetVoiceLatencyPercentile(const VoiceLatencyHistogram &histogram, float fraction);
+
+/// One talker's stream on a playback voice, from when it started talking, as returned by RakVoice::GetPlaybackStreams
+struct VoicePlaybackStream
+{
+	/// The talker heard on the voice
+	RakNetGUID talker;
+	/// When the talker was given the voice
+	RakNet::TimeMS startTime;
+	/// Frames played on the voice so far, including concealed ones
+	unsigned framesPlayed;
+	/// Frames on the voice interpolated by speex for packets that were lost or late
+	unsigned concealedFrames;
+};
+
+/// Use of the playback voices, as returned by RakVoice::GetPlaybackStatistics
+struct VoicePlaybackStatistics
+{
+	/// Voices in the pool
+	unsigned voices;
+	/// Voices currently playing a talker
+	unsigned voicesInUse;
+	/// Streams given a voice
+	unsigned streamsStarted;
+	/// Streams that went quiet or were closed, and gave their voice back
+	unsigned streamsFinished;
+	/// Streams that started while every voice was in use.  They are decoded but not heard until a voice is free.
+	unsigned streamsRefused;
+	/// Total and longest length of the finished streams, in milliseconds
+	RakNet::TimeMS totalStreamMS;
+	RakNet::TimeMS longestStreamMS;
+};
+
+/// How the loudest talkers were picked, as returned by RakVoice::GetSpeakerStatistics
+struct VoiceSpeakerStatistics
+{
+	/// Most talkers decoded at once, or 0 for every talker
+	unsigned maxSpeakers;
+	/// Talkers currently among the loudest
+	unsigned speakers;
+	/// Times a talker was picked because there was a free place, and because they were louder than one already picked
+	unsigned speakersPicked;
+	unsigned speakersReplaced;
+	/// Packets and frames dropped without decoding, as their talker wasn't among the loudest
+	uint64_t packetsSkipped;
+	uint64_t framesSkipped;
+};
+
+/// \internal
+/// A voice from the playback pool, and the channel's counters when it was given out
+struct VoicePlaybackVoice
+{
+	VoicePlaybackStream stream;
+	unsigned framesPlayedAtStart;
+	unsigned concealedFramesAtStart;
+};
+
+/// \internal
+/// One encoded frame waiting in a jitter buffer
+struct VoiceJitterSlot
+{
+	int frameNumber;
+	unsigned short length;
+	bool filled;
+	bool redundant;	// Holds a low bitrate copy from a later packet
+	// The first frame of a stamped packet, when it arrived, and how long it took to get here from the talker's microphone
+	bool latencyStamped;
+	RakNet::TimeUS arrivalTime;
+	int64_t upstreamMicroseconds;
+	char data[VOICE_JITTER_MAX_FRAME_BYTES];
+};
 
 /// \internal
 struct VoiceChannel
 {
 	RakNetGUID guid;
-	void *enc_state;
 	void *dec_state;
-	void *pre_state;
+	// SpeexBits the decoder reads each frame from, kept for the life of the channel
+	void *dec_bits;
 	unsigned int remoteSampleRate;
-	
-	// Circular buffer of unencoded sound data read from the user.
-	char *outgoingBuffer;
-	// Each frame sent to speex requires this many samples, of whatever size you are using.
-	int speexOutgoingFrameSampleCount;
-	// Index in is bytes.
-	// Write index points to the next byte to write to, which must be free.
-	unsigned outgoingReadIndex, outgoingWriteIndex;
+
+	// The outgoing stream is encoded once by RakVoice and shared by every channel, so only the send bookkeeping is per channel
 	bool isSendingVoiceData;
-	bool bufferOutput;
-	bool copiedOutgoingBufferToBufferedOutput;
+	// Counts speex frames, including those not sent because VAD detected no speech, so the receiver can use it as a timestamp
 	unsigned short outgoingMessageNumber;
+	// Negotiated when the channel was opened
+	VoicePacketProfile packetProfile;
+	// Encoded frames waiting to fill this channel's next packet, and when the first of them was encoded
+	unsigned pendingFrames;
+	RakNet::TimeMS pendingSince;
+
+	bool copiedOutgoingBufferToBufferedOutput;
+	// Bytes of incomingBuffer decoded for the block being mixed, set when the channel is decoded and cleared when it is mixed
+	unsigned bytesToMix;
 
 	// Circular buffer of unencoded sound data to be passed to the user.  Each element in the buffer is of size bufferSizeBytes bytes.
 	char *incomingBuffer;
 	int speexIncomingFrameSampleCount;
 	unsigned incomingReadIndex, incomingWriteIndex;	// Index in bytes
-	unsigned short incomingMessageNumber;  // The ID_VOICE message number we expect to get.  Used to drop out of order and detect how many missing packets in a sequence
 
-	RakNet::TimeMS lastSend;
+	// Jitter buffer of encoded frames, indexed by the sender's message number extended to 32 bits
+	VoiceJitterSlot *jitterSlots;
+	VoicePlayoutState playoutState;
+	bool jitterStarted;
+	int playoutFrameNumber;		// The next frame to play
+	int newestFrameNumber;		// The newest frame received
+	unsigned targetDelayFrames;
+	unsigned bufferingFrames;	// Frames of silence played while buffering
+	unsigned concealedInARow;
+	unsigned cleanFrames;		// Frames played since the target delay last grew or shrank
+	unsigned redundantFramesSeen;	// How many previous frames the sender repeats in each packet
+	unsigned framesPerPacketSeen;	// How many frames the sender bundles into each packet
+	float jitterMS;				// Interarrival jitter estimate, as in RFC 3550
+	bool talkEnded;				// The sender flagged the end of its talk spurt, at endOfTalkFrame
+	int endOfTalkFrame;
+	int lastTransitMS;
+	bool hasTransit;
+	VoiceJitterStatistics jitterStatistics;
+
+	// Latency of the stamped frames, allocated when the first one arrives.  A stamped frame decoded and waiting to be mixed,
+	// with when it was decoded and how long it took to get to the decoder.
+	VoiceLatencyStatistics *latency;
+	bool latencyPending;
+	RakNet::TimeUS latencyDecodeTime;
+	int64_t latencyMicroseconds;
+
+	// The voice the channel is heard on while it plays, or 0.  Set to waitingForVoice if none was free when it started.
+	VoicePlaybackVoice *playbackVoice;
+	bool waitingForVoice;
+
+	// The system this channel's voice arrives through, or UNASSIGNED_RAKNET_GUID if it comes from guid directly
+	RakNetGUID relayedBy;
+
+	// Where the channel is in the table's active list, or VOICE_CHANNEL_TABLE_EMPTY if it has nothing to play
+	unsigned activeIndex;
+
+	// Loudness of the talker, followed by UpdateSpeakerLevel.  Picked if among the loudest, and since when.  Always active while picked.
+	float speakerLevel;
+	bool speakerPicked;
+	RakNet::TimeMS speakerPickedTime;
+};
+
+/// \internal
+/// The open channels, looked up by GUID with an open addressing hash table.
+/// The channels themselves are kept packed together in one array, so looping over them walks contiguous memory and a
+/// lookup costs the same however many channels a relay holds.  Removing a channel moves the last one into its place,
+/// so indices and pointers are only valid until the next Insert or RemoveAtIndex.
+/// The channels with something to play are also kept in an active list, so Update only visits the talkers and not every
+/// channel that is open.  A channel is added when voice arrives for it, and removed once it has played out.
+class VoiceChannelTable
+{
+public:
+	VoiceChannelTable();
+	~VoiceChannelTable();
+
+	/// \return The index of the channel with \a key, if \a objectExists is set to true
+	unsigned GetIndexFromKey(const RakNetGUID &key, bool *objectExists) const;
+	/// \return true if there is a channel with \a key
+	bool HasData(const RakNetGUID &key) const;
+	/// Adds a zeroed channel for \a key, which must not already be in the table
+	/// \return The new channel, with only its guid set
+	VoiceChannel* Insert(const RakNetGUID &key);
+	/// Removes the channel at \a index, moving the last channel into its place.  Doesn't free what the channel points to.
+	void RemoveAtIndex(unsigned index);
+	/// Removes every channel and frees the table
+	void Clear(void);
+	unsigned Size(void) const {return channelCount;}
+	VoiceChannel* operator[](unsigned index) const {return channels+index;}
+
+	/// Adds \a channel to the active list, if it isn't already in it
+	/// \return false if it already was
+	bool Activate(VoiceChannel *channel);
+	/// Removes \a channel from the active list, moving the last active channel into its place
+	void Deactivate(VoiceChannel *channel);
+	unsigned ActiveSize(void) const {return activeCount;}
+	VoiceChannel* GetActive(unsigned index) const {return channels+active[index];}
+
+protected:
+	/// The home bucket of a GUID
+	unsigned GetBucket(const RakNetGUID &key) const;
+	/// The bucket holding a GUID, or bucketCount if it isn't in the table
+	unsigned FindBucket(const RakNetGUID &key) const;
+	void Grow(void);
+
+	// Index into channels for each bucket, or VOICE_CHANNEL_TABLE_EMPTY.  Linear probing, at most half full.
+	unsigned *buckets;
+	unsigned bucketCount;
+	unsigned bucketShift;	// 64 - log2(bucketCount)
+	VoiceChannel *channels;
+	unsigned channelCount;
+	unsigned channelCapacity;
+	// Index into channels of each active channel, in the order they became active.  Allocated for channelCapacity.
+	unsigned *active;
+	unsigned activeCount;
 };
-int VoiceChannelComp( const RakNetGUID &key, VoiceChannel * const &data );
 
 /// Voice compression and transmission interface
 class RAK_DLL_EXPORT RakVoice : public PluginInterface2
@@ -97,6 +582,89 @@ public:
 	/// \param[in] enable true to enable VBR, false to disable
 	void SetVBR(bool enable);
 
+	/// \brief Sets how many previous frames are repeated in each voice packet
+	/// The repeats come from a second encoder running at a low bitrate.  A receiver that lost a packet decodes its frame from a later
+	/// packet's copy instead of interpolating it, so voice holds up on lossy links without reliable sends and their extra latency.
+	/// Receivers raise their playout delay to cover the repeats.
+	/// \pre Only applies to encoder.
+	/// \param[in] frames 0 to VOICE_FEC_MAX_FRAMES.  0, the default, turns redundancy off.
+	void SetRedundancy(unsigned frames);
+
+	/// \brief Enables or disables echo cancellation
+	/// What ReceiveFrame returns is taken back out of what is passed to SendFrame, before the preprocessor, so
+	/// open speakers don't send everyone's voice back to them.  The residual echo is passed on to the preprocessor's noise filter.
+	/// \param[in] enable true to enable, false to disable
+	void SetEchoCancellation(bool enable);
+
+	/// \brief Describes the path from the speakers back to the microphone, for the echo canceller
+	/// \param[in] playbackDelayMS How long after ReceiveFrame returns a block it is heard, such as the length of the sound it is written to.
+	/// \param[in] tailMS The longest echo to cancel after that.  Longer tails cost more CPU per frame.
+	void SetEchoPath(unsigned playbackDelayMS, unsigned tailMS=VOICE_ECHO_DEFAULT_TAIL_MS);
+
+	/// \brief Mixes the incoming channels with 32 bit integers instead of floats
+	/// Both use the fastest SIMD kernels the CPU supports.  The integer mix skips converting every sample to and from float.
+	/// Takes effect from the next block returned by ReceiveFrame.
+	/// \param[in] enable true for the integer mix, false for the float mix (the default)
+	void SetFixedPointMix(bool enable);
+
+	/// \brief Runs the speex work of Update on a pool of threads
+	/// The outgoing stream is preprocessed and encoded as one job, and each channel is decoded as another, so they all run at once.
+	/// Update still waits for the jobs (helping run them) and mixes the channels in order afterwards, so it takes about as long as
+	/// the slowest job instead of all of them, and a channel's frames are never decoded out of order.
+	/// \param[in] pool The pool to use, or 0 to do everything on the thread calling Update (the default).  Must outlive RakVoice, or be unset first.
+	void SetWorkerPool(VoiceWorkerPool *pool);
+
+	/// \brief Adapts the outgoing stream to the link and the CPU, instead of leaving it as set
+	/// Every VOICE_ADAPT_INTERVAL_MS Update samples RakNet's statistics for each outgoing channel.  A growing send buffer or a rising
+	/// round trip time steps down a ladder of lower speex quality and more frames per packet, and a clean link steps back up.
+	/// Packet loss adds redundant copies, and encode time over budget lowers the complexity.
+	/// SetEncoderComplexity and SetRedundancy still set the highest complexity and the fewest copies used.
+	/// \param[in] enable true to adapt, false to go back to the fixed settings (the default)
+	void SetAdaptiveQuality(bool enable);
+
+	/// \brief Returns true if the outgoing stream adapts to the link and the CPU
+	bool IsAdaptiveQualityActive(void) const;
+
+	/// \brief Returns what the adaptive quality controller last measured and chose
+	/// \param[out] statistics Filled in with the statistics
+	void GetAdaptiveStatistics(VoiceAdaptiveStatistics *statistics) const;
+
+	/// \brief Starts or stops sending, such as for push to talk, without closing any channels
+	/// Frames passed to SendFrame while not talking are dropped.  When talking stops the last packet is flagged in band,
+	/// so receivers stop playing the stream straight away instead of concealing its tail, and when it starts again
+	/// the first frame is sent on its own.  Talking is on by default.
+	/// \param[in] talking true to send the frames passed to SendFrame
+	void SetTalking(bool talking);
+
+	/// \brief Returns true if the frames passed to SendFrame are sent
+	bool IsTalking(void) const;
+
+	/// \brief Stamps outgoing packets with when their first frame was recorded, so listeners can measure mouth to ear latency
+	/// Costs VOICE_LATENCY_STAMP_SIZE bytes a packet.  Stamped packets are measured whether this is on or not.
+	/// \param[in] enable true to stamp packets.  Off by default.
+	void SetLatencyStamps(bool enable);
+
+	/// \brief Tells RakVoice how long ago the first sample of the next block passed to SendFrame was recorded
+	/// Such as how long it waited in the sound device and a capture ring.  Only used for latency stamps.
+	/// \param[in] microseconds The age of the block.  It is cleared by SendFrame, so has to be set for every block.
+	void SetCaptureAge(RakNet::TimeUS microseconds);
+
+	/// \brief Tells RakVoice how long the block the next Update mixes will wait before it is heard
+	/// Such as what is already queued ahead of it in a playback ring and the sound device.  Only used for latency stamps.
+	/// \param[in] microseconds The delay.  It is cleared by Update, so has to be set for every block.  Without it the playback delay given to SetEchoPath is used.
+	void SetPlayoutDelay(RakNet::TimeUS microseconds);
+
+	/// \brief Only decodes the loudest talkers, by the loudness the senders put in each packet
+	/// Packets from other talkers are dropped as they arrive.  A talker keeps their place until they go quiet, or
+	/// a talker VOICE_SPEAKER_HYSTERESIS_DB louder takes it after VOICE_SPEAKER_HOLD_MS, so the talkers heard don't flap.
+	/// \param[in] maxSpeakers Most talkers decoded at once, or 0 (the default) to decode everyone
+	void SetMaxSpeakers(unsigned maxSpeakers);
+
+	/// \brief Sets the packet profile offered to systems when a channel is opened
+	/// Channels that are already open keep the profile they negotiated.
+	/// \param[in] profile VOICE_PROFILE_LOW_LATENCY (the default), VOICE_PROFILE_BANDWIDTH, or your own
+	void SetPacketProfile(const VoicePacketProfile &profile);
+
 	/// \brief Returns the complexity of the encoder
 	/// \pre Only applies to encoder.
 	/// \return a value from 0 to 10.
@@ -117,6 +685,56 @@ public:
 	/// \return true if VBR is active, false otherwise.
 	bool IsVBRActive();
 
+	/// \brief Returns how many previous frames are repeated in each voice packet
+	/// \pre Only applies to encoder.
+	/// \return a value from 0 to VOICE_FEC_MAX_FRAMES.
+	unsigned GetRedundancy(void) const;
+
+	/// \brief Returns the current state of echo cancellation
+	/// \return true if echo cancellation is active, false otherwise.
+	bool IsEchoCancellationActive(void) const;
+
+	/// \brief Returns true if the incoming channels are mixed with 32 bit integers
+	bool IsFixedPointMix(void) const;
+
+	/// \brief Returns the pool Update runs its speex work on, or 0 if it does it all itself
+	VoiceWorkerPool* GetWorkerPool(void) const;
+
+	/// \brief Returns the cost of the echo canceller so far
+	/// \param[out] statistics Filled in with the statistics, which are reset when echo cancellation is enabled
+	void GetEchoStatistics(VoiceEchoStatistics *statistics) const;
+
+	/// \brief Returns the packet profile offered to systems when a channel is opened
+	const VoicePacketProfile& GetPacketProfile(void) const;
+
+	/// \brief Returns the allocation counts of the memory used for channels and speex state
+	/// Once every channel has been opened once, heapAllocations stops rising however often channels are opened, closed, or sent voice.
+	/// \param[out] statistics Filled in with the statistics
+	void GetMemoryStatistics(VoiceArenaStatistics *statistics) const;
+
+	/// \brief Returns how the playback voices have been used
+	/// \param[out] statistics Filled in with the statistics
+	void GetPlaybackStatistics(VoicePlaybackStatistics *statistics) const;
+
+	/// \brief Returns the streams currently playing on a voice
+	/// \param[out] streams Filled in with up to \a maxStreams streams
+	/// \param[in] maxStreams How many elements \a streams holds.  VOICE_PLAYBACK_VOICES is always enough.
+	/// \return How many streams were written
+	unsigned GetPlaybackStreams(VoicePlaybackStream *streams, unsigned maxStreams) const;
+
+	/// \brief Returns how many channels have voice buffered or playing.  Update only decodes and mixes these.
+	unsigned GetActiveChannelCount(void) const;
+
+	/// \brief Returns the time spent in each stage of the pipeline since Init
+	/// \param[out] statistics Filled in with the statistics
+	void GetStageStatistics(VoiceStageStatistics *statistics) const;
+
+	/// \brief Returns the packet profile a channel negotiated
+	/// \param[in] guid The system to query
+	/// \param[out] profile Filled in with the channel's profile
+	/// \return false if there is no channel with \a guid
+	bool GetChannelPacketProfile(RakNetGUID guid, VoicePacketProfile *profile) const;
+
 	/// Shuts down RakVoice
 	void Deinit(void);
 	
@@ -134,7 +752,14 @@ public:
 	/// Other systems will get ID_RAKVOICE_CLOSE_CHANNEL
 	void CloseAllChannels(void);
 
+	/// \brief Sends voice data to every system with an open channel
+	/// The frame is preprocessed and encoded once in Update, and the same payload is sent on every channel.
+	/// \param[in] inputBuffer The voice data.  The size of inputBuffer should be what was specified as bufferSizeBytes in Init
+	/// \return false if there are no open channels to send to
+	bool SendFrame(void *inputBuffer);
+
 	/// \brief Sends voice data to a system on an open channel
+	/// All channels share one outgoing stream, so this is the same as SendFrame(inputBuffer) and should only be called once per frame.
 	/// \pre \a recipient must refer to a system with an open channel via RequestVoiceChannel
 	/// \param[in] recipient The system to send voice data to
 	/// \param[in] inputBuffer The voice data.  The size of inputBuffer should be what was specified as bufferSizeBytes in Init
@@ -145,6 +770,22 @@ public:
 	/// \return If we are sending voice data for the specified system
 	bool IsSendingVoiceDataTo(RakNetGUID recipient);
 
+	/// \brief Decodes voice data that a relay (such as a server) forwarded from another system
+	/// The packet is laid out as [MessageID][unsigned short message number][RakNetGUID talker][speex data].
+	/// A receive channel is opened for each talker the first time they are heard, using our own sample rate.
+	/// \param[in] packet The relayed packet, as returned by RakPeerInterface::Receive
+	void OnRelayedVoiceData(Packet *packet);
+
+	/// \brief Opens the receive channel of a talker heard through a relay before they first talk, so the decoder is ready for their first packet
+	/// \param[in] talker The talker's GUID, as written in the relayed packets
+	/// \param[in] relay The system forwarding their voice
+	/// \return false if RakVoice isn't initialized
+	bool PrepareRelayedChannel(RakNetGUID talker, RakNetGUID relay);
+
+	/// \brief Frees the receive channel of a talker heard through a relay
+	/// \param[in] talker The talker's GUID, as written in the relayed packets
+	void CloseRelayedChannel(RakNetGUID talker);
+
 	/// \brief Gets decoded voice data, from one or more remote senders
 	/// \param[out] outputBuffer The voice data.  The size of outputBuffer should be what was specified as bufferSizeBytes in Init
 	void ReceiveFrame(void *outputBuffer);
@@ -167,7 +808,8 @@ public:
 
 	/// How many bytes are on the write buffer, waiting to be passed to a call to RakPeer::Send (internally)
 	/// This should remain at a fairly small near-constant size as outgoing data is sent to the Send function
-	/// \param[in] guid The system to query, or RakNet::UNASSIGNED_SYSTEM_ADDRESS for the sum of all channels.
+	/// The write buffer is shared by every channel.
+	/// \param[in] guid The system to query, or RakNet::UNASSIGNED_SYSTEM_ADDRESS for any channel.
 	/// \return Number of bytes on the write buffer
 	unsigned GetBufferedBytesToSend(RakNetGUID guid) const;
 
@@ -177,6 +819,24 @@ public:
 	/// \return Number of bytes on the read buffer.
 	unsigned GetBufferedBytesToReturn(RakNetGUID guid) const;
 
+	/// Returns the jitter buffer statistics of a channel
+	/// The delay adapts to each channel's network conditions, growing under jitter and shrinking again when the network is clean.
+	/// \param[in] guid The system to query.  For voice heard through a relay, this is the talker's GUID.
+	/// \param[out] statistics Filled in with the channel's statistics
+	/// \return false if there is no channel with \a guid
+	bool GetJitterStatistics(RakNetGUID guid, VoiceJitterStatistics *statistics) const;
+
+	/// Returns the latency of a talker's stream, from their microphone to our speaker, stage by stage
+	/// The talker has to have latency stamps on.  See SetLatencyStamps.
+	/// \param[in] guid The system to query.  For voice heard through a relay, this is the talker's GUID.
+	/// \param[out] statistics Filled in with the channel's statistics
+	/// \return false if there is no channel with \a guid, or it hasn't received a stamped packet
+	bool GetLatencyStatistics(RakNetGUID guid, VoiceLatencyStatistics *statistics) const;
+
+	/// \brief Returns how the loudest talkers were picked.  See SetMaxSpeakers.
+	/// \param[out] statistics Filled in with the statistics
+	void GetSpeakerStatistics(VoiceSpeakerStatistics *statistics) const;
+
 	/// Enables/disables loopback mode
 	/// \param[in] true to enable, false to disable
 	void SetLoopbackMode(bool enabled);
@@ -196,24 +856,125 @@ protected:
 	void OnOpenChannelRequest(Packet *packet);
 	void OnOpenChannelReply(Packet *packet);
 	virtual void OnVoiceData(Packet *packet);
+	void BufferVoiceData(VoiceChannel *channel, unsigned short packetMessageNumber, const unsigned char *data, unsigned length);
+	void StoreJitterFrame(VoiceChannel *channel, int frameNumber, const unsigned char *data, unsigned length, bool redundant);
+	int64_t RecordUpstreamLatency(VoiceChannel *channel, const VoiceLatencyStamp &stamp);
+	void RecordDownstreamLatency(VoiceChannel *channel);
+	bool PickSpeaker(VoiceChannel *channel, const VoicePayload &payload, RakNet::TimeMS currentTime);
+	void DropSpeaker(VoiceChannel *channel);
+	void SendPendingFrames(VoiceChannel *channel, bool endOfTalk);
+	void ApplyTalking(RakNet::TimeMS currentTime);
+	void UpdateAdaptiveQuality(RakNet::TimeMS currentTime);
+	void ApplyAdaptiveQuality(void);
+	unsigned GetFramesPerPacket(const VoiceChannel *channel) const;
+	unsigned GetSendIntervalMS(const VoiceChannel *channel) const;
+	void EncodeOutgoingStream(RakNet::TimeMS currentTime);
+	void DecodeChannel(VoiceChannel *channel);
+	void MixChannel(VoiceChannel *channel, RakNet::TimeMS currentTime);
+	void AssignPlaybackVoice(VoiceChannel *channel, RakNet::TimeMS currentTime);
+	void ReleasePlaybackVoice(VoiceChannel *channel, RakNet::TimeMS currentTime);
+	VoiceEncodedFrame* GetEncodedFrame(unsigned age);
+	void UpdateTargetDelay(VoiceChannel *channel, bool late);
+	void StartPlayoutWhenBuffered(VoiceChannel *channel);
+	bool PlayoutFrame(VoiceChannel *channel);
+	void ResetJitterBuffer(VoiceChannel *channel, int frameNumber);
+	unsigned GetJitterDepth(const VoiceChannel *channel) const;
 	void OpenChannel(Packet *packet);
+	VoiceChannel* OpenRelayedChannel(RakNetGUID talker, RakNetGUID relay);
+	void FreeRelayedChannels(RakNetGUID relay);
 	void FreeChannelMemory(RakNetGUID recipient);
 	void FreeChannelMemory(unsigned index, bool removeIndex);
 	void WriteOutputToChannel(VoiceChannel *channel, char *dataToWrite);
-	void SetEncoderParameter(void* enc_state, int vartype, int val);
-	void SetPreprocessorParameter(void* pre_state, int vartype, int val);
+	void SetEncoderParameter(int vartype, int val);
+	void SetPreprocessorParameter(int vartype, int val);
+	bool HasOutgoingChannel(void) const;
+	void CreateEchoCanceller(void);
+	void FreeEchoCanceller(void);
+	void StoreEchoReference(const short *samples, unsigned count);
+	void ReadEchoReference(short *samples, unsigned count);
 	
-	DataStructures::OrderedList<RakNetGUID, VoiceChannel*, VoiceChannelComp> voiceChannels;
+	VoiceChannelTable voiceChannels;
 	int32_t sampleRate;
 	unsigned bufferSizeBytes;
 	float *bufferedOutput;
+	int32_t *bufferedOutputFixed;
 	unsigned bufferedOutputCount;
 	bool zeroBufferedOutput;
+	// A channel was mixed into the block since it was last zeroed, so it isn't silence
+	bool bufferedOutputMixed;
+	bool fixedPointMix, fixedPointMixRequested;
 	int defaultEncoderComplexity;
 	bool defaultVADState;
 	bool defaultDENOISEState;
 	bool defaultVBRState;
+	bool defaultEchoState;
+	unsigned echoPlaybackDelayMS;
+	unsigned echoTailMS;
+	unsigned redundantFrames, requestedRedundantFrames;
+	VoicePacketProfile packetProfile;
 	bool loopbackMode;
+	VoiceWorkerPool *workerPool;
+	// Push to talk.  Requested by SetTalking and applied at the start of Update, between encodes.
+	bool talkingRequested, talking;
+	// Send the next frame on its own, or flag the next packets as the end of talk
+	bool talkStarting, talkEnding;
+	RakNet::TimeMS talkStoppedTime;
+	// Latency stamps, and the age of the next block passed to SendFrame
+	bool latencyStamps;
+	RakNet::TimeUS captureAge;
+	// How long the block the next Update mixes waits to be heard, if the sound adapter measured it
+	bool playoutDelaySet;
+	RakNet::TimeUS playoutDelay;
+	// Loudest talkers decoded.  The number picked is in speakerStatistics.
+	unsigned maxSpeakers;
+	VoiceSpeakerStatistics speakerStatistics;
+	// Adaptive quality.  When it last sampled, last stepped down, and since when each measure has been clean.
+	bool adaptiveQuality;
+	RakNet::TimeMS adaptSampleTime, adaptStepDownTime, adaptCleanSince, adaptLossCleanSince, adaptEncodeCleanSince;
+	unsigned previousSendBufferBytes;
+	// Encode time of the frames since the last sample
+	RakNet::TimeUS encodeMicroseconds;
+	unsigned encodeFrames;
+	VoiceAdaptiveStatistics adaptiveStatistics;
+	VoiceStageStatistics stageStatistics;
+
+	// Channel buffers and speex state come from here, so opening and closing channels reuses memory instead of going to the heap
+	VoiceArena arena;
+
+	// Fixed pool of playback voices, allocated in Init, and a stack of the indices of the free ones
+	VoicePlaybackVoice *playbackVoices;
+	unsigned *freePlaybackVoices;
+	unsigned freePlaybackVoiceCount;
+	VoicePlaybackStatistics playbackStatistics;
+
+	// Outgoing stream, shared by every channel, and the SpeexBits each frame is encoded into
+	void *enc_state;
+	void *enc_bits;
+	void *pre_state;
+	// Low bitrate encoder for the redundant copies
+	void *fec_enc_state;
+	void *fec_enc_bits;
+	// Echo canceller, and the spectrum of the echo it left behind for the preprocessor
+	void *echo_state;
+	int32_t *echoResidual;
+	// Circular buffer of the samples ReceiveFrame returned, starting with the playback delay of silence.  Indices are in samples.
+	short *echoReference;
+	unsigned echoReferenceSize, echoReferenceReadIndex, echoReferenceCount;
+	VoiceEchoStatistics echoStatistics;
+	// The last frames encoded, for bundling into each channel's packets.  encodedFrameIndex is where the next one goes.
+	VoiceEncodedFrame encodedFrames[VOICE_ENCODED_FRAME_COUNT];
+	unsigned encodedFrameIndex;
+	// Frames encoded in a row since VAD last held one back
+	unsigned contiguousFrames;
+	// Circular buffer of unencoded sound data read from the user.
+	char *outgoingBuffer;
+	// Each frame sent to speex requires this many samples, of whatever size you are using.
+	int speexOutgoingFrameSampleCount;
+	// Index in is bytes.
+	// Write index points to the next byte to write to, which must be free.
+	unsigned outgoingReadIndex, outgoingWriteIndex;
+	// When the first sample of each block of outgoingBuffer was recorded
+	RakNet::TimeUS outgoingCaptureTimes[FRAME_OUTGOING_BUFFER_COUNT];
 
 };
 
@@ -13,25 +13,20 @@
 	@param:		MAXCLIENTS				- The maximum amount of connections allowed.
 	@param:		PORT					- The internal pc port that the network will flow through.
 */
-Server::Server(unsigned int MAXCLIENTS, const unsigned short PORT) {
+Server::Server(unsigned int MAXCLIENTS, const unsigned short PORT) : _Shutdown(false), _EventLoop(SERVER_TICK_RATE), _Clients(MAXCLIENTS), _VoiceRelay(_Clients, VOICE_MIX_SAMPLE_RATE) {
 	
 	// Get reference to rak peer interface
 	_pPeerInterface = RakNet::RakPeerInterface::GetInstance();
+
+	// The event loop hooks the reliability layer, so it must be attached before startup
+	_pPeerInterface->AttachPlugin(&_EventLoop);
+	_pPeerInterface->AttachPlugin(&_VoiceRelay);
+	_VoiceRelay.setWorkerPool(&_VoiceWorkers);
 	
 	// Start server instance
 	RakNet::SocketDescriptor sd(PORT, 0);
 	_pPeerInterface->Startup(MAXCLIENTS, &sd, 1);
 	_pPeerInterface->SetMaximumIncomingConnections(_MaxClients = MAXCLIENTS);
-	
-	// Setup ID array
-	for (unsigned int i = 0; i < MAXCLIENTS; i++) {
-
-		// This means that the first client who joins wont have an ID of 0, but 1 instead
-		if (i == 0) { _IDArray.push_back(new bool(true)); }
-
-		// All IDs are available from startup because no clients have joined yet
-		else { _IDArray.push_back(new bool(false)); }
-	}
 
 	// Server properties
 	std::cout << "\n------------------------------" << std::endl;
@@ -42,8 +37,12 @@ Server::Server(unsigned int MAXCLIENTS, const unsigned short PORT) {
 			  << "\n - Wifi Address:\t  " << _pPeerInterface->GetLocalIP(2)
 			  << "\n - Port:\t\t  " << sd.port
 			  << "\n - Max Clients:\t\t  " << MAXCLIENTS
+			  << "\n - Voice Workers:\t  " << _VoiceWorkers.getThreadCount()
 			  << std::endl;
 
+	// Mix voice every tick (does nothing unless mix mode is on)
+	_EventLoop.AddPeriodicTask(1, [this] { _VoiceRelay.Update(); });
+
 	// Run server commands on a separate thread
 	_ServerCommandsThread = std::thread([=] { ServerCommands(); });
 
@@ -57,44 +56,24 @@ Server::Server(unsigned int MAXCLIENTS, const unsigned short PORT) {
 Server::~Server() {
 
 	// Free used resources
-	for (auto iter : _IDArray)		{ delete iter; iter = nullptr; }
-	for (auto iter : _ClientList)	{ delete iter; iter = nullptr; }
+	_Clients.Clear();
 }
 
 /** --------------------------------------------------------------------------------------------------------------
 	@Summary:	Initializes a client & sets their ID so they can be identified in the server & by other clients.
 	
 	@param:		packet					- Packet containing the client's info
-	@param:		clientsConnected		- Current amount of clients connected to the server (used to determine new ID).
 	
 	@return:	VOID
 */
-void Server::SendClientID(RakNet::Packet* packet, int& clientsConnected) {
+void Server::SendClientID(RakNet::Packet* packet) {
 
-	// Add the client as new increment in counter
-	clientsConnected++;
-
-	// Find the lowest ID availiable
-	int id;
-	for (int i = 1; i < _MaxClients; i++) {
-
-		if (_IDArray.at(i) != NULL) {
-
-			// Found ID
-			if (*_IDArray.at(i) == false) {
-
-				id = i;
-				*_IDArray.at(i) = true;
-				break;
-			}
-		}
-	}
-
-	// Update client info list with new client data
-	int i = _ClientList.size();
-	_ClientList.push_back(new ClientInfo());
-	_ClientList.at(i)->GUID = packet->guid;
-	_ClientList.at(i)->ID = id;
+	// Register the client, this also gives them the lowest ID availiable
+	ClientHandle handle = _Clients.Add(packet->guid);
+	ClientInfo* info = _Clients.Get(handle);
+	if (info == nullptr) { return; }
+	int id = info->ID;
+	_VoiceRelay.OnChannelJoined(handle);
 
 	// Create packet
 	RakNet::BitStream bitStream;
@@ -115,17 +94,11 @@ void Server::SendClientID(RakNet::Packet* packet, int& clientsConnected) {
 */
 void Server::SendClientChannel(RakNet::Packet* packet, int newChannel) {
 
-	// Update client info->channel in list
-	int i = 0;
-	for (auto iter : _ClientList) {
-
-		if (iter->GUID == packet->guid) {
-
-			_ClientList.at(i)->Channel = newChannel;
-			break;
-		}
-		++i;
-	}
+	// Move the client into the new channel's subscriber list
+	ClientHandle handle = _Clients.Find(packet->guid);
+	_VoiceRelay.OnChannelLeaving(handle);
+	_Clients.SetChannel(handle, newChannel);
+	_VoiceRelay.OnChannelJoined(handle);
 
 	// Create bitstream
 	RakNet::BitStream bitstream;
@@ -210,52 +183,70 @@ void Server::BroadcastServerMessage(std::string message) {
 }
 
 /** --------------------------------------------------------------------------------------------------------------
-	@Summary:	Updates all client versions of the client list
+	@Summary:	Sends the whole client list to a single client in one packet, stamped with the current lobby version.
+				Only used when a client joins or when they have missed a delta.
+	
+	@param:		guid					- The receiving client's GUID.
 	
 	@return:	VOID
 */
-void Server::BroadcastUpdatedClientList() {
+void Server::SendLobbySnapshot(RakNet::RakNetGUID guid) {
+
+	// Create packet
+	RakNet::BitStream bitstream;
+	bitstream.Write((RakNet::MessageID)GameMessages::ID_SERVER_LOBBY_SNAPSHOT);
+	bitstream.Write(_LobbyVersion);
+	bitstream.WriteCompressed(_Clients.getSize());
 
-	// Get infos for packet
-	std::vector<ClientInfo> info;
-	for (unsigned int i = 0; i < _ClientList.size(); ++i) { 
+	for (unsigned int i = 0; i < _Clients.getSize(); ++i) {
 
-		info.push_back(*_ClientList.at(i)); 
+		const ClientInfo& info = _Clients.getInfoAt(i);
+		RakNet::RakString rakString;
+		rakString.Set(info.ProfileName.c_str());
+
+		bitstream.Write(info.GUID);
+		bitstream.WriteCompressed(info.ID);
+		bitstream.WriteCompressed(info.Channel);
+		bitstream.Write(rakString);						// Byte aligns itself, matching the client's Read(RakString)
 	}
 
-	// Create packet to let the client know they are about to receive a vector array of a specified size
-	RakNet::BitStream bitstream1;
-	bitstream1.Write((RakNet::MessageID)GameMessages::ID_SERVER_SET_CLIENTLIST_SIZE);
-	bitstream1.Write(info.size());
+	// Lobby packets share an ordering channel so deltas can never overtake the snapshot
+	_pPeerInterface->Send(&bitstream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, guid, false);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Bumps the lobby version & sends a single client's change to everyone else.
+	
+	@param:		type					- Whether the client was added, removed or modified.
+	@param:		info					- The client that changed.
+	@param:		fields					- LobbyDeltaField flags of what changed (LOBBY_DELTA_MODIFY only).
+	
+	@return:	VOID
+*/
+void Server::BroadcastLobbyDelta(LobbyDeltaType type, const ClientInfo& info, unsigned char fields) {
+
+	// Create packet
+	RakNet::BitStream bitstream;
+	bitstream.Write((RakNet::MessageID)GameMessages::ID_SERVER_LOBBY_DELTA);
+	bitstream.Write(++_LobbyVersion);
+	bitstream.Write((unsigned char)type);
+	bitstream.Write(info.GUID);
 
-	// Send vector array size packet
-	_pPeerInterface->Send(&bitstream1, IMMEDIATE_PRIORITY, RELIABLE_WITH_ACK_RECEIPT, 0, RakNet::UNASSIGNED_RAKNET_GUID, true);
+	if (type == LOBBY_DELTA_ADD) { fields = LOBBY_FIELD_CHANNEL | LOBBY_FIELD_NAME; }
+	if (type == LOBBY_DELTA_MODIFY) { bitstream.Write(fields); }
+	if (type == LOBBY_DELTA_ADD) { bitstream.WriteCompressed(info.ID); }
 
-	// Broadcast to clients
-	int i = 0;
-	for (auto iter : info) {
+	if (fields & LOBBY_FIELD_CHANNEL) { bitstream.WriteCompressed(info.Channel); }
+	if (fields & LOBBY_FIELD_NAME) {
 
-		// Break the struct into its members for writing
-		RakNet::RakNetGUID guid = iter.GUID;
-		int id = iter.ID;
-		int channel = iter.Channel;
 		RakNet::RakString rakString;
-		rakString.Set(iter.ProfileName.c_str());
-
-		// Create a client info packet
-		RakNet::BitStream bs;
-		bs.Write((RakNet::MessageID)GameMessages::ID_SERVER_UPDATE_CLIENTLIST);
-		bs.Write(i);
-		bs.Write(guid);
-		bs.Write(id);
-		bs.Write(channel);
-		bs.Write((unsigned short)strlen(rakString));
-		bs.Write(rakString, strlen(rakString));
-
-		// Send a client info packet
-		_pPeerInterface->Send(&bs, HIGH_PRIORITY, RELIABLE_ORDERED, 0, RakNet::UNASSIGNED_RAKNET_GUID, true);
-		++i;
+		rakString.Set(info.ProfileName.c_str());
+		bitstream.Write(rakString);
 	}
+
+	// Added & removed clients get the snapshot / disconnection instead of their own delta
+	bool excludeSubject = type != LOBBY_DELTA_MODIFY;
+	_pPeerInterface->Send(&bitstream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, excludeSubject ? info.GUID : RakNet::UNASSIGNED_RAKNET_GUID, true);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -265,10 +256,10 @@ void Server::BroadcastUpdatedClientList() {
 	
 	@return:	VOID
 */
-void Server::OnClientBanned(RakNet::RakNetGUID guid, int clientID) {
+void Server::OnClientBanned(RakNet::RakNetGUID guid) {
 
 	// Kick
-	OnClientKicked(guid, clientID);
+	OnClientKicked(guid);
 
 	// Ban
 	_pPeerInterface->AddToBanList(guid.ToString());
@@ -281,34 +272,19 @@ void Server::OnClientBanned(RakNet::RakNetGUID guid, int clientID) {
 	
 	@return:	VOID
 */
-void Server::OnClientKicked(RakNet::RakNetGUID guid, int clientID) {
+void Server::OnClientKicked(RakNet::RakNetGUID guid) {
 	
-	// -1 from counter
-	_ClientsConnected--;
-
-	// Make ID available again for use
-	if (clientID > 0 && clientID <= _MaxClients) {
-
-		delete _IDArray.at(clientID -1);
-		_IDArray.at(clientID -1) = new bool(false);
+	// The client may have already been removed (e.g. a quit request followed by the disconnection)
+	ClientInfo* info = _Clients.Get(guid);
+	if (info != nullptr) {
 
 		// Notify other clients of the disconnection
-		BroadcastServerMessage(_ClientList.at(clientID - 1)->ProfileName + " has left the server.");
-	}
-
-	// Remove from list by removing the last iterator in the list 
-	// then re-queuing it to the front if its not meant to be removed
-	for (unsigned int i = 0; i < _ClientList.size(); ++i) {
-	
-		// dequeue
-		auto* value = _ClientList.back();
-		_ClientList.pop_back();
-	
-		// re-queue if not the address to remove
-		if (value->GUID != guid) { _ClientList.insert(_ClientList.begin(), value); }
+		BroadcastServerMessage(info->ProfileName + " has left the server.");
+		BroadcastLobbyDelta(LOBBY_DELTA_REMOVE, *info);
 
-		// Delete the resource if it was intended to be removed
-		delete value; value = nullptr;
+		// Remove from list & make ID available again for use
+		_VoiceRelay.OnChannelLeaving(_Clients.Find(guid));
+		_Clients.Remove(guid);
 	}
 	
 	// Notify client that they have been disconnected
@@ -343,7 +319,7 @@ void Server::OnClientRequestQuit(RakNet::Packet* packet, int& id, std::string& n
 	name = rakName.C_String();
 
 	// Kick the client from the server
-	OnClientKicked(packet->guid, id);
+	OnClientKicked(packet->guid);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -365,27 +341,18 @@ void Server::OnClientRequestChannel(RakNet::Packet * packet) {
 	int channel;
 	bitstream.Read(channel);
 
-	// Loop through client list until we find the matching client
-	int i = 0;
-	for (auto iter : _ClientList) {
-
-		// Update the client list with the new channel
-		if (iter->GUID == packet->guid) {
-
-			iter->Channel = channel;
-			break;
-		}
-		++i;
-	}
+	// Find the matching client
+	ClientInfo* info = _Clients.Get(packet->guid);
+	if (info == nullptr) { return; }
 
-	// Send a packet back to the client with their new profile name
-	SendClientChannel(packet, _ClientList.at(i)->Channel);
+	// Send a packet back to the client with their new channel
+	SendClientChannel(packet, channel);
 
 	// Notify client
 	SendClientServerMessage(packet->guid, "Team channel requested accepted.");
 
 	// Update clientside client list
-	BroadcastUpdatedClientList();
+	BroadcastLobbyDelta(LOBBY_DELTA_MODIFY, *info, LOBBY_FIELD_CHANNEL);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -408,31 +375,98 @@ void Server::OnClientRequestNameChange(RakNet::Packet* packet) {
 	RakNet::RakString rakName;
 	bitstream.Read(rakName);
 
-	// Loop through client list until we find the matching client
-	int i = 0;
-	for (auto iter : _ClientList) {
-
-		// Update the client list with the new name change
-		if (iter->GUID == packet->guid) { 
-
-			iter->ProfileName = rakName.C_String(); 
-			break;
-		}
-		++i;
-	}
+	// Update the client list with the new name change
+	ClientInfo* info = _Clients.Get(packet->guid);
+	if (info == nullptr) { return; }
+	info->ProfileName = rakName.C_String();
 
 	// Send a packet back to the client with their new profile name
-	SendClientProfileName(packet->systemAddress, _ClientList.at(i)->ProfileName);
+	SendClientProfileName(packet->systemAddress, info->ProfileName);
 
 	// Notify client
 	SendClientServerMessage(packet->guid, "Profile name change requested accepted.");
 
 	// Update clientside client list
-	BroadcastUpdatedClientList();	
+	BroadcastLobbyDelta(LOBBY_DELTA_MODIFY, *info, LOBBY_FIELD_NAME);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Forwards a chat message to every client it is meant for. Team messages only go to the
+				subscribers of the sender's channel, everything else goes to all other clients.
+				The packet is forwarded as is, so it is only ever serialized once by the sender.
+	
+	@param:		packet					- The chat message packet.
+	
+	@return:	VOID
+*/
+void Server::OnClientChatMessage(RakNet::Packet* packet) {
+
+	ClientHandle sender = _Clients.Find(packet->guid);
+	ClientInfo* info = _Clients.Get(sender);
+	if (info == nullptr) { return; }
+
+	RakNet::BitStream bitStream(packet->data, packet->length, false);
+	bitStream.IgnoreBytes(sizeof(RakNet::MessageID));
+
+	// Skip past the sender's ID, channel & profile name
+	int clientID, clientChannel;
+	unsigned short nameLength;
+	bitStream.Read(clientID);
+	bitStream.Read(clientChannel);
+	bitStream.Read(nameLength);
+	bitStream.IgnoreBytes(nameLength);
+
+	// Read in message's channel type
+	int iChannelType;
+	if (!bitStream.Read(iChannelType)) { return; }
+	bitStream.ResetReadPointer();
+
+	if (MessageChannelType(iChannelType) == TEAM_ONLY) {
+
+		// Only the subscribers of the sender's channel (our own record, not the one in the packet)
+		const std::vector<unsigned int>& members = _Clients.getChannelMembers(info->Channel);
+		for (unsigned int i = 0; i < members.size(); ++i) {
+
+			if (members[i] == sender.Slot) { continue; }
+			_pPeerInterface->Send(&bitStream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, _Clients.getInfoBySlot(members[i]).GUID, false);
+		}
+	}
+	else {
+
+		// Everyone except the sender
+		_pPeerInterface->Send(&bitStream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, packet->guid, true);
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Forwards a whisper to the client it is addressed to.
+	
+	@param:		packet					- The whisper packet (the recipient's GUID follows the message ID).
+	
+	@return:	VOID
+*/
+void Server::OnClientWhisperMessage(RakNet::Packet* packet) {
+
+	if (!_Clients.Find(packet->guid).isValid()) { return; }
+
+	RakNet::BitStream bitStream(packet->data, packet->length, false);
+	bitStream.IgnoreBytes(sizeof(RakNet::MessageID));
+
+	// Read in the recipient
+	RakNet::RakNetGUID recipient;
+	if (!bitStream.Read(recipient)) { return; }
+
+	ClientInfo* info = _Clients.Get(recipient);
+	if (info == nullptr) { return; }
+
+	// Send packet
+	bitStream.ResetReadPointer();
+	_pPeerInterface->Send(&bitStream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, info->GUID, false);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
 	@Summary:	Receives packets & notifies client(s) of the event.
+				The loop sleeps until a packet arrives, the next tick is due or a shutdown is requested.
 	
 	@return:	VOID
 */
@@ -441,6 +475,9 @@ void Server::UpdateReceivingPackets() {
 	RakNet::Packet* packet = nullptr;
 
 	while (!_Shutdown) {
+
+		// Sleep until there is something to do
+		_EventLoop.WaitForEvent();
 		
 		for (packet = _pPeerInterface->Receive(); packet;
 					  _pPeerInterface->DeallocatePacket(packet),
@@ -453,12 +490,14 @@ void Server::UpdateReceivingPackets() {
 				case ID_NEW_INCOMING_CONNECTION: {
 					
 					// Setup client properties
-					SendClientID(packet, _ClientsConnected);
+					SendClientID(packet);
 					SendClientChannel(packet, 1);
 
-					// Notify clients
+					// Notify clients, the new client gets the whole list & everyone else just the addition
 					BroadcastServerMessage("A client has connected");
-					BroadcastUpdatedClientList();
+					ClientInfo* info = _Clients.Get(packet->guid);
+					if (info != nullptr) { BroadcastLobbyDelta(LOBBY_DELTA_ADD, *info); }
+					SendLobbySnapshot(packet->guid);
 					break;
 				}
 
@@ -466,7 +505,7 @@ void Server::UpdateReceivingPackets() {
 				case ID_DISCONNECTION_NOTIFICATION: {
 
 					// Remove client address from list
-					OnClientKicked(packet->guid, 0);
+					OnClientKicked(packet->guid);
 					break;
 				}
 
@@ -474,7 +513,7 @@ void Server::UpdateReceivingPackets() {
 				case ID_CONNECTION_LOST: {
 
 					// Remove client address from list
-					OnClientKicked(packet->guid, 0);
+					OnClientKicked(packet->guid);
 
 					// Notify clients
 					BroadcastServerMessage("A client has lost connection");
@@ -494,9 +533,16 @@ void Server::UpdateReceivingPackets() {
 				// Client chat message broadcast
 				case ID_CLIENT_CHAT_MESSAGE_BROADCAST: {
 
-					// Send the message to client(s)
-					RakNet::BitStream bitStream(packet->data, packet->length, false);
-					_pPeerInterface->Send(&bitStream, HIGH_PRIORITY, RELIABLE_ORDERED, 0, packet->systemAddress, true);
+					// Send the message to the client(s) it is meant for
+					OnClientChatMessage(packet);
+					break;
+				}
+
+				// Client chat message to a single client
+				case ID_CLIENT_CHAT_MESSAGE_WHISPER: {
+
+					// Send the message to the recipient only
+					OnClientWhisperMessage(packet);
 					break;
 				}
 
@@ -516,9 +562,23 @@ void Server::UpdateReceivingPackets() {
 					break;
 				}
 
+				// Client missed a lobby delta
+				case ID_CLIENT_REQUEST_LOBBY_RESYNC: {
+
+					SendLobbySnapshot(packet->guid);
+					break;
+				}
+
 				default: break;
 			}
 		}
+
+		// Run anything the server commands posted, as only this thread may touch the clients & relay
+		_EventLoop.RunPostedTasks();
+
+		// Look again soon if the wake found nothing, then run any periodic work that is due
+		_EventLoop.OnPacketsDrained();
+		_EventLoop.RunDueTicks();
 	}
 
 	// Shutdown the server
@@ -539,6 +599,12 @@ void Server::ServerCommands() {
 	std::cout << " - Kick client:\t\t< k >" << std::endl;
 	std::cout << " - Ban client:\t\t< b >" << std::endl;
 	std::cout << " - Broadcast Message:\t< s >" << std::endl;
+	std::cout << " - Tick statistics:\t< i >" << std::endl;
+	std::cout << " - Toggle voice mixing:\t< v >" << std::endl;
+	std::cout << " - Toggle voice packets:\t< p >" << std::endl;
+	std::cout << " - Toggle loudest speakers:\t< n >" << std::endl;
+	std::cout << " - Mixing benchmark:\t< m >" << std::endl;
+	std::cout << " - Voice latency:\t< l >" << std::endl;
 
 	bool ValidInput = false;
 	while (!ValidInput) {
@@ -558,6 +624,9 @@ void Server::ServerCommands() {
 
 				_Shutdown = true;
 				ValidInput = true;
+
+				// Wake the packet loop so it notices the shutdown straight away
+				_EventLoop.Wake();
 				break;
 			}
 
@@ -565,13 +634,15 @@ void Server::ServerCommands() {
 			case 'k':
 			case 'K': {
 
-				if (_ClientList.size() > 0) {
+				// The client list belongs to the packet loop, so only look at it from there
+				bool hasClients = false;
+				_EventLoop.Call([&] {
 
-					for (unsigned int i = 0; i < _ClientList.size(); ++i) {
+					hasClients = _Clients.getSize() > 0;
+					if (hasClients) { PrintClients(); }
+				});
 
-						// Print the client's ID then profile name
-						std::cout << " < " << _ClientList.at(i)->ID << " > " << _ClientList.at(i)->ProfileName.c_str() << std::endl;
-					}
+				if (hasClients) {
 
 					// Selecting client to kick
 					bool ValidInput2 = false;
@@ -580,19 +651,21 @@ void Server::ServerCommands() {
 						std::cout << "\n Kick < # >: ";
 						std::cin.clear();
 						std::cin.ignore(INT_MAX, '\n');
-						char cKick = '\0';
-						int i = 0;
+						int id = 0;
+						std::cin >> id;
 
-						std::cin >> cKick;
-						i = cKick - '0';
+						// Kick client, the ID is looked up on the loop as the client may have left since
+						_EventLoop.Call([&] {
 
-						if (i > 0 && i < _MaxClients) {
+							ClientInfo* info = _Clients.Get(_Clients.FindByID(id));
+							if (info != nullptr) {
 
-							// Kick client
-							OnClientKicked(_ClientList.at(i - 1)->GUID, _ClientList.at(i - 1)->ID);
-							ValidInput2 = true;
-						}
-						else {
+								OnClientKicked(info->GUID);
+								ValidInput2 = true;
+							}
+						});
+
+						if (!ValidInput2) {
 
 							// Invalid input
 							std::cin.clear();
@@ -608,33 +681,38 @@ void Server::ServerCommands() {
 			case 'b':
 			case 'B': {
 
-				if (_ClientList.size() > 0) {
+				// The client list belongs to the packet loop, so only look at it from there
+				bool hasClients = false;
+				_EventLoop.Call([&] {
 
-					for (unsigned int i = 0; i < _ClientList.size(); ++i) {
+					hasClients = _Clients.getSize() > 0;
+					if (hasClients) { PrintClients(); }
+				});
 
-						// Print the client's ID then profile name
-						std::cout << " < " << _ClientList.at(i)->ID << " > " << _ClientList.at(i)->ProfileName.c_str() << std::endl;
-					}
+				if (hasClients) {
 
+					// Selecting client to ban
 					bool ValidInput2 = false;
 					while (!ValidInput2) {
 
 						std::cout << "\n Ban < # >: ";
 						std::cin.clear();
 						std::cin.ignore(INT_MAX, '\n');
-						char cBan = '\0';
-						int i = 0;
+						int id = 0;
+						std::cin >> id;
 
-						std::cin >> cBan;
-						i = cBan - '0';
+						// Ban client, the ID is looked up on the loop as the client may have left since
+						_EventLoop.Call([&] {
 
-						if (i > 0 && i < _MaxClients) {
+							ClientInfo* info = _Clients.Get(_Clients.FindByID(id));
+							if (info != nullptr) {
 
-							// Ban client
-							OnClientBanned(_ClientList.at(i - 1)->GUID, _ClientList.at(i - 1)->ID);
-							ValidInput2 = true;
-						}
-						else {
+								OnClientBanned(info->GUID);
+								ValidInput2 = true;
+							}
+						});
+
+						if (!ValidInput2) {
 
 							// Invalid input
 							std::cin.clear();
@@ -663,6 +741,55 @@ void Server::ServerCommands() {
 				break;
 			}
 
+			// Print idle vs busy time
+			case 'i':
+			case 'I': {
+
+				// The relay & mixing counters are written by the packet loop, so print them from there
+				_EventLoop.Call([this] { PrintTickStats(); });
+				break;
+			}
+
+			// Switch between forwarding & mixing voice
+			case 'v':
+			case 'V': {
+
+				ToggleVoiceMode();
+				break;
+			}
+
+			// Switch between low latency & bundled voice packets
+			case 'p':
+			case 'P': {
+
+				ToggleVoicePacketProfile();
+				break;
+			}
+
+			// Switch between forwarding every talker & only the loudest of each channel
+			case 'n':
+			case 'N': {
+
+				ToggleLoudestSpeakers();
+				break;
+			}
+
+			// Time the mixing kernels on this thread
+			case 'm':
+			case 'M': {
+
+				PrintMixBenchmark();
+				break;
+			}
+
+			// Print how long each talker's voice takes to reach the server
+			case 'l':
+			case 'L': {
+
+				_EventLoop.Call([this] { PrintVoiceLatency(); });
+				break;
+			}
+
 			// Invalid input
 			default: {
 
@@ -682,7 +809,169 @@ void Server::ServerCommands() {
 */
 void Server::KickAllClients() {
 
-	for (auto client : _ClientList) { OnClientKicked(client->GUID, client->ID); }
+	while (_Clients.getSize() > 0) { OnClientKicked(_Clients.getInfoAt(0).GUID); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Prints the ID & profile name of every connected client (packet loop thread only).
+	
+	@return:	VOID
+*/
+void Server::PrintClients() {
+
+	for (unsigned int i = 0; i < _Clients.getSize(); ++i) {
+
+		// Print the client's ID then profile name
+		ClientInfo& info = _Clients.getInfoAt(i);
+		std::cout << " < " << info.ID << " > " << info.ProfileName.c_str() << std::endl;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Prints how long the packet loop has spent sleeping vs working (packet loop thread only).
+	
+	@return:	VOID
+*/
+void Server::PrintTickStats() {
+
+	TickStats stats = _EventLoop.getTickStats();
+	unsigned long long total = stats.IdleMicroseconds + stats.BusyMicroseconds;
+	double busyPercent = total > 0 ? (100.0 * stats.BusyMicroseconds) / total : 0.0;
+
+	std::cout << "\n - Ticks:\t\t  " << stats.Ticks << " (" << _EventLoop.getTickIntervalMs() << "ms)"
+			  << "\n - Wakeups:\t\t  " << stats.Wakeups
+			  << "\n - Rechecks:\t\t  " << stats.Rechecks
+			  << "\n - Last tick idle:\t  " << stats.LastTickIdleMicroseconds << "us"
+			  << "\n - Last tick busy:\t  " << stats.LastTickBusyMicroseconds << "us"
+			  << "\n - Total busy:\t\t  " << busyPercent << "%"
+			  << std::endl;
+
+	const RelayStats& relay = _VoiceRelay.getStats();
+	std::cout << "\n - Voice packets in:\t  " << relay.PacketsIn << " (" << relay.BytesIn << " bytes)"
+			  << "\n - Voice packets out:\t  " << relay.PacketsOut << " (" << relay.BytesOut << " bytes)"
+			  << "\n - Voice packets skipped: " << relay.PacketsSkipped << " (" << relay.SpeakersReplaced << " speakers replaced)"
+			  << std::endl;
+
+	const MixStats& mix = _VoiceRelay.getMixStats();
+	std::cout << "\n - Frames mixed:\t  " << mix.FramesMixed
+			  << "\n - Shared encodes:\t  " << mix.SharedEncodes
+			  << "\n - Personal encodes:\t  " << mix.PersonalEncodes
+			  << "\n - Mixed packets out:\t  " << mix.PacketsOut
+			  << "\n - Concealed frames:\t  " << mix.ConcealedFrames
+			  << "\n - Recovered frames:\t  " << mix.RecoveredFrames
+			  << std::endl;
+
+	WorkerPoolStats workers = _VoiceWorkers.getStats();
+	std::cout << "\n - Voice jobs run:\t  " << workers.JobsRun << " (" << _VoiceWorkers.getThreadCount() << " threads)"
+			  << "\n - Voice jobs stolen:\t  " << workers.JobsStolen
+			  << "\n - Voice jobs helped:\t  " << workers.JobsHelped
+			  << std::endl;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Switches the voice relay between forwarding every talker & mixing each channel.
+	
+	@return:	VOID
+*/
+void Server::ToggleVoiceMode() {
+
+	bool mixing = _VoiceRelay.getMode() != VOICE_RELAY_MIX;
+	_VoiceRelay.setMode(mixing ? VOICE_RELAY_MIX : VOICE_RELAY_FORWARD);
+
+	std::cout << "\n - Voice mode:\t\t  " << (mixing ? "Mixing (MCU)" : "Forwarding (SFU)") << std::endl;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Switches the packet profile offered to clients between one frame per packet & bundling
+				several frames per packet, which cuts the packets the server handles for more latency.
+				Only clients that open their voice channel afterwards use the new profile.
+	
+	@return:	VOID
+*/
+void Server::ToggleVoicePacketProfile() {
+
+	bool bundling = _VoiceRelay.getPacketProfile().framesPerPacket == RakNet::VOICE_PROFILE_LOW_LATENCY.framesPerPacket;
+	_VoiceRelay.setPacketProfile(bundling ? RakNet::VOICE_PROFILE_BANDWIDTH : RakNet::VOICE_PROFILE_LOW_LATENCY);
+
+	RakNet::VoicePacketProfile profile = _VoiceRelay.getPacketProfile();
+	std::cout << "\n - Voice packets:\t  " << (bundling ? "Bandwidth" : "Low latency") << " ("
+			  << (int)profile.framesPerPacket << " frames, " << profile.sendIntervalMS << "ms)" << std::endl;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Switches the voice relay between forwarding every talker & only forwarding the loudest
+				talkers of each channel, which bounds what listeners decode in a big channel.
+	
+	@return:	VOID
+*/
+void Server::ToggleLoudestSpeakers() {
+
+	bool limiting = _VoiceRelay.getMaxSpeakers() == 0;
+	_VoiceRelay.setMaxSpeakers(limiting ? VOICE_RELAY_DEFAULT_SPEAKERS : 0);
+
+	if (limiting) { std::cout << "\n - Loudest speakers:\t  " << _VoiceRelay.getMaxSpeakers() << " per channel" << std::endl; }
+	else { std::cout << "\n - Loudest speakers:\t  Off (everyone is forwarded)" << std::endl; }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Prints how many samples one core mixes per second, for 2 to 64 speakers, with each
+				instruction set the CPU supports.
+	
+	@return:	VOID
+*/
+void Server::PrintMixBenchmark() {
+
+	std::cout << "\n - Mixing kernels:\t  " << VoiceMixing::getName(VoiceMixing::getInstructionSet()) << std::endl;
+	std::cout << "\n   Speakers  Kernels   Float (Msamples/s)  Int32 (Msamples/s)" << std::endl;
+
+	for (unsigned int speakers = 2; speakers <= 64; speakers *= 2) {
+
+		for (int set = VoiceMixing::VOICE_MIXING_SCALAR; set <= VoiceMixing::VOICE_MIXING_AVX2; ++set) {
+
+			if (!VoiceMixing::isSupported((VoiceMixing::InstructionSet)set)) { continue; }
+
+			VoiceMixing::BenchmarkResult result = VoiceMixing::Benchmark(speakers, (VoiceMixing::InstructionSet)set);
+			std::cout << "   " << speakers << "\t     " << VoiceMixing::getName((VoiceMixing::InstructionSet)set)
+					  << "\t       " << (unsigned long long)(result.FloatSamplesPerSecond / 1000000.0)
+					  << "\t\t  " << (unsigned long long)(result.Int32SamplesPerSecond / 1000000.0)
+					  << std::endl;
+		}
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Prints the median, 95th percentile & worst latency of each connected talker's stamped
+				voice packets, for every hop from their microphone to the server. The network hop
+				relies on RakNet's estimate of the talker's clock, so is only as good as their ping.
+				Packet loop thread only, as it walks the client list.
+	
+	@return:	VOID
+*/
+void Server::PrintVoiceLatency() {
+
+	static const char* hops[] = { "Capture", "Encode", "Send queue", "Network" };
+
+	std::cout << "\n   Talker\t\tHop\t\tp50 (ms)  p95 (ms)  Max (ms)  Packets" << std::endl;
+	for (unsigned int i = 0; i < _Clients.getSize(); ++i) {
+
+		ClientInfo& info = _Clients.getInfoAt(i);
+		RakNet::VoiceLatencyStatistics stats;
+		if (!_VoiceRelay.getTalkerLatency(info.GUID, stats)) { continue; }
+		if (stats.hops[RakNet::VOICE_LATENCY_NETWORK].count == 0) { continue; }
+
+		for (int hop = RakNet::VOICE_LATENCY_CAPTURE; hop <= RakNet::VOICE_LATENCY_NETWORK; ++hop) {
+
+			const RakNet::VoiceLatencyHistogram& histogram = stats.hops[hop];
+			std::cout << std::fixed << std::setprecision(1)
+					  << "   < " << info.ID << " > " << info.ProfileName.c_str() << "\t" << hops[hop]
+					  << "\t" << RakNet::GetVoiceLatencyPercentile(histogram, 0.5f) / 1000.0
+					  << "\t  " << RakNet::GetVoiceLatencyPercentile(histogram, 0.95f) / 1000.0
+					  << "\t    " << histogram.maxMicroseconds / 1000.0
+					  << "\t      " << histogram.count
+					  << std::endl;
+		}
+	}
+	std::cout << std::defaultfloat << std::setprecision(6);
 }
 
 /** --------------------------------------------------------------------------------------------------------------
@@ -1,6 +1,8 @@
 #pragma once
 
 // Standard libraries
+#include <atomic>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 #include <list>
@@ -15,6 +17,16 @@
 
 // NPC libraries
 #include "Enumeration.h"
+#include "ClientRegistry.h"
+#include "ServerEventLoop.h"
+#include "VoiceRelay.h"
+#include "VoiceMixing.h"
+#include "VoiceWorkerPool.h"
+
+// How many times per second the server runs its periodic work.
+// Packets are handled as soon as they arrive regardless of this rate.
+#define SERVER_TICK_RATE (20)
+#define VOICE_MIX_SAMPLE_RATE (8000)
 
 class Server {
 
@@ -25,20 +37,30 @@ public:
 	~Server();
 
 	// Networking
-	void SendClientID(RakNet::Packet* packet, int& clientID);
+	void SendClientID(RakNet::Packet* packet);
 	void SendClientChannel(RakNet::Packet* packet, int newChannel);
 	void SendClientProfileName(RakNet::SystemAddress address, std::string name);
 	void SendClientServerMessage(RakNet::RakNetGUID guid, std::string message);
 	void BroadcastServerMessage(std::string message);
-	void BroadcastUpdatedClientList();
-	void OnClientBanned(RakNet::RakNetGUID guid, int clientID);
-	void OnClientKicked(RakNet::RakNetGUID guid, int clientID);
+	void SendLobbySnapshot(RakNet::RakNetGUID guid);
+	void BroadcastLobbyDelta(LobbyDeltaType type, const ClientInfo& info, unsigned char fields = 0);
+	void OnClientBanned(RakNet::RakNetGUID guid);
+	void OnClientKicked(RakNet::RakNetGUID guid);
 	void OnClientRequestQuit(RakNet::Packet* packet, int& id, std::string& name);
 	void OnClientRequestChannel(RakNet::Packet* packet);
 	void OnClientRequestNameChange(RakNet::Packet* packet);
+	void OnClientChatMessage(RakNet::Packet* packet);
+	void OnClientWhisperMessage(RakNet::Packet* packet);
 	void UpdateReceivingPackets();
 	void ServerCommands();
 	void KickAllClients();
+	void PrintClients();
+	void PrintTickStats();
+	void ToggleVoiceMode();
+	void ToggleVoicePacketProfile();
+	void ToggleLoudestSpeakers();
+	void PrintMixBenchmark();
+	void PrintVoiceLatency();
 	void Shutdown();
 
 protected:
@@ -47,12 +69,16 @@ protected:
 
 	// Server properties
 	int _MaxClients;										// Maximum amount of client connections allowed.
-	int _ClientsConnected = 0;								// Amount of client(s) that are connected to this server.
-	bool _Shutdown = false;									// Returns TRUE when the server is starting the shutdown process.
+	std::atomic<bool> _Shutdown;							// Returns TRUE when the server is starting the shutdown process.
 	std::thread _ServerCommandsThread;						// The thread related to the server commands processes.
+	ServerEventLoop _EventLoop;								// Sleeps the packet loop until there is work to do.
 
 	// Client list
-	std::vector<bool*> _IDArray;							// Array of all client IDs in use/not in use.
-	std::vector<ClientInfo*> _ClientList;					// Array of all client infos connected to the server.
+	ClientRegistry _Clients;								// Table of all client infos connected to the server, indexed by GUID & ID.
+	unsigned int _LobbyVersion = 0;							// Incremented on every change to the client list, stamped on each delta.
+
+	// Voice
+	VoiceWorkerPool _VoiceWorkers;							// Decodes & mixes voice on every other core (outlives _VoiceRelay).
+	VoiceRelay _VoiceRelay;									// Forwards each talker's voice to the rest of their channel.
 
 };
\ No newline at end of file
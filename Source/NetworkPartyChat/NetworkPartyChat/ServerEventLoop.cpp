@@ -0,0 +1,270 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "ServerEventLoop.h"
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Creates the event loop with a fixed tick rate.
+
+	@param:		tickRate				- How many ticks per second the periodic work is run at.
+*/
+ServerEventLoop::ServerEventLoop(unsigned int tickRate) {
+
+	// Never allow a zero tick rate, as that would sleep forever without packets
+	_TickIntervalMs = tickRate > 0 ? 1000 / tickRate : 1000;
+	if (_TickIntervalMs == 0) { _TickIntervalMs = 1; }
+
+	_NextTick = Clock::now() + std::chrono::milliseconds(_TickIntervalMs);
+	_BusySince = Clock::now();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Registers work that is to be run every X ticks.
+
+	@param:		intervalTicks			- How many ticks between each run of the task.
+	@param:		task					- The work to be run.
+
+	@return:	VOID
+*/
+void ServerEventLoop::AddPeriodicTask(unsigned int intervalTicks, std::function<void()> task) {
+
+	PeriodicTask periodic;
+	periodic.IntervalTicks = intervalTicks > 0 ? intervalTicks : 1;
+	periodic.TicksRemaining = periodic.IntervalTicks;
+	periodic.Task = task;
+	_Tasks.push_back(periodic);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Blocks the calling thread until packets arrive, the next tick is due or Wake() is called.
+				If the last wake found nothing to receive, only waits until it is time to look again.
+				The time spent blocked is recorded as idle time for the current tick.
+
+	@return:	VOID
+*/
+void ServerEventLoop::WaitForEvent() {
+
+	Clock::time_point waitStart = Clock::now();
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+
+	// Everything since we last woke up was spent working
+	_TickBusyMicroseconds += ElapsedMicroseconds(_BusySince, waitStart);
+
+	// Sleep until signalled or the next tick is due
+	Clock::time_point until = _Rechecks > 0 && _RecheckAt < _NextTick ? _RecheckAt : _NextTick;
+	_Woken = _WakeCondition.wait_until(lock, until, [this] { return _WakeRequested; });
+	_WakeRequested = false;
+	if (_Woken) { _Stats.Wakeups++; }
+
+	_BusySince = Clock::now();
+	_TickIdleMicroseconds += ElapsedMicroseconds(waitStart, _BusySince);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Called once Receive() has been drained after a wait. RakNet wakes the loop just before it
+				queues a packet, so a wake that found nothing looks again shortly after instead of
+				sleeping until the next tick.
+
+	@return:	VOID
+*/
+void ServerEventLoop::OnPacketsDrained() {
+
+	unsigned int count = _PacketsReceived;
+	_PacketsReceived = 0;
+
+	// A wake for posted work wasnt early, so there is nothing to look again for
+	bool ranPosted = _RanPosted;
+	_RanPosted = false;
+
+	std::lock_guard<std::mutex> lock(_Mutex);
+	if (count > 0 || ranPosted || !(_Woken || _Rechecks > 0) || _Rechecks >= EVENT_LOOP_MAX_RECHECKS) {
+
+		_Rechecks = 0;
+		return;
+	}
+
+	_Rechecks++;
+	_Stats.Rechecks++;
+	_RecheckAt = Clock::now() + std::chrono::microseconds(EVENT_LOOP_RECHECK_US);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs the periodic tasks for every tick that is due & rolls the tick statistics over.
+				Ticks are scheduled at a fixed rate, if the loop falls behind by more than a tick
+				then the missed ticks are skipped rather than run back to back.
+
+	@return:	VOID
+*/
+void ServerEventLoop::RunDueTicks() {
+
+	Clock::time_point now = Clock::now();
+	if (now < _NextTick) { return; }
+
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		// Close off the statistics for the tick that just finished
+		_TickBusyMicroseconds += ElapsedMicroseconds(_BusySince, now);
+		_BusySince = now;
+
+		_Stats.Ticks++;
+		_Stats.IdleMicroseconds += _TickIdleMicroseconds;
+		_Stats.BusyMicroseconds += _TickBusyMicroseconds;
+		_Stats.LastTickIdleMicroseconds = _TickIdleMicroseconds;
+		_Stats.LastTickBusyMicroseconds = _TickBusyMicroseconds;
+		_TickIdleMicroseconds = 0;
+		_TickBusyMicroseconds = 0;
+	}
+
+	// Advance on the fixed rate, skipping ticks we have fallen too far behind on
+	std::chrono::milliseconds interval(_TickIntervalMs);
+	_NextTick += interval;
+	if (_NextTick <= now) { _NextTick = now + interval; }
+
+	// Run any work that is due this tick
+	for (auto& iter : _Tasks) {
+
+		if (--iter.TicksRemaining == 0) {
+
+			iter.TicksRemaining = iter.IntervalTicks;
+			iter.Task();
+		}
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Wakes the loop up early (thread safe).
+
+	@return:	VOID
+*/
+void ServerEventLoop::Wake() {
+
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+		_WakeRequested = true;
+	}
+	_WakeCondition.notify_one();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Queues work to be run on the loop thread & wakes the loop up (thread safe).
+				Anything that touches the client list or the voice relay has to go through here
+				when it doesnt come from the packet loop itself.
+
+	@param:		task					- The work to be run.
+
+	@return:	VOID
+*/
+void ServerEventLoop::Post(std::function<void()> task) {
+
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+		_Posted.push_back(std::move(task));
+	}
+	Wake();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Queues work to be run on the loop thread & blocks until it has finished (thread safe).
+				Must never be called from the loop thread, as it would wait on itself.
+
+	@param:		task					- The work to be run.
+
+	@return:	VOID
+*/
+void ServerEventLoop::Call(std::function<void()> task) {
+
+	std::promise<void> done;
+	std::future<void> finished = done.get_future();
+	Post([&task, &done] {
+
+		task();
+		done.set_value();
+	});
+	finished.wait();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs the work other threads have posted since the last call, in the order it was posted.
+				The queue is swapped out first, so tasks can post more work without deadlocking.
+
+	@return:	VOID
+*/
+void ServerEventLoop::RunPostedTasks() {
+
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+		tasks.swap(_Posted);
+	}
+
+	for (auto& iter : tasks) { iter(); }
+	if (!tasks.empty()) { _RanPosted = true; }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns a copy of the tick statistics (thread safe).
+
+	@return:	TickStats
+*/
+TickStats ServerEventLoop::getTickStats() {
+
+	std::lock_guard<std::mutex> lock(_Mutex);
+	return _Stats;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Called by RakNet for every datagram that doesnt go through the reliability layer
+				(connection requests, pings).
+
+	@return:	VOID
+*/
+void ServerEventLoop::OnDirectSocketReceive(const char* data, const RakNet::BitSize_t bitsUsed, RakNet::SystemAddress remoteSystemAddress) {
+
+	(void)data; (void)bitsUsed; (void)remoteSystemAddress;
+	Wake();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Called by RakNet for every message sent or received through the reliability layer.
+				Received messages are about to be queued for Receive(), so wake the loop up. The
+				packet may not be queued by the time the loop looks, see OnPacketsDrained.
+
+	@return:	VOID
+*/
+void ServerEventLoop::OnInternalPacket(RakNet::InternalPacket* internalPacket, unsigned frameNumber, RakNet::SystemAddress remoteSystemAddress, RakNet::TimeMS time, int isSend) {
+
+	(void)internalPacket; (void)frameNumber; (void)remoteSystemAddress; (void)time;
+	if (!isSend) { Wake(); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Called by RakNet for every packet Receive() handles, before the plugins after this one
+				can consume it, so voice data counts as something received.
+
+	@param:		packet					- The packet received.
+
+	@return:	RakNet::PluginReceiveResult
+*/
+RakNet::PluginReceiveResult ServerEventLoop::OnReceive(RakNet::Packet* packet) {
+
+	(void)packet;
+	_PacketsReceived++;
+	return RakNet::RR_CONTINUE_PROCESSING;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the microseconds between two time points.
+
+	@return:	unsigned long long
+*/
+unsigned long long ServerEventLoop::ElapsedMicroseconds(Clock::time_point from, Clock::time_point to) {
+
+	if (to <= from) { return 0; }
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
\ No newline at end of file
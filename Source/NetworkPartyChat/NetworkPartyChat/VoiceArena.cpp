@@ -0,0 +1,251 @@
+/// \file
+/// \brief Pooled memory for RakVoice channels and the speex codec state
+
+#include "VoiceArena.h"
+#include "RakMemoryOverride.h"
+#include "RakAssert.h"
+#include <string.h>
+#include <atomic>
+
+using namespace RakNet;
+
+// Bytes in front of every block, keeping the block 16 byte aligned
+#define VOICE_ARENA_HEADER_SIZE 16
+// Bytes in front of every chunk, for the link to the next chunk
+#define VOICE_ARENA_CHUNK_HEADER_SIZE 16
+
+/// \internal
+struct VoiceArenaHeader
+{
+	// The arena the block came from, or 0 if it came from the heap
+	VoiceArena *arena;
+	// Size class of the block, or VOICE_ARENA_SIZE_CLASSES if it was too big to pool
+	uint32_t sizeClass;
+	// Usable bytes after the header
+	uint32_t capacity;
+};
+
+static VoiceArenaHeader* GetHeader(void *block)
+{
+	return (VoiceArenaHeader*) ((char*) block - VOICE_ARENA_HEADER_SIZE);
+}
+
+// Each thread allocates speex state from its own current arena
+static thread_local VoiceArena *currentArena=0;
+static std::atomic<uint64_t> unpooledAllocations(0);
+
+/// \internal
+/// Allocates from the current arena, or from the heap with a header saying so
+static void* AllocateCurrent(size_t size)
+{
+	if (currentArena)
+		return currentArena->Allocate(size);
+
+	unpooledAllocations++;
+	char *memory = (char*) rakMalloc_Ex(size+VOICE_ARENA_HEADER_SIZE, _FILE_AND_LINE_);
+	if (memory==0)
+		return 0;
+	VoiceArenaHeader *header = (VoiceArenaHeader*) memory;
+	header->arena=0;
+	header->sizeClass=VOICE_ARENA_SIZE_CLASSES;
+	header->capacity=(uint32_t) size;
+	memset(memory+VOICE_ARENA_HEADER_SIZE, 0, size);
+	return memory+VOICE_ARENA_HEADER_SIZE;
+}
+
+VoiceArena::VoiceArena()
+{
+	memset(freeLists, 0, sizeof(freeLists));
+	memset(&statistics, 0, sizeof(statistics));
+	chunks=0;
+	chunkCursor=0;
+	chunkRemaining=0;
+}
+VoiceArena::~VoiceArena()
+{
+	Release();
+}
+void* VoiceArena::Allocate(size_t size)
+{
+	unsigned sizeClass=0;
+	size_t blockSize=VOICE_ARENA_MIN_BLOCK;
+	char *memory;
+	VoiceArenaHeader *header;
+
+	while (blockSize < size+VOICE_ARENA_HEADER_SIZE && sizeClass < VOICE_ARENA_SIZE_CLASSES)
+	{
+		blockSize<<=1;
+		sizeClass++;
+	}
+	statistics.allocations++;
+
+	if (sizeClass==VOICE_ARENA_SIZE_CLASSES)
+	{
+		// Too big to pool, so it goes straight back to the heap when freed
+		blockSize=size+VOICE_ARENA_HEADER_SIZE;
+		memory=(char*) rakMalloc_Ex(blockSize, _FILE_AND_LINE_);
+		if (memory==0)
+			return 0;
+		statistics.heapAllocations++;
+		statistics.heapBytes+=blockSize;
+	}
+	else if (freeLists[sizeClass])
+	{
+		// Reuse a freed block
+		memory=(char*) freeLists[sizeClass];
+		freeLists[sizeClass]=*(void**) memory;
+	}
+	else
+	{
+		if (blockSize+VOICE_ARENA_CHUNK_HEADER_SIZE > VOICE_ARENA_CHUNK_SIZE)
+		{
+			// A chunk of its own
+			memory=(char*) rakMalloc_Ex(blockSize+VOICE_ARENA_CHUNK_HEADER_SIZE, _FILE_AND_LINE_);
+			if (memory==0)
+				return 0;
+			*(void**) memory=chunks;
+			chunks=memory;
+			memory+=VOICE_ARENA_CHUNK_HEADER_SIZE;
+			statistics.heapBytes+=blockSize+VOICE_ARENA_CHUNK_HEADER_SIZE;
+		}
+		else
+		{
+			if (chunkRemaining < blockSize)
+			{
+				// The rest of the old chunk is too small for this class, and is left unused
+				memory=(char*) rakMalloc_Ex(VOICE_ARENA_CHUNK_SIZE, _FILE_AND_LINE_);
+				if (memory==0)
+					return 0;
+				*(void**) memory=chunks;
+				chunks=memory;
+				chunkCursor=memory+VOICE_ARENA_CHUNK_HEADER_SIZE;
+				chunkRemaining=VOICE_ARENA_CHUNK_SIZE-VOICE_ARENA_CHUNK_HEADER_SIZE;
+				statistics.heapBytes+=VOICE_ARENA_CHUNK_SIZE;
+			}
+			memory=chunkCursor;
+			chunkCursor+=blockSize;
+			chunkRemaining-=blockSize;
+		}
+		statistics.heapAllocations++;
+	}
+
+	statistics.bytesInUse+=blockSize;
+	header=(VoiceArenaHeader*) memory;
+	header->arena=this;
+	header->sizeClass=sizeClass;
+	header->capacity=(uint32_t) (blockSize-VOICE_ARENA_HEADER_SIZE);
+
+	// Speex expects calloc
+	memset(memory+VOICE_ARENA_HEADER_SIZE, 0, header->capacity);
+	return memory+VOICE_ARENA_HEADER_SIZE;
+}
+void VoiceArena::Free(void *block)
+{
+	if (block==0)
+		return;
+
+	VoiceArenaHeader *header=GetHeader(block);
+	if (header->arena==0)
+		rakFree_Ex(header, _FILE_AND_LINE_);
+	else
+		header->arena->FreeBlock(header, header->sizeClass);
+}
+void VoiceArena::FreeBlock(void *block, unsigned sizeClass)
+{
+	VoiceArenaHeader *header=(VoiceArenaHeader*) block;
+	statistics.frees++;
+	statistics.bytesInUse-=header->capacity+VOICE_ARENA_HEADER_SIZE;
+
+	if (sizeClass==VOICE_ARENA_SIZE_CLASSES)
+	{
+		rakFree_Ex(block, _FILE_AND_LINE_);
+		return;
+	}
+
+	*(void**) block=freeLists[sizeClass];
+	freeLists[sizeClass]=block;
+}
+void* VoiceArena::Reallocate(void *block, size_t size)
+{
+	if (block==0)
+		return AllocateCurrent(size);
+
+	VoiceArenaHeader *header=GetHeader(block);
+	if (size <= header->capacity)
+		return block;
+
+	// Stay in the same arena as the old block
+	VoiceArena *previous=currentArena;
+	currentArena=header->arena;
+	void *moved=AllocateCurrent(size);
+	currentArena=previous;
+	if (moved==0)
+		return 0;
+
+	memcpy(moved, block, header->capacity);
+	Free(block);
+	return moved;
+}
+void VoiceArena::Release(void)
+{
+	RakAssert(statistics.bytesInUse==0);
+
+	void *next;
+	while (chunks)
+	{
+		next=*(void**) chunks;
+		rakFree_Ex(chunks, _FILE_AND_LINE_);
+		chunks=next;
+	}
+	memset(freeLists, 0, sizeof(freeLists));
+	chunkCursor=0;
+	chunkRemaining=0;
+}
+const VoiceArenaStatistics& VoiceArena::GetStatistics(void) const
+{
+	return statistics;
+}
+VoiceArena::Scope::Scope(VoiceArena *arena)
+{
+	previous=currentArena;
+	currentArena=arena;
+}
+VoiceArena::Scope::~Scope()
+{
+	currentArena=previous;
+}
+VoiceArena* VoiceArena::GetCurrent(void)
+{
+	return currentArena;
+}
+uint64_t VoiceArena::GetUnpooledAllocationCount(void)
+{
+	return unpooledAllocations;
+}
+
+#if RAKVOICE_OVERRIDE_SPEEX_ALLOC==1
+// libspeex calls these for all of its memory (see misc.h)
+extern "C"
+{
+void *speex_alloc (int size)
+{
+	return AllocateCurrent((size_t) size);
+}
+void *speex_alloc_scratch (int size)
+{
+	return AllocateCurrent((size_t) size);
+}
+void *speex_realloc (void *ptr, int size)
+{
+	return VoiceArena::Reallocate(ptr, (size_t) size);
+}
+void speex_free (void *ptr)
+{
+	VoiceArena::Free(ptr);
+}
+void speex_free_scratch (void *ptr)
+{
+	VoiceArena::Free(ptr);
+}
+}
+#endif
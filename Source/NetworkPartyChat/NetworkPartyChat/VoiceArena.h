@@ -0,0 +1,101 @@
+/// \file
+/// \brief Pooled memory for RakVoice channels and the speex codec state
+
+#ifndef __VOICE_ARENA_H
+#define __VOICE_ARENA_H
+
+#include "Export.h"
+#include "NativeTypes.h"
+#include <stddef.h>
+
+namespace RakNet {
+
+/// Set to 1 to route speex_alloc and the other speex allocation wrappers into the current VoiceArena.
+/// libspeex has to be built with OVERRIDE_SPEEX_ALLOC, OVERRIDE_SPEEX_ALLOC_SCRATCH, OVERRIDE_SPEEX_REALLOC,
+/// OVERRIDE_SPEEX_FREE and OVERRIDE_SPEEX_FREE_SCRATCH defined to match, or the wrappers are defined twice.
+/// The libspeex project in the demo tree is built that way, and is the one DemoApplication and VoiceBenchmark link.
+#ifndef RAKVOICE_OVERRIDE_SPEEX_ALLOC
+#define RAKVOICE_OVERRIDE_SPEEX_ALLOC 1
+#endif
+
+// Smallest block handed out, in bytes.  Each size class is double the one before.
+#define VOICE_ARENA_MIN_BLOCK 64
+// Size classes, so the largest pooled block is VOICE_ARENA_MIN_BLOCK << (VOICE_ARENA_SIZE_CLASSES-1) bytes
+#define VOICE_ARENA_SIZE_CLASSES 16
+// Bytes taken from the heap at a time to carve small blocks from.  Larger blocks get a chunk of their own.
+#define VOICE_ARENA_CHUNK_SIZE 65536
+
+/// Allocation counts of a VoiceArena, as returned by VoiceArena::GetStatistics
+struct VoiceArenaStatistics
+{
+	/// Blocks handed out
+	uint64_t allocations;
+	/// Blocks handed out that needed new memory from the heap, instead of reusing a freed block.  Stops rising once the arena has warmed up.
+	uint64_t heapAllocations;
+	/// Blocks given back
+	uint64_t frees;
+	/// Bytes taken from the heap so far
+	uint64_t heapBytes;
+	/// Bytes in blocks that haven't been given back
+	uint64_t bytesInUse;
+};
+
+/// \brief A pool of power of two sized blocks, carved from large chunks of heap memory.
+/// Freed blocks go on a free list for their size and are handed out again, so once a RakVoice has opened and
+/// closed its channels the memory is reused instead of going back to the heap.  Nothing is returned to the heap until Release.
+/// Every block starts with a small header naming its arena, so Free works without knowing where a block came from.
+/// Not thread safe.  An arena belongs to the thread that runs its RakVoice.
+class RAK_DLL_EXPORT VoiceArena
+{
+public:
+	VoiceArena();
+	~VoiceArena();
+
+	/// \brief Returns a zeroed block of at least \a size bytes
+	void* Allocate(size_t size);
+
+	/// \brief Gives a block back to the arena it came from, or to the heap if it didn't come from an arena
+	static void Free(void *block);
+
+	/// \brief Moves a block to one of \a size bytes, keeping its contents
+	static void* Reallocate(void *block, size_t size);
+
+	/// \brief Returns the arena's memory to the heap.  Every block must have been freed.
+	void Release(void);
+
+	/// \brief Returns the allocation counts so far
+	const VoiceArenaStatistics& GetStatistics(void) const;
+
+	/// \brief Speex allocates from this arena on this thread while a Scope is alive
+	class RAK_DLL_EXPORT Scope
+	{
+	public:
+		Scope(VoiceArena *arena);
+		~Scope();
+	private:
+		VoiceArena *previous;
+	};
+
+	/// \brief Returns the arena speex allocates from on this thread, or 0 if it allocates from the heap
+	static VoiceArena* GetCurrent(void);
+
+	/// \brief Returns how many speex allocations went straight to the heap, because no arena was current
+	static uint64_t GetUnpooledAllocationCount(void);
+
+protected:
+	/// \internal
+	void FreeBlock(void *block, unsigned sizeClass);
+
+	// Freed blocks of each size class, linked through their first bytes
+	void *freeLists[VOICE_ARENA_SIZE_CLASSES];
+	// Every chunk taken from the heap, linked through their first bytes
+	void *chunks;
+	// The unused end of the newest small block chunk
+	char *chunkCursor;
+	size_t chunkRemaining;
+	VoiceArenaStatistics statistics;
+};
+
+} // namespace RakNet
+
+#endif
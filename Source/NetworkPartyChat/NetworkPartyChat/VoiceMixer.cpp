@@ -0,0 +1,523 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceMixer.h"
+
+// Standard libraries
+#include <algorithm>
+#include <cstring>
+
+// Raknet libraries
+#include <MessageIdentifiers.h>
+#include <PacketPriority.h>
+
+// Speex libraries
+#include <speex/speex.h>
+
+// NPC libraries
+#include "RakVoice.h"
+#include "VoiceMixing.h"
+
+// 1 byte for ID, 2 bytes(short) for message number
+static const unsigned int VOICE_DATA_HEADER_SIZE = sizeof(RakNet::MessageID) + sizeof(unsigned short);
+
+// Mixed packets carry one frame & dont repeat any, so their frame count byte is always 0
+static const unsigned int VOICE_MIX_PAYLOAD_OFFSET = VOICE_DATA_HEADER_SIZE + 1;
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Allocates the mixer state for every client slot up front.
+
+	@param:		clients					- The server's client registry.
+	@param:		sampleRate				- 8000, 16000 or 32000. Only talkers using this rate are mixed.
+*/
+VoiceMixer::VoiceMixer(ClientRegistry& clients, int sampleRate) : _Clients(clients), _SampleRate(sampleRate) {
+
+	// Get the frame size of the speex mode
+	void* decoder = CreateDecoder();
+	speex_decoder_ctl(decoder, SPEEX_GET_FRAME_SIZE, &_FrameSize);
+	speex_decoder_destroy(decoder);
+	_FrameDuration = std::chrono::microseconds((1000000ll * _FrameSize) / _SampleRate);
+
+	for (unsigned int i = 0; i < _Clients.getCapacity(); ++i) {
+
+		_Talkers.emplace_back();
+		Talker& talker = _Talkers.back();
+		talker.Frames.resize(VOICE_MIX_QUEUE_FRAMES * _FrameSize);
+		talker.Pending.resize(VOICE_MIX_PENDING_PACKETS);
+		speex_bits_init(&talker.Bits);
+	}
+
+	// Every channel could be mixed at once, so there is a set of buffers for each
+	_Channels.reserve(_Clients.getCapacity());
+	for (unsigned int i = 0; i < _Clients.getCapacity(); ++i) {
+
+		_Scratch.emplace_back(new MixScratch());
+		MixScratch& mix = *_Scratch.back();
+		mix.Accumulator.resize(_FrameSize);
+		mix.MixOut.resize(_FrameSize);
+		speex_bits_init(&mix.Bits);
+		mix.Packet[0] = ID_RAKVOICE_DATA;
+		mix.Packet[VOICE_DATA_HEADER_SIZE] = 0;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Default deconstructor
+*/
+VoiceMixer::~VoiceMixer() {
+
+	FinishDecoding();
+
+	for (auto& iter : _Talkers) {
+
+		if (iter.Decoder != nullptr) { speex_decoder_destroy(iter.Decoder); }
+		if (iter.Encoder != nullptr) { speex_encoder_destroy(iter.Encoder); }
+		speex_bits_destroy(&iter.Bits);
+	}
+	for (auto& iter : _SharedEncoders) {
+
+		if (iter.second != nullptr) { speex_encoder_destroy(iter.second); }
+	}
+	for (auto& iter : _Scratch) { speex_bits_destroy(&iter->Bits); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Sets the pool that decodes talkers & mixes channels. Anything still being decoded on
+				the previous pool is finished first.
+
+	@param:		pool					- The pool to use, or nullptr to do everything on the calling thread.
+
+	@return:	VOID
+*/
+void VoiceMixer::setWorkerPool(VoiceWorkerPool* pool) {
+
+	FinishDecoding();
+	_Pool = pool;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Starts mixing for a client, their voice is mixed into their channel & they hear
+				the channel's mix. Any state from a previous client in the slot is reset.
+
+	@param:		slot					- The client's registry slot.
+
+	@return:	VOID
+*/
+void VoiceMixer::OpenSlot(unsigned int slot) {
+
+	FinishDecoding();
+
+	Talker& talker = _Talkers[slot];
+
+	if (talker.Decoder == nullptr) { talker.Decoder = CreateDecoder(); }
+	else { speex_decoder_ctl(talker.Decoder, SPEEX_RESET_STATE, nullptr); }
+	if (talker.Encoder != nullptr) { speex_encoder_ctl(talker.Encoder, SPEEX_RESET_STATE, nullptr); }
+
+	talker.ReadFrame = 0;
+	talker.FrameCount = 0;
+	talker.NextSequence = 0;
+	talker.SequenceStarted = false;
+	talker.Primed = false;
+	talker.Active = false;
+	talker.Open = true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Stops mixing for a client.
+
+	@param:		slot					- The client's registry slot.
+
+	@return:	VOID
+*/
+void VoiceMixer::CloseSlot(unsigned int slot) {
+
+	FinishDecoding();
+
+	Talker& talker = _Talkers[slot];
+	talker.Open = false;
+	talker.Primed = false;
+	talker.Active = false;
+	talker.FrameCount = 0;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Drops everything queued for mixing, used when mixing is switched back on. The message
+				numbers sent to each client carry on, as their jitter buffers are still running.
+
+	@return:	VOID
+*/
+void VoiceMixer::Restart() {
+
+	FinishDecoding();
+
+	for (auto& iter : _Talkers) {
+
+		if (iter.Decoder != nullptr) { speex_decoder_ctl(iter.Decoder, SPEEX_RESET_STATE, nullptr); }
+		iter.ReadFrame = 0;
+		iter.FrameCount = 0;
+		iter.SequenceStarted = false;
+		iter.Primed = false;
+		iter.Active = false;
+	}
+	_Mixing = false;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Queues a talker's voice packet to be decoded into their frame queue. With a worker
+				pool the packet is copied & decoded on the talker's strand, so this returns straight
+				away & the talkers are decoded at the same time. Otherwise it is decoded here.
+
+	@param:		slot					- The talker's registry slot.
+	@param:		sequence				- The talker's message number for the packet.
+	@param:		data					- The voice payload (redundant frames, then the speex frame).
+	@param:		length					- Length of the payload in bytes.
+
+	@return:	VOID
+*/
+void VoiceMixer::OnVoiceData(unsigned int slot, unsigned short sequence, const unsigned char* data, unsigned int length) {
+
+	Talker& talker = _Talkers[slot];
+	if (!talker.Open) { return; }
+
+	if (_Pool == nullptr) { DecodePacket(talker, sequence, data, length); return; }
+
+	// Too far behind to keep up, drop the packet (it is concealed like a lost one)
+	if (length > VOICE_MIX_MAX_PAYLOAD || talker.PendingCount.load() == VOICE_MIX_PENDING_PACKETS) { return; }
+
+	PendingPacket& packet = talker.Pending[talker.PendingWrite];
+	packet.Sequence = sequence;
+	packet.Length = length;
+	memcpy(packet.Data, data, length);
+	talker.PendingWrite = (talker.PendingWrite + 1) % VOICE_MIX_PENDING_PACKETS;
+	talker.PendingCount++;
+
+	_Pool->Submit(talker.Decoding, _Decodes, [this, slot] { DecodePending(slot); });
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Decodes the oldest packet copied for a talker (runs on the talker's strand).
+
+	@param:		slot					- The talker's registry slot.
+
+	@return:	VOID
+*/
+void VoiceMixer::DecodePending(unsigned int slot) {
+
+	Talker& talker = _Talkers[slot];
+	const PendingPacket& packet = talker.Pending[talker.PendingRead];
+	DecodePacket(talker, packet.Sequence, packet.Data, packet.Length);
+
+	talker.PendingRead = (talker.PendingRead + 1) % VOICE_MIX_PENDING_PACKETS;
+	talker.PendingCount--;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Decodes a talker's voice packet into their frame queue. Small gaps in their message
+				numbers are filled in from the redundant copies in the packet, or else with speex's
+				packet loss concealment. Larger ones are the talker pausing (their message numbers
+				count the frames they didnt send). Only touches the talker, so talkers can be decoded
+				at the same time.
+
+	@param:		talker					- The talker the packet is from.
+	@param:		sequence				- The talker's message number for the packet.
+	@param:		data					- The voice payload (redundant frames, then the speex frame).
+	@param:		length					- Length of the payload in bytes.
+
+	@return:	VOID
+*/
+void VoiceMixer::DecodePacket(Talker& talker, unsigned short sequence, const unsigned char* data, unsigned int length) {
+
+	// Find the packet's frames & the redundant copies of the frames before them (newest first)
+	RakNet::VoicePayload payload;
+	if (!RakNet::ParseVoicePayload(data, length, &payload)) { return; }
+
+	// An end of talk marker carries no frames, the talker simply stops adding to the mix
+	if (payload.frameCount == 0) { return; }
+
+	if (talker.SequenceStarted) {
+
+		// Intentional overflow, anything "behind" us is late & dropped
+		unsigned short skipped = sequence - talker.NextSequence;
+		if (skipped > ((unsigned short)-1) / 2) { return; }
+
+		unsigned int conceal = (skipped <= VOICE_MIX_MAX_CONCEAL) ? skipped : 0;
+		for (unsigned int i = 0; i < conceal; ++i) {
+
+			// Copy N is of the frame N + 1 before this packet's
+			unsigned int copy = conceal - 1 - i;
+			if (copy < payload.redundantCount) {
+
+				speex_bits_read_from(&talker.Bits, (char*)payload.redundantFrames[copy], (int)payload.redundantLengths[copy]);
+				speex_decode_int(talker.Decoder, &talker.Bits, (spx_int16_t*)PushFrame(talker));
+				talker.RecoveredFrames++;
+			}
+			else {
+
+				speex_decode_int(talker.Decoder, nullptr, (spx_int16_t*)PushFrame(talker));
+				talker.ConcealedFrames++;
+			}
+		}
+	}
+	talker.SequenceStarted = true;
+	talker.NextSequence = sequence + (unsigned short)payload.frameCount;
+	talker.FramesPerPacket = payload.frameCount;
+
+	for (unsigned int i = 0; i < payload.frameCount; ++i) {
+
+		speex_bits_read_from(&talker.Bits, (char*)payload.frames[i], (int)payload.frameLengths[i]);
+		speex_decode_int(talker.Decoder, &talker.Bits, (spx_int16_t*)PushFrame(talker));
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Waits for every packet queued for decoding, then adds the talkers' decode counters to
+				the mixer's stats.
+
+	@return:	VOID
+*/
+void VoiceMixer::FinishDecoding() {
+
+	if (_Pool != nullptr) { _Pool->Wait(_Decodes); }
+
+	for (auto& iter : _Talkers) {
+
+		_Stats.ConcealedFrames += iter.ConcealedFrames;
+		_Stats.RecoveredFrames += iter.RecoveredFrames;
+		iter.ConcealedFrames = 0;
+		iter.RecoveredFrames = 0;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Mixes & sends every frame that has come due since the last call. Run this at least
+				once per server tick, as it catches up on whole frames by the clock.
+
+	@param:		peer					- The server's peer, to send the mixes with.
+
+	@return:	VOID
+*/
+void VoiceMixer::MixDueFrames(RakNet::RakPeerInterface* peer) {
+
+	// The frames being mixed have to be in the queues
+	FinishDecoding();
+
+	Clock::time_point now = Clock::now();
+	if (!_Mixing) { _NextMix = now; _Mixing = true; }
+
+	unsigned int framesMixed = 0;
+	while (now >= _NextMix) {
+
+		// Fallen too far behind, skip ahead rather than bursting
+		if (framesMixed++ == VOICE_MIX_MAX_CATCH_UP) {
+
+			// The skipped frames still count, so listeners dont take the jump for network jitter
+			_FrameNumber += (unsigned short)((now - _NextMix) / _FrameDuration);
+			_NextMix = now + _FrameDuration;
+			break;
+		}
+
+		// Find the channels that have someone to mix
+		_Channels.clear();
+		for (unsigned int i = 0; i < _Clients.getSize(); ++i) {
+
+			if (!_Talkers[_Clients.getHandleAt(i).Slot].Open) { continue; }
+
+			int channel = _Clients.getInfoAt(i).Channel;
+			if (std::find(_Channels.begin(), _Channels.end(), channel) == _Channels.end()) {
+
+				// The mix jobs only look encoders up, so any new channel's entry is added here
+				_Channels.push_back(channel);
+				_SharedEncoders.emplace(channel, nullptr);
+			}
+		}
+
+		// Channels dont share any talkers, so each one is mixed & sent by its own job
+		for (unsigned int i = 0; i < _Channels.size(); ++i) {
+
+			MixScratch* mix = _Scratch[i].get();
+			mix->Peer = peer;
+			mix->Channel = _Channels[i];
+			if (_Pool == nullptr || _Channels.size() == 1) { MixChannel(*mix); }
+			else { _Pool->Submit(_Mixes, [this, mix] { MixChannel(*mix); }); }
+		}
+		if (_Pool != nullptr) { _Pool->Wait(_Mixes); }
+
+		for (unsigned int i = 0; i < _Channels.size(); ++i) {
+
+			MixStats& counted = _Scratch[i]->Stats;
+			_Stats.FramesMixed += counted.FramesMixed;
+			_Stats.SharedEncodes += counted.SharedEncodes;
+			_Stats.PersonalEncodes += counted.PersonalEncodes;
+			_Stats.PacketsOut += counted.PacketsOut;
+			counted = MixStats();
+		}
+		_NextMix += _FrameDuration;
+		_FrameNumber++;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Mixes one frame of a channel & sends it to the channel's listeners. Everyone who isnt
+				talking gets the full mix, which is encoded once. Talkers get the mix minus their own
+				voice, encoded with their own encoder. Only touches the channel's talkers & buffers,
+				so channels can be mixed at the same time.
+
+	@param:		mix						- The channel to mix, & the buffers to mix it with.
+
+	@return:	VOID
+*/
+void VoiceMixer::MixChannel(MixScratch& mix) {
+
+	const std::vector<unsigned int>& members = _Clients.getChannelMembers(mix.Channel);
+
+	// Sum up every talker with a frame ready
+	VoiceMixing::ZeroInt32(mix.Accumulator.data(), _FrameSize);
+	unsigned int activeTalkers = 0;
+	for (unsigned int slot : members) {
+
+		Talker& talker = _Talkers[slot];
+		talker.Active = false;
+		if (!talker.Open) { continue; }
+
+		// Bundled frames arrive together, so hold the rest of a packet on top
+		if (!talker.Primed && talker.FrameCount >= VOICE_MIX_PRIME_FRAMES + talker.FramesPerPacket - 1) { talker.Primed = true; }
+		if (!talker.Primed) { continue; }
+
+		// Ran dry, wait for the queue to fill up again before mixing them back in
+		if (talker.FrameCount == 0) { talker.Primed = false; continue; }
+
+		VoiceMixing::AccumulateInt16(mix.Accumulator.data(), &talker.Frames[talker.ReadFrame * _FrameSize], _FrameSize);
+		talker.Active = true;
+		activeTalkers++;
+	}
+	if (activeTalkers == 0) { return; }
+	mix.Stats.FramesMixed++;
+
+	// The full mix, shared by everyone who isnt talking
+	bool sharedEncoded = false;
+	unsigned int sharedLength = 0;
+	for (unsigned int slot : members) {
+
+		Talker& talker = _Talkers[slot];
+		if (!talker.Open || talker.Active) { continue; }
+
+		if (!sharedEncoded) {
+
+			void*& encoder = _SharedEncoders.at(mix.Channel);
+			if (encoder == nullptr) { encoder = CreateEncoder(); }
+
+			VoiceMixing::ClampToInt16(mix.MixOut.data(), mix.Accumulator.data(), _FrameSize);
+			sharedLength = Encode(mix, encoder, mix.MixOut.data());
+			sharedEncoded = true;
+			mix.Stats.SharedEncodes++;
+		}
+		SendMix(mix, slot, sharedLength);
+	}
+
+	// Each talker hears everyone but themselves
+	for (unsigned int slot : members) {
+
+		Talker& talker = _Talkers[slot];
+		if (!talker.Active) { continue; }
+
+		if (activeTalkers > 1) {
+
+			if (talker.Encoder == nullptr) { talker.Encoder = CreateEncoder(); }
+
+			VoiceMixing::SubtractClampToInt16(mix.MixOut.data(), mix.Accumulator.data(), &talker.Frames[talker.ReadFrame * _FrameSize], _FrameSize);
+			SendMix(mix, slot, Encode(mix, talker.Encoder, mix.MixOut.data()));
+			mix.Stats.PersonalEncodes++;
+		}
+
+		// Done with this frame
+		talker.ReadFrame = (talker.ReadFrame + 1) % VOICE_MIX_QUEUE_FRAMES;
+		talker.FrameCount--;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Sends the encoded mix currently in the channel's packet buffer to a client.
+
+	@param:		mix						- The channel being mixed.
+	@param:		slot					- The client's registry slot.
+	@param:		length					- Length of the speex data in bytes.
+
+	@return:	VOID
+*/
+void VoiceMixer::SendMix(MixScratch& mix, unsigned int slot, unsigned int length) {
+
+	// Every mix of this frame carries the same number, listeners use it as the timestamp
+	memcpy(mix.Packet + sizeof(RakNet::MessageID), &_FrameNumber, sizeof(unsigned short));
+
+	mix.Peer->Send((const char*)mix.Packet, (int)(length + VOICE_MIX_PAYLOAD_OFFSET), HIGH_PRIORITY, UNRELIABLE, 0, _Clients.getInfoBySlot(slot).GUID, false);
+	mix.Stats.PacketsOut++;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Encodes one frame into the channel's packet buffer.
+
+	@param:		mix						- The channel being mixed.
+	@param:		encoder					- The speex encoder to use.
+	@param:		samples					- One frame of samples.
+
+	@return:	unsigned int			- Length of the speex data in bytes.
+*/
+unsigned int VoiceMixer::Encode(MixScratch& mix, void* encoder, const int16_t* samples) {
+
+	speex_bits_reset(&mix.Bits);
+	speex_encode_int(encoder, (spx_int16_t*)samples, &mix.Bits);
+	return (unsigned int)speex_bits_write(&mix.Bits, (char*)mix.Packet + VOICE_MIX_PAYLOAD_OFFSET, sizeof(mix.Packet) - VOICE_MIX_PAYLOAD_OFFSET);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Adds a frame to the end of a talker's queue, dropping the oldest frame if it is full.
+
+	@return:	int16_t*				- Where to decode the frame to.
+*/
+int16_t* VoiceMixer::PushFrame(Talker& talker) {
+
+	if (talker.FrameCount == VOICE_MIX_QUEUE_FRAMES) {
+
+		talker.ReadFrame = (talker.ReadFrame + 1) % VOICE_MIX_QUEUE_FRAMES;
+		talker.FrameCount--;
+	}
+
+	unsigned int writeFrame = (talker.ReadFrame + talker.FrameCount) % VOICE_MIX_QUEUE_FRAMES;
+	talker.FrameCount++;
+	return &talker.Frames[writeFrame * _FrameSize];
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Creates a speex encoder with the same settings RakVoice uses by default.
+
+	@return:	void*
+*/
+void* VoiceMixer::CreateEncoder() {
+
+	void* encoder;
+	if (_SampleRate == 8000) { encoder = speex_encoder_init(&speex_nb_mode); }
+	else if (_SampleRate == 16000) { encoder = speex_encoder_init(&speex_wb_mode); }
+	else { encoder = speex_encoder_init(&speex_uwb_mode); }
+
+	int complexity = 2;
+	int vbr = 0;
+	speex_encoder_ctl(encoder, SPEEX_SET_COMPLEXITY, &complexity);
+	speex_encoder_ctl(encoder, SPEEX_SET_VBR, &vbr);
+	return encoder;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Creates a speex decoder for the mixer's sample rate.
+
+	@return:	void*
+*/
+void* VoiceMixer::CreateDecoder() {
+
+	if (_SampleRate == 8000) { return speex_decoder_init(&speex_nb_mode); }
+	if (_SampleRate == 16000) { return speex_decoder_init(&speex_wb_mode); }
+	return speex_decoder_init(&speex_uwb_mode);
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+
+// Standard libraries
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Raknet libraries
+#include <RakNetTypes.h>
+#include <RakPeerInterface.h>
+
+// Speex libraries
+#include <speex/speex_bits.h>
+
+// NPC libraries
+#include "ClientRegistry.h"
+#include "VoiceWorkerPool.h"
+
+#define VOICE_MIX_QUEUE_FRAMES (16)							// Decoded frames buffered for each talker.
+#define VOICE_MIX_PRIME_FRAMES (3)							// Frames a talker must have buffered before they are mixed in, plus the rest of a bundled packet.
+#define VOICE_MIX_MAX_CONCEAL (5)							// Largest gap concealed for a talker, anything longer is them pausing.
+#define VOICE_MIX_MAX_CATCH_UP (5)							// Most frames mixed in one update before the clock is reset.
+#define VOICE_MIX_PENDING_PACKETS (8)						// Packets a talker can have waiting for a worker to decode them.
+#define VOICE_MIX_MAX_PAYLOAD (1024)						// Largest voice payload copied for a worker, anything bigger is dropped.
+
+struct MixStats {
+
+	unsigned long long FramesMixed = 0;						// Frames mixed across every channel.
+	unsigned long long SharedEncodes = 0;					// Encodes of a channel's full mix, shared by everyone not talking.
+	unsigned long long PersonalEncodes = 0;					// Encodes of a talker's mix minus their own voice.
+	unsigned long long PacketsOut = 0;						// Mixed packets sent to listeners.
+	unsigned long long ConcealedFrames = 0;					// Frames interpolated for lost talker packets.
+	unsigned long long RecoveredFrames = 0;					// Lost talker frames decoded from the redundant copies in later packets.
+};
+
+// Decodes the talkers of each channel & sends every listener one mixed stream, minus their own voice (MCU).
+// Everyone who isnt talking hears the same mix, so that mix is encoded once per channel & shared.
+// With a worker pool, talkers are decoded as their packets arrive (in order, on a strand per talker)
+// & the channels are mixed & encoded at the same time, one job each.
+class VoiceMixer {
+
+public:
+
+	// Constructors
+	VoiceMixer(ClientRegistry& clients, int sampleRate);
+	~VoiceMixer();
+
+	// Slots
+	void OpenSlot(unsigned int slot);
+	void CloseSlot(unsigned int slot);
+	void Restart();
+	bool isSlotOpen(unsigned int slot) const				{ return _Talkers[slot].Open; }
+	void setWorkerPool(VoiceWorkerPool* pool);
+
+	// Mixing
+	void OnVoiceData(unsigned int slot, unsigned short sequence, const unsigned char* data, unsigned int length);
+	void MixDueFrames(RakNet::RakPeerInterface* peer);
+
+	// Properties
+	int getSampleRate() const								{ return _SampleRate; }
+	const MixStats& getStats() const						{ return _Stats; }
+
+protected:
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct PendingPacket {
+
+		unsigned short Sequence = 0;						// The talker's message number for the packet.
+		unsigned int Length = 0;
+		unsigned char Data[VOICE_MIX_MAX_PAYLOAD];
+	};
+
+	struct Talker {
+
+		void* Decoder = nullptr;							// Speex decoder for the talker's upload.
+		void* Encoder = nullptr;							// Speex encoder for the mix this client hears while talking.
+		SpeexBits Bits;										// Reused for every decode of the talker's upload.
+		std::vector<int16_t> Frames;						// Ring of decoded frames waiting to be mixed.
+		unsigned int ReadFrame = 0;
+		unsigned int FrameCount = 0;
+		unsigned short NextSequence = 0;					// Message number expected next from the talker.
+		unsigned int FramesPerPacket = 1;					// Frames the talker bundles into each packet.
+		bool SequenceStarted = false;
+		bool Primed = false;								// Returns TRUE once enough frames are buffered to mix the talker in.
+		bool Active = false;								// Returns TRUE if the talker is in the frame being mixed.
+		bool Open = false;
+
+		std::vector<PendingPacket> Pending;					// Ring of packets copied for a worker to decode.
+		unsigned int PendingRead = 0;						// Only moved by the decode jobs.
+		unsigned int PendingWrite = 0;						// Only moved by OnVoiceData.
+		std::atomic<unsigned int> PendingCount{ 0 };		// Packets copied that havent been decoded yet.
+		VoiceWorkerPool::Strand Decoding;					// Keeps the talker's packets decoded in the order they arrived.
+		unsigned long long ConcealedFrames = 0;				// Counted while decoding, added to the stats before mixing.
+		unsigned long long RecoveredFrames = 0;
+	};
+
+	struct MixScratch {
+
+		RakNet::RakPeerInterface* Peer = nullptr;			// The server's peer, to send the mixes with.
+		int Channel = 0;									// The channel being mixed.
+		std::vector<int32_t> Accumulator;					// Sum of every talker in the channel being mixed.
+		std::vector<int16_t> MixOut;						// Clamped mix being encoded.
+		SpeexBits Bits;										// Reused for every encode of the channel.
+		unsigned char Packet[2048];							// [ID_RAKVOICE_DATA][message number][0 (1 frame, no copies)][speex data]
+		MixStats Stats;										// Counted by the mix job, added to the mixer's stats once it finishes.
+	};
+
+	void DecodePacket(Talker& talker, unsigned short sequence, const unsigned char* data, unsigned int length);
+	void DecodePending(unsigned int slot);
+	void FinishDecoding();
+	int16_t* PushFrame(Talker& talker);
+	void MixChannel(MixScratch& mix);
+	void SendMix(MixScratch& mix, unsigned int slot, unsigned int length);
+	unsigned int Encode(MixScratch& mix, void* encoder, const int16_t* samples);
+	void* CreateEncoder();
+	void* CreateDecoder();
+
+	ClientRegistry& _Clients;								// The clients connected to the server.
+	int _SampleRate;										// The sample rate every mixed talker & listener uses.
+	int _FrameSize = 0;										// Samples in one speex frame.
+	std::chrono::microseconds _FrameDuration;				// Time covered by one speex frame.
+	Clock::time_point _NextMix;								// When the next frame is due to be mixed.
+	bool _Mixing = false;									// Returns TRUE while the mix clock is running.
+	unsigned short _FrameNumber = 0;						// Frames of the mix clock so far, sent as the message number of every mixed packet.
+
+	std::deque<Talker> _Talkers;							// Mixer state for each registry slot (a deque, as talkers cant be moved).
+	std::unordered_map<int, void*> _SharedEncoders;			// Channel to the encoder for its shared mix.
+	std::vector<int> _Channels;								// Channels with an open slot, rebuilt each frame.
+	std::vector<std::unique_ptr<MixScratch>> _Scratch;		// Buffers for each channel mixed at once (one per registry slot).
+	MixStats _Stats;										// Mixing counters.
+
+	VoiceWorkerPool* _Pool = nullptr;						// Runs the decode & mix jobs, or nullptr to run them on the calling thread.
+	VoiceWorkerPool::Group _Decodes;						// Decodes queued since the last mix.
+	VoiceWorkerPool::Group _Mixes;							// Channels of the frame being mixed.
+
+};
\ No newline at end of file
@@ -0,0 +1,554 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceMixing.h"
+
+// Standard libraries
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define VOICE_MIXING_HAS_SSE2
+	#include <emmintrin.h>
+#endif
+
+// The AVX2 kernels are always compiled on x86, & only run if the CPU has AVX2
+#if defined(VOICE_MIXING_HAS_SSE2) && (defined(_MSC_VER) || defined(__GNUC__))
+	#define VOICE_MIXING_HAS_AVX2
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define VOICE_MIXING_AVX2_TARGET
+	#else
+		#define VOICE_MIXING_AVX2_TARGET __attribute__((target("avx2")))
+	#endif
+#endif
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Saturates a 32 bit sample to the 16 bit range.
+
+	@return:	int16_t
+*/
+static inline int16_t Saturate(int32_t sample) {
+
+	if (sample > 32767) { return 32767; }
+	if (sample < -32768) { return -32768; }
+	return (int16_t)sample;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Saturates a float sample to the 16 bit range, dropping any fraction.
+
+	@return:	int16_t
+*/
+static inline int16_t Saturate(float sample) {
+
+	if (sample > 32767.0f) { return 32767; }
+	if (sample < -32768.0f) { return -32768; }
+	return (int16_t)sample;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// Scalar kernels
+// ---------------------------------------------------------------------------------------------------------------
+
+static void AccumulateInt32Scalar(int32_t* accumulator, const int16_t* in, unsigned int count) {
+
+	for (unsigned int i = 0; i < count; ++i) { accumulator[i] += in[i]; }
+}
+
+static void ClampInt32Scalar(int16_t* out, const int32_t* accumulator, unsigned int count) {
+
+	for (unsigned int i = 0; i < count; ++i) { out[i] = Saturate(accumulator[i]); }
+}
+
+static void SubtractClampInt32Scalar(int16_t* out, const int32_t* accumulator, const int16_t* subtract, unsigned int count) {
+
+	for (unsigned int i = 0; i < count; ++i) { out[i] = Saturate(accumulator[i] - subtract[i]); }
+}
+
+static void AccumulateFloatScalar(float* accumulator, const int16_t* in, unsigned int count) {
+
+	for (unsigned int i = 0; i < count; ++i) { accumulator[i] += in[i]; }
+}
+
+static void ClampFloatScalar(int16_t* out, const float* accumulator, unsigned int count) {
+
+	for (unsigned int i = 0; i < count; ++i) { out[i] = Saturate(accumulator[i]); }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// SSE2 kernels (8 samples at a time)
+// ---------------------------------------------------------------------------------------------------------------
+
+#ifdef VOICE_MIXING_HAS_SSE2
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Sign extends 8 16 bit samples to 32 bits, by unpacking them into the high halves & shifting back down.
+
+	@return:	VOID
+*/
+static inline void WidenSSE2(const int16_t* in, __m128i& low, __m128i& high) {
+
+	__m128i samples = _mm_loadu_si128((const __m128i*)in);
+	low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+	high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+}
+
+static void AccumulateInt32SSE2(int32_t* accumulator, const int16_t* in, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8) {
+
+		__m128i low, high;
+		WidenSSE2(in + i, low, high);
+
+		__m128i* acc = (__m128i*)(accumulator + i);
+		_mm_storeu_si128(acc, _mm_add_epi32(_mm_loadu_si128(acc), low));
+		_mm_storeu_si128(acc + 1, _mm_add_epi32(_mm_loadu_si128(acc + 1), high));
+	}
+	AccumulateInt32Scalar(accumulator + i, in + i, count - i);
+}
+
+static void ClampInt32SSE2(int16_t* out, const int32_t* accumulator, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8) {
+
+		__m128i low = _mm_loadu_si128((const __m128i*)(accumulator + i));
+		__m128i high = _mm_loadu_si128((const __m128i*)(accumulator + i + 4));
+
+		// Packing with signed saturation does the clamp
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+	}
+	ClampInt32Scalar(out + i, accumulator + i, count - i);
+}
+
+static void SubtractClampInt32SSE2(int16_t* out, const int32_t* accumulator, const int16_t* subtract, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8) {
+
+		__m128i subLow, subHigh;
+		WidenSSE2(subtract + i, subLow, subHigh);
+
+		__m128i low = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(accumulator + i)), subLow);
+		__m128i high = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(accumulator + i + 4)), subHigh);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+	}
+	SubtractClampInt32Scalar(out + i, accumulator + i, subtract + i, count - i);
+}
+
+static void AccumulateFloatSSE2(float* accumulator, const int16_t* in, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8) {
+
+		__m128i low, high;
+		WidenSSE2(in + i, low, high);
+
+		_mm_storeu_ps(accumulator + i, _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_cvtepi32_ps(low)));
+		_mm_storeu_ps(accumulator + i + 4, _mm_add_ps(_mm_loadu_ps(accumulator + i + 4), _mm_cvtepi32_ps(high)));
+	}
+	AccumulateFloatScalar(accumulator + i, in + i, count - i);
+}
+
+static void ClampFloatSSE2(int16_t* out, const float* accumulator, unsigned int count) {
+
+	// Clamp to the 32 bit range first, so huge sums dont convert to the integer indefinite value
+	const __m128 maximum = _mm_set1_ps(32767.0f);
+	const __m128 minimum = _mm_set1_ps(-32768.0f);
+
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8) {
+
+		__m128 low = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(accumulator + i), maximum), minimum);
+		__m128 high = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(accumulator + i + 4), maximum), minimum);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(_mm_cvttps_epi32(low), _mm_cvttps_epi32(high)));
+	}
+	ClampFloatScalar(out + i, accumulator + i, count - i);
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------
+// AVX2 kernels (16 samples at a time)
+// ---------------------------------------------------------------------------------------------------------------
+
+#ifdef VOICE_MIXING_HAS_AVX2
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Packs 16 32 bit samples to 16 bits with signed saturation. The pack works within each 128 bit
+				lane, so the middle two quarters are swapped back afterwards.
+
+	@return:	__m256i
+*/
+VOICE_MIXING_AVX2_TARGET static inline __m256i PackAVX2(__m256i low, __m256i high) {
+
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+}
+
+VOICE_MIXING_AVX2_TARGET static void AccumulateInt32AVX2(int32_t* accumulator, const int16_t* in, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16) {
+
+		__m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+		__m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+
+		__m256i* acc = (__m256i*)(accumulator + i);
+		_mm256_storeu_si256(acc, _mm256_add_epi32(_mm256_loadu_si256(acc), low));
+		_mm256_storeu_si256(acc + 1, _mm256_add_epi32(_mm256_loadu_si256(acc + 1), high));
+	}
+	AccumulateInt32SSE2(accumulator + i, in + i, count - i);
+}
+
+VOICE_MIXING_AVX2_TARGET static void ClampInt32AVX2(int16_t* out, const int32_t* accumulator, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16) {
+
+		__m256i low = _mm256_loadu_si256((const __m256i*)(accumulator + i));
+		__m256i high = _mm256_loadu_si256((const __m256i*)(accumulator + i + 8));
+		_mm256_storeu_si256((__m256i*)(out + i), PackAVX2(low, high));
+	}
+	ClampInt32SSE2(out + i, accumulator + i, count - i);
+}
+
+VOICE_MIXING_AVX2_TARGET static void SubtractClampInt32AVX2(int16_t* out, const int32_t* accumulator, const int16_t* subtract, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16) {
+
+		__m256i subLow = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(subtract + i)));
+		__m256i subHigh = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(subtract + i + 8)));
+
+		__m256i low = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(accumulator + i)), subLow);
+		__m256i high = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(accumulator + i + 8)), subHigh);
+		_mm256_storeu_si256((__m256i*)(out + i), PackAVX2(low, high));
+	}
+	SubtractClampInt32SSE2(out + i, accumulator + i, subtract + i, count - i);
+}
+
+VOICE_MIXING_AVX2_TARGET static void AccumulateFloatAVX2(float* accumulator, const int16_t* in, unsigned int count) {
+
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16) {
+
+		__m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i))));
+		__m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8))));
+
+		_mm256_storeu_ps(accumulator + i, _mm256_add_ps(_mm256_loadu_ps(accumulator + i), low));
+		_mm256_storeu_ps(accumulator + i + 8, _mm256_add_ps(_mm256_loadu_ps(accumulator + i + 8), high));
+	}
+	AccumulateFloatSSE2(accumulator + i, in + i, count - i);
+}
+
+VOICE_MIXING_AVX2_TARGET static void ClampFloatAVX2(int16_t* out, const float* accumulator, unsigned int count) {
+
+	const __m256 maximum = _mm256_set1_ps(32767.0f);
+	const __m256 minimum = _mm256_set1_ps(-32768.0f);
+
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16) {
+
+		__m256 low = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(accumulator + i), maximum), minimum);
+		__m256 high = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(accumulator + i + 8), maximum), minimum);
+		_mm256_storeu_si256((__m256i*)(out + i), PackAVX2(_mm256_cvttps_epi32(low), _mm256_cvttps_epi32(high)));
+	}
+	ClampFloatSSE2(out + i, accumulator + i, count - i);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns TRUE if the CPU has AVX2 & the OS saves the AVX registers on a context switch.
+
+	@return:	bool
+*/
+static bool CpuHasAVX2() {
+
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) { return false; }
+
+	// OSXSAVE & AVX, then the OS has enabled the SSE & AVX state
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) { return false; }
+	if ((_xgetbv(0) & 0x6) != 0x6) { return false; }
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------------------------------------------
+
+struct Kernels {
+
+	void (*AccumulateInt32)(int32_t*, const int16_t*, unsigned int);
+	void (*ClampInt32)(int16_t*, const int32_t*, unsigned int);
+	void (*SubtractClampInt32)(int16_t*, const int32_t*, const int16_t*, unsigned int);
+	void (*AccumulateFloat)(float*, const int16_t*, unsigned int);
+	void (*ClampFloat)(int16_t*, const float*, unsigned int);
+};
+
+static const Kernels SCALAR_KERNELS = { AccumulateInt32Scalar, ClampInt32Scalar, SubtractClampInt32Scalar, AccumulateFloatScalar, ClampFloatScalar };
+#ifdef VOICE_MIXING_HAS_SSE2
+static const Kernels SSE2_KERNELS = { AccumulateInt32SSE2, ClampInt32SSE2, SubtractClampInt32SSE2, AccumulateFloatSSE2, ClampFloatSSE2 };
+#endif
+#ifdef VOICE_MIXING_HAS_AVX2
+static const Kernels AVX2_KERNELS = { AccumulateInt32AVX2, ClampInt32AVX2, SubtractClampInt32AVX2, AccumulateFloatAVX2, ClampFloatAVX2 };
+#endif
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the kernels for an instruction set, or the next best ones if it wasnt compiled in.
+
+	@return:	const Kernels&
+*/
+static const Kernels& getKernels(VoiceMixing::InstructionSet set) {
+
+#ifdef VOICE_MIXING_HAS_AVX2
+	if (set == VoiceMixing::VOICE_MIXING_AVX2) { return AVX2_KERNELS; }
+#endif
+#ifdef VOICE_MIXING_HAS_SSE2
+	if (set != VoiceMixing::VOICE_MIXING_SCALAR) { return SSE2_KERNELS; }
+#endif
+	(void)set;
+	return SCALAR_KERNELS;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the kernels for the fastest instruction set the CPU supports (found once).
+
+	@return:	const Kernels&
+*/
+static const Kernels& getActiveKernels() {
+
+	static const Kernels& kernels = getKernels(VoiceMixing::getInstructionSet());
+	return kernels;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the fastest instruction set the CPU supports (found once).
+
+	@return:	VoiceMixing::InstructionSet
+*/
+VoiceMixing::InstructionSet VoiceMixing::getInstructionSet() {
+
+	static const InstructionSet set = isSupported(VOICE_MIXING_AVX2) ? VOICE_MIXING_AVX2 : isSupported(VOICE_MIXING_SSE2) ? VOICE_MIXING_SSE2 : VOICE_MIXING_SCALAR;
+	return set;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns TRUE if the kernels for an instruction set were compiled in & the CPU can run them.
+
+	@param:		set						- The instruction set.
+
+	@return:	bool
+*/
+bool VoiceMixing::isSupported(InstructionSet set) {
+
+	switch (set) {
+
+#ifdef VOICE_MIXING_HAS_AVX2
+		case VOICE_MIXING_AVX2: {
+
+			static const bool avx2 = CpuHasAVX2();
+			return avx2;
+		}
+#endif
+#ifdef VOICE_MIXING_HAS_SSE2
+		case VOICE_MIXING_SSE2: return true;
+#endif
+		case VOICE_MIXING_SCALAR: return true;
+		default: return false;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the printable name of an instruction set.
+
+	@param:		set						- The instruction set.
+
+	@return:	const char*
+*/
+const char* VoiceMixing::getName(InstructionSet set) {
+
+	switch (set) {
+
+		case VOICE_MIXING_AVX2: return "AVX2";
+		case VOICE_MIXING_SSE2: return "SSE2";
+		default: return "Scalar";
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Clears an accumulator.
+
+	@param:		out						- The accumulator.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::ZeroInt32(int32_t* out, unsigned int count) {
+
+	memset(out, 0, count * sizeof(int32_t));
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Adds 16 bit samples into a 32 bit accumulator, so any amount of talkers can be summed
+				without clipping until the very end.
+
+	@param:		accumulator				- The running sum.
+	@param:		in						- The samples to add.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::AccumulateInt16(int32_t* accumulator, const int16_t* in, unsigned int count) {
+
+	getActiveKernels().AccumulateInt32(accumulator, in, count);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Converts an accumulator to 16 bit samples, clamping anything out of range.
+
+	@param:		out						- The 16 bit samples.
+	@param:		accumulator				- The running sum.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::ClampToInt16(int16_t* out, const int32_t* accumulator, unsigned int count) {
+
+	getActiveKernels().ClampInt32(out, accumulator, count);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes one talker from a mix & converts it to 16 bit samples (mix minus).
+
+	@param:		out						- The 16 bit samples.
+	@param:		accumulator				- The running sum of every talker.
+	@param:		subtract				- The talker to leave out.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::SubtractClampToInt16(int16_t* out, const int32_t* accumulator, const int16_t* subtract, unsigned int count) {
+
+	getActiveKernels().SubtractClampInt32(out, accumulator, subtract, count);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Clears a float accumulator (all bits zero is 0.0f).
+
+	@param:		out						- The accumulator.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::ZeroFloat(float* out, unsigned int count) {
+
+	memset(out, 0, count * sizeof(float));
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Adds 16 bit samples into a float accumulator.
+
+	@param:		accumulator				- The running sum.
+	@param:		in						- The samples to add.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::AccumulateInt16(float* accumulator, const int16_t* in, unsigned int count) {
+
+	getActiveKernels().AccumulateFloat(accumulator, in, count);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Converts a float accumulator to 16 bit samples, clamping anything out of range.
+
+	@param:		out						- The 16 bit samples.
+	@param:		accumulator				- The running sum.
+	@param:		count					- Amount of samples.
+
+	@return:	VOID
+*/
+void VoiceMixing::ClampToInt16(int16_t* out, const float* accumulator, unsigned int count) {
+
+	getActiveKernels().ClampFloat(out, accumulator, count);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Times mixing a number of speakers on this thread, through both accumulators, with one
+				instruction set's kernels.
+
+	@param:		speakers				- Streams mixed into each frame.
+	@param:		set						- The kernels to time (must be supported).
+
+	@return:	VoiceMixing::BenchmarkResult
+*/
+VoiceMixing::BenchmarkResult VoiceMixing::Benchmark(unsigned int speakers, InstructionSet set) {
+
+	typedef std::chrono::steady_clock Clock;
+
+	BenchmarkResult result;
+	result.Speakers = speakers;
+	if (speakers == 0 || !isSupported(set)) { return result; }
+
+	const Kernels& kernels = getKernels(set);
+	const unsigned int frameSize = VOICE_MIXING_BENCHMARK_FRAME;
+
+	// Noise at talking level, different for every speaker
+	std::vector<int16_t> input(speakers * frameSize);
+	uint32_t seed = 12345;
+	for (unsigned int i = 0; i < input.size(); ++i) {
+
+		seed = seed * 1664525 + 1013904223;
+		input[i] = (int16_t)((int32_t)(seed >> 16) - 32768) / 4;
+	}
+
+	std::vector<int32_t> fixedAccumulator(frameSize);
+	std::vector<float> floatAccumulator(frameSize);
+	std::vector<int16_t> output(frameSize);
+	double samples = (double)speakers * frameSize * VOICE_MIXING_BENCHMARK_FRAMES;
+	volatile int16_t sink = 0;
+
+	Clock::time_point start = Clock::now();
+	for (unsigned int frame = 0; frame < VOICE_MIXING_BENCHMARK_FRAMES; ++frame) {
+
+		ZeroFloat(floatAccumulator.data(), frameSize);
+		for (unsigned int s = 0; s < speakers; ++s) { kernels.AccumulateFloat(floatAccumulator.data(), &input[s * frameSize], frameSize); }
+		kernels.ClampFloat(output.data(), floatAccumulator.data(), frameSize);
+		sink = output[frame % frameSize];
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.FloatSamplesPerSecond = seconds > 0.0 ? samples / seconds : 0.0;
+
+	start = Clock::now();
+	for (unsigned int frame = 0; frame < VOICE_MIXING_BENCHMARK_FRAMES; ++frame) {
+
+		ZeroInt32(fixedAccumulator.data(), frameSize);
+		for (unsigned int s = 0; s < speakers; ++s) { kernels.AccumulateInt32(fixedAccumulator.data(), &input[s * frameSize], frameSize); }
+		kernels.ClampInt32(output.data(), fixedAccumulator.data(), frameSize);
+		sink = output[frame % frameSize];
+	}
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.Int32SamplesPerSecond = seconds > 0.0 ? samples / seconds : 0.0;
+
+	(void)sink;
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+
+#define VOICE_MIXING_BENCHMARK_FRAME (320)					// Samples in each benchmark frame (20ms at 16kHz).
+#define VOICE_MIXING_BENCHMARK_FRAMES (2000)				// Frames mixed per speaker count & path.
+
+// Sample kernels shared by the voice mixers. Every kernel has an AVX2 path (16 samples at a time) & an SSE2 path
+// (8 samples at a time) with a scalar tail. The fastest one the CPU supports is picked the first time a kernel runs.
+namespace VoiceMixing {
+
+	enum InstructionSet {
+
+		VOICE_MIXING_SCALAR,
+		VOICE_MIXING_SSE2,
+		VOICE_MIXING_AVX2
+	};
+
+	struct BenchmarkResult {
+
+		unsigned int Speakers = 0;							// Streams mixed into each frame.
+		double FloatSamplesPerSecond = 0.0;					// Input samples mixed per second through a float accumulator.
+		double Int32SamplesPerSecond = 0.0;					// Input samples mixed per second through a 32 bit accumulator.
+	};
+
+	// Fixed point (32 bit accumulator)
+	void ZeroInt32(int32_t* out, unsigned int count);
+	void AccumulateInt16(int32_t* accumulator, const int16_t* in, unsigned int count);
+	void ClampToInt16(int16_t* out, const int32_t* accumulator, unsigned int count);
+	void SubtractClampToInt16(int16_t* out, const int32_t* accumulator, const int16_t* subtract, unsigned int count);
+
+	// Floating point (float accumulator)
+	void ZeroFloat(float* out, unsigned int count);
+	void AccumulateInt16(float* accumulator, const int16_t* in, unsigned int count);
+	void ClampToInt16(int16_t* out, const float* accumulator, unsigned int count);
+
+	// Dispatch
+	InstructionSet getInstructionSet();
+	bool isSupported(InstructionSet set);
+	const char* getName(InstructionSet set);
+	BenchmarkResult Benchmark(unsigned int speakers, InstructionSet set);
+
+}
\ No newline at end of file
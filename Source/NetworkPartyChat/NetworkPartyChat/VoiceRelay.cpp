@@ -0,0 +1,500 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceRelay.h"
+
+// Standard libraries
+#include <cstring>
+
+// Raknet libraries
+#include <GetTime.h>
+#include <MessageIdentifiers.h>
+#include <PacketPriority.h>
+
+// NPC libraries
+#include "Enumeration.h"
+
+// 1 byte for ID, 2 bytes(short) for message number
+static const unsigned int VOICE_DATA_HEADER_SIZE = sizeof(RakNet::MessageID) + sizeof(unsigned short);
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Allocates the voice state for every client slot up front.
+
+	@param:		clients					- The server's client registry.
+	@param:		mixSampleRate			- The sample rate of the clients that can be mixed in mix mode.
+*/
+VoiceRelay::VoiceRelay(ClientRegistry& clients, int mixSampleRate) : _Clients(clients), _Mixer(clients, mixSampleRate), _Mode(VOICE_RELAY_FORWARD), _Profile(RakNet::VOICE_PROFILE_LOW_LATENCY), _MaxSpeakers(0) {
+
+	_Talkers.resize(_Clients.getCapacity());
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Mixes any frames that are due in mix mode (run every server tick).
+
+	@return:	VOID
+*/
+void VoiceRelay::Update() {
+
+	VoiceRelayMode mode = _Mode;
+	if (mode != _UpdatedMode) {
+
+		// Dont mix in anything that was queued before mixing was last switched off
+		if (mode == VOICE_RELAY_MIX) { _Mixer.Restart(); }
+		_UpdatedMode = mode;
+	}
+
+	if (mode == VOICE_RELAY_MIX && rakPeerInterface != nullptr) { _Mixer.MixDueFrames(rakPeerInterface); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Adds a stream each way between a client & every other member of the channel they
+				have just joined. Call after the client is added to the registry or moved channel.
+
+	@param:		handle					- The client.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnChannelJoined(ClientHandle handle) {
+
+	ClientInfo* info = _Clients.Get(handle);
+	if (info == nullptr) { return; }
+
+	Talker& talker = _Talkers[handle.Slot];
+	talker.Streams.clear();
+
+	const std::vector<unsigned int>& members = _Clients.getChannelMembers(info->Channel);
+	for (unsigned int i = 0; i < members.size(); ++i) {
+
+		unsigned int member = members[i];
+		if (member == handle.Slot) { continue; }
+
+		Stream stream;
+		stream.Listener = member;
+		talker.Streams.push_back(stream);
+
+		stream.Listener = handle.Slot;
+		_Talkers[member].Streams.push_back(stream);
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Removes every stream between a client & the other members of their channel. Call before
+				the client is moved channel or removed from the registry.
+
+	@param:		handle					- The client.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnChannelLeaving(ClientHandle handle) {
+
+	ClientInfo* info = _Clients.Get(handle);
+	if (info == nullptr) { return; }
+
+	const std::vector<unsigned int>& members = _Clients.getChannelMembers(info->Channel);
+	for (unsigned int i = 0; i < members.size(); ++i) {
+
+		// Order doesnt matter, so swap the last stream into its place
+		std::vector<Stream>& streams = _Talkers[members[i]].Streams;
+		Stream* stream = findStream(members[i], handle.Slot);
+		if (stream == nullptr) { continue; }
+
+		*stream = streams.back();
+		streams.pop_back();
+	}
+
+	_Talkers[handle.Slot].Streams.clear();
+	_Talkers[handle.Slot].Picked = false;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns TRUE if the client has an open voice channel with the server.
+
+	@param:		guid					- The GUID of the client.
+
+	@return:	bool
+*/
+bool VoiceRelay::isVoiceOpen(RakNet::RakNetGUID guid) {
+
+	ClientHandle handle = _Clients.Find(guid);
+	return handle.isValid() && isOpen(handle.Slot);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Copies the uplink latency of a talker's stamped packets, from capture to the server.
+
+	@param:		guid					- The GUID of the talker.
+	@param:		stats					- Where the histograms are copied to.
+
+	@return:	bool					- FALSE if the client isnt connected.
+*/
+bool VoiceRelay::getTalkerLatency(RakNet::RakNetGUID guid, RakNet::VoiceLatencyStatistics& stats) {
+
+	ClientHandle handle = _Clients.Find(guid);
+	if (!handle.isValid()) { return false; }
+
+	stats = _Talkers[handle.Slot].Latency;
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Handles the RakVoice messages sent to the server. Voice data is consumed here & never
+				reaches the server's packet loop.
+
+	@param:		packet					- The packet received.
+
+	@return:	RakNet::PluginReceiveResult
+*/
+RakNet::PluginReceiveResult VoiceRelay::OnReceive(RakNet::Packet* packet) {
+
+	switch (packet->data[0]) {
+
+		case ID_RAKVOICE_OPEN_CHANNEL_REQUEST: {
+
+			OnOpenChannelRequest(packet);
+			return RakNet::RR_STOP_PROCESSING_AND_DEALLOCATE;
+		}
+
+		case ID_RAKVOICE_CLOSE_CHANNEL: {
+
+			OnCloseChannel(packet->guid);
+			return RakNet::RR_STOP_PROCESSING_AND_DEALLOCATE;
+		}
+
+		case ID_RAKVOICE_DATA: {
+
+			OnVoiceData(packet);
+			return RakNet::RR_STOP_PROCESSING_AND_DEALLOCATE;
+		}
+
+		default: break;
+	}
+	return RakNet::RR_CONTINUE_PROCESSING;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Closes the voice channel of a client that has disconnected.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnClosedConnection(const RakNet::SystemAddress& systemAddress, RakNet::RakNetGUID rakNetGUID, RakNet::PI2_LostConnectionReason lostConnectionReason) {
+
+	(void)systemAddress; (void)lostConnectionReason;
+	OnCloseChannel(rakNetGUID);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Opens a voice channel for a client & replies with their own sample rate, as the
+				relay never decodes anything it only needs to match talkers to listeners. The reply
+				offers the server's packet profile, so the client bundles at least as many frames.
+
+	@param:		packet					- The open channel request.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnOpenChannelRequest(RakNet::Packet* packet) {
+
+	ClientHandle handle = _Clients.Find(packet->guid);
+	if (!handle.isValid()) { return; }
+
+	RakNet::BitStream in(packet->data, packet->length, false);
+	in.IgnoreBytes(sizeof(RakNet::MessageID));
+
+	int32_t sampleRate;
+	if (!in.Read(sampleRate)) { return; }
+
+	// Clients that dont send a profile send one frame per packet
+	RakNet::VoicePacketProfile profile = RakNet::VOICE_PROFILE_LOW_LATENCY;
+	if (!in.Read(profile.framesPerPacket) || !in.Read(profile.sendIntervalMS)) { profile = RakNet::VOICE_PROFILE_LOW_LATENCY; }
+	profile = RakNet::NegotiatePacketProfile(profile, _Profile);
+
+	Talker& talker = _Talkers[handle.Slot];
+	talker.Handle = handle;
+	talker.SampleRate = sampleRate;
+	talker.Open = true;
+	talker.Latency = RakNet::VoiceLatencyStatistics();
+	talker.Picked = false;
+
+	// The client's message numbers start from 0 again
+	ResetStreams(handle.Slot);
+	if (sampleRate == _Mixer.getSampleRate()) { _Mixer.OpenSlot(handle.Slot); }
+	else { _Mixer.CloseSlot(handle.Slot); }
+
+	RakNet::BitStream out;
+	out.Write((RakNet::MessageID)ID_RAKVOICE_OPEN_CHANNEL_REPLY);
+	out.Write(sampleRate);
+	out.Write(profile.framesPerPacket);
+	out.Write(profile.sendIntervalMS);
+	SendUnified(&out, HIGH_PRIORITY, RELIABLE_ORDERED, 0, packet->guid, false);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Closes a client's voice channel.
+
+	@param:		guid					- The GUID of the client.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnCloseChannel(RakNet::RakNetGUID guid) {
+
+	ClientHandle handle = _Clients.Find(guid);
+	if (!handle.isValid()) { return; }
+
+	_Talkers[handle.Slot].Open = false;
+	_Talkers[handle.Slot].Picked = false;
+	_Mixer.CloseSlot(handle.Slot);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Forwards a talker's voice packet to every other member of their channel. The outgoing
+				packet is built once, only the message number is rewritten for each listener. A
+				latency stamp is moved into the server's clock, so listeners only ever need the
+				server's clock differential. When the speakers are limited, only the loudest talkers
+				of the channel are forwarded, by the loudness the talkers put in their packets.
+
+				Relayed packet: [ID_SERVER_VOICE_RELAY][message number][talker GUID][speex data]
+
+	@param:		packet					- The voice data packet.
+
+	@return:	VOID
+*/
+void VoiceRelay::OnVoiceData(RakNet::Packet* packet) {
+
+	ClientHandle handle = _Clients.Find(packet->guid);
+	ClientInfo* info = _Clients.Get(handle);
+	if (info == nullptr || !isOpen(handle.Slot)) { return; }
+	if (packet->length <= VOICE_DATA_HEADER_SIZE) { return; }
+
+	_Stats.PacketsIn++;
+	_Stats.BytesIn += packet->length;
+
+	// Packets that cant be read are still forwarded, the listeners decide what to do with them
+	RakNet::VoicePayload payload;
+	bool parsed = RakNet::ParseVoicePayload(packet->data + VOICE_DATA_HEADER_SIZE, packet->length - VOICE_DATA_HEADER_SIZE, &payload);
+	if (parsed && payload.hasLatencyStamp) { RecordUplinkLatency(handle.Slot, packet->guid, payload.latencyStamp); }
+
+	unsigned short talkerSequence;
+	memcpy(&talkerSequence, packet->data + sizeof(RakNet::MessageID), sizeof(unsigned short));
+
+	// Mixed talkers are decoded here, their channel hears them in the next mix
+	bool mixing = _UpdatedMode == VOICE_RELAY_MIX;
+	if (mixing && _Mixer.isSlotOpen(handle.Slot)) {
+
+		_Mixer.OnVoiceData(handle.Slot, talkerSequence, packet->data + VOICE_DATA_HEADER_SIZE, packet->length - VOICE_DATA_HEADER_SIZE);
+		return;
+	}
+
+	// Only the loudest talkers of the channel are forwarded
+	if (parsed && !PickSpeaker(handle.Slot, info->Channel, payload)) {
+
+		_Stats.PacketsSkipped++;
+		return;
+	}
+
+	// Build the packet once
+	_RelayPacket.Reset();
+	_RelayPacket.Write((RakNet::MessageID)ID_SERVER_VOICE_RELAY);
+	_RelayPacket.Write((unsigned short)0);
+	_RelayPacket.Write(packet->guid);
+	_RelayPacket.WriteAlignedBytes(packet->data + VOICE_DATA_HEADER_SIZE, packet->length - VOICE_DATA_HEADER_SIZE);
+	unsigned char* sequenceField = _RelayPacket.GetData() + sizeof(RakNet::MessageID);
+	if (parsed && payload.hasLatencyStamp) {
+
+		unsigned char* voiceData = sequenceField + sizeof(unsigned short) + sizeof(uint64_t);
+		RakNet::WriteVoiceLatencyStamp(voiceData + payload.latencyStampOffset, payload.latencyStamp);
+	}
+
+	Talker& talker = _Talkers[handle.Slot];
+	for (unsigned int i = 0; i < talker.Streams.size(); ++i) {
+
+		Stream& stream = talker.Streams[i];
+		unsigned int listener = stream.Listener;
+		if (!isOpen(listener)) { continue; }
+
+		// The listener decodes with their own sample rate
+		if (_Talkers[listener].SampleRate != talker.SampleRate) { continue; }
+		if (mixing && _Mixer.isSlotOpen(listener)) { continue; }
+
+		// Keep the spacing of the talker's numbers, as listeners use them as timestamps (intentional overflow).
+		// A talker who reopened their channel carries on after the frames of the last packet the listener got,
+		// the same number their end of talk marker used.
+		if (stream.Started) { stream.Sequence += (unsigned short)(talkerSequence - stream.LastTalkerSequence); }
+		else { stream.Sequence += (unsigned short)(talker.LastFrameCount > 0 ? talker.LastFrameCount : 1); }
+		stream.Started = true;
+		stream.LastTalkerSequence = talkerSequence;
+
+		memcpy(sequenceField, &stream.Sequence, sizeof(unsigned short));
+		SendUnified(&_RelayPacket, HIGH_PRIORITY, UNRELIABLE, 0, _Clients.getInfoBySlot(listener).GUID, false);
+
+		_Stats.PacketsOut++;
+		_Stats.BytesOut += _RelayPacket.GetNumberOfBytesUsed();
+	}
+
+	// A talker who says they stopped gives up their place straight away
+	if (parsed && payload.frameCount > 0) { talker.LastFrameCount = payload.frameCount; }
+	if (parsed && payload.endOfTalk) { talker.Picked = false; }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Records how long a stamped voice packet took to reach the server, & converts its stamp
+				to the server's clock using RakNet's estimate of the talker's clock differential.
+
+	@param:		slot					- The talker's registry slot.
+	@param:		guid					- The GUID of the talker.
+	@param:		stamp					- The packet's stamp, converted to the server's clock.
+
+	@return:	VOID
+*/
+void VoiceRelay::RecordUplinkLatency(unsigned int slot, RakNet::RakNetGUID guid, RakNet::VoiceLatencyStamp& stamp) {
+
+	// Differential is the talker's clock minus ours (intentional overflow)
+	stamp.captureTime -= (uint32_t)rakPeerInterface->GetClockDifferential(guid);
+
+	RakNet::VoiceLatencyStatistics& latency = _Talkers[slot].Latency;
+	int64_t sender = ((int64_t)stamp.captureUnits + stamp.encodeUnits + stamp.sendQueueUnits) * VOICE_LATENCY_STAMP_UNIT_US;
+	int64_t network = (int64_t)(int32_t)(RakNet::GetTimeMS() - stamp.captureTime) * 1000 - sender;
+	if (network < 0) { network = 0; }
+	RakNet::RecordVoiceLatency(&latency.hops[RakNet::VOICE_LATENCY_CAPTURE], (int64_t)stamp.captureUnits * VOICE_LATENCY_STAMP_UNIT_US);
+	RakNet::RecordVoiceLatency(&latency.hops[RakNet::VOICE_LATENCY_ENCODE], (int64_t)stamp.encodeUnits * VOICE_LATENCY_STAMP_UNIT_US);
+	RakNet::RecordVoiceLatency(&latency.hops[RakNet::VOICE_LATENCY_SEND_QUEUE], (int64_t)stamp.sendQueueUnits * VOICE_LATENCY_STAMP_UNIT_US);
+	RakNet::RecordVoiceLatency(&latency.hops[RakNet::VOICE_LATENCY_NETWORK], network);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Decides if a talker's packet is forwarded, when only the loudest talkers of each channel
+				are. A talker keeps their place until they stop, or until one who is clearly louder
+				takes it after they have had it a while, so who is heard doesnt flap.
+
+	@param:		slot					- The talker's registry slot.
+	@param:		channel					- The channel the talker is in.
+	@param:		payload					- The talker's voice packet.
+
+	@return:	bool					- Returns TRUE if the packet should be forwarded.
+*/
+bool VoiceRelay::PickSpeaker(unsigned int slot, int channel, const RakNet::VoicePayload& payload) {
+
+	RakNet::TimeMS now = RakNet::GetTimeMS();
+	Talker& talker = _Talkers[slot];
+	if (payload.hasEnergy) { talker.Level = RakNet::UpdateSpeakerLevel(talker.Level, payload.energy); }
+	talker.LastVoiceTime = now;
+
+	unsigned int maxSpeakers = _MaxSpeakers;
+	if (maxSpeakers == 0 || talker.Picked) { return true; }
+	if (payload.frameCount == 0) { return false; }
+
+	// Count the channel's speakers, freeing the places of any that stopped without saying so
+	unsigned int speakers = 0;
+	unsigned int quietest = slot;
+	const std::vector<unsigned int>& members = _Clients.getChannelMembers(channel);
+	for (unsigned int i = 0; i < members.size(); ++i) {
+
+		unsigned int member = members[i];
+		Talker& other = _Talkers[member];
+		if (member == slot || !other.Picked) { continue; }
+		if (now - other.LastVoiceTime >= VOICE_RELAY_SPEAKER_TIMEOUT_MS || !isOpen(member)) { other.Picked = false; continue; }
+
+		speakers++;
+		if (quietest == slot || other.Level < _Talkers[quietest].Level) { quietest = member; }
+	}
+
+	// Only take the place of a talker who has had it a while, and is clearly quieter
+	if (speakers >= maxSpeakers) {
+
+		Talker& other = _Talkers[quietest];
+		if (talker.Level < other.Level + VOICE_SPEAKER_HYSTERESIS_DB || now - other.PickedTime < VOICE_SPEAKER_HOLD_MS) { return false; }
+
+		EndStreams(quietest);
+		other.Picked = false;
+		_Stats.SpeakersReplaced++;
+	}
+
+	talker.Picked = true;
+	talker.PickedTime = now;
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Tells the listeners a talker stopped after the last packet they were forwarded, so they
+				play out what they have rather than concealing the packets that are no longer sent.
+
+				End marker: [ID_SERVER_VOICE_RELAY][message number after the last frame][talker GUID][VOICE_PAYLOAD_END_OF_TALK]
+
+	@param:		slot					- The talker's registry slot.
+
+	@return:	VOID
+*/
+void VoiceRelay::EndStreams(unsigned int slot) {
+
+	RakNet::BitStream out;
+	out.Write((RakNet::MessageID)ID_SERVER_VOICE_RELAY);
+	out.Write((unsigned short)0);
+	out.Write(_Clients.getInfoBySlot(slot).GUID);
+	out.Write((unsigned char)VOICE_PAYLOAD_END_OF_TALK);
+	unsigned char* sequenceField = out.GetData() + sizeof(RakNet::MessageID);
+
+	Talker& talker = _Talkers[slot];
+	for (unsigned int i = 0; i < talker.Streams.size(); ++i) {
+
+		Stream& stream = talker.Streams[i];
+		if (!stream.Started || !isOpen(stream.Listener)) { continue; }
+
+		// The marker isnt a frame, so the next packet forwarded keeps its spacing (intentional overflow)
+		unsigned short sequence = (unsigned short)(stream.Sequence + talker.LastFrameCount);
+		memcpy(sequenceField, &sequence, sizeof(unsigned short));
+		SendUnified(&out, HIGH_PRIORITY, UNRELIABLE, 0, _Clients.getInfoBySlot(stream.Listener).GUID, false);
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Restarts every stream a slot is the talker or listener of. The message numbers sent
+				on carry on from where they were, so the listener's jitter buffer never sees them go back.
+
+	@param:		slot					- The registry slot.
+
+	@return:	VOID
+*/
+void VoiceRelay::ResetStreams(unsigned int slot) {
+
+	std::vector<Stream>& streams = _Talkers[slot].Streams;
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+
+		streams[i].Started = false;
+
+		Stream* heard = findStream(streams[i].Listener, slot);
+		if (heard != nullptr) { heard->Started = false; }
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the stream from a talker to a listener, or nullptr if they arent in the same channel.
+
+	@param:		talker					- The talker's registry slot.
+	@param:		listener				- The listener's registry slot.
+
+	@return:	Stream*
+*/
+VoiceRelay::Stream* VoiceRelay::findStream(unsigned int talker, unsigned int listener) {
+
+	std::vector<Stream>& streams = _Talkers[talker].Streams;
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+
+		if (streams[i].Listener == listener) { return &streams[i]; }
+	}
+	return nullptr;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns TRUE if the slot's client is still connected & has their voice channel open.
+
+	@param:		slot					- The registry slot.
+
+	@return:	bool
+*/
+bool VoiceRelay::isOpen(unsigned int slot) {
+
+	Talker& talker = _Talkers[slot];
+	return talker.Open && _Clients.Get(talker.Handle) != nullptr;
+}
\ No newline at end of file
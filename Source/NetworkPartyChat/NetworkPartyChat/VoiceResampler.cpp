@@ -0,0 +1,220 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceResampler.h"
+
+// Standard libraries
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define VOICE_RESAMPLER_SSE
+	#include <emmintrin.h>
+#endif
+
+// Fraction of the lower of the two nyquist frequencies let through, the rest is the filter's roll off
+static const double VOICE_RESAMPLER_PASSBAND = 0.9;
+
+static const double PI = 3.14159265358979323846;
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the greatest common divisor of two rates.
+
+	@return:	unsigned int
+*/
+static unsigned int GreatestCommonDivisor(unsigned int a, unsigned int b) {
+
+	while (b != 0) {
+
+		unsigned int remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the dot product of a filter phase & the samples under it.
+
+	@param:		coefficients			- The phase's taps.
+	@param:		samples					- The oldest sample under the filter.
+	@param:		count					- Amount of taps (a multiple of 4).
+
+	@return:	float
+*/
+static inline float Dot(const float* coefficients, const float* samples, unsigned int count) {
+
+	unsigned int i = 0;
+	float sum = 0.0f;
+
+#ifdef VOICE_RESAMPLER_SSE
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4) {
+
+		accumulator = _mm_add_ps(accumulator, _mm_mul_ps(_mm_loadu_ps(coefficients + i), _mm_loadu_ps(samples + i)));
+	}
+
+	// Add the 4 lanes together
+	accumulator = _mm_add_ps(accumulator, _mm_movehl_ps(accumulator, accumulator));
+	accumulator = _mm_add_ss(accumulator, _mm_shuffle_ps(accumulator, accumulator, 1));
+	sum = _mm_cvtss_f32(accumulator);
+#endif
+
+	for (; i < count; ++i) { sum += coefficients[i] * samples[i]; }
+	return sum;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Rounds a filtered sample to 16 bits, clamping anything out of range.
+
+	@return:	int16_t
+*/
+static inline int16_t Saturate(float sample) {
+
+	if (sample >= 32767.0f) { return 32767; }
+	if (sample <= -32768.0f) { return -32768; }
+	return (int16_t)(sample >= 0.0f ? sample + 0.5f : sample - 0.5f);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Builds the filter bank for converting between two rates.
+
+	@param:		inRate					- The rate of the samples going in.
+	@param:		outRate					- The rate of the samples coming out.
+
+	@return:	bool					- FALSE if the rates are invalid or too awkward a ratio.
+*/
+bool VoiceResampler::Init(int inRate, int outRate) {
+
+	if (inRate <= 0 || outRate <= 0) { return false; }
+
+	unsigned int divisor = GreatestCommonDivisor((unsigned int)inRate, (unsigned int)outRate);
+	unsigned int up = (unsigned int)outRate / divisor;
+	unsigned int down = (unsigned int)inRate / divisor;
+	if (up > VOICE_RESAMPLER_MAX_PHASES) { return false; }
+
+	_InRate = inRate;
+	_OutRate = outRate;
+	_UpFactor = up;
+	_DownFactor = down;
+	if (isPassthrough()) { _Coefficients.clear(); _History.clear(); return true; }
+
+	// Converting down, the filter has to be longer for the same sharpness at the lower cut off
+	_Taps = VOICE_RESAMPLER_TAPS * ((down + up - 1) / up);
+
+	// Windowed sinc at the upsampled rate, cut off below the lower nyquist frequency
+	unsigned int length = _Taps * up;
+	double cutoff = (0.5 * VOICE_RESAMPLER_PASSBAND) / (double)(up > down ? up : down);
+	double centre = (length - 1) * 0.5;
+
+	std::vector<double> prototype(length);
+	double total = 0.0;
+	for (unsigned int i = 0; i < length; ++i) {
+
+		double x = (double)i - centre;
+		double sinc = (x == 0.0) ? 2.0 * cutoff : sin(2.0 * PI * cutoff * x) / (PI * x);
+		double blackman = 0.42 - 0.5 * cos((2.0 * PI * i) / (length - 1)) + 0.08 * cos((4.0 * PI * i) / (length - 1));
+		prototype[i] = sinc * blackman;
+		total += prototype[i];
+	}
+
+	// Split it into one phase per output offset. Each phase gets about 1 / up of the taps, so scale for unity gain.
+	_Coefficients.resize(length);
+	for (unsigned int phase = 0; phase < up; ++phase) {
+
+		for (unsigned int tap = 0; tap < _Taps; ++tap) {
+
+			_Coefficients[phase * _Taps + tap] = (float)((prototype[phase + (_Taps - 1 - tap) * up] * up) / total);
+		}
+	}
+
+	_History.resize(_Taps - 1 + VOICE_RESAMPLER_CHUNK);
+	Reset();
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Forgets the samples of the last stream, as if it had been silent.
+
+	@return:	VOID
+*/
+void VoiceResampler::Reset() {
+
+	if (isPassthrough()) { return; }
+
+	std::fill(_History.begin(), _History.end(), 0.0f);
+	_HistoryCount = _Taps - 1;
+	_Position = (_Taps - 1) * _UpFactor;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Converts the next samples of the stream. Input that doesnt make a whole output sample yet
+				is kept for the next call.
+
+	@param:		in						- The samples at the input rate.
+	@param:		inCount					- Amount of input samples.
+	@param:		out						- Where to write the samples at the output rate.
+	@param:		outCapacity				- At least getMaxOutput(inCount).
+
+	@return:	unsigned int			- Amount of output samples written.
+*/
+unsigned int VoiceResampler::Process(const int16_t* in, unsigned int inCount, int16_t* out, unsigned int outCapacity) {
+
+	if (isPassthrough()) {
+
+		unsigned int count = inCount < outCapacity ? inCount : outCapacity;
+		memcpy(out, in, count * sizeof(int16_t));
+		return count;
+	}
+
+	unsigned int written = 0;
+	while (inCount > 0) {
+
+		// Take as much input as fits
+		unsigned int take = (unsigned int)_History.size() - _HistoryCount;
+		if (take > inCount) { take = inCount; }
+		for (unsigned int i = 0; i < take; ++i) { _History[_HistoryCount + i] = in[i]; }
+		_HistoryCount += take;
+		in += take;
+		inCount -= take;
+
+		// Every output whose newest input sample has arrived
+		while (written < outCapacity) {
+
+			unsigned int newest = _Position / _UpFactor;
+			if (newest >= _HistoryCount) { break; }
+
+			const float* phase = &_Coefficients[(_Position % _UpFactor) * _Taps];
+			out[written++] = Saturate(Dot(phase, &_History[newest + 1 - _Taps], _Taps));
+			_Position += _DownFactor;
+		}
+
+		// Drop the input that comes before the next output's filter
+		unsigned int drop = _Position / _UpFactor + 1 - _Taps;
+		if (drop > _HistoryCount) { drop = _HistoryCount; }
+		memmove(&_History[0], &_History[drop], (_HistoryCount - drop) * sizeof(float));
+		_HistoryCount -= drop;
+		_Position -= drop * _UpFactor;
+
+		// Ran out of room for the output, the rest of the input is lost
+		if (written == outCapacity) { break; }
+	}
+	return written;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns the most output samples a call to Process can write for an amount of input.
+
+	@param:		inCount					- Amount of input samples.
+
+	@return:	unsigned int
+*/
+unsigned int VoiceResampler::getMaxOutput(unsigned int inCount) const {
+
+	return (unsigned int)(((unsigned long long)inCount * _UpFactor + _DownFactor - 1) / _DownFactor) + 1;
+}
\ No newline at end of file
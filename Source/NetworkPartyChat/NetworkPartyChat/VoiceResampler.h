@@ -0,0 +1,45 @@
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+#include <vector>
+
+#define VOICE_RESAMPLER_TAPS (16)							// Filter taps per phase when converting up, scaled by the ratio when converting down.
+#define VOICE_RESAMPLER_MAX_PHASES (1024)					// Most phases in the filter bank (44.1kHz to 32kHz needs 320).
+#define VOICE_RESAMPLER_CHUNK (1024)						// Input samples filtered at a time.
+
+// Converts a stream of 16 bit mono samples from one sample rate to another with a polyphase windowed
+// sinc filter, so the sound device can run at its own rate while speex runs at 8, 16 or 32kHz.
+// The filter has an SSE path (4 taps at a time), & falls back to scalar code when SSE2 isnt available.
+class VoiceResampler {
+
+public:
+
+	// Constructors
+	VoiceResampler() {}
+	~VoiceResampler() {}
+
+	// Resampling
+	bool Init(int inRate, int outRate);
+	void Reset();
+	unsigned int Process(const int16_t* in, unsigned int inCount, int16_t* out, unsigned int outCapacity);
+
+	// Properties
+	unsigned int getMaxOutput(unsigned int inCount) const;
+	int getInRate() const									{ return _InRate; }
+	int getOutRate() const									{ return _OutRate; }
+	bool isPassthrough() const								{ return _UpFactor == _DownFactor; }
+
+protected:
+
+	int _InRate = 0;
+	int _OutRate = 0;
+	unsigned int _UpFactor = 1;								// Output rate / GCD of the rates.
+	unsigned int _DownFactor = 1;							// Input rate / GCD of the rates.
+	unsigned int _Taps = 0;									// Filter taps per phase (a multiple of 4).
+	std::vector<float> _Coefficients;						// Phase * taps, each phase reversed so its last tap meets the newest sample.
+	std::vector<float> _History;							// Input samples the next outputs still need.
+	unsigned int _HistoryCount = 0;
+	unsigned int _Position = 0;								// Where the next output falls, in 1 / _UpFactor of a _History sample.
+
+};
\ No newline at end of file
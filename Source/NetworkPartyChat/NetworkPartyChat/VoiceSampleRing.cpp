@@ -0,0 +1,113 @@
+/// \file
+/// \brief Wait-free ring of samples between the audio thread and the thread running RakVoice
+
+#include "VoiceSampleRing.h"
+#include "RakMemoryOverride.h"
+#include "RakAssert.h"
+#include <string.h>
+
+using namespace RakNet;
+
+VoiceSampleRing::VoiceSampleRing()
+{
+	samples=0;
+	capacity=0;
+	mask=0;
+	writeIndex=0;
+	readIndex=0;
+}
+VoiceSampleRing::~VoiceSampleRing()
+{
+	Free();
+}
+bool VoiceSampleRing::Init(unsigned capacity)
+{
+	unsigned rounded;
+
+	Free();
+	if (capacity==0)
+		return false;
+
+	rounded=1;
+	while (rounded < capacity)
+		rounded<<=1;
+
+	samples=(short*) rakMalloc_Ex(rounded*sizeof(short), _FILE_AND_LINE_);
+	if (samples==0)
+		return false;
+	this->capacity=rounded;
+	mask=rounded-1;
+	Clear();
+	return true;
+}
+void VoiceSampleRing::Free(void)
+{
+	if (samples)
+		rakFree_Ex(samples, _FILE_AND_LINE_);
+	samples=0;
+	capacity=0;
+	mask=0;
+	Clear();
+}
+void VoiceSampleRing::Clear(void)
+{
+	writeIndex.store(0, std::memory_order_relaxed);
+	readIndex.store(0, std::memory_order_relaxed);
+}
+unsigned VoiceSampleRing::Write(const short *input, unsigned count)
+{
+	unsigned write, read, room, offset, first;
+
+	// Our own index can be read relaxed, the reader's has to be acquired so we don't overwrite samples it hasn't copied out yet
+	write=writeIndex.load(std::memory_order_relaxed);
+	read=readIndex.load(std::memory_order_acquire);
+	room=capacity-(write-read);
+	if (count > room)
+		count=room;
+	if (count==0)
+		return 0;
+
+	offset=write & mask;
+	first=capacity-offset;
+	if (first > count)
+		first=count;
+	memcpy(samples+offset, input, first*sizeof(short));
+	memcpy(samples, input+first, (count-first)*sizeof(short));
+
+	// Publish the samples
+	writeIndex.store(write+count, std::memory_order_release);
+	return count;
+}
+unsigned VoiceSampleRing::Read(short *output, unsigned count)
+{
+	unsigned write, read, available, offset, first;
+
+	read=readIndex.load(std::memory_order_relaxed);
+	write=writeIndex.load(std::memory_order_acquire);
+	available=write-read;
+	if (count > available)
+		count=available;
+	if (count==0)
+		return 0;
+
+	offset=read & mask;
+	first=capacity-offset;
+	if (first > count)
+		first=count;
+	memcpy(output, samples+offset, first*sizeof(short));
+	memcpy(output+first, samples, (count-first)*sizeof(short));
+
+	// Hand the space back to the writer
+	readIndex.store(read+count, std::memory_order_release);
+	return count;
+}
+unsigned VoiceSampleRing::GetReadAvailable(void) const
+{
+	// The read index first, so on any thread the write index seen is never behind it
+	unsigned read=readIndex.load(std::memory_order_acquire);
+	return writeIndex.load(std::memory_order_acquire)-read;
+}
+unsigned VoiceSampleRing::GetWriteAvailable(void) const
+{
+	return capacity-GetReadAvailable();
+}
@@ -0,0 +1,58 @@
+/// \file
+/// \brief Wait-free ring of samples between the audio thread and the thread running RakVoice
+
+#ifndef __VOICE_SAMPLE_RING_H
+#define __VOICE_SAMPLE_RING_H
+
+#include "Export.h"
+#include <atomic>
+
+namespace RakNet {
+
+/// \brief A ring buffer of 16 bit samples for exactly one writing thread and one reading thread.
+/// Neither side ever locks or waits on the other.  Each side only moves its own index, and publishes it after the samples it covers.
+/// The capacity is rounded up to a power of two so the free running indices wrap with a mask.
+class RAK_DLL_EXPORT VoiceSampleRing
+{
+public:
+	VoiceSampleRing();
+	~VoiceSampleRing();
+
+	/// \brief Allocates room for at least \a capacity samples, and empties the ring
+	/// Neither side may be using the ring while it is initialized.
+	bool Init(unsigned capacity);
+
+	/// \brief Frees the samples.  Neither side may be using the ring.
+	void Free(void);
+
+	/// \brief Empties the ring.  Neither side may be using the ring.
+	void Clear(void);
+
+	/// \brief Appends up to \a count samples.  Writing thread only.
+	/// \return How many samples fitted, which is less than \a count when the ring is full
+	unsigned Write(const short *input, unsigned count);
+
+	/// \brief Takes up to \a count of the oldest samples.  Reading thread only.
+	/// \return How many samples were read, which is less than \a count when the ring runs dry
+	unsigned Read(short *output, unsigned count);
+
+	/// \brief Samples waiting to be read.  Exact on the reading thread, a lower bound anywhere else.
+	unsigned GetReadAvailable(void) const;
+
+	/// \brief Room left to write.  Exact on the writing thread, a lower bound anywhere else.
+	unsigned GetWriteAvailable(void) const;
+
+	unsigned GetCapacity(void) const {return capacity;}
+
+protected:
+	short *samples;
+	unsigned capacity;
+	unsigned mask;
+	// Free running sample counts.  Only the writer moves writeIndex and only the reader moves readIndex.
+	std::atomic<unsigned> writeIndex;
+	std::atomic<unsigned> readIndex;
+};
+
+} // namespace RakNet
+
+#endif
@@ -0,0 +1,292 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceWorkerPool.h"
+
+// Each thread of a pool knows which queue is its own, so the jobs it submits stay on it
+static thread_local VoiceWorkerPool* CurrentPool = nullptr;
+static thread_local unsigned int CurrentWorker = 0;
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Overload constructor	- Starts the pool's threads.
+
+	@param:		threads					- How many threads to start, or VOICE_WORKER_POOL_AUTO.
+*/
+VoiceWorkerPool::VoiceWorkerPool(unsigned int threads) {
+
+	// Leave a hardware thread for the one submitting the jobs, as it helps out while waiting on them
+	if (threads == VOICE_WORKER_POOL_AUTO) {
+
+		unsigned int hardware = std::thread::hardware_concurrency();
+		threads = hardware > 1 ? hardware - 1 : 1;
+	}
+	if (threads > VOICE_WORKER_POOL_MAX_THREADS) { threads = VOICE_WORKER_POOL_MAX_THREADS; }
+
+	// Every queue exists before any thread can go looking for work in it
+	for (unsigned int i = 0; i < threads; ++i) { _Workers.emplace_back(new Worker()); }
+	for (unsigned int i = 0; i < threads; ++i) { _Workers[i]->Thread = std::thread([this, i] { WorkerLoop(i); }); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Default deconstructor	- Runs whatever is still queued, then joins the threads.
+*/
+VoiceWorkerPool::~VoiceWorkerPool() {
+
+	{
+		std::lock_guard<std::mutex> lock(_SleepMutex);
+		_Stopping = true;
+	}
+	_WakeCondition.notify_all();
+
+	for (auto& iter : _Workers) { iter->Thread.join(); }
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Queues a job to run on any thread.
+
+	@param:		group					- The group the job is waited on with.
+	@param:		job						- The work to be run.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Submit(Group& group, Job job) {
+
+	group._Pending++;
+
+	Task task;
+	task.Run = std::move(job);
+	task.Owner = &group;
+	Push(std::move(task));
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Queues a job to run after every job submitted to the strand before it. The strand is
+				only queued to a thread when it isnt already, so its jobs never run at the same time.
+
+	@param:		strand					- The strand the job is ordered by.
+	@param:		group					- The group the job is waited on with.
+	@param:		job						- The work to be run.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Submit(Strand& strand, Group& group, Job job) {
+
+	group._Pending++;
+
+	bool schedule = false;
+	{
+		std::lock_guard<std::mutex> lock(strand._Mutex);
+		Strand::Entry entry;
+		entry.Run = std::move(job);
+		entry.Owner = &group;
+		strand._Jobs.push_back(std::move(entry));
+		if (!strand._Scheduled) { strand._Scheduled = schedule = true; }
+	}
+
+	if (schedule) {
+
+		Task task;
+		task.Serial = &strand;
+		Push(std::move(task));
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Blocks until every job in the group has finished, running queued jobs (from any group)
+				in the meantime. Once there are none to run it sleeps until a group finishes or more
+				jobs are queued. Safe to call from a job.
+
+	@param:		group					- The group to wait on.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Wait(Group& group) {
+
+	unsigned int self = CurrentPool == this ? CurrentWorker : (unsigned int)_Workers.size();
+	while (!group.isDone()) {
+
+		Task task;
+		if ((self < _Workers.size() && Pop(self, task)) || Steal(self, task)) {
+
+			Execute(task);
+			_JobsHelped++;
+			continue;
+		}
+
+		// Whatever is left is already running on other threads
+		std::unique_lock<std::mutex> lock(_SleepMutex);
+		_Waiting++;
+		_DoneCondition.wait(lock, [this, &group] { return group.isDone() || _Queued.load() > 0; });
+		_Waiting--;
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns a copy of the pool's counters (thread safe).
+
+	@return:	WorkerPoolStats
+*/
+WorkerPoolStats VoiceWorkerPool::getStats() const {
+
+	WorkerPoolStats stats;
+	stats.JobsRun = _JobsRun.load();
+	stats.JobsStolen = _JobsStolen.load();
+	stats.JobsHelped = _JobsHelped.load();
+	return stats;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Puts a task in a queue & wakes a sleeping thread for it. A pool thread uses its own
+				queue, anyone else spreads their tasks across the queues in turn.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Push(Task&& task) {
+
+	unsigned int index = CurrentPool == this ? CurrentWorker : _NextWorker++ % (unsigned int)_Workers.size();
+	{
+		Worker& worker = *_Workers[index];
+		std::lock_guard<std::mutex> lock(worker.Mutex);
+		worker.Jobs.push_back(std::move(task));
+	}
+
+	// A thread about to sleep either sees the new task or is woken for it
+	_Queued++;
+	if (_Sleeping.load() > 0 || _Waiting.load() > 0) {
+
+		{ std::lock_guard<std::mutex> lock(_SleepMutex); }
+		_WakeCondition.notify_one();
+		_DoneCondition.notify_all();
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Takes the newest task from a thread's own queue.
+
+	@return:	bool					- FALSE if the queue is empty.
+*/
+bool VoiceWorkerPool::Pop(unsigned int worker, Task& task) {
+
+	Worker& own = *_Workers[worker];
+	std::lock_guard<std::mutex> lock(own.Mutex);
+	if (own.Jobs.empty()) { return false; }
+
+	task = std::move(own.Jobs.back());
+	own.Jobs.pop_back();
+	_Queued--;
+	return true;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Takes the oldest task from another thread's queue, starting with the one after the thief's.
+
+	@param:		thief					- The thread stealing, or the thread count for a thread outside the pool.
+	@param:		task					- Where the task is moved to.
+
+	@return:	bool					- FALSE if every other queue is empty.
+*/
+bool VoiceWorkerPool::Steal(unsigned int thief, Task& task) {
+
+	if (_Queued.load() == 0) { return false; }
+
+	unsigned int count = (unsigned int)_Workers.size();
+	for (unsigned int i = 1; i <= count; ++i) {
+
+		unsigned int victim = (thief + i) % count;
+		if (victim == thief) { continue; }
+
+		Worker& worker = *_Workers[victim];
+		std::lock_guard<std::mutex> lock(worker.Mutex);
+		if (worker.Jobs.empty()) { continue; }
+
+		task = std::move(worker.Jobs.front());
+		worker.Jobs.pop_front();
+		_Queued--;
+		_JobsStolen++;
+		return true;
+	}
+	return false;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs a task & marks it finished in its group.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Execute(Task& task) {
+
+	if (task.Serial != nullptr) { RunStrand(*task.Serial); return; }
+
+	task.Run();
+	_JobsRun++;
+	Finish(*task.Owner);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Marks a job of the group finished & wakes the threads in Wait() when it was the last.
+				The group isnt touched after the count reaches 0, as its waiter may return & free it.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::Finish(Group& group) {
+
+	if (--group._Pending == 0 && _Waiting.load() > 0) {
+
+		{ std::lock_guard<std::mutex> lock(_SleepMutex); }
+		_DoneCondition.notify_all();
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs a strand's jobs in order until its queue is empty. Jobs submitted to the strand
+				while it runs are picked up by the same loop.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::RunStrand(Strand& strand) {
+
+	for (;;) {
+
+		Strand::Entry entry;
+		{
+			std::lock_guard<std::mutex> lock(strand._Mutex);
+			if (strand._Jobs.empty()) { strand._Scheduled = false; return; }
+			entry = std::move(strand._Jobs.front());
+			strand._Jobs.pop_front();
+		}
+
+		entry.Run();
+		_JobsRun++;
+		Finish(*entry.Owner);
+	}
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs jobs from the thread's own queue, then from the others, & sleeps when there are none.
+
+	@param:		worker					- The thread's index.
+
+	@return:	VOID
+*/
+void VoiceWorkerPool::WorkerLoop(unsigned int worker) {
+
+	CurrentPool = this;
+	CurrentWorker = worker;
+
+	for (;;) {
+
+		Task task;
+		if (Pop(worker, task) || Steal(worker, task)) { Execute(task); continue; }
+
+		std::unique_lock<std::mutex> lock(_SleepMutex);
+		if (_Stopping && _Queued.load() == 0) { return; }
+
+		_Sleeping++;
+		_WakeCondition.wait(lock, [this] { return _Queued.load() > 0 || _Stopping; });
+		_Sleeping--;
+	}
+}
\ No newline at end of file
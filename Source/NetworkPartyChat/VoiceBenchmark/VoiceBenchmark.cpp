@@ -0,0 +1,352 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+#include "VoiceBenchmark.h"
+
+// Standard libraries
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+
+// Raknet libraries
+#include <BitStream.h>
+#include <GetTime.h>
+#include <RakMemoryOverride.h>
+
+// NPC libraries
+#include "Enumeration.h"
+#include "RakVoice.h"
+#include "VoiceResampler.h"
+
+// Every call to the heap the process makes, through operator new or RakNet's allocator (which the voice arena & speex use)
+static std::atomic<unsigned long long> HeapAllocations(0);
+
+// The talkers' GUIDs follow the relay's
+static const uint64_t BENCHMARK_RELAY_GUID = 1;
+
+static const double PI = 3.14159265358979323846;
+
+void* operator new(std::size_t size) {
+
+	HeapAllocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == nullptr) { throw std::bad_alloc(); }
+	return memory;
+}
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { free(memory); }
+
+static void* CountingMalloc(size_t size, const char*, unsigned int)				{ HeapAllocations++; return malloc(size); }
+static void* CountingRealloc(void* memory, size_t size, const char*, unsigned int)	{ HeapAllocations++; return realloc(memory, size); }
+static void CountingFree(void* memory, const char*, unsigned int)					{ free(memory); }
+
+// A RakVoice that hands every packet it sends itself in loopback mode to a number of relayed talkers,
+// the same way the server's relay would, so each of them decodes the stream with its own decoder.
+class BenchmarkVoice : public RakNet::RakVoice {
+
+public:
+
+	void setTalkers(unsigned int talkers)					{ _Talkers = talkers; }
+	unsigned long long getReceiveMicroseconds() const		{ return _ReceiveMicroseconds; }
+
+protected:
+
+	/** --------------------------------------------------------------------------------------------------------------
+		@Summary:	Forwards the loopback packet to every talker, instead of playing it back on the loopback channel.
+
+					Relayed packet: [ID_SERVER_VOICE_RELAY][message number][talker GUID][speex data]
+
+		@param:		packet					- The packet RakVoice built for itself.
+
+		@return:	VOID
+	*/
+	virtual void OnVoiceData(RakNet::Packet* packet) {
+
+		static const unsigned int headerSize = sizeof(RakNet::MessageID) + sizeof(unsigned short);
+		if (packet->length <= headerSize) { return; }
+
+		RakNet::TimeUS start = RakNet::GetTimeUS();
+
+		unsigned short sequence;
+		memcpy(&sequence, packet->data + sizeof(RakNet::MessageID), sizeof(unsigned short));
+
+		RakNet::Packet relayed;
+		relayed.systemAddress = RakNet::UNASSIGNED_SYSTEM_ADDRESS;
+		relayed.guid = RakNet::RakNetGUID(BENCHMARK_RELAY_GUID);
+		for (unsigned int i = 0; i < _Talkers; ++i) {
+
+			_Relayed.Reset();
+			_Relayed.Write((RakNet::MessageID)ID_SERVER_VOICE_RELAY);
+			_Relayed.Write(sequence);
+			_Relayed.Write(RakNet::RakNetGUID(BENCHMARK_RELAY_GUID + 1 + i));
+			_Relayed.WriteAlignedBytes(packet->data + headerSize, packet->length - headerSize);
+
+			relayed.data = _Relayed.GetData();
+			relayed.length = _Relayed.GetNumberOfBytesUsed();
+			OnRelayedVoiceData(&relayed);
+		}
+
+		_ReceiveMicroseconds += RakNet::GetTimeUS() - start;
+	}
+
+	unsigned int _Talkers = 0;
+	RakNet::BitStream _Relayed;								// Reused for every forwarded packet.
+	unsigned long long _ReceiveMicroseconds = 0;
+
+};
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Default constructor		- Counts RakNet's allocations along with the rest of the heap.
+*/
+VoiceBenchmark::VoiceBenchmark() {
+
+	SetMalloc_Ex(CountingMalloc);
+	SetRealloc_Ex(CountingRealloc);
+	SetFree_Ex(CountingFree);
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Returns how many times the heap has been called so far (thread safe).
+
+	@return:	unsigned long long
+*/
+unsigned long long VoiceBenchmark::getHeapAllocations() {
+
+	return HeapAllocations.load();
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Loads a 16 bit PCM wave file as the corpus. Every channel of the file is mixed down to one.
+
+	@param:		path					- The file to load.
+
+	@return:	bool					- FALSE if the file couldnt be read or isnt 16 bit PCM.
+*/
+bool VoiceBenchmark::LoadWave(const std::string& path) {
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file) { return false; }
+
+	char riff[12];
+	if (!file.read(riff, sizeof(riff)) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) { return false; }
+
+	uint16_t format = 0, channels = 0, bits = 0;
+	uint32_t rate = 0;
+	bool foundFormat = false;
+
+	// Chunks can come in any order, & are padded to an even length
+	char header[8];
+	while (file.read(header, sizeof(header))) {
+
+		uint32_t length;
+		memcpy(&length, header + 4, sizeof(length));
+
+		if (memcmp(header, "fmt ", 4) == 0 && length >= 16) {
+
+			char fmt[16];
+			if (!file.read(fmt, sizeof(fmt))) { return false; }
+			memcpy(&format, fmt, sizeof(format));
+			memcpy(&channels, fmt + 2, sizeof(channels));
+			memcpy(&rate, fmt + 4, sizeof(rate));
+			memcpy(&bits, fmt + 14, sizeof(bits));
+			file.seekg((length - 16) + (length & 1), std::ios::cur);
+			foundFormat = true;
+		}
+		else if (memcmp(header, "data", 4) == 0 && foundFormat) {
+
+			if (format != 1 || bits != 16 || channels == 0 || rate == 0) { return false; }
+
+			std::vector<int16_t> interleaved(length / sizeof(int16_t));
+			file.read((char*)interleaved.data(), interleaved.size() * sizeof(int16_t));
+			size_t frames = (size_t)file.gcount() / (sizeof(int16_t) * channels);
+			if (frames == 0) { return false; }
+
+			_Corpus.resize(frames);
+			for (size_t i = 0; i < frames; ++i) {
+
+				int32_t sum = 0;
+				for (uint16_t c = 0; c < channels; ++c) { sum += interleaved[i * channels + c]; }
+				_Corpus[i] = (int16_t)(sum / channels);
+			}
+			_CorpusRate = (int)rate;
+			_CorpusName = path;
+			_SamplesRate = 0;
+			return true;
+		}
+		else { file.seekg(length + (length & 1), std::ios::cur); }
+	}
+	return false;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Makes a corpus that behaves roughly like speech - a pitched, harmonic buzz shaped into
+				syllables, with short gaps between words & a little noise throughout.
+
+	@return:	VOID
+*/
+void VoiceBenchmark::GenerateSpeech() {
+
+	const int rate = 48000;
+	_Corpus.resize(rate * VOICE_BENCHMARK_SYNTHETIC_SECONDS);
+
+	uint32_t seed = 12345;
+	double phase = 0.0;
+	for (size_t i = 0; i < _Corpus.size(); ++i) {
+
+		double time = (double)i / rate;
+
+		// Pitch wanders between 100 & 160Hz, syllables come 4 times a second & words are broken up every 1.5 seconds
+		double pitch = 130.0 + 30.0 * sin(2.0 * PI * 0.7 * time);
+		double syllable = 0.5 - 0.5 * cos(2.0 * PI * 4.0 * time);
+		double word = fmod(time, 1.5) < 1.2 ? 1.0 : 0.0;
+		phase += 2.0 * PI * pitch / rate;
+
+		double voiced = 0.0;
+		for (int harmonic = 1; harmonic <= 12; ++harmonic) { voiced += sin(phase * harmonic) / harmonic; }
+
+		seed = seed * 1664525 + 1013904223;
+		double noise = ((double)(seed >> 16) / 32768.0 - 1.0) * 0.02;
+
+		_Corpus[i] = (int16_t)(8000.0 * (voiced * syllable * word * 0.5 + noise));
+	}
+	_CorpusRate = rate;
+	_CorpusName = "synthetic speech";
+	_SamplesRate = 0;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Resamples the corpus to the rate being run, unless it already is.
+
+	@param:		sampleRate				- The rate speex runs at.
+
+	@return:	VOID
+*/
+void VoiceBenchmark::PrepareCorpus(int sampleRate) {
+
+	if (_SamplesRate == sampleRate) { return; }
+	if (_Corpus.empty()) { GenerateSpeech(); }
+
+	VoiceResampler resampler;
+	resampler.Init(_CorpusRate, sampleRate);
+	_Samples.resize(resampler.getMaxOutput((unsigned int)_Corpus.size()));
+	_Samples.resize(resampler.Process(_Corpus.data(), (unsigned int)_Corpus.size(), _Samples.data(), (unsigned int)_Samples.size()));
+	_SamplesRate = sampleRate;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Times the whole voice pipeline on this thread for one sample rate & number of talkers.
+				The corpus is encoded once per block & decoded by every talker, as a listener in a
+				channel of that many people talking at once would.
+
+	@param:		sampleRate				- 8000, 16000 or 32000.
+	@param:		channels				- Talkers decoded & mixed (1 to VOICE_BENCHMARK_MAX_CHANNELS).
+	@param:		echoCancellation		- Returns TRUE to run the echo canceller on what is sent.
+
+	@return:	VoiceBenchmarkResult
+*/
+VoiceBenchmarkResult VoiceBenchmark::Run(int sampleRate, unsigned int channels, bool echoCancellation) {
+
+	typedef std::chrono::steady_clock Clock;
+
+	VoiceBenchmarkResult result;
+	result.SampleRate = sampleRate;
+	result.Channels = channels;
+	result.Frames = VOICE_BENCHMARK_FRAMES;
+	if (channels == 0 || channels > VOICE_BENCHMARK_MAX_CHANNELS) { return result; }
+
+	PrepareCorpus(sampleRate);
+	unsigned int blockSamples = sampleRate * VOICE_BENCHMARK_FRAME_MS / 1000;
+	if (_Samples.size() < blockSamples) { return result; }
+	unsigned int blocks = (unsigned int)(_Samples.size() / blockSamples);
+
+	BenchmarkVoice* voice = new BenchmarkVoice();
+	voice->Init((unsigned short)sampleRate, blockSamples * sizeof(int16_t));
+	voice->SetVAD(false);
+	voice->SetNoiseFilter(true);
+	voice->SetEchoCancellation(echoCancellation);
+	voice->SetLoopbackMode(true);
+
+	// Every talker is open before anything is timed, so the arena's growth is the channels' memory
+	RakNet::VoiceArenaStatistics arenaBefore, arenaAfter;
+	voice->GetMemoryStatistics(&arenaBefore);
+	for (unsigned int i = 0; i < channels; ++i) { voice->PrepareRelayedChannel(RakNet::RakNetGUID(BENCHMARK_RELAY_GUID + 1 + i), RakNet::RakNetGUID(BENCHMARK_RELAY_GUID)); }
+	voice->GetMemoryStatistics(&arenaAfter);
+	result.BytesPerChannel = (double)(arenaAfter.bytesInUse - arenaBefore.bytesInUse) / channels + sizeof(RakNet::VoiceChannel);
+	voice->setTalkers(channels);
+
+	std::vector<int16_t> output(blockSamples);
+	unsigned int block = 0;
+	for (unsigned int frame = 0; frame < VOICE_BENCHMARK_WARMUP_FRAMES; ++frame, block = (block + 1) % blocks) {
+
+		voice->SendFrame(&_Samples[block * blockSamples]);
+		voice->Update();
+		voice->ReceiveFrame(output.data());
+	}
+
+	// Counters are taken as differences, so the warm up isnt counted
+	RakNet::VoiceStageStatistics stagesBefore, stagesAfter;
+	RakNet::VoiceEchoStatistics echoBefore, echoAfter;
+	RakNet::VoiceJitterStatistics jitter;
+	voice->GetStageStatistics(&stagesBefore);
+	voice->GetEchoStatistics(&echoBefore);
+	voice->GetMemoryStatistics(&arenaBefore);
+	unsigned long long receiveBefore = voice->getReceiveMicroseconds();
+	unsigned long long framesPlayedBefore = 0;
+	for (unsigned int i = 0; i < channels; ++i) {
+
+		if (voice->GetJitterStatistics(RakNet::RakNetGUID(BENCHMARK_RELAY_GUID + 1 + i), &jitter)) { framesPlayedBefore += jitter.framesPlayed; }
+	}
+	unsigned long long heapBefore = getHeapAllocations();
+
+	Clock::time_point start = Clock::now();
+	for (unsigned int frame = 0; frame < VOICE_BENCHMARK_FRAMES; ++frame, block = (block + 1) % blocks) {
+
+		voice->SendFrame(&_Samples[block * blockSamples]);
+		voice->Update();
+		voice->ReceiveFrame(output.data());
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	unsigned long long heapAfter = getHeapAllocations();
+	voice->GetStageStatistics(&stagesAfter);
+	voice->GetEchoStatistics(&echoAfter);
+	voice->GetMemoryStatistics(&arenaAfter);
+	unsigned long long framesPlayedAfter = 0;
+	for (unsigned int i = 0; i < channels; ++i) {
+
+		if (voice->GetJitterStatistics(RakNet::RakNetGUID(BENCHMARK_RELAY_GUID + 1 + i), &jitter)) { framesPlayedAfter += jitter.framesPlayed; }
+	}
+
+	double frames = (double)VOICE_BENCHMARK_FRAMES;
+	double channelFrames = frames * channels;
+	result.PreprocessNs = (stagesAfter.preprocessMicroseconds - stagesBefore.preprocessMicroseconds) * 1000.0 / frames;
+	result.EchoNs = (echoAfter.totalMicroseconds - echoBefore.totalMicroseconds) * 1000.0 / frames;
+	result.EncodeNs = (stagesAfter.encodeMicroseconds - stagesBefore.encodeMicroseconds) * 1000.0 / frames;
+	result.PacketizeNs = (stagesAfter.packetizeMicroseconds - stagesBefore.packetizeMicroseconds) * 1000.0 / frames;
+	result.ReceiveNs = (voice->getReceiveMicroseconds() - receiveBefore) * 1000.0 / channelFrames;
+	result.DecodeNs = (stagesAfter.decodeMicroseconds - stagesBefore.decodeMicroseconds) * 1000.0 / channelFrames;
+	result.MixNs = (stagesAfter.mixMicroseconds - stagesBefore.mixMicroseconds) * 1000.0 / channelFrames;
+	result.ChannelFramesPerSecond = seconds > 0.0 ? channelFrames / seconds : 0.0;
+	result.RealtimeFactor = seconds > 0.0 ? frames * VOICE_BENCHMARK_FRAME_MS / 1000.0 / seconds : 0.0;
+	result.HeapAllocations = heapAfter - heapBefore;
+	result.HeapAllocationsPerFrame = result.HeapAllocations / frames;
+	result.ArenaAllocationsPerFrame = (arenaAfter.allocations - arenaBefore.allocations) / frames;
+	result.FramesDecoded = (unsigned int)(framesPlayedAfter - framesPlayedBefore);
+
+	RakNet::VoicePlaybackStatistics playback;
+	voice->GetPlaybackStatistics(&playback);
+	result.VoicesMixed = playback.voicesInUse;
+
+	voice->Deinit();
+	delete voice;
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+// Standard libraries
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define VOICE_BENCHMARK_FRAME_MS (20)						// Length of each block passed to SendFrame & ReceiveFrame.
+#define VOICE_BENCHMARK_WARMUP_FRAMES (250)					// Blocks run before timing starts, so the jitter buffers & arena have settled.
+#define VOICE_BENCHMARK_FRAMES (3000)						// Blocks timed per run (a minute of audio).
+#define VOICE_BENCHMARK_MAX_CHANNELS (256)					// Most talkers decoded in one run.
+#define VOICE_BENCHMARK_SYNTHETIC_SECONDS (10)				// Length of the speech-like signal used when no corpus is given.
+
+struct VoiceBenchmarkResult {
+
+	int SampleRate = 0;
+	unsigned int Channels = 0;								// Talkers decoded & mixed.
+	unsigned int Frames = 0;								// Blocks timed.
+
+	// Nanoseconds per block, spent once however many talkers there are
+	double EchoNs = 0.0;									// Zero unless echo cancellation was on.
+	double PreprocessNs = 0.0;
+	double EncodeNs = 0.0;
+	double PacketizeNs = 0.0;
+
+	// Nanoseconds per block for each talker
+	double ReceiveNs = 0.0;									// Parsing the relayed packet into the jitter buffer.
+	double DecodeNs = 0.0;
+	double MixNs = 0.0;
+
+	double ChannelFramesPerSecond = 0.0;					// Talker blocks pushed through the whole pipeline per second, on one core.
+	double RealtimeFactor = 0.0;							// Seconds of audio processed per second.
+	unsigned long long HeapAllocations = 0;					// Calls to the heap (operator new & RakNet's allocator) while timed. Anything but 0 fails the run.
+	double HeapAllocationsPerFrame = 0.0;					// The same, per block.
+	double ArenaAllocationsPerFrame = 0.0;					// Blocks taken from the voice arena per block, reused or not.
+	double BytesPerChannel = 0.0;							// Memory each talker's channel holds.
+	unsigned int FramesDecoded = 0;							// Speex frames the talkers played out, to check the run really decoded.
+	unsigned int VoicesMixed = 0;							// Talkers heard at the end of the run. The rest are decoded but not mixed.
+};
+
+// Runs a RakVoice in loopback mode without a network or sound device. What it encodes is handed to as
+// many relayed talkers as asked for, so one process measures capture, preprocess, encode, packetize,
+// receive, decode & mix, & how the receiving side scales with the number of talkers.
+class VoiceBenchmark {
+
+public:
+
+	// Constructors
+	VoiceBenchmark();
+	~VoiceBenchmark() {}
+
+	// Corpus
+	bool LoadWave(const std::string& path);
+	void GenerateSpeech();
+
+	// Running
+	VoiceBenchmarkResult Run(int sampleRate, unsigned int channels, bool echoCancellation);
+
+	// Properties
+	const std::string& getCorpusName() const				{ return _CorpusName; }
+	static unsigned long long getHeapAllocations();
+
+protected:
+
+	void PrepareCorpus(int sampleRate);
+
+	std::string _CorpusName;
+	std::vector<int16_t> _Corpus;							// Mono samples, at the rate they were recorded.
+	int _CorpusRate = 0;
+	std::vector<int16_t> _Samples;							// The corpus resampled to the rate being run.
+	int _SamplesRate = 0;
+
+};
\ No newline at end of file
@@ -0,0 +1,119 @@
+/*
+	Created by: DANIEL MARTON
+
+	Created on: 16/10/2026
+	Last edited on: 16/10/2026
+*/
+
+// Standard libraries
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// NPC libraries
+#include "VoiceBenchmark.h"
+
+//*********************************************************
+// FUNCTIONS
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Prints one run as a row of the results table.
+
+	@param:		result					- The run to print.
+
+	@return:	VOID
+*/
+void PrintResult(const VoiceBenchmarkResult& result) {
+
+	std::cout << std::fixed << std::setprecision(0)
+			  << "   " << std::setw(5) << result.SampleRate / 1000 << "kHz"
+			  << std::setw(6) << result.Channels
+			  << std::setw(8) << result.EchoNs
+			  << std::setw(8) << result.PreprocessNs
+			  << std::setw(8) << result.EncodeNs
+			  << std::setw(8) << result.PacketizeNs
+			  << std::setw(8) << result.ReceiveNs
+			  << std::setw(8) << result.DecodeNs
+			  << std::setw(8) << result.MixNs
+			  << std::setw(11) << result.ChannelFramesPerSecond
+			  << std::setw(9) << result.RealtimeFactor << "x"
+			  << std::setprecision(2)
+			  << std::setw(8) << result.HeapAllocationsPerFrame
+			  << std::setw(8) << result.ArenaAllocationsPerFrame
+			  << std::setprecision(0)
+			  << std::setw(9) << result.BytesPerChannel
+			  << std::setw(5) << result.VoicesMixed
+			  << (result.HeapAllocations > 0 ? "  FAILED (heap used after warm up)" : "")
+			  << std::endl;
+}
+
+/** --------------------------------------------------------------------------------------------------------------
+	@Summary:	Runs every sample rate with 1 to VOICE_BENCHMARK_MAX_CHANNELS talkers over one corpus.
+
+	@param:		benchmark				- Holds the corpus to run.
+	@param:		echoCancellation		- Returns TRUE to run the echo canceller on what is sent.
+
+	@return:	unsigned int			- The number of runs that called the heap after warming up.
+*/
+unsigned int RunCorpus(VoiceBenchmark& benchmark, bool echoCancellation) {
+
+	std::cout << "\n - Corpus:\t  " << benchmark.getCorpusName() << std::endl;
+	std::cout << "\n   Rate   Talkers  Echo    Prep     Enc     Pkt     Recv    Dec     Mix     Frames/s   Realtime  Heap/f  Arena/f  B/chan  Voices" << std::endl;
+	std::cout << "                   (ns/block, once)                (ns/block, per talker)" << std::endl;
+
+	unsigned int failures = 0;
+	const int rates[] = { 8000, 16000, 32000 };
+	for (int rate : rates) {
+
+		for (unsigned int channels = 1; channels <= VOICE_BENCHMARK_MAX_CHANNELS; channels *= 2) {
+
+			VoiceBenchmarkResult result = benchmark.Run(rate, channels, echoCancellation);
+			PrintResult(result);
+			if (result.HeapAllocations > 0) { failures++; }
+		}
+	}
+	return failures;
+}
+
+int main(int argc, char** argv) {
+
+	// VoiceBenchmark [-echo] [corpus.wav ...]
+	bool echoCancellation = false;
+	std::vector<std::string> corpora;
+	for (int i = 1; i < argc; ++i) {
+
+		if (strcmp(argv[i], "-echo") == 0) { echoCancellation = true; }
+		else { corpora.push_back(argv[i]); }
+	}
+
+	std::cout << " Voice pipeline benchmark - " << VOICE_BENCHMARK_FRAMES << " blocks of " << VOICE_BENCHMARK_FRAME_MS
+			  << "ms per run, on one core" << (echoCancellation ? ", echo cancellation on" : "") << std::endl;
+
+	VoiceBenchmark benchmark;
+	unsigned int failures = 0;
+	if (corpora.empty()) {
+
+		benchmark.GenerateSpeech();
+		failures += RunCorpus(benchmark, echoCancellation);
+	}
+
+	for (auto& iter : corpora) {
+
+		if (!benchmark.LoadWave(iter)) {
+
+			std::cout << "\n - Couldnt load " << iter << " (16 bit PCM wave files only)" << std::endl;
+			continue;
+		}
+		failures += RunCorpus(benchmark, echoCancellation);
+	}
+
+	// The pipeline must run out of memory it already holds once it has warmed up
+	if (failures > 0) {
+
+		std::cout << "\n - FAILED:\t  " << failures << " run(s) called the heap after warming up" << std::endl;
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file